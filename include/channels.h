@@ -743,8 +743,53 @@ class H323_RTPChannel : public H323_RealTimeChannel
 
     virtual PInt64 GetSilenceDuration() const;
 
+  /**@name Media relay */
+  //@{
+    /**Relay the media received on this channel to another channel without
+       transcoding. The target must be a transmitting channel on another
+       connection using the same codec. Received frames are passed to the
+       target still encoded, bypassing the codecs of both channels, and the
+       target transmit thread is idle while relaying. Setting the relay
+       before this channel is started also bypasses the jitter buffer.
+
+       The target switches to relayed media between packets, so a packet
+       it was building from its own codec when the relay starts is dropped.
+       Codec filters, eg in-band DTMF detection, see no media while relaying.
+       Channel filters still run on both channels, so RFC2833 user input is
+       reported by this channel and sent by the target. Received packets of
+       any other payload type, eg comfort noise, are not relayed as the
+       target may not have negotiated them.
+
+       Set target to NULL to stop relaying.
+      */
+    PBoolean SetRelayChannel(
+      H323_RTPChannel * target   ///< Channel to relay media to
+    );
+
+    /**Get the channel media is relayed to, if any.
+      */
+    H323_RTPChannel * GetRelayChannel() const { return relayTarget; }
+
+    /**Indicate another channel is relaying media through this one.
+      */
+    PBoolean IsRelayTarget() const { return relaySource != NULL; }
+
+    /**Send a frame relayed from another channel.
+       The default behaviour sets the payload type and offsets the timestamp
+       for this channel, runs the channel filters and calls WriteFrame(),
+       which sets the sequence number and SSRC, and encrypts the frame for a
+       secure channel.
+      */
+    virtual PBoolean RelayFrame(
+      RTP_DataFrame & frame     ///< RTP data frame
+    );
+  //@}
 
   protected:
+    void InternalSetRelayChannel(H323_RTPChannel * target);
+    void StopRelay();
+    PBoolean WaitWhileRelayTarget();
+
     RTP_Session      & rtpSession;
     H323_RTP_Session & rtpCallbacks;
 
@@ -756,6 +801,14 @@ class H323_RTPChannel : public H323_RealTimeChannel
 
     unsigned rec_written;
     PBoolean rec_ok;
+
+    H323_RTPChannel * relayTarget;
+    H323_RTPChannel * relaySource;
+    PMutex            relayMutex;
+    PSyncPoint        relayStopped;
+    PBoolean          relayStarted;
+    DWORD             relayTimestampOffset;
+    RTP_DataFrame::PayloadTypes relayPayloadType;
 };
 
 
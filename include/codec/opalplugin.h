@@ -199,6 +199,7 @@ struct PluginCodec_Definition;
 #define PLUGINCODEC_CONTROL_CODEC_EVENT           "event_codec"
 #define PLUGINCODEC_CONTROL_FLOW_OPTIONS          "to_flowcontrol_options"
 #define PLUGINCODEC_CONTROL_SET_FORMAT_OPTIONS    "set_format_options"
+#define PLUGINCODEC_CONTROL_GET_BATCH_FUNCTION    "get_batch_function"
 
 
 /* Log function, plug in gets a pointer to this function which allows
@@ -220,6 +221,29 @@ struct PluginCodec_ControlDefn {
 
 };
 
+
+/* Batch function, optionally returned by the "get_batch_function" control
+   in parm (parmLen is sizeof(PluginCodec_BatchFunction)), which codes up to
+   count fixed size frames in one call. Frame i is read from
+   from + i*fromStride and written to to + i*toStride, and its output length
+   is put in toLens[i]. The function returns the number of frames coded, or
+   zero on error. An encoder must stop after a frame that has to be the last
+   in the RTP packet, such as a SID, the remaining frames are offered again
+   in the next call. Plug ins without the control are called one frame at a
+   time through codecFunction as before. */
+struct PluginCodec_FrameBatch {
+  const void * from;         // first input frame
+  unsigned     fromStride;   // bytes between input frames
+  void *       to;           // first output frame
+  unsigned     toStride;     // bytes between output frames
+  unsigned *   toLens;       // output length of each frame
+  unsigned     count;        // number of frames
+  unsigned     flags;        // as for codecFunction flag
+};
+
+typedef int (*PluginCodec_BatchFunction)(const struct PluginCodec_Definition * codec, void * context,
+                                         struct PluginCodec_FrameBatch * batch);
+
 enum PluginCodec_OptionTypes {
   PluginCodec_StringOption,
   PluginCodec_BoolOption,
@@ -52,6 +52,7 @@
 class H245_MiscellaneousCommand_type;
 class H245_MiscellaneousIndication_type;
 class H323Connection;
+class H323AudioResampler;
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -376,11 +377,78 @@ class H323Codec : public PObject
 
     H323LIST(FilterList, FilterData);
     FilterList filters;
+
+#ifdef H323_AUDIO_CODECS
+    H323AudioResampler * rawResampler;      // Converts between raw channel and codec sample rates
+    PShortArray          rawResampleBuffer;
+#endif
 };
 
 #ifdef H323_AUDIO_CODECS
 
 
+/**This class converts 16 bit mono PCM between two sample rates using a
+   polyphase FIR filter, with SSE2/AVX2 inner loops where available.
+
+   H323AudioCodec::SetRawSampleRate() uses it to run the raw data channel at
+   a different rate to the codec. It may also be attached to any audio codec
+   with H323Codec::AddFilter(GetFilter()), converting the data in place, as
+   long as the filter buffer has room for the converted samples.
+ */
+class H323AudioResampler : public PObject
+{
+  PCLASSINFO(H323AudioResampler, PObject);
+
+  public:
+    /**Create a resampler between the two rates in samples/second.
+      */
+    H323AudioResampler(
+      unsigned inputRate,   ///< Sample rate of the input
+      unsigned outputRate   ///< Sample rate of the output
+    );
+
+    /**Convert a block of samples. The input and output may be the same
+       buffer. Returns the number of output samples, at most outputMax.
+      */
+    PINDEX Convert(
+      const short * input,  ///< Input samples
+      PINDEX inputSamples,  ///< Number of input samples
+      short * output,       ///< Buffer for output samples
+      PINDEX outputMax      ///< Size of output buffer in samples
+    );
+
+    /**Get the number of input samples needed for a number of output samples.
+      */
+    PINDEX GetInputSamples(PINDEX outputSamples) const
+    { return (outputSamples*down + up - 1)/up; }
+
+    /**Get the number of output samples produced from a number of input samples.
+      */
+    PINDEX GetOutputSamples(PINDEX inputSamples) const
+    { return (inputSamples*up + down - 1)/down; }
+
+    unsigned GetInputRate() const { return inputRate; }
+    unsigned GetOutputRate() const { return outputRate; }
+
+    /**Get a notifier for H323Codec::AddFilter() which converts the filter
+       data in place.
+      */
+    PNotifier GetFilter();
+
+  protected:
+    PDECLARE_NOTIFIER(H323Codec::FilterInfo, H323AudioResampler, OnFilter);
+
+    unsigned    inputRate;
+    unsigned    outputRate;
+    unsigned    up;         // Interpolation factor
+    unsigned    down;       // Decimation factor
+    unsigned    taps;       // Filter taps for each phase
+    PShortArray coeffs;     // taps coefficients for each of up phases, reversed
+    PShortArray history;    // Last taps-1 input samples then the new input
+    unsigned    position;   // Next output position, in input samples * up
+};
+
+
 /**This class defines a codec class that will use the standard platform PCM
    output device.
 
@@ -437,11 +505,17 @@ class H323AudioCodec : public H323Codec
     enum SilenceDetectionMode {
       NoSilenceDetection,
       FixedSilenceDetection,
-      AdaptiveSilenceDetection
+      AdaptiveSilenceDetection,
+      VoiceActivityDetection
     };
 
     /**Enable/Disable silence detection.
        The deadband periods are in audio samples of 8kHz.
+
+       VoiceActivityDetection classifies frames from their energy against a
+       tracked noise floor, and from their spectral tilt, using the values
+       from GetSignalEnergy(). The silence deadband is the hangover after
+       the end of speech and the threshold is not used.
       */
     void SetSilenceDetectionMode(
       SilenceDetectionMode mode,   ///< New silence detection mode
@@ -486,6 +560,12 @@ class H323AudioCodec : public H323Codec
       */
     virtual PBoolean DetectSilence();
 
+    /**Check frame for voice activity.
+       This is called from within DetectSilence() in VoiceActivityDetection
+       mode and returns TRUE if the frame is silent.
+      */
+    PBoolean DetectVoiceActivity();
+
     /**Get the average signal level in the audio stream.
        This is called from within DetectSilence() to calculate the average
        signal level since the last call to DetectSilence().
@@ -495,11 +575,50 @@ class H323AudioCodec : public H323Codec
       */
     virtual unsigned GetAverageSignalLevel();
 
+    /**Get the signal energy in the audio stream.
+       This is called from within DetectSilence() when in the
+       VoiceActivityDetection mode. The energy is the mean square of the
+       samples since the last call to DetectSilence() at half amplitude, the
+       deltaEnergy that of the difference between adjacent samples, which
+       rises with the proportion of high frequency content.
+
+       The default behaviour returns FALSE which disables voice activity
+       detection.
+      */
+    virtual PBoolean GetSignalEnergy(
+      unsigned & energy,      ///< Mean square of samples
+      unsigned & deltaEnergy  ///< Mean square of sample differences
+    );
+
+    /**Get the number of frames checked by the current DetectSilence().
+       The deadband and adaptation periods advance by this many frames.
+
+       The default behaviour returns 1.
+      */
+    virtual unsigned GetSilenceDetectFrames() const { return 1; }
+
    /**SetRawDataHeld is called when the call has been held and the raw 
       data channel has been swapped out and released for another connection.
       */
     virtual PBoolean SetRawDataHeld(PBoolean hold);
 
+    /**Set the sample rate of the raw data channel.
+       When this differs from the codec clock rate, samples are converted by
+       a H323AudioResampler between the raw data channel and any filters, so
+       the filters and the codec always see the codec rate. The rate must
+       give a whole number of raw samples in each frame. A rate of zero, or
+       the codec rate, removes the conversion.
+
+       This is called by Open() with H323Connection::GetAudioRawSampleRate().
+      */
+    PBoolean SetRawSampleRate(
+      unsigned rate   ///< Raw data channel rate in samples/second
+    );
+
+    /**Get the sample rate of the raw data channel.
+      */
+    unsigned GetRawSampleRate() const;
+
 #ifdef H323_AEC	
 	/** Attach Acoustic Echo Cancellation.
 	*/
@@ -524,6 +643,7 @@ class H323AudioCodec : public H323Codec
     unsigned silenceMaximum;        // Maximum of frames below threshold
     unsigned signalFramesReceived;  // Frames of signal received
     unsigned silenceFramesReceived; // Frames of silence received
+    double   vadNoiseFloor;         // Noise energy in dB for voice activity detection
     PBoolean	 IsRawDataHeld;
 };
 
@@ -601,6 +721,20 @@ class H323FramedAudioCodec : public H323AudioCodec
       */
     virtual unsigned GetAverageSignalLevel();
 
+    /**Get the signal energy in the audio stream.
+       This is called from within DetectSilence() when in the
+       VoiceActivityDetection mode, for the frames in the sampleBuffer.
+      */
+    virtual PBoolean GetSignalEnergy(
+      unsigned & energy,
+      unsigned & deltaEnergy
+    );
+
+    /**Get the number of frames checked by the current DetectSilence(),
+       which is all the frames of a batch.
+      */
+    virtual unsigned GetSilenceDetectFrames() const { return framesInBuffer; }
+
 
     /**Encode a sample block into the buffer specified.
        The samples have been read and are waiting in the readBuffer member
@@ -638,6 +772,55 @@ class H323FramedAudioCodec : public H323AudioCodec
     )
     { memset(buffer, 0, length); }
 
+    /**Indicate the codec can encode or decode several frames in one call
+       to EncodeFrames() and DecodeFrames().
+       The default behaviour returns FALSE.
+     */
+    virtual PBoolean CanBatchFrames() const;
+
+    /**Set the number of frames to encode or decode in each Read() or Write().
+       This has no effect unless CanBatchFrames() returns TRUE.
+     */
+    void SetFramesInPacket(
+      unsigned frames   ///< Frames in each RTP packet
+    );
+
+    /**Get the number of frames each Read() or Write() asks for, one unless
+       batching.
+     */
+    unsigned GetFramesInPacket() const { return framesInPacket; }
+
+    /**Get the number of frames of audio processed by the last Read() or
+       Write(), including a Read() that returned silence.
+     */
+    unsigned GetLastFrameCount() const { return framesInBuffer; }
+
+    /**Encode a block of frames into the buffer specified.
+       The samples for frames frames are waiting in the sampleBuffer. The
+       encoded frames are placed one after the other in the buffer, and
+       frames is set to the number actually encoded. An encoder may stop
+       early, after a frame that must end the RTP packet such as a SID.
+       The default behaviour returns FALSE.
+     */
+    virtual PBoolean EncodeFrames(
+      BYTE * buffer,      ///< Buffer into which encoded bytes are placed
+      unsigned & length,  ///< Actual length of encoded data buffer
+      unsigned & frames   ///< Frames to encode, and frames encoded
+    );
+
+    /**Decode a block of frames from the buffer specified.
+       The samples are placed one frame after the other in the sampleBuffer,
+       and frames is set to the number actually decoded.
+       The default behaviour returns FALSE.
+     */
+    virtual PBoolean DecodeFrames(
+      const BYTE * buffer,    ///< Buffer from which encoded data is found
+      unsigned length,        ///< Length of encoded data buffer
+      unsigned & written,     ///< Number of bytes used from data buffer
+      unsigned & bytesOutput, ///< Number of bytes in decoded data
+      unsigned & frames       ///< Frames to decode, and frames decoded
+    );
+
 #ifdef H323_AEC	
     /** Attach Acoustic Echo Cancellation.
     */
@@ -656,6 +839,11 @@ class H323FramedAudioCodec : public H323AudioCodec
     PINDEX      readBytes;
     unsigned    writeBytes;
     PINDEX      cntBytes;
+
+    enum { MaxFramesInBatch = 16 };
+    unsigned    framesInPacket;   // Frames encoded/decoded per call when batching
+    unsigned    framesInBuffer;   // Frames handled by the last Read()/Write()
+    unsigned    carriedFrames;    // Frames read but not yet encoded
 };
 
 
@@ -714,6 +902,24 @@ class H323StreamedAudioCodec : public H323FramedAudioCodec
      */
     virtual short Decode(int sample) const = 0;
 
+    /**Encode a block of samples for an 8 bit per sample codec.
+       The default behaviour calls Encode() for each sample.
+     */
+    virtual void EncodeSamples(
+      const short * samples,  ///< Samples to encode
+      BYTE * buffer,          ///< Buffer into which encoded bytes are placed
+      PINDEX count            ///< Number of samples
+    ) const;
+
+    /**Decode a block of samples for an 8 bit per sample codec.
+       The default behaviour calls Decode() for each sample.
+     */
+    virtual void DecodeSamples(
+      const BYTE * buffer,    ///< Encoded bytes
+      short * samples,        ///< Buffer into which samples are placed
+      PINDEX count            ///< Number of samples
+    ) const;
+
   protected:
     unsigned bitsPerSample;
 };
@@ -1019,9 +1225,19 @@ class H323_ALawCodec : public H323StreamedAudioCodec
     virtual int   Encode(short sample) const { return EncodeSample(sample); }
     virtual short Decode(int   sample) const { return DecodeSample(sample); }
 
+    virtual void EncodeSamples(const short * samples, BYTE * buffer, PINDEX count) const
+      { EncodeBlock(samples, buffer, count); }
+    virtual void DecodeSamples(const BYTE * buffer, short * samples, PINDEX count) const
+      { DecodeBlock(buffer, samples, count); }
+
     static int   EncodeSample(short sample);
     static short DecodeSample(int   sample);
 
+    /**Convert a block of samples using the fastest kernel for this processor.
+     */
+    static void EncodeBlock(const short * samples, BYTE * buffer, PINDEX count);
+    static void DecodeBlock(const BYTE * buffer, short * samples, PINDEX count);
+
   protected:
     PBoolean sevenBit;
 };
@@ -1048,9 +1264,19 @@ class H323_muLawCodec : public H323StreamedAudioCodec
     virtual int   Encode(short sample) const { return EncodeSample(sample); }
     virtual short Decode(int   sample) const { return DecodeSample(sample); }
 
+    virtual void EncodeSamples(const short * samples, BYTE * buffer, PINDEX count) const
+      { EncodeBlock(samples, buffer, count); }
+    virtual void DecodeSamples(const BYTE * buffer, short * samples, PINDEX count) const
+      { DecodeBlock(buffer, samples, count); }
+
     static int   EncodeSample(short sample);
     static short DecodeSample(int   sample);
 
+    /**Convert a block of samples using the fastest kernel for this processor.
+     */
+    static void EncodeBlock(const short * samples, BYTE * buffer, PINDEX count);
+    static void DecodeBlock(const BYTE * buffer, short * samples, PINDEX count);
+
   protected:
     PBoolean sevenBit;
 };
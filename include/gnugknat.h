@@ -80,6 +80,32 @@ class GNUGKTransport  : public H323TransportTCP
       */
     PBoolean HandleGNUGKSignallingSocket(H323SignalPDU & pdu);
 
+    /**Read one PDU from the GNUGK signalling channel. Unsolicited Information
+       messages are handled here. Returns FALSE on failure, setup is set TRUE
+       when the PDU is the Setup of an incoming call.
+      */
+    PBoolean ReadGNUGKSignallingPDU(H323SignalPDU & pdu, PBoolean & setup);
+
+    /**Handle the Setup of an incoming call received on the channel.
+       The thread becomes the signalling thread of the call.
+      */
+    PBoolean HandleGNUGKSetup(H323SignalPDU & pdu, PThread * thread);
+
+    /**Start servicing the channel, from the shared event loop in the
+       consolidated mode otherwise with a thread of its own.
+      */
+    void StartService();
+
+    /**A whole PDU, or a malformed TPKT header, has already been read into
+       the buffer, so reading it will not block.
+      */
+    PBoolean HasBufferedPDU() const;
+
+    /**Read the data waiting on the socket into the buffer with a single read,
+       keeping any partial PDU for the next call. Call only when readable.
+      */
+    PBoolean ReadAvailable();
+
     /**Write a protocol data unit from the transport.
        This will write using the transports mechanism for PDU boundaries, for
        example UDP is a single Write() call, while for TCP there is a TPKT
@@ -126,6 +152,8 @@ class GNUGKTransport  : public H323TransportTCP
 
     PBoolean CloseTransport() { return closeTransport; };
 
+    GNUGK_Feature * GetFeature() const { return Feature; };
+
   protected:
      PString GKid;
 
@@ -141,6 +169,7 @@ class GNUGKTransport  : public H323TransportTCP
      PBoolean   isConnected;
      PBoolean   remoteShutDown;
      PBoolean    closeTransport;
+     PBoolean   inEventLoop;      ///< Serviced by the consolidated event loop
      
      H323TransportSecurity m_callSecurity;
 };
@@ -167,9 +196,19 @@ public:
 
     PBoolean IsOpen() { return open; };
 
+    /**Set the consolidated mode, off by default. In this mode the idle
+       signalling channels of all endpoints in the process are waited on and
+       kept alive by one event loop thread, instead of a thread and timer
+       each. Set before registering with the gatekeeper.
+      */
+    static void SetConsolidatedMode(PBoolean mode) { consolidated = mode; };
+    static PBoolean IsConsolidatedMode() { return consolidated; };
+
     static WORD keepalive;
-    static GNUGKTransport * curtransport;
-    static PBoolean connectionlost;
+    static PBoolean consolidated;
+
+    GNUGKTransport * curtransport;   ///< Channel waiting for the next call
+    PBoolean connectionlost;
         
 protected:
 
@@ -1733,6 +1733,19 @@ class H323Connection : public PObject
       unsigned bufferSize,   ///< Size of each sound buffer
       H323AudioCodec & codec ///< codec that is doing the opening
     );
+
+    /**Set the sample rate of the raw audio channels of this connection.
+       Audio codecs running at another clock rate convert their samples to
+       and from this rate, see H323AudioCodec::SetRawSampleRate(). Zero,
+       the default, runs the raw channels at the codec rate.
+      */
+    void SetAudioRawSampleRate(
+      unsigned rate   ///< Raw channel rate in samples/second
+    ) { audioRawSampleRate = rate; }
+
+    /**Get the sample rate of the raw audio channels of this connection.
+      */
+    unsigned GetAudioRawSampleRate() const { return audioRawSampleRate; }
 #endif
 
 #ifdef H323_VIDEO
@@ -1747,6 +1760,26 @@ class H323Connection : public PObject
       H323VideoCodec & codec ///< codec doing the opening
     );
 
+    /**Set the video encoder sharing group for this connection.
+       Transmitting video channels of connections in the same group whose
+       negotiated media format options match share a single plugin encoder.
+       Each frame is grabbed and encoded once and the same RTP payloads are
+       sent on every channel, fast update requests from the receivers are
+       coalesced into one I-Frame. This suits an MCU sending the same layout
+       to several participants, the application is responsible for giving
+       the same group only to connections that see the same picture.
+
+       An empty group, the default, disables sharing. It must be set before
+       the video transmit channel is opened.
+      */
+    void SetVideoEncoderGroup(
+      const PString & group   ///< Sharing group name
+    ) { videoEncoderGroup = group; }
+
+    /**Get the video encoder sharing group for this connection.
+      */
+    const PString & GetVideoEncoderGroup() const { return videoEncoderGroup; }
+
 #ifdef H323_H239
     /** Open a H.239 Channel
       */
@@ -3386,6 +3419,12 @@ class H323Connection : public PObject
     unsigned           minAudioJitterDelay;
     unsigned           maxAudioJitterDelay;
     unsigned           bandwidthAvailable;
+#ifdef H323_AUDIO_CODECS
+    unsigned           audioRawSampleRate;
+#endif
+#ifdef H323_VIDEO
+    PString            videoEncoderGroup;
+#endif
     unsigned           uuiesRequested;
     PString            gkAccessTokenOID;
     PBYTEArray         gkAccessTokenData;
@@ -35,6 +35,7 @@
 
 #include "h323.h"
 #include "h323con.h"
+#include <deque>
 
 #ifdef P_USE_PRAGMA
 #pragma interface
@@ -120,6 +121,112 @@ class H323FileTransferList;
 
 ///////////////////////////////////////////////////////////////////////////////
 
+#if P_DNS
+
+#include <ptclib/pdns.h>
+
+/**This class caches the results of the DNS SRV, ENUM and host lookups used
+   to route calls. Successful and failed lookups are both remembered for a
+   time, and a lookup already being done by another thread is waited for
+   rather than being done again.
+
+   The actual queries are virtual so an application (or a test) may resolve
+   names some other way.
+ */
+class H323DNSCache : public PObject
+{
+  PCLASSINFO(H323DNSCache, PObject);
+
+  public:
+    H323DNSCache();
+    ~H323DNSCache();
+
+    /**Look up the SRV records of service for the domain of url, which is of
+       the form [scheme:]user@domain. The results are of the form
+       [scheme:]user@address:port in order of preference.
+      */
+    PBoolean LookupSRV(
+      const PString & url,          ///< URL to look up
+      const PString & service,      ///< Service eg "_h323cs._tcp."
+      PStringList & results         ///< Addresses found
+    );
+
+    /**Look up the ENUM NAPTR record of an E.164 number.
+      */
+    PBoolean ENUMLookup(
+      const PString & number,       ///< E.164 number
+      const PString & service,      ///< Service eg "E2U+h323"
+      PString & result              ///< URL found
+    );
+
+    /**Look up the address of a host name.
+      */
+    PBoolean GetHostAddress(
+      const PString & host,         ///< Host name
+      PIPSocket::Address & addr     ///< Address found
+    );
+
+    /**Set how long found and not found results are kept.
+       The default is 5 minutes and 30 seconds.
+      */
+    void SetTimeToLive(
+      const PTimeInterval & found,
+      const PTimeInterval & notFound
+    );
+
+    /**Forget all the results.
+      */
+    void Clear();
+
+  protected:
+    /**Query the SRV records for name, as address:port strings in order
+       of preference.
+      */
+    virtual PBoolean QuerySRV(const PString & name, PStringList & results);
+
+    /**Query the ENUM record of number for service.
+      */
+    virtual PBoolean QueryENUM(const PString & number, const PString & service, PStringList & results);
+
+    /**Query the address of host.
+      */
+    virtual PBoolean QueryHost(const PString & host, PStringList & results);
+
+    enum QueryType {
+      e_SRV,
+      e_ENUM,
+      e_Host
+    };
+
+    PBoolean Lookup(QueryType type, const PString & name, const PString & param, PStringList & results);
+
+    struct Pending {
+      Pending() : done(0, INT_MAX), waiters(0), found(FALSE) { }
+      PSemaphore    done;           // Signalled once for each waiter
+      unsigned      waiters;
+      PStringList   results;
+      PBoolean      found;
+    };
+
+    struct Entry {
+      Entry() : found(FALSE), pending(NULL) { }
+      PStringList   results;
+      PBoolean      found;
+      PTimeInterval expires;        // PTimer::Tick() after which it is looked up again
+      Pending     * pending;        // Non NULL while being looked up
+    };
+    typedef std::map<PString, Entry> EntryMap;
+
+    EntryMap      m_entries;
+    PTimeInterval m_foundTTL;
+    PTimeInterval m_notFoundTTL;
+    PMutex        m_mutex;
+};
+
+#endif // P_DNS
+
+///////////////////////////////////////////////////////////////////////////////
+
 /**This class manages the H323 endpoint.
    An endpoint may have zero or more listeners to create incoming connections
    or zero or more outgoing conenctions initiated via the MakeCall() function.
@@ -675,6 +782,40 @@ class H323EndPoint : public PObject
       H323Transport * transport = NULL ///< Transport to use for call.
     );
 
+    /**Make a call to a remote party without waiting for its address.
+       This returns immediately. The DNS ENUM and SRV lookups of
+       ResolveCallParty() are done in a new background thread and the call is
+       then made as for MakeCall(). OnMakeCallAsync() is called with the
+       result.
+
+       ClearAllCalls() waits for these threads. A descendant that overrides
+       OnMakeCallAsync() should call ClearAllCalls() in its destructor, so
+       no call back is made once it has been partly destroyed.
+      */
+    PBoolean MakeCallAsync(
+      const PString & remoteParty,     ///< Remote party to call
+      void * userData = NULL,          ///< user data to pass to CreateConnection
+      PBoolean supplimentary = false   ///< Whether the call is a supplimentary call
+    );
+
+    /**Wait for all the threads started by MakeCallAsync() to finish.
+       This is called by ClearAllCalls() when it waits for the calls to be
+       cleared. A thread calling it from OnMakeCallAsync() does not wait
+       for itself.
+      */
+    void WaitForMakeCallThreads();
+
+    /**Call back for a call started with MakeCallAsync().
+       The token is empty if the call could not be made.
+
+       The default behaviour does nothing.
+      */
+    virtual void OnMakeCallAsync(
+      const PString & remoteParty,     ///< Remote party called
+      const PString & token,           ///< Token for the connection
+      void * userData                  ///< user data passed to MakeCallAsync
+    );
+
 #ifdef H323_H450
 
   /**@name H.450.2 Call Transfer */
@@ -801,7 +942,8 @@ class H323EndPoint : public PObject
 #endif // H323_H450
 
     /** Use DNS SRV and ENUM to resolve all the possible addresses a call party 
-       can be found. Only effective if not registered with Gatekeeper
+       can be found. Only effective if not registered with Gatekeeper.
+       The lookups are cached, see GetDNSCache().
       */
     PBoolean ResolveCallParty(
       const PString & _remoteParty, 
@@ -820,6 +962,12 @@ class H323EndPoint : public PObject
       H323TransportAddress & address  ///< Parsed transport address
     );
 
+#if P_DNS
+    /**Get the cache of DNS lookups used to resolve call parties.
+      */
+    H323DNSCache & GetDNSCache() { return dnsCache; }
+#endif
+
     /**Clear a current connection.
        This hangs up the connection to a remote endpoint. Note that this function
        is asynchronous
@@ -857,8 +1005,9 @@ class H323EndPoint : public PObject
     /**Clear all current connections.
        This hangs up all the connections to remote endpoints. The wait
        parameter is used to wait for all the calls to be cleared and their
-       memory usage cleaned up before returning. This is typically used in
-       the destructor for your descendant of H323EndPoint.
+       memory usage cleaned up before returning, including calls still being
+       made by MakeCallAsync(). This is typically used in the destructor for
+       your descendant of H323EndPoint.
       */
     virtual void ClearAllCalls(
       H323Connection::CallEndReason reason =
@@ -2666,10 +2815,16 @@ class H323EndPoint : public PObject
      */
     void SetTCPPorts(unsigned tcpBase, unsigned tcpMax);
 
-    /**Get the next TCP port number for H.245 channels
+    /**Get the next TCP port number for H.245 channels.
+       The port is not handed out again until ReleaseTCPPort() is called,
+       unless every port in the range is in use.
      */
     WORD GetNextTCPPort();
 
+    /**Release a TCP port number from GetNextTCPPort().
+     */
+    void ReleaseTCPPort(WORD port);
+
     /**Get the UDP port number base for RAS channels
      */
     WORD GetUDPPortBase() const { return udpPorts.base; }
@@ -2698,10 +2853,36 @@ class H323EndPoint : public PObject
      */
     void SetRtpIpPorts(unsigned udpBase, unsigned udpMax);
 
+    /**Set the UDP port number base and max for RTP channels bound to the
+       local interface iface. Interfaces without a range of their own use
+       the range set with SetRtpIpPorts(unsigned, unsigned).
+     */
+    void SetRtpIpPorts(const PIPSocket::Address & iface, unsigned udpBase, unsigned udpMax);
+
     /**Get the UDP port number pair for RTP channels.
+       Port pairs in use are skipped, released ones are used again first.
      */
     WORD GetRtpIpPortPair();
 
+    /**Get the UDP port number pair for RTP channels bound to iface.
+     */
+    WORD GetRtpIpPortPair(const PIPSocket::Address & iface);
+
+    /**Mark a UDP port number pair bound to iface some other way as in use,
+       returns FALSE if it was already.
+     */
+    PBoolean ReserveRtpIpPortPair(WORD port, const PIPSocket::Address & iface);
+
+    /**Release a UDP port number pair for RTP channels bound to iface.
+     */
+    void ReleaseRtpIpPortPair(WORD port, const PIPSocket::Address & iface);
+
+    /**Get the pool of RTP/RTCP socket pairs bound ahead of time. Use
+       SetSize() on it to change the number of pairs kept per interface,
+       or to disable it.
+     */
+    RTP_UDPSocketPool & GetRtpSocketPool() { return *rtpSocketPool; }
+
 #ifdef H323_H46019M
    /**Set the UDP port number base for Multiplex RTP/RTCP channels.
      */
@@ -3019,6 +3200,8 @@ class H323EndPoint : public PObject
     PBoolean     clearCallOnRoundTripFail;
 
     struct PortInfo {
+      PortInfo() : base(0), max(0), current(0), step(1), used(0), tracked(FALSE) { }
+
       void Set(
         unsigned base,
         unsigned max,
@@ -3028,13 +3211,34 @@ class H323EndPoint : public PObject
       WORD GetNext(
         unsigned increment
       );
+      PBoolean Reserve(
+        WORD port
+      );
+      void Release(
+        WORD port
+      );
 
       PMutex mutex;
       WORD   base;
       WORD   max;
       WORD   current;
+
+      // If tracked ports handed out are marked in a bitmap, one bit per
+      // step, until released. Released ports are reused oldest first. Ports
+      // handed out again while all are in use are counted in lent.
+      unsigned          step;
+      std::vector<BYTE> inUse;
+      std::deque<WORD>  freeList;
+      std::map<WORD, unsigned> lent;
+      unsigned          used;
+      PBoolean          tracked;
     } tcpPorts, udpPorts, rtpIpPorts;
 
+    PortInfo & GetRtpIpPortInfo(const PIPSocket::Address & iface);
+    std::map<PString, PortInfo *> rtpIpInterfacePorts;
+    PMutex                        rtpIpInterfaceMutex;
+    RTP_UDPSocketPool           * rtpSocketPool;
+
 #ifdef P_STUN
     H323NatStrategy * natMethods;
 #endif
@@ -3058,6 +3262,12 @@ class H323EndPoint : public PObject
 
     TerminalTypes terminalType;
     PBoolean rewriteParsePartyName;
+#if P_DNS
+    H323DNSCache dnsCache;
+#endif
+
+    PMutex                makeCallThreadsMutex;
+    std::deque<PThread *> makeCallThreads;   // Started by MakeCallAsync(), deleted once terminated
 
 #ifdef H323_H450
 
@@ -412,6 +412,82 @@ class H323ControlPDU : public H245_MultimediaSystemControlMessage
 };
 
 
+/////////////////////////////////////////////////////////////////////////////
+
+/**Lazy view of a PER encoded OpenLogicalChannel as carried in the fastStart
+   field of H.225 messages.
+   Only the fields required to match a proposal against a capability (channel
+   number, direction, data type and H.225.0 multiplex parameters) are decoded
+   on construction. The remaining fields (separate stack, encryption sync,
+   generic information etc) are only decoded when Decode() is called, which
+   should be deferred until the proposal is actually selected.
+ */
+class H323FastStartView : public PObject
+{
+  PCLASSINFO(H323FastStartView, PObject);
+
+  public:
+    /**Create a view of the encoded OpenLogicalChannel.
+      */
+    H323FastStartView(
+      const PASN_OctetString & encoded   ///< Element of fastStart array
+    );
+
+    /**Indicate the leading fields of the proposal decoded correctly.
+      */
+    PBoolean IsValid() const { return valid; }
+
+    /**Indicate the proposal has reverse logical channel parameters, ie is
+       a channel in the direction of the receiver of the proposal.
+      */
+    PBoolean IsReverse() const { return reverse; }
+
+    /**Get the forward logical channel number.
+      */
+    unsigned GetChannelNumber() const;
+
+    /**Get the data type relevant to the proposal direction.
+      */
+    const H245_DataType & GetDataType() const;
+
+    /**Get the H.225.0 logical channel parameters relevant to the proposal
+       direction. Returns NULL if not present or not H.225.0.
+      */
+    const H245_H2250LogicalChannelParameters * GetH2250Parameters() const;
+
+    /**Get the RTP session ID of the proposal, zero if not available.
+      */
+    unsigned GetSessionID() const;
+
+    /**Get the RTP media address of the proposal, if present.
+      */
+    PBoolean GetMediaAddress(
+      H323TransportAddress & address
+    ) const;
+
+    /**Complete the decode of the OpenLogicalChannel. This is a no-op if
+       already fully decoded.
+      */
+    PBoolean Decode();
+
+    /**Indicate Decode() has been successfully called.
+      */
+    PBoolean IsDecoded() const { return decoded; }
+
+    /**Get the OpenLogicalChannel PDU. Only the leading fields are valid
+       until Decode() has been called.
+      */
+    const H245_OpenLogicalChannel & GetPDU() const { return open; }
+
+  protected:
+    PBYTEArray              rawData;
+    H245_OpenLogicalChannel open;
+    PBoolean                valid;
+    PBoolean                reverse;
+    PBoolean                decoded;
+};
+
+
 /////////////////////////////////////////////////////////////////////////////
 
 /**Wrapper class for the H323 gatekeeper RAS channel.
@@ -441,6 +517,7 @@ class H323RasPDU : public H225_RasMessage, public H323TransactionPDU
 #endif
     virtual H323TransactionPDU * ClonePDU() const;
     virtual void DeletePDU();
+    virtual PBoolean SetTemplateFields(H323PDUTemplate & tmpl);
 
     // new functions
     H225_GatekeeperRequest       & BuildGatekeeperRequest(unsigned seqNum);
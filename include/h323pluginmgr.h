@@ -64,6 +64,11 @@ class H323PluginCodecManager : public PPluginModuleManager
 
     static void CodecListing(const PString & matchStr, PStringList & listing);
 
+    /**Set the most memory, in bytes, the video frame pool keeps in idle
+       buffers for reuse by plugin video codecs. Zero disables pooling.
+      */
+    static void SetVideoFramePoolLimit(PINDEX bytes);
+
     virtual void OnShutdown();
 
     static void Bootstrap();
@@ -49,6 +49,7 @@ class H245_H2250LogicalChannelAckParameters;
 class H245_ArrayOf_GenericInformation;
 
 class H323Connection;
+class H323EndPoint;
 class H323_RTPChannel;
 
 class H245_TransportCapability;
@@ -198,6 +199,10 @@ class H323_RTP_UDP : public H323_RTP_Session
       RTP_UDP & rtp,                     ///< RTP session
       RTP_QOS * rtpqos = NULL            ///< QoS spec if available
     );
+
+    /**Release the RTP port pair back to the endpoint.
+     */
+    ~H323_RTP_UDP();
   //@}
 
   /**@name Operations */
@@ -297,6 +302,9 @@ class H323_RTP_UDP : public H323_RTP_Session
     );
 
     RTP_UDP & rtp;
+    H323EndPoint & endpoint;
+    PIPSocket::Address portInterface;  ///< Local interface the port pair was allocated on
+    WORD portPair;                     ///< Port pair to release, 0 if none
 };
 
 
@@ -38,8 +38,94 @@
 #include "h235auth.h"
 
 #include <ptclib/asner.h>
+#include <map>
+#include <vector>
 
 
+///////////////////////////////////////////////////////////
+
+/**Pre-encoded PDU template.
+   A PDU is PER encoded once and the bit location of the fields that change
+   between otherwise identical messages (sequence numbers, call identifiers
+   etc) is recorded. Subsequent PDUs are then produced by patching those
+   fields in place in a copy of the encoding. If anything else in the PDU
+   differs from the one the template was built from, a full encode is done
+   and the template rebuilt.
+
+   Only constrained integers of at most 16 bits and fixed size octet strings
+   can be patched.
+  */
+class H323PDUTemplate : public PObject
+{
+  PCLASSINFO(H323PDUTemplate, PObject);
+  public:
+    H323PDUTemplate();
+    ~H323PDUTemplate();
+
+    /**Remove the variable fields of the PDU to be encoded.
+      */
+    void ClearFields();
+
+    /**Add a constrained integer field of the PDU to be encoded.
+      */
+    void AddField(
+      PASN_Integer & field
+    );
+
+    /**Add a fixed size octet string field of the PDU to be encoded.
+      */
+    void AddField(
+      PASN_OctetString & field
+    );
+
+    /**Encode the PDU, using the pre-encoded template if the PDU matches it.
+      */
+    void Encode(
+      PASN_Object & pdu,
+      PPER_Stream & strm
+    );
+
+    /**Get the number of times the template was used.
+      */
+    unsigned GetHits() const { return hits; }
+
+    /**Get the number of times a full encode was required.
+      */
+    unsigned GetMisses() const { return misses; }
+
+  protected:
+    PBoolean Compile(PASN_Object & pdu);
+    PBoolean Matches(PASN_Object & pdu);
+    PBoolean LocateField(PASN_Object & pdu, PINDEX idx);
+    void Patch(PBYTEArray & data) const;
+
+    struct Field {
+      Field() : object(NULL), isInteger(FALSE), bitOffset(0), bitCount(0), lower(0), value(0) { }
+
+      PASN_Object * object;     // Field in the PDU being encoded
+      PBoolean      isInteger;
+      PINDEX        bitOffset;  // Location in the encoding
+      PINDEX        bitCount;
+      unsigned      lower;      // Integer lower limit
+      unsigned      value;      // Integer value when compiled
+      PBYTEArray    octets;     // Octet string value when compiled
+    };
+    std::vector<Field> liveFields;
+    std::vector<Field> fields;
+
+    PASN_Object * snapshot;
+    PBYTEArray    encoding;
+
+    unsigned hits;
+    unsigned misses;
+    unsigned consecutiveMisses;
+    unsigned giveUps;
+    unsigned backoff;
+};
+
+
+///////////////////////////////////////////////////////////
+
 class H323TransactionPDU {
   public:
     H323TransactionPDU();
@@ -62,6 +148,18 @@ class H323TransactionPDU {
     virtual H323TransactionPDU * ClonePDU() const = 0;
     virtual void DeletePDU() = 0;
 
+    /**Add the fields that vary between otherwise identical PDUs to the
+       template. Return FALSE if this PDU must be fully encoded, e.g. it
+       carries security tokens. Default adds no fields and returns TRUE.
+      */
+    virtual PBoolean SetTemplateFields(H323PDUTemplate & /*tmpl*/) { return TRUE; }
+
+    /**Set the template to use when encoding in Write(), NULL for none.
+      */
+    void SetEncodingTemplate(
+      H323PDUTemplate * tmpl
+    ) { encodingTemplate = tmpl; }
+
     const H235Authenticators & GetAuthenticators() const { return authenticators; }
     void SetAuthenticators(
       const H235Authenticators & auth
@@ -84,6 +182,7 @@ class H323TransactionPDU {
   protected:
     H235Authenticators authenticators;
     PPER_Stream        rawPDU;
+    H323PDUTemplate  * encodingTemplate;
 };
 
 
@@ -200,6 +299,18 @@ class H323Transactor : public PObject
     /**Get flag to check all crypto tokens on responses.
       */
     PBoolean GetCheckResponseCryptoTokens() { return checkResponseCryptoTokens; }
+
+    /**Use a pre-encoded template for the PDU type. This is worthwhile for
+       PDUs that are sent repeatedly with only sequence numbers or call
+       identifiers changing, eg lightweight RRQ or periodic IRR.
+
+       There is one template per PDU type for the transactor, so it does not
+       suit a transactor sending to many peers, eg a gatekeeper listener,
+       nor PDUs carrying H.235 tokens, which differ on every send.
+      */
+    void EnablePDUTemplate(
+      unsigned tag    ///<  Choice tag of the PDU
+    );
   //@}
 	
     class Request : public PObject
@@ -251,6 +362,9 @@ class H323Transactor : public PObject
     void Construct();
 
     unsigned GetNextSequenceNumber();
+    PBoolean WriteWithTemplate(
+      H323TransactionPDU & pdu
+    );
     PBoolean SetUpCallSignalAddresses(
       H225_ArrayOf_TransportAddress & addresses
     );
@@ -314,6 +428,8 @@ class H323Transactor : public PObject
 
     PMutex                pduWriteMutex;
     PSortedList<Response> responses;
+
+    std::map<unsigned, H323PDUTemplate *> pduTemplates;
 };
 
 
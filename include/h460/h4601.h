@@ -54,6 +54,7 @@
 #include <ptlib/pluginmgr.h>
 #include <ptclib/url.h>
 #include <map>
+#include <vector>
 #include "ptlib_extras.h"
 
 
@@ -646,6 +647,14 @@ class H460_Feature : public H225_FeatureDescriptor
       */
       virtual PBoolean FeatureAdvertised(int mtype);
 
+    /** Whether the feature sends or reads anything in the message.
+        Override to return false for messages which have no OnSend/OnReceive
+        implementation so the FeatureSet does not call the feature for them.
+        The answer is cached so must not change with the state of the feature.
+        Derived classes implementing further messages must include them here.
+      */
+      virtual PBoolean FeatureHandled(int /*mtype*/) { return true; };
+
     /** Whether Supports Non-Call Supplimentary Service
      */
        virtual PBoolean SupportNonCallService() const { return false; };
@@ -1186,10 +1195,28 @@ class H460_FeatureSet : public PObject
 
    PString PTracePDU(PINDEX id) const;
 
+   /** Build the per message dispatch table and the feature ID index.
+       Done when the FeatureSet is loaded and again after features are added or removed.
+     */
+   void BuildDispatchTable();
+
+   /** Features handling a message type
+     */
+   const std::vector<H460_Feature *> & GetDispatch(unsigned MessageID);
+
+   /** Find the Feature for a received descriptor
+     */
+   H460_Feature * FindFeaturePDU(const H225_FeatureDescriptor & pdu);
+
    H460_Features  Features;
    H323EndPoint * ep;
    H460_FeatureSet * baseSet;
 
+   std::map<unsigned, std::vector<H460_Feature *> > dispatchTable;
+   std::map<unsigned, H460_Feature *> stdFeatureIndex;   ///< Standard features by number
+   std::map<PString, H460_Feature *> featureIndex;       ///< OID and NonStandard features by ID string
+   PBoolean dispatchValid;
+
 };
 
 /////////////////////////////////////////////////////////////////////
@@ -49,6 +49,7 @@
 #endif // _MSC_VER > 1000
 
 #include "h323pdu.h"
+#include <map>
 
 class H46018SignalPDU  : public H323SignalPDU
 {
@@ -158,6 +159,10 @@ class H46018Transport  : public H323TransportTCP
 
     PBoolean CloseTransport() { return closeTransport; };
 
+    /**Time of the last PDU written, as PTimer::Tick()
+      */
+    PTimeInterval GetLastWriteTime() const { return lastWrite; }
+
   protected:
 
      PMutex connectionsMutex;
@@ -169,6 +174,90 @@ class H46018Transport  : public H323TransportTCP
      PBoolean   isConnected;
      PBoolean   remoteShutDown;
      PBoolean   closeTransport;
+     PTimeInterval lastWrite;
+};
+
+
+/**Keep-alive scheduler for the H.460.18 signalling channels and H.460.19
+   media sockets of an endpoint.
+   All keep-alives are sent from one thread driven by a timing wheel, so
+   there is no timer or thread per socket. Regular keep-alives are sent a
+   little early by a random amount so those registered at the same time
+   spread out, and are skipped when the client reports that it has sent
+   to the keep-alive address within the interval anyway.
+  */
+class H46019KeepAliveScheduler : public PObject
+{
+    PCLASSINFO(H46019KeepAliveScheduler, PObject);
+
+  public:
+    /**Something to be kept alive.
+      */
+    class Client
+    {
+      public:
+        virtual ~Client() { }
+
+        /**Send a keep-alive, called from the scheduler thread.
+          */
+        virtual void OnKeepAlive() = 0;
+
+        /**Get the PTimer::Tick() of the last packet sent that keeps the
+           binding alive anyway, zero if never or not known.
+          */
+        virtual PTimeInterval GetLastKeepAliveTime() const { return 0; }
+    };
+
+    H46019KeepAliveScheduler();
+    ~H46019KeepAliveScheduler();
+
+    /**Start keep-alives for a client, replacing any existing schedule.
+       The initial keep-alives are sent first, a short time apart.
+      */
+    void Add(
+      Client & client,          ///< Client to keep alive
+      unsigned interval,        ///< Seconds between keep-alives
+      unsigned initial = 0      ///< Number of initial keep-alives
+    );
+
+    /**Stop keep-alives for a client. If wait is TRUE this does not return
+       while a keep-alive is being sent, as needed before the client is
+       deleted.
+      */
+    void Remove(
+      Client & client,
+      PBoolean wait = TRUE
+    );
+
+    /**Is the client having keep-alives sent.
+      */
+    PBoolean IsScheduled(Client & client) const;
+
+  protected:
+    struct Entry {
+      Client * client;
+      unsigned interval;      // ms
+      unsigned initial;       // Initial keep-alives still to send
+      unsigned rounds;        // Turns of the wheel before due
+      unsigned next;          // ms until due again, set when sent
+      PTimeInterval lastSent; // Time of our last keep-alive
+      PBoolean removed;       // Deleted by the thread when next in a slot
+    };
+
+    void Schedule(Entry * entry, PInt64 delay);
+    PDECLARE_NOTIFIER(PThread, H46019KeepAliveScheduler, WorkerMain);
+
+    typedef std::map<Client *, Entry *> EntryMap;
+    EntryMap                          m_entries;
+    std::vector< std::vector<Entry *> > m_wheel;
+    PInt64                            m_currentTick;
+    PTimeInterval                     m_tickTime;
+
+    PMutex      m_mutex;          // Protects the entries and wheel
+    PMutex      m_sendMutex;      // Held while keep-alives are sent
+    PThread   * m_thread;
+    PSyncPoint  m_wakeUp;
+    PBoolean    m_shutdown;
 };
 
 
@@ -200,6 +289,8 @@ class H46018Handler : public PObject
 #endif
 
     void SetTransportSecurity(const H323TransportSecurity & callSecurity);
+
+    H46019KeepAliveScheduler & GetKeepAliveScheduler() { return m_keepAlives; }
         
   protected:    
     H323EndPoint & EP;
@@ -217,6 +308,7 @@ class H46018Handler : public PObject
     PThread * SocketCreateThread;
     PDECLARE_NOTIFIER(PThread, H46018Handler, SocketThread);
     PBoolean m_h46018inOperation;
+    H46019KeepAliveScheduler m_keepAlives;
 
     H323TransportSecurity m_callSecurity;
 };
@@ -227,6 +319,34 @@ typedef map<unsigned, PUDPSocket*> muxSocketMap;
 typedef map<PString, unsigned> muxPortMap;
 
 class H46019MultiplexSocket;
+class RTP_MultiDataFrame;
+
+/**Open addressed table of multiplexed sockets indexed by multiplex ID.
+   This is the lookup used by the multiplex reader for every packet, the
+   muxSocketMap is kept for the slower searches of the recovery paths.
+   Multiplex ID zero is never stored.
+  */
+class H46019MultiplexTable
+{
+  public:
+    H46019MultiplexTable();
+
+    PUDPSocket * GetAt(unsigned id) const;
+    void SetAt(unsigned id, PUDPSocket * socket);
+    void RemoveAt(unsigned id);
+    void RemoveAll();
+
+  protected:
+    void Resize(unsigned size);
+
+    struct Entry {
+      unsigned     id;      // Zero if never used
+      PUDPSocket * socket;  // NULL if removed
+    };
+    std::vector<Entry> m_entries;
+    unsigned           m_used;   // Entries with a non zero ID
+    unsigned           m_count;  // Entries with a socket
+};
 #endif
 
 class PNatMethod_H46019  : public H323NatMethod
@@ -335,6 +455,17 @@ class PNatMethod_H46019  : public H323NatMethod
       */
     void StartMultiplexListener();
 
+    /** Route a frame read from a multiplex socket to its session socket.
+        Called by the listener thread with the muxMutex held.
+      */
+    static void DispatchMultiplexFrame(
+        PBoolean rtp,                      ///< Read from the RTP socket
+        RTP_MultiDataFrame & frame,        ///< Frame as read
+        PINDEX len,                        ///< Length read
+        const PIPSocket::Address & addr,   ///< Source address
+        WORD port                          ///< Source port
+    );
+
 #endif
 
     /**  OpenSocket
@@ -427,6 +558,8 @@ protected:
     static muxSocketMap                  rtpSocketMap;
     static muxPortMap                    rtpPortMap;
     static muxSocketMap                  rtcpSocketMap;
+    static H46019MultiplexTable          rtpSocketTable;
+    static H46019MultiplexTable          rtcpSocketTable;
     static PMutex                        muxMutex;
     PThread *                            m_readThread;
     PDECLARE_NOTIFIER(PThread, PNatMethod_H46019, ReadThread);
@@ -447,10 +580,44 @@ protected:
 struct  H46019MultiPacket {
   PIPSocket::Address fromAddr;
   WORD               fromPort;
-  PBYTEArray         frame;
+  PINDEX             length;
+  PBYTEArray         frame;     // Only ever grows, reused for each packet
 };
 
-typedef std::queue<H46019MultiPacket> H46019MultiQueue;
+/**Queue of packets for a multiplexed session socket.
+   There is one writer, the multiplex listener thread, and one reader, the
+   thread reading the session socket, so no lock is needed. Packet buffers
+   are kept between packets so there is no allocation once running.
+  */
+class H46019MultiQueue
+{
+  public:
+    H46019MultiQueue();
+
+    /** Add a packet, called only by the multiplex listener.
+        Returns false if the queue is full.
+      */
+    PBoolean Push(const void * buf, PINDEX len, const PIPSocket::Address & addr, WORD port);
+
+    /** Remove a packet, called only by the session reader. On entry len is
+        the size of buf, on exit the length of the packet.
+      */
+    PBoolean Pop(void * buf, PINDEX & len, PIPSocket::Address & addr, WORD & port);
+
+    /** Discard all packets, when there is no writer.
+      */
+    void Clear();
+
+    PINDEX GetCount() const { return m_count; }
+
+  protected:
+    enum { QueueSize = 64 };    // Must be a power of 2
+
+    H46019MultiPacket m_packets[QueueSize];
+    unsigned          m_head;   // Next to read, only changed by reader
+    unsigned          m_tail;   // Next to write, only changed by writer
+    PAtomicInteger    m_count;  // Publishes packets between the threads
+};
 
 class H46019MultiplexSocket : public H323UDPSocket
 {
@@ -509,7 +676,7 @@ class H46019MultiplexSocket : public H323UDPSocket
 };
 #endif
 
-class H46019UDPSocket : public H323UDPSocket
+class H46019UDPSocket : public H323UDPSocket, public H46019KeepAliveScheduler::Client
 {
     PCLASSINFO(H46019UDPSocket, H323UDPSocket);
   public:
@@ -670,11 +837,18 @@ class H46019UDPSocket : public H323UDPSocket
 
     PString ProbeState(probe_state state);
 
+    enum probe_candidate {
+        e_candidateAlternate,   ///< Address given in the H.460.24 Annex A generic information
+        e_candidateAnnexB,      ///< Address given in an H.460.24 Annex B request
+        e_candidateReflexive    ///< Address the remote's probes were received from
+    };
+
     struct probe_packet {
         PUInt16b    Length;        // Length
         PUInt32b    SSRC;        // Time Stamp
         BYTE        name[4];    // Name is limited to 32 (4 Bytes)
         BYTE        cui[20];    // SHA-1 is always 160 (20 Bytes)
+        PUInt32b    tick;       // Send tick (ms) of the request, echoed in the reply
     };
 
 
@@ -701,9 +875,39 @@ class H46019UDPSocket : public H323UDPSocket
         WORD port                    ///< Detected Port.
         );
 
-    /** Start sending media/control to alternate address
+    /** Add a remote address to probe for a direct path. All candidates
+        are probed together and the one answering fastest is used.
       */
-    void H46024Adirect(bool starter);
+    void AddProbeCandidate(
+        const Address & address,      ///< Remote address
+        WORD port,                    ///< Remote port
+        unsigned muxID,               ///< Remote multiplex ID
+        probe_candidate kind          ///< Where the address came from
+        );
+
+    /** Get the candidate probing chose as the direct path.
+        Returns FALSE if it has not chosen one.
+      */
+    PBoolean GetDirectCandidate(
+        probe_candidate & kind,       ///< Where the address came from
+        Address & address,            ///< Remote address
+        WORD & port,                  ///< Remote port
+        unsigned & muxID              ///< Remote multiplex ID
+        );
+
+    /** Add the RTP candidate matching the reflexive RTCP address probing
+        chose. Reflexive addresses are only learned on the RTCP socket.
+      */
+    void AddReflexiveRTPCandidate(
+        const Address & address,      ///< Remote RTCP address
+        WORD port,                    ///< Remote RTCP port
+        unsigned muxID                ///< Remote RTCP multiplex ID
+        );
+
+    /** Start sending media/control to alternate address, the candidate
+        chosen by probing or else the one of the given kind.
+      */
+    void H46024Adirect(bool starter, probe_candidate kind = e_candidateAlternate);
 #endif
 
 #ifdef H323_H46024B
@@ -724,13 +928,21 @@ class H46019UDPSocket : public H323UDPSocket
 
 #ifdef H323_H46024A
     // H46024 Annex A support
-    PBoolean ReceivedProbePacket(const RTP_ControlFrame & frame, bool & probe, bool & success);
-    void BuildProbe(RTP_ControlFrame & report, bool reply);
+    PBoolean ReceivedProbePacket(const RTP_ControlFrame & frame, const Address & addr, WORD port, bool & probe, bool & success);
+    void BuildProbe(RTP_ControlFrame & report, bool reply, DWORD tick);
     void StartProbe();
     void ProbeReceived(bool probe, const PIPSocket::Address & addr, WORD & port);
     void SetProbeState(probe_state newstate);
     int GetProbeState() const;
+#endif
+
+#if defined(H323_H46024A) || defined(H323_H46024B)
     PMutex probeMutex;
+
+    /** Check a received packet against the direct media state.
+        Returns FALSE if it was a probe which is not to be passed on.
+      */
+    PBoolean ReceivedPacket(const void * buf, PINDEX len, const Address & addr, WORD port);
 #endif
 
 private:
@@ -748,18 +960,16 @@ private:
     WORD keepseqno;                            ///< KeepAlive sequence number
     PTime * keepStartTime;                    ///< KeepAlive start time for TimeStamp.
 
-    PThread * initialKeep;                    ///< Initial keepalive thread.
-    PDECLARE_NOTIFIER(PThread, H46019UDPSocket, StartKeepAlives); ///< First keep alives handling
+    PTimeInterval keepLastSent;               ///< Time of last packet sent to KeepAlive Address
 
-    PDECLARE_NOTIFIER(PTimer, H46019UDPSocket, Ping);    ///< Timer to notify to poll for External IP
-    PTimer    Keep;                                        ///< Polling Timer
+    virtual void OnKeepAlive();
+    virtual PTimeInterval GetLastKeepAliveTime() const;
+    void StopKeepAlive();
 
 #ifdef H323_H46019M
     unsigned         m_recvMultiplexID;             ///< Multiplex ID
     unsigned         m_sendMultiplexID;             ///< Multiplex ID
     H46019MultiQueue m_multQueue;                   ///< Incoming frame Queue
-    unsigned         m_multiBuffer;                 ///< Multiplex BufferSize
-    PMutex           m_multiMutex;                  ///< MultiQueue mutex
     PBoolean         m_shutDown;                    ///< Shutdown
 #endif
 
@@ -772,8 +982,26 @@ private:
     PIPSocket::Address m_pendAddr;  WORD m_pendPort;        ///< detected pending RTCP Probe Address (as detected from actual packets)
     PDECLARE_NOTIFIER(PTimer, H46019UDPSocket, Probe);        ///< Thread to probe for direct connection
     PTimer m_Probe;                                            ///< Probe Timer
-    PINDEX m_probes;                                        ///< Probe count
     DWORD SSRC;                                                ///< Random number
+
+    struct ProbeCandidate {
+        Address         addr;
+        WORD            port;
+        unsigned        muxID;
+        probe_candidate kind;
+        PINDEX          sent;           ///< Probes sent
+        PTimeInterval   lastSent;       ///< Tick the last probe was sent
+        PTimeInterval   rtt;            ///< Round trip time of the verified reply
+        bool            verified;       ///< Reply received and verified
+    };
+    PINDEX FindCandidate(const Address & addr, WORD port) const;
+    PINDEX FindCandidate(probe_candidate kind) const;
+
+    std::vector<ProbeCandidate> m_candidates;                 ///< Remote addresses to probe
+    PINDEX m_nextCandidate;                                 ///< Next candidate to check
+    PINDEX m_bestCandidate;                                 ///< Candidate chosen (P_MAX_INDEX if none)
+    PTimeInterval m_probeDecide;                            ///< Tick at which to choose from those verified
+    DWORD m_probeEcho;                                      ///< Tick of the last request received, echoed in the reply
 #endif
     PIPSocket::Address m_altAddr;  
 	WORD m_altPort;                                           ///< supplied remote Address (as supplied in Generic Information)
@@ -40,6 +40,8 @@
 
 #include <h460/h46026.h>
 #include <queue>
+#include <deque>
+#include <list>
 #include <vector>
 #include <map>
 
@@ -50,6 +52,7 @@ public:
     H46026_ArrayOf_FrameData & GetData();
 
     void SetFrame(const PBYTEArray & data);
+    void SetFrame(const BYTE * data, PINDEX len);
 
     H46026_UDPFrame & GetBuffer();
     void ClearBuffer();
@@ -78,25 +81,48 @@ public:
         unsigned crv;
         int sessionId;
         int priority;
-        int delay;
         PInt64 packTime;
      };
 
-     int operator() ( const std::pair<PBYTEArray, MessageHeader>& p1,
-                      const std::pair<PBYTEArray, MessageHeader>& p2 ) {
-           return ((p1.second.priority >= p2.second.priority) && 
-                     (p1.second.packTime > p2.second.packTime));
-     }
-
      PString PriorityAsString();
 };
 
-typedef std::priority_queue< std::pair<PBYTEArray, socketOrder::MessageHeader >, 
-        std::vector< std::pair<PBYTEArray, socketOrder::MessageHeader> >, socketOrder > H46026SocketQueue;
-
 typedef std::map<int,H46026UDPBuffer*> H46026CallMap;
 typedef std::map<unsigned, H46026CallMap >  H46026RTPBuffer;
 
+/* Messages queued for the socket from one flow, the signalling or one
+   direction of a media session of a call. Signalling, audio and data flows
+   are sent first, oldest message first. Video and RTCP flows share what
+   is left of the pipe by deficit round robin in proportion to their weight.
+ */
+class H46026FlowQueue {
+public:
+    H46026FlowQueue(unsigned crv, int sessionId, int priority);
+
+    struct Entry {
+        PBYTEArray data;
+        socketOrder::MessageHeader header;
+        PBoolean frameEnd;          // Last message of a video frame
+    };
+
+    PBoolean IsStrict() const;
+
+    unsigned           m_crv;
+    int                m_sessionId;
+    int                m_priority;
+    unsigned           m_weight;
+    std::deque<Entry>  m_queue;
+    PINDEX             m_bytes;           // Bytes queued
+    PINDEX             m_deficit;         // Round robin byte credit
+    PBoolean           m_backlogged;      // In the strict or round robin list
+    PBoolean           m_frameStart;      // Next message starts a video frame
+    PBoolean           m_dropping;        // Dropping until the next frame starts
+    PInt64             m_lastFastUpdate;
+    unsigned           m_droppedFrames;
+};
+
+typedef std::map<PInt64, H46026FlowQueue*> H46026FlowMap;
+
 //-------------------------------------------------------------------------------
 
 class H46026_MediaFrame  : public PBYTEArray
@@ -131,6 +157,16 @@ public:
     /* Set the pipe bandwidth Default is 384k */
     void SetPipeBandwidth(unsigned bps);
 
+    /* Get the bandwidth the pipe is estimated to be taking in bps.
+       This is never more than the pipe bandwidth set.
+     */
+    unsigned GetEstimatedBandwidth() const;
+
+    /* Set the share of the pipe a video session gets relative to the others
+       when they cannot all be sent. Default is 1.
+     */
+    void SetFlowWeight(unsigned crv, PINDEX sessionId, unsigned weight);
+
     /** Clear Buffers */
     /* Call this is clear the channel buffers at the end of a call */
     /* This MUST be called at the end of a call */
@@ -174,6 +210,13 @@ public:
     PBoolean SocketOut(BYTE * data, PINDEX & len);
     PBoolean SocketOut(PBYTEArray & data, PINDEX & len);
 
+    /* Collect all the messages the pipe can take now, up to maxBytes, to
+       send to the socket together. The messages are reference counted, not
+       copied, until they are coalesced into one buffer for a single write.
+       Returns false if there is nothing ready to send.
+     */
+    PBoolean SocketOut(std::vector<PBYTEArray> & messages, PINDEX maxBytes);
+
     /* Receiving from the socket */
     /* Process an incoming message from the socket.
         Returns false if message could not be handled or decoded into Q931.
@@ -183,14 +226,23 @@ public:
     PBoolean SocketIn(const Q931 & q931);
 
 protected:
-    PBoolean WriteQueue(const Q931 & msg, const socketOrder::MessageHeader & prior);
-    PBoolean WriteQueue(const PBYTEArray & data, const socketOrder::MessageHeader & prior);
+    PBoolean WriteQueue(const Q931 & msg, const socketOrder::MessageHeader & prior, PBoolean frameEnd = true);
+    PBoolean WriteQueue(const PBYTEArray & data, const socketOrder::MessageHeader & prior, PBoolean frameEnd = true);
 
-    PBoolean PackageFrame(PBoolean rtp, unsigned crv, PacketTypes id, PINDEX sessionId, H46026_UDPFrame & data);
+    PBoolean PackageFrame(PBoolean rtp, unsigned crv, PacketTypes id, PINDEX sessionId, H46026_UDPFrame & data, PBoolean frameEnd = true);
     H46026UDPBuffer * GetRTPBuffer(unsigned crv, int sessionId);
 
     PBoolean ProcessQueue();
 
+    // Queue handling, m_queueMutex must be held
+    H46026FlowQueue * GetFlow(unsigned crv, int sessionId, int priority);
+    H46026FlowQueue * NextFlow();
+    void PopFlow(H46026FlowQueue * flow, H46026FlowQueue::Entry & entry);
+    void DropFrames(H46026FlowQueue * flow, PInt64 nowTime);
+    void RequestFastUpdate(H46026FlowQueue * flow, PInt64 nowTime);
+    void RefillCredit(PInt64 nowTime);
+    void ClearFlows(unsigned crv);
+
     unsigned NextPacketCounter();
 
 private:
@@ -202,8 +254,16 @@ private:
     H225_H323_UserInformation  m_uuie;
     H46026RTPBuffer            m_rtpBuffer;
     PMutex                     m_writeMutex;
-    H46026SocketQueue          m_socketQueue;
-    PMutex                     m_queueMutex;
+
+    H46026FlowMap                 m_flows;
+    std::list<H46026FlowQueue*>   m_strictFlows;    // Backlogged signal, audio and data flows
+    std::list<H46026FlowQueue*>   m_roundRobin;     // Backlogged video and RTCP flows
+    PINDEX                        m_queuedBytes;
+    double                        m_credit;         // Bytes the pipe can take now
+    double                        m_rateEstimate;   // Measured pipe rate in bps
+    PInt64                        m_lastOutTime;
+    PINDEX                        m_lastOutBytes;
+    PMutex                        m_queueMutex;
 };
 
 
@@ -45,6 +45,7 @@ public:
 	static PStringArray GetIdentifier();
 
 	virtual PBoolean CommonFeature() { return remoteSupport; }
+    virtual PBoolean FeatureHandled(int mtype);
 
     virtual PBoolean SupportNonCallService();
 
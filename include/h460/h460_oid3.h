@@ -150,6 +150,7 @@ public:
     static PStringArray GetIdentifier();
 
     virtual PBoolean CommonFeature() { return remoteSupport; }
+    virtual PBoolean FeatureHandled(int mtype);
 
     virtual PBoolean OnSendGatekeeperRequest(H225_FeatureDescriptor & pdu);
     virtual PBoolean OnSendRegistrationRequest(H225_FeatureDescriptor & pdu);
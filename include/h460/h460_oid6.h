@@ -67,6 +67,7 @@ public:
     static PStringArray GetIdentifier();
 
     virtual PBoolean CommonFeature() { return remoteSupport; }
+    virtual PBoolean FeatureHandled(int mtype);
 
    // Messages
    // GK -> EP
@@ -69,6 +69,7 @@ public:
     static PStringArray GetIdentifier();
 
     virtual PBoolean CommonFeature() { return false; }  // Remove this feature if required.
+    virtual PBoolean FeatureHandled(int mtype);
 
     // Messages
     virtual PBoolean OnSendAdmissionRequest(H225_FeatureDescriptor & pdu);
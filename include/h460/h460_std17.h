@@ -70,6 +70,7 @@ public:
     static PStringArray GetIdentifier() { return PStringArray("17"); };
 
     virtual PBoolean CommonFeature() { return isEnabled; }
+    virtual PBoolean FeatureHandled(int /*mtype*/) { return false; }  // Nothing sent or read in messages
 
     static PBoolean IsEnabled()  { return isEnabled; }
 
@@ -74,6 +74,7 @@ public:
 	static PStringArray GetIdentifier() { return PStringArray("18"); }
 
 	virtual PBoolean CommonFeature() { return isEnabled; }
+    virtual PBoolean FeatureHandled(int mtype);
 
     void SetTransportSecurity(const H323TransportSecurity & callSecurity);
 
@@ -130,6 +131,7 @@ public:
 	virtual PBoolean CommonFeature() { return remoteSupport; }
 
     virtual PBoolean FeatureAdvertised(int mtype);
+    virtual PBoolean FeatureHandled(int mtype);
 
     /////////////////////
     // H.460.19 Messages
@@ -69,6 +69,7 @@ public:
 	static PStringArray GetIdentifier() { return PStringArray("22"); };
 
     virtual PBoolean FeatureAdvertised(int mtype);
+    virtual PBoolean FeatureHandled(int mtype);
 	virtual PBoolean CommonFeature() { return isEnabled; }
 
 	// Messages
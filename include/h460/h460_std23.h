@@ -139,9 +139,16 @@ protected:
         PortInfo singlePortInfo;
         PortInfo pairedPortInfo;
 #endif
+        // Cached result of a recent test on the same interface and server
+        bool GetCachedNATType(PSTUNClient::NatTypes & type, PIPSocket::Address & extIP);
+        void SetCachedNATType(PSTUNClient::NatTypes type, const PIPSocket::Address & extIP);
+
 private:
         PThread *               mainThread;
         PDECLARE_NOTIFIER(PThread, PNatMethod_H46024, MainMethod);
+        PSyncPoint              recheck;
+        bool                    shutdown;
+        PString                 cacheKey;
         bool                    isActive;
         bool                    isAvailable;
         PSTUNClient::NatTypes   natType;
@@ -177,6 +184,7 @@ public:
     static PStringArray GetIdentifier() { return PStringArray("23"); };
 
     virtual PBoolean CommonFeature() { return isEnabled; }
+    virtual PBoolean FeatureHandled(int mtype);
 
     // Messages
     // GK -> EP
@@ -197,7 +205,14 @@ public:
     bool AlternateNATMethod();
     bool UseAlternate();
 
+    /**Look for a UPnP device while the STUN test runs, rather than only
+       after it finds a NAT that UPnP could help with. Off by default.
+      */
+    static void SetEarlyUPnPDiscovery(PBoolean enable) { earlyUPnP = enable; }
+
 protected:
+    static PBoolean earlyUPnP;
+
     bool DetectALG(const PIPSocket::Address & detectAddress);
     void StartSTUNTest(const PString & server);
     
@@ -205,6 +220,7 @@ protected:
     bool IsAlternateAvailable(PString & name);
 #endif
     void DelayedReRegistration();
+    PDECLARE_NOTIFIER(PTimer, H460_FeatureStd23, OnReRegistrationTimeout);
  
 private:
     H323EndPoint *            EP;
@@ -215,6 +231,7 @@ private:
     PBoolean                 isavailable;
     PBoolean                 isEnabled; 
     int                      useAlternate;
+    PTimer                   reRegistrationTimer;
 
 };
 
@@ -251,6 +268,7 @@ public:
     virtual int GetFeaturePurpose()  { return H460_FeatureStd24::GetPurpose(); } 
     static PStringArray GetIdentifier() { return PStringArray("24"); }
     virtual PBoolean CommonFeature() { return isEnabled; }
+    virtual PBoolean FeatureHandled(int mtype);
 
     enum NatInstruct {
         e_unknown,
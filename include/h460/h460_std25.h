@@ -72,6 +72,7 @@ public:
 	static PStringArray GetIdentifier() { return PStringArray("25"); }
 
     virtual PBoolean FeatureAdvertised(int mtype);
+    virtual PBoolean FeatureHandled(int mtype);
 	virtual PBoolean CommonFeature() { return enabled; }
 
 	// Messages
@@ -121,6 +121,7 @@ public:
     static PStringArray GetIdentifier() { return PStringArray("26"); };
 
     virtual PBoolean FeatureAdvertised(int mtype);
+    virtual PBoolean FeatureHandled(int mtype);
     virtual PBoolean CommonFeature() { return isEnabled; }
 
     // Messages
@@ -68,6 +68,7 @@ public:
 	static PStringArray GetIdentifier() { return PStringArray("9"); }
 
     virtual PBoolean FeatureAdvertised(int mtype);
+    virtual PBoolean FeatureHandled(int mtype);
 	virtual PBoolean CommonFeature() { return qossupport; }
 
 	// Messages
@@ -76,6 +76,7 @@ public:
     static PStringArray GetIdentifier();
 
     virtual PBoolean FeatureAdvertised(int mtype);
+    virtual PBoolean FeatureHandled(int mtype);
     virtual PBoolean CommonFeature();  // Remove this feature if required.
 
     // Messages
@@ -34,6 +34,7 @@
 #endif
 
 #include "ptlib_extras.h"
+#include <vector>
 
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -97,9 +98,28 @@ class Q931 : public PObject
     void BuildStatusEnquiry(int callRef, PBoolean fromDest);
     void BuildReleaseComplete(int callRef, PBoolean fromDest);
 
+    /**Decode the Q.931 PDU. The information elements reference the data
+       buffer rather than being copied out of it.
+      */
     PBoolean Decode(const PBYTEArray & data);
+
+    /**Encode the Q.931 PDU into the array.
+      */
     PBoolean Encode(PBYTEArray & data) const;
 
+    /**Encode the Q.931 PDU into a caller provided buffer in a single pass.
+       Returns FALSE if the buffer is smaller than GetEncodedSize().
+      */
+    PBoolean Encode(
+      BYTE * buffer,    ///<  Buffer to encode into
+      PINDEX size,      ///<  Size of buffer
+      PINDEX & length   ///<  Length of encoded PDU
+    ) const;
+
+    /**Get the number of bytes the encoded Q.931 PDU will occupy.
+      */
+    PINDEX GetEncodedSize() const;
+
     void PrintOn(ostream & strm) const;
     PString GetMessageTypeName() const;
 
@@ -134,6 +154,15 @@ class Q931 : public PObject
     void SetIE(InformationElementCodes ie, const PBYTEArray & userData);
     void RemoveIE(InformationElementCodes ie);
 
+    /**Get the information element without copying it. The pointer is only
+       valid until the Q931 PDU is next altered or decoded.
+      */
+    PBoolean GetIE(
+      InformationElementCodes ie,   ///<  Information element code
+      const BYTE * & data,          ///<  Pointer to element contents
+      PINDEX & length               ///<  Length of element contents
+    ) const;
+
     enum InformationTransferCapability {
       TransferSpeech,
       TransferUnrestrictedDigital = 8,
@@ -466,8 +495,40 @@ class Q931 : public PObject
     unsigned protocolDiscriminator;
     MsgTypes messageType;
 
-    H323DICTIONARY(InternalInformationElements, POrdinalKey, PBYTEArray);
-    InternalInformationElements informationElements;
+    // Information elements are kept in a table found through an index by
+    // IE code. Decoded elements reference the received PDU, elements that
+    // are set locally go in the inline buffer if they fit, else the overflow
+    // array. Space left by elements set again or removed is reclaimed by
+    // compacting the buffers once it is half of what they hold.
+    enum InformationElementSource {
+      IEAbsent,
+      IEReceived,
+      IEInline,
+      IEOverflow
+    };
+    struct InformationElement {
+      PINDEX offset;
+      PINDEX length;
+      BYTE   source;
+    };
+    enum { InlineIESize = 64 };
+
+    void ClearIEs();
+    const BYTE * GetIEPointer(const InformationElement & element) const;
+    const InformationElement * FindIE(unsigned ie) const;
+    InformationElement & AddIE(unsigned ie);
+    void StoreIE(InformationElement & element, const BYTE * data, PINDEX length);
+    void ReleaseIE(InformationElement & element);
+    void CompactIEs();
+
+    WORD               ieIndex[256];  // Position in informationElements plus one, 0 if never set
+    std::vector<InformationElement> informationElements;
+    PBYTEArray         receivedData;
+    BYTE               inlineData[InlineIESize];
+    PINDEX             inlineUsed;
+    PBYTEArray         overflowData;
+    PINDEX             overflowUsed;
+    PINDEX             storageWasted; // Bytes of inline and overflow no longer used
 };
 
 
@@ -41,9 +41,12 @@
 #include <ptlib/sockets.h>
 
 #include "ptlib_extras.h"
+#include <deque>
+#include <map>
 
 class RTP_JitterBuffer;
 class PHandleAggregator;
+class H323EndPoint;
 
 #ifdef P_STUN
 class PNatMethod;
@@ -1076,6 +1079,16 @@ class RTP_UDP : public RTP_Session
 #endif
       RTP_QOS * rtpqos = NULL           ///<  QOS spec (or NULL if no QoS)
     );
+
+    /**Open the RTP session on a socket pair that is already bound and
+       configured, as taken from an RTP_UDPSocketPool. The session takes
+       ownership of the sockets.
+      */
+    PBoolean Open(
+      PIPSocket::Address localAddress,  ///<  Local interface bound to
+      PUDPSocket * dataSocket,          ///<  Bound RTP socket
+      PUDPSocket * controlSocket        ///<  Bound RTCP socket, on the next port
+    );
   //@}
 
    /**Reopens an existing session in the given direction.
@@ -1184,6 +1197,106 @@ class RTP_UDP : public RTP_Session
     unsigned successiveWrongAddresses;
 
     PBoolean mediaIsTunneled;
+
+    void OnOpened();
+};
+
+
+/**This class keeps RTP/RTCP socket pairs bound, with the Type of Service and
+   buffer sizes applied, for each local interface media has been opened on.
+   Opening an RTP_UDP session takes a pair from here instead of binding two
+   sockets while the call is being answered, the pool is topped up again by
+   a low priority thread.
+
+   The port pairs come from the endpoint RTP port range and stay reserved
+   there, whoever takes a pair releases the port with the endpoint when done.
+ */
+class RTP_UDPSocketPool : public PObject
+{
+  PCLASSINFO(RTP_UDPSocketPool, PObject);
+
+  public:
+  /**@name Construction */
+  //@{
+    /**Create a pool for the endpoint, initially holding size pairs for
+       each interface.
+      */
+    RTP_UDPSocketPool(
+      H323EndPoint & endpoint,  ///<  Endpoint owning the RTP port range
+      PINDEX size = 4           ///<  Pairs kept open per interface
+    );
+
+    /// Destroy the pool, closing all pairs not taken
+    ~RTP_UDPSocketPool();
+  //@}
+
+  /**@name Operations */
+  //@{
+    /**Take a bound pair for the interface. Returns FALSE if there is none
+       ready, in which case the caller should bind its own. Either way the
+       pool for the interface is topped up in the background.
+      */
+    PBoolean Take(
+      const PIPSocket::Address & iface,   ///<  Local interface to bind to
+      BYTE ipTypeOfService,               ///<  Type of Service byte
+      PUDPSocket * & dataSocket,          ///<  Bound RTP socket
+      PUDPSocket * & controlSocket        ///<  Bound RTCP socket
+    );
+
+    /**Close all pairs not yet taken and release their ports, for example
+       after the port range has changed.
+      */
+    void Clear();
+
+    /**Stop the refill thread and close all pairs.
+      */
+    void Shutdown();
+  //@}
+
+  /**@name Member variable access */
+  //@{
+    /**Set the number of pairs kept open for each interface, zero disables
+       the pool.
+      */
+    void SetSize(PINDEX size);
+
+    /**Get the number of pairs kept open for each interface.
+      */
+    PINDEX GetSize() const { return size; }
+  //@}
+
+  protected:
+    struct Pair {
+      PUDPSocket * data;
+      PUDPSocket * control;
+      WORD         port;
+      BYTE         tos;
+    };
+
+    struct Interface {
+      PIPSocket::Address address;
+      std::deque<Pair>   pairs;
+    };
+
+    /**Bind a pair on the interface, called from the refill thread.
+      */
+    virtual PBoolean OpenPair(
+      const PIPSocket::Address & iface,
+      Pair & pair
+    );
+
+    void ClosePair(const PIPSocket::Address & iface, Pair & pair);
+
+    PDECLARE_NOTIFIER(PThread, RTP_UDPSocketPool, RefillMain);
+
+    H323EndPoint & endpoint;
+    PINDEX         size;
+
+    PMutex                            mutex;
+    std::map<PString, Interface>      interfaces;
+    PThread                         * refillThread;
+    PSyncPoint                        refill;
+    PBoolean                          shutdown;
 };
 
 
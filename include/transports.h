@@ -40,6 +40,7 @@
 
 #include <ptlib/sockets.h>
 #include "ptlib_extras.h"
+#include <vector>
 
 #ifdef H323_TLS
 #include <ptclib/pssl.h>
@@ -553,6 +554,22 @@ class H323Transport : public PIndirectChannel
       const PBYTEArray & pdu  ///<  PDU to write
     ) = 0;
 
+    /**Begin a batch of protocol data unit writes.
+       While a batch is active WritePDU() may hold PDUs back so that they can
+       be sent to the network together when the outermost EndWriteBatch() is
+       called. Batches may be nested.
+
+       The default behaviour does nothing.
+      */
+    virtual void BeginWriteBatch();
+
+    /**End a batch of protocol data unit writes.
+       Any PDUs held back since the matching BeginWriteBatch() are written.
+
+       The default behaviour does nothing and returns TRUE.
+      */
+    virtual PBoolean EndWriteBatch();
+
     /**Write a protocol data unit from the transport.
        This will write using the transports mechanism for PDU boundaries, for
        example UDP is a single Write() call, while for TCP there is a TPKT
@@ -874,6 +891,33 @@ class H323ListenerTLS : public H323ListenerTCP
 
 #endif // H323_TLS
 
+/////////////////////////////////////////////////////////////////////////////////
+
+/**Hold back the PDUs written to a transport until End() is called, or this
+   object is destroyed, and send them together. A NULL transport is ignored.
+   Call End() to find out if the write succeeded.
+ */
+class H323TransportWriteBatch
+{
+  public:
+    H323TransportWriteBatch(H323Transport * trans)
+      : transport(trans) { if (transport != NULL) transport->BeginWriteBatch(); }
+    ~H323TransportWriteBatch() { End(); }
+
+    /**Send the PDUs held back, returns FALSE if the write failed.
+      */
+    PBoolean End()
+    {
+      H323Transport * trans = transport;
+      transport = NULL;
+      return trans == NULL || trans->EndWriteBatch();
+    }
+
+  protected:
+    H323Transport * transport;
+};
+
+
 /////////////////////////////////////////////////////////////////////////////////
 
 /**This class represents a particular H323 transport using TCP/IP.
@@ -952,6 +996,17 @@ class H323TransportTCP : public H323TransportIP
       const PBYTEArray & pdu  ///<  PDU to write
     );
 
+    /**Begin a batch of protocol data unit writes.
+       PDUs written during the batch are queued, then copied into one
+       buffer and sent with a single write when the batch ends.
+      */
+    virtual void BeginWriteBatch();
+
+    /**End a batch of protocol data unit writes.
+       Flushes the queued PDUs when the outermost batch is ended.
+      */
+    virtual PBoolean EndWriteBatch();
+
     /**Begin the opening of a control channel.
        This sets up the channel so that the remote endpoint can connect back
        to this endpoint.
@@ -1012,8 +1067,25 @@ class H323TransportTCP : public H323TransportIP
      */
     virtual PBoolean OnOpen();
 
+    /**Copy the PDUs, each with its TPKT header, into one buffer and write
+       it to the socket with a single call. The writeMutex must be held by
+       the caller.
+      */
+    PBoolean WriteCoalescedTPKTs(
+      const PBYTEArray * pdus,  ///<  PDUs to write
+      PINDEX count              ///<  Number of PDUs
+    );
 
     PTCPSocket * h245listener;
+    WORD         rangePort;    ///< Port taken from the endpoint TCP range
+
+    PMutex                  writeMutex;
+    unsigned                writeBatchDepth;
+    std::vector<PBYTEArray> writeQueue;
+
+    PBYTEArray readBuffer;
+    PINDEX     readBufferStart;
+    PINDEX     readBufferEnd;
 };
 
 
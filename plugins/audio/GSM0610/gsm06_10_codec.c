@@ -180,6 +180,72 @@ static int codec_decoder(const struct PluginCodec_Definition * codec,
   return 1;
 }
 
+// Batch functions code all the frames of an RTP packet in one call
+
+static int codec_encoder_batch(const struct PluginCodec_Definition * codec, 
+                                                      void * _context,
+                                 struct PluginCodec_FrameBatch * batch)
+{
+  struct gsm_state * context = (struct gsm_state *)_context;
+  unsigned i;
+
+  if (batch->fromStride < SAMPLES_PER_FRAME * 2 || batch->toStride < BYTES_PER_FRAME)
+    return 0;
+
+  for (i = 0; i < batch->count; i++) {
+    gsm_encode(context, (gsm_signal *)((const char *)batch->from + i * batch->fromStride),
+                        (gsm_byte *)((char *)batch->to + i * batch->toStride));
+    batch->toLens[i] = BYTES_PER_FRAME;
+  }
+
+  return batch->count;
+}
+
+static int codec_decoder_batch(const struct PluginCodec_Definition * codec, 
+                                                      void * _context,
+                                 struct PluginCodec_FrameBatch * batch)
+{
+  gsm context = (gsm)_context;
+  unsigned i;
+
+  if (batch->fromStride < BYTES_PER_FRAME || batch->toStride < SAMPLES_PER_FRAME * 2)
+    return 0;
+
+  {
+    int opt = 0;
+    gsm_option(context, GSM_OPT_WAV49, &opt);
+  }
+
+  for (i = 0; i < batch->count; i++) {
+    gsm_decode(context, (gsm_byte *)((const char *)batch->from + i * batch->fromStride),
+                        (gsm_signal *)((char *)batch->to + i * batch->toStride));
+    batch->toLens[i] = SAMPLES_PER_FRAME * 2;
+  }
+
+  return batch->count;
+}
+
+static int get_batch_function(const struct PluginCodec_Definition * codec, 
+                                                 void * context, 
+                                           const char * key, 
+                                                 void * parm, 
+                                             unsigned * parmLen)
+{
+  if (parmLen == NULL || parm == NULL || *parmLen != sizeof(PluginCodec_BatchFunction))
+    return 0;
+
+  if (codec->codecFunction == codec_encoder)
+    *(PluginCodec_BatchFunction *)parm = codec_encoder_batch;
+  else
+    *(PluginCodec_BatchFunction *)parm = codec_decoder_batch;
+  return 1;
+}
+
+static struct PluginCodec_ControlDefn gsmCoderControls[] = {
+  { PLUGINCODEC_CONTROL_GET_BATCH_FUNCTION, get_batch_function },
+  { NULL }
+};
+
 /////////////////////////////////////////////////////////////////////////////
 
 static int codec_msgsm_encoder(const struct PluginCodec_Definition * codec, 
@@ -386,7 +452,7 @@ static struct PluginCodec_Definition gsmCodecDefn[4] =
     create_codec,                       // create codec function
     destroy_codec,                      // destroy codec
     codec_encoder,                      // encode/decode
-    NULL,                               // codec controls
+    gsmCoderControls,                   // codec controls
 
     PluginCodec_H323AudioCodec_gsmFullRate,  // h323CapabilityType 
     &gsmCaps                             // h323CapabilityData
@@ -421,7 +487,7 @@ static struct PluginCodec_Definition gsmCodecDefn[4] =
     create_codec,                       // create codec function
     destroy_codec,                      // destroy codec
     codec_decoder,                      // encode/decode
-    NULL,                               // codec controls
+    gsmCoderControls,                   // codec controls
 
     PluginCodec_H323AudioCodec_gsmFullRate,  // h323CapabilityType 
     &gsmCaps                             // h323CapabilityData
@@ -532,6 +532,11 @@ debug_write_data(decoderInput, "decoder input", "decoder.input", srcRTP.GetPacke
       now = (now + 1) & 0xff;
 
       int frameBytes = (frameWidth * frameHeight * 12) / 8;
+      if (dstRTP.GetPayloadSize() < sizeof(PluginCodec_Video_FrameHeader) + frameBytes) {
+        videoDecoder->resetndblk();
+        flags = PluginCodec_ReturnCoderBufferTooSmall | PluginCodec_ReturnCoderRequestIFrame;
+        return 1;
+      }
       dstRTP.SetPayloadSize(sizeof(PluginCodec_Video_FrameHeader) + frameBytes);
       dstRTP.SetPayloadType(RTP_DYNAMIC_PAYLOAD);
       dstRTP.SetMarker(true);
@@ -88,6 +88,24 @@
 #include "bsd-endian.h"
 #include "dct.h"
 
+/*
+ * fdct() and the H.261 rdct() have SSE2 versions wherever SSE2 is part
+ * of the base instruction set (all x86-64 targets), and AVX2 versions
+ * selected at startup when the cpu supports them.
+ */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#if defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#define DCT_SIMD 1
+#define DCT_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && _MSC_VER >= 1700
+#define DCT_SIMD 1
+#define DCT_TARGET_AVX2
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+#endif
+
 /*
  * Macros for fix-point (integer) arithmetic.  FP_NBITS gives the number
  * of binary digits past the decimal point.  FP_MUL computes the product
@@ -915,11 +933,11 @@ rdct(register short *bp, u_int m0, u_int m1, u_char* p,
  * This routine does not take a quantization table, since the H.261
  * inverse quantizer is easily implemented via table lookup in the decoder.
  */
-void
+static void
 #ifdef INT_64
-rdct(register short *bp, INT_64 m0, u_char* p, int stride, const u_char* in)
+rdct_c(register short *bp, INT_64 m0, u_char* p, int stride, const u_char* in)
 #else
-rdct(register short *bp, u_int m0, u_int m1, u_char* p, int stride, const u_char *in)
+rdct_c(register short *bp, u_int m0, u_int m1, u_char* p, int stride, const u_char *in)
 #endif
 {
 	int tmp[64];
@@ -1122,7 +1140,7 @@ rdct(register short *bp, u_int m0, u_int m1, u_char* p, int stride, const u_char
  
 #define FWD_DandQ(v, iq) short((v) * qt[iq])
 
-void fdct(const u_char* in, int stride, short* out, const float* qt)
+static void fdct_c(const u_char* in, int stride, short* out, const float* qt)
 {
 	float tmp[64];
 	float* tp = tmp;
@@ -1222,6 +1240,433 @@ void fdct(const u_char* in, int stride, short* out, const float* qt)
 	}
 }
 
+#ifdef DCT_SIMD
+
+/*
+ * SSE2/AVX2 versions of fdct() and the H.261 rdct().  Each 1D pass
+ * transforms all eight rows (or columns) at once, one per vector lane,
+ * using exactly the same sequence of operations as the scalar code so
+ * the results are bit for bit identical.  The zero-skipping shortcuts
+ * of the scalar rdct are not needed since a zero term contributes
+ * nothing to the full butterfly.
+ */
+
+#define FDCT_1D(ADD, SUB, MUL, T, i0, i1, i2, i3, i4, i5, i6, i7, \
+		o0, o1, o2, o3, o4, o5, o6, o7) { \
+	T t0 = ADD(i0, i7), t7 = SUB(i0, i7); \
+	T t1 = ADD(i1, i6), t6 = SUB(i1, i6); \
+	T t2 = ADD(i2, i5), t5 = SUB(i2, i5); \
+	T t3 = ADD(i3, i4), t4 = SUB(i3, i4); \
+	T x0 = ADD(t0, t3), x2 = ADD(t1, t2); \
+	o0 = ADD(x0, x2); \
+	o4 = SUB(x0, x2); \
+	T x1 = SUB(t0, t3), x3 = SUB(t1, t2); \
+	t0 = MUL(ADD(x1, x3), FA1); \
+	o2 = ADD(x1, t0); \
+	o6 = SUB(x1, t0); \
+	x0 = ADD(t4, t5); \
+	x1 = ADD(t5, t6); \
+	x2 = ADD(t6, t7); \
+	t3 = MUL(x1, FA1); \
+	t4 = SUB(t7, t3); \
+	t0 = MUL(SUB(x0, x2), FA5); \
+	t1 = ADD(MUL(x0, FA2), t0); \
+	o3 = SUB(t4, t1); \
+	o5 = ADD(t4, t1); \
+	t7 = ADD(t7, t3); \
+	t2 = ADD(MUL(x2, FA4), t0); \
+	o1 = ADD(t7, t2); \
+	o7 = SUB(t7, t2); \
+}
+
+#define RDCT_1D(ADD, SUB, FPMUL, T, i0, i1, i2, i3, i4, i5, i6, i7, \
+		o0, o1, o2, o3, o4, o5, o6, o7) { \
+	T t4 = i1, t5 = i3, t6 = i5, t7 = i7; \
+	T x0 = SUB(t6, t5); \
+	t6 = ADD(t6, t5); \
+	T x1 = SUB(t4, t7); \
+	t7 = ADD(t7, t4); \
+	t5 = FPMUL(SUB(t7, t6), A3); \
+	t7 = ADD(t7, t6); \
+	t4 = FPMUL(ADD(x1, x0), A5); \
+	t6 = SUB(FPMUL(x1, A4), t4); \
+	t4 = ADD(t4, FPMUL(x0, A2)); \
+	t7 = ADD(t7, t6); \
+	t6 = ADD(t6, t5); \
+	t5 = ADD(t5, t4); \
+	T t0 = i0, t1 = i2, t2 = i4, t3 = i6; \
+	x0 = FPMUL(SUB(t1, t3), A1); \
+	t3 = ADD(t3, t1); \
+	t1 = SUB(t0, t2); \
+	t0 = ADD(t0, t2); \
+	t2 = ADD(t3, x0); \
+	t3 = SUB(t0, t2); \
+	t0 = ADD(t0, t2); \
+	t2 = SUB(t1, x0); \
+	t1 = ADD(t1, x0); \
+	o0 = ADD(t0, t7); \
+	o1 = ADD(t1, t6); \
+	o2 = ADD(t2, t5); \
+	o3 = ADD(t3, t4); \
+	o4 = SUB(t3, t4); \
+	o5 = SUB(t2, t5); \
+	o6 = SUB(t1, t6); \
+	o7 = SUB(t0, t7); \
+}
+
+/* cross_stage transposed, so the column vectors can be scaled directly */
+static int cross_stage_t[64];
+
+static inline void transpose8x8_epi16(__m128i* r)
+{
+	__m128i a0 = _mm_unpacklo_epi16(r[0], r[1]);
+	__m128i a1 = _mm_unpackhi_epi16(r[0], r[1]);
+	__m128i a2 = _mm_unpacklo_epi16(r[2], r[3]);
+	__m128i a3 = _mm_unpackhi_epi16(r[2], r[3]);
+	__m128i a4 = _mm_unpacklo_epi16(r[4], r[5]);
+	__m128i a5 = _mm_unpackhi_epi16(r[4], r[5]);
+	__m128i a6 = _mm_unpacklo_epi16(r[6], r[7]);
+	__m128i a7 = _mm_unpackhi_epi16(r[6], r[7]);
+	__m128i b0 = _mm_unpacklo_epi32(a0, a2);
+	__m128i b1 = _mm_unpackhi_epi32(a0, a2);
+	__m128i b2 = _mm_unpacklo_epi32(a1, a3);
+	__m128i b3 = _mm_unpackhi_epi32(a1, a3);
+	__m128i b4 = _mm_unpacklo_epi32(a4, a6);
+	__m128i b5 = _mm_unpackhi_epi32(a4, a6);
+	__m128i b6 = _mm_unpacklo_epi32(a5, a7);
+	__m128i b7 = _mm_unpackhi_epi32(a5, a7);
+	r[0] = _mm_unpacklo_epi64(b0, b4);
+	r[1] = _mm_unpackhi_epi64(b0, b4);
+	r[2] = _mm_unpacklo_epi64(b1, b5);
+	r[3] = _mm_unpackhi_epi64(b1, b5);
+	r[4] = _mm_unpacklo_epi64(b2, b6);
+	r[5] = _mm_unpackhi_epi64(b2, b6);
+	r[6] = _mm_unpacklo_epi64(b3, b7);
+	r[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+/*
+ * Load the eight rows of coefficients, zeroing any that are not
+ * flagged in the mask, and transpose so r[k] holds column k.
+ */
+static inline void rdct_load(const short* bp, u_int m0, u_int m1, __m128i* r)
+{
+	const __m128i bit = _mm_setr_epi16(1, 2, 4, 8, 16, 32, 64, 128);
+	for (int i = 0; i < 8; ++i) {
+		int m = (i < 4 ? m0 >> (8 * i) : m1 >> (8 * (i - 4))) & 0xff;
+		__m128i sel = _mm_and_si128(_mm_set1_epi16((short)m), bit);
+		r[i] = _mm_and_si128(_mm_loadu_si128((const __m128i*)(bp + 8 * i)),
+				     _mm_cmpeq_epi16(sel, bit));
+	}
+	transpose8x8_epi16(r);
+}
+
+/*
+ * Round, add the prediction (if any), clamp to 0..255 and store a row.
+ */
+static inline void rdct_store(__m128i lo, __m128i hi, u_char* p, const u_char* in)
+{
+	__m128i v = _mm_packs_epi32(lo, hi);
+	if (in != 0)
+		v = _mm_adds_epi16(v, _mm_unpacklo_epi8(
+			_mm_loadl_epi64((const __m128i*)in), _mm_setzero_si128()));
+	_mm_storel_epi64((__m128i*)p, _mm_packus_epi16(v, v));
+}
+
+/*
+ * Scale by qt, truncate and wrap to 16 bits the way short(float) does.
+ */
+static inline __m128i fdct_quant(__m128 v, const float* qt)
+{
+	__m128i q = _mm_cvttps_epi32(_mm_mul_ps(v, _mm_loadu_ps(qt)));
+	return _mm_srai_epi32(_mm_slli_epi32(q, 16), 16);
+}
+
+static inline void transpose8x8_ps(__m128 m[8][2])
+{
+	__m128 a0 = m[0][0], a1 = m[1][0], a2 = m[2][0], a3 = m[3][0];
+	__m128 b0 = m[0][1], b1 = m[1][1], b2 = m[2][1], b3 = m[3][1];
+	__m128 c0 = m[4][0], c1 = m[5][0], c2 = m[6][0], c3 = m[7][0];
+	__m128 d0 = m[4][1], d1 = m[5][1], d2 = m[6][1], d3 = m[7][1];
+	_MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+	_MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+	_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+	_MM_TRANSPOSE4_PS(d0, d1, d2, d3);
+	m[0][0] = a0; m[1][0] = a1; m[2][0] = a2; m[3][0] = a3;
+	m[4][0] = b0; m[5][0] = b1; m[6][0] = b2; m[7][0] = b3;
+	m[0][1] = c0; m[1][1] = c1; m[2][1] = c2; m[3][1] = c3;
+	m[4][1] = d0; m[5][1] = d1; m[6][1] = d2; m[7][1] = d3;
+}
+
+/* SSE2 has no 32 bit low multiply, build it from two 32x32->64 ones */
+static inline __m128i mullo_epi32_sse2(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+				  _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+#define SSE_MULPS(a, k) _mm_mul_ps(a, _mm_set1_ps(k))
+#define SSE_FPMUL(a, k) _mm_srai_epi32(mullo_epi32_sse2(_mm_srai_epi32(a, 5), \
+					_mm_set1_epi32((k) >> 5)), FP_NBITS - 10)
+
+static void fdct_sse2(const u_char* in, int stride, short* out, const float* qt)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i r[8];
+	int i;
+	for (i = 0; i < 8; ++i)
+		r[i] = _mm_unpacklo_epi8(
+			_mm_loadl_epi64((const __m128i*)(in + i * stride)), zero);
+	transpose8x8_epi16(r);
+
+	__m128 c[8][2], m[8][2];
+	for (i = 0; i < 8; ++i) {
+		c[i][0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(r[i], zero));
+		c[i][1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(r[i], zero));
+	}
+	for (i = 0; i < 2; ++i)
+		FDCT_1D(_mm_add_ps, _mm_sub_ps, SSE_MULPS, __m128,
+			c[0][i], c[1][i], c[2][i], c[3][i],
+			c[4][i], c[5][i], c[6][i], c[7][i],
+			m[0][i], m[1][i], m[2][i], m[3][i],
+			m[4][i], m[5][i], m[6][i], m[7][i])
+	transpose8x8_ps(m);
+	for (i = 0; i < 2; ++i)
+		FDCT_1D(_mm_add_ps, _mm_sub_ps, SSE_MULPS, __m128,
+			m[0][i], m[1][i], m[2][i], m[3][i],
+			m[4][i], m[5][i], m[6][i], m[7][i],
+			c[0][i], c[1][i], c[2][i], c[3][i],
+			c[4][i], c[5][i], c[6][i], c[7][i])
+	transpose8x8_ps(c);
+	for (i = 0; i < 8; ++i)
+		_mm_storeu_si128((__m128i*)(out + 8 * i),
+			_mm_packs_epi32(fdct_quant(c[i][0], qt + 8 * i),
+					fdct_quant(c[i][1], qt + 8 * i + 4)));
+}
+
+static void rdct_sse2(short* bp, u_int m0, u_int m1, u_char* p, int stride, const u_char* in)
+{
+	__m128i r[8];
+	rdct_load(bp, m0, m1, r);
+
+	/* the integer vectors are transposed as floats, it is only a shuffle */
+	__m128 c[8][2], m[8][2];
+	int i;
+	for (i = 0; i < 8; ++i) {
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(r[i], r[i]), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(r[i], r[i]), 16);
+		const __m128i* qt = (const __m128i*)(cross_stage_t + 8 * i);
+		c[i][0] = _mm_castsi128_ps(mullo_epi32_sse2(lo, _mm_loadu_si128(qt)));
+		c[i][1] = _mm_castsi128_ps(mullo_epi32_sse2(hi, _mm_loadu_si128(qt + 1)));
+	}
+	for (i = 0; i < 2; ++i) {
+		__m128i o0, o1, o2, o3, o4, o5, o6, o7;
+		RDCT_1D(_mm_add_epi32, _mm_sub_epi32, SSE_FPMUL, __m128i,
+			_mm_castps_si128(c[0][i]), _mm_castps_si128(c[1][i]),
+			_mm_castps_si128(c[2][i]), _mm_castps_si128(c[3][i]),
+			_mm_castps_si128(c[4][i]), _mm_castps_si128(c[5][i]),
+			_mm_castps_si128(c[6][i]), _mm_castps_si128(c[7][i]),
+			o0, o1, o2, o3, o4, o5, o6, o7)
+		m[0][i] = _mm_castsi128_ps(o0); m[1][i] = _mm_castsi128_ps(o1);
+		m[2][i] = _mm_castsi128_ps(o2); m[3][i] = _mm_castsi128_ps(o3);
+		m[4][i] = _mm_castsi128_ps(o4); m[5][i] = _mm_castsi128_ps(o5);
+		m[6][i] = _mm_castsi128_ps(o6); m[7][i] = _mm_castsi128_ps(o7);
+	}
+	transpose8x8_ps(m);
+	for (i = 0; i < 2; ++i) {
+		__m128i o0, o1, o2, o3, o4, o5, o6, o7;
+		RDCT_1D(_mm_add_epi32, _mm_sub_epi32, SSE_FPMUL, __m128i,
+			_mm_castps_si128(m[0][i]), _mm_castps_si128(m[1][i]),
+			_mm_castps_si128(m[2][i]), _mm_castps_si128(m[3][i]),
+			_mm_castps_si128(m[4][i]), _mm_castps_si128(m[5][i]),
+			_mm_castps_si128(m[6][i]), _mm_castps_si128(m[7][i]),
+			o0, o1, o2, o3, o4, o5, o6, o7)
+		c[0][i] = _mm_castsi128_ps(o0); c[1][i] = _mm_castsi128_ps(o1);
+		c[2][i] = _mm_castsi128_ps(o2); c[3][i] = _mm_castsi128_ps(o3);
+		c[4][i] = _mm_castsi128_ps(o4); c[5][i] = _mm_castsi128_ps(o5);
+		c[6][i] = _mm_castsi128_ps(o6); c[7][i] = _mm_castsi128_ps(o7);
+	}
+	transpose8x8_ps(c);
+
+	const __m128i round = _mm_set1_epi32(1 << (FP_NBITS - 1));
+	for (i = 0; i < 8; ++i) {
+		__m128i lo = _mm_srai_epi32(_mm_add_epi32(_mm_castps_si128(c[i][0]), round), FP_NBITS);
+		__m128i hi = _mm_srai_epi32(_mm_add_epi32(_mm_castps_si128(c[i][1]), round), FP_NBITS);
+		rdct_store(lo, hi, p, in);
+		p += stride;
+		if (in != 0)
+			in += stride;
+	}
+}
+
+DCT_TARGET_AVX2
+static inline void transpose8x8_ps256(__m256* m)
+{
+	__m256 t0 = _mm256_unpacklo_ps(m[0], m[1]);
+	__m256 t1 = _mm256_unpackhi_ps(m[0], m[1]);
+	__m256 t2 = _mm256_unpacklo_ps(m[2], m[3]);
+	__m256 t3 = _mm256_unpackhi_ps(m[2], m[3]);
+	__m256 t4 = _mm256_unpacklo_ps(m[4], m[5]);
+	__m256 t5 = _mm256_unpackhi_ps(m[4], m[5]);
+	__m256 t6 = _mm256_unpacklo_ps(m[6], m[7]);
+	__m256 t7 = _mm256_unpackhi_ps(m[6], m[7]);
+	__m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+	__m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+	__m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+	__m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+	__m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+	__m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+	__m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+	__m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+	m[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+	m[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+	m[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+	m[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+	m[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+	m[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+	m[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+	m[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+
+#define AVX_MULPS(a, k) _mm256_mul_ps(a, _mm256_set1_ps(k))
+#define AVX_FPMUL(a, k) _mm256_srai_epi32(_mm256_mullo_epi32(_mm256_srai_epi32(a, 5), \
+					_mm256_set1_epi32((k) >> 5)), FP_NBITS - 10)
+#define AVX_ADDI(a, b) _mm256_castsi256_ps(_mm256_add_epi32(_mm256_castps_si256(a), _mm256_castps_si256(b)))
+#define AVX_SUBI(a, b) _mm256_castsi256_ps(_mm256_sub_epi32(_mm256_castps_si256(a), _mm256_castps_si256(b)))
+#define AVX_FPMULI(a, k) _mm256_castsi256_ps(AVX_FPMUL(_mm256_castps_si256(a), k))
+
+DCT_TARGET_AVX2
+static void fdct_avx2(const u_char* in, int stride, short* out, const float* qt)
+{
+	__m128i r[8];
+	int i;
+	for (i = 0; i < 8; ++i)
+		r[i] = _mm_unpacklo_epi8(
+			_mm_loadl_epi64((const __m128i*)(in + i * stride)), _mm_setzero_si128());
+	transpose8x8_epi16(r);
+
+	__m256 c[8], m[8];
+	for (i = 0; i < 8; ++i)
+		c[i] = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(r[i]));
+	FDCT_1D(_mm256_add_ps, _mm256_sub_ps, AVX_MULPS, __m256,
+		c[0], c[1], c[2], c[3], c[4], c[5], c[6], c[7],
+		m[0], m[1], m[2], m[3], m[4], m[5], m[6], m[7])
+	transpose8x8_ps256(m);
+	FDCT_1D(_mm256_add_ps, _mm256_sub_ps, AVX_MULPS, __m256,
+		m[0], m[1], m[2], m[3], m[4], m[5], m[6], m[7],
+		c[0], c[1], c[2], c[3], c[4], c[5], c[6], c[7])
+	transpose8x8_ps256(c);
+	for (i = 0; i < 8; ++i) {
+		__m256i q = _mm256_cvttps_epi32(_mm256_mul_ps(c[i], _mm256_loadu_ps(qt + 8 * i)));
+		q = _mm256_srai_epi32(_mm256_slli_epi32(q, 16), 16);
+		_mm_storeu_si128((__m128i*)(out + 8 * i),
+			_mm_packs_epi32(_mm256_castsi256_si128(q),
+					_mm256_extracti128_si256(q, 1)));
+	}
+}
+
+DCT_TARGET_AVX2
+static void rdct_avx2(short* bp, u_int m0, u_int m1, u_char* p, int stride, const u_char* in)
+{
+	__m128i r[8];
+	rdct_load(bp, m0, m1, r);
+
+	__m256 c[8], m[8];
+	int i;
+	for (i = 0; i < 8; ++i)
+		c[i] = _mm256_castsi256_ps(_mm256_mullo_epi32(_mm256_cvtepi16_epi32(r[i]),
+			_mm256_loadu_si256((const __m256i*)(cross_stage_t + 8 * i))));
+	RDCT_1D(AVX_ADDI, AVX_SUBI, AVX_FPMULI, __m256,
+		c[0], c[1], c[2], c[3], c[4], c[5], c[6], c[7],
+		m[0], m[1], m[2], m[3], m[4], m[5], m[6], m[7])
+	transpose8x8_ps256(m);
+	RDCT_1D(AVX_ADDI, AVX_SUBI, AVX_FPMULI, __m256,
+		m[0], m[1], m[2], m[3], m[4], m[5], m[6], m[7],
+		c[0], c[1], c[2], c[3], c[4], c[5], c[6], c[7])
+	transpose8x8_ps256(c);
+
+	const __m256i round = _mm256_set1_epi32(1 << (FP_NBITS - 1));
+	for (i = 0; i < 8; ++i) {
+		__m256i v = _mm256_srai_epi32(_mm256_add_epi32(_mm256_castps_si256(c[i]), round), FP_NBITS);
+		rdct_store(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1), p, in);
+		p += stride;
+		if (in != 0)
+			in += stride;
+	}
+}
+
+static bool dct_cpu_avx2()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+	__cpuid(info, 1);
+	/* OSXSAVE and AVX, and the OS must save the ymm state */
+	if ((info[2] & 0x18000000) != 0x18000000 || (_xgetbv(0) & 6) != 6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & 0x20) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+#endif /* DCT_SIMD */
+
+#ifndef INT_64
+#define rdct_c32 rdct_c
+#else
+static void rdct_c32(short* bp, u_int m0, u_int m1, u_char* p, int stride, const u_char* in)
+{
+	rdct_c(bp, (INT_64)m0 | ((INT_64)m1 << 32), p, stride, in);
+}
+#endif
+
+/*
+ * Pick the fastest fdct/rdct the cpu supports, once at startup.
+ */
+static struct DCTKernels {
+	void (*fdct)(const u_char* in, int stride, short* out, const float* qt);
+	void (*rdct)(short* bp, u_int m0, u_int m1, u_char* p, int stride, const u_char* in);
+
+	DCTKernels() : fdct(fdct_c), rdct(rdct_c32) {
+#ifdef DCT_SIMD
+		for (int i = 0; i < 64; ++i)
+			cross_stage_t[i] = cross_stage[8 * (i & 7) + (i >> 3)];
+		if (dct_cpu_avx2()) {
+			fdct = fdct_avx2;
+			rdct = rdct_avx2;
+		} else {
+			fdct = fdct_sse2;
+			rdct = rdct_sse2;
+		}
+#endif
+	}
+} dctKernels;
+
+void fdct(const u_char* in, int stride, short* out, const float* qt)
+{
+	dctKernels.fdct(in, stride, out, qt);
+}
+
+void
+#ifdef INT_64
+rdct(short* bp, INT_64 m0, u_char* p, int stride, const u_char* in)
+{
+	dctKernels.rdct(bp, u_int(m0), u_int(m0 >> 32), p, stride, in);
+}
+#else
+rdct(short* bp, u_int m0, u_int m1, u_char* p, int stride, const u_char* in)
+{
+	dctKernels.rdct(bp, m0, m1, p, stride, in);
+}
+#endif
+
 /*
  * decimate the *rows* of the two input 8x8 DCT matrices into
  * a single output matrix.  we decimate rows rather than
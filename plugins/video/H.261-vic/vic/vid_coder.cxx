@@ -140,6 +140,41 @@ void Pre_Vid_Coder::allocref()
  */
 #define ABS(v) if (v < 0) v = -v;
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+
+/*
+ * Signed sums of the differences over one 16 pixel line of a block,
+ * split into the left 4, centre 8 and right 4 pixels.
+ */
+static inline void diffline_sse2(const u_char* in, const u_char* frm, int* sum)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi16(1);
+	__m128i a = _mm_loadu_si128((const __m128i*)in);
+	__m128i b = _mm_loadu_si128((const __m128i*)frm);
+	__m128i lo = _mm_madd_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(a, zero),
+						  _mm_unpacklo_epi8(b, zero)), one);
+	__m128i hi = _mm_madd_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(a, zero),
+						  _mm_unpackhi_epi8(b, zero)), one);
+	__m128 x = _mm_castsi128_ps(lo), y = _mm_castsi128_ps(hi);
+	__m128i s = _mm_add_epi32(
+		_mm_castps_si128(_mm_shuffle_ps(x, y, _MM_SHUFFLE(2, 0, 2, 0))),
+		_mm_castps_si128(_mm_shuffle_ps(x, y, _MM_SHUFFLE(3, 1, 3, 1))));
+	_mm_storeu_si128((__m128i*)sum, s);
+}
+
+#define DIFFLINE(in, frm, left, center, right) { \
+	int _sum[4]; \
+	diffline_sse2(in, frm, _sum); \
+	left += _sum[0]; \
+	center += _sum[1] + _sum[2]; \
+	right += _sum[3]; \
+	ABS(right); \
+	ABS(left); \
+	ABS(center); \
+}
+#else
 #define DIFF4(in, frm, v) \
 	v += (in)[0] - (frm)[0]; \
 	v += (in)[1] - (frm)[1]; \
@@ -154,6 +189,7 @@ void Pre_Vid_Coder::allocref()
 	ABS(right); \
 	ABS(left); \
 	ABS(center);
+#endif
 
 void Pre_Vid_Coder::suppress(const u_char* devbuf)
 {
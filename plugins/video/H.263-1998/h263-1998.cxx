@@ -244,6 +244,9 @@ H263_Base_EncoderContext::H263_Base_EncoderContext(const char * _prefix)
   _frameCount = 0;
   _width = 0;
   _height= 0;
+  _threads = 1;
+  _maxThreads = 1;
+  _sliceStructured = false;
   m_targetBitRate = 0;
 
   if (!FFMPEGLibraryInstance.IsLoaded()){
@@ -428,8 +431,9 @@ void H263_Base_EncoderContext::EnableAnnex (Annex annex)
       break;
     case K:
       // Annex K: 
-      // does not work with eyeBeam
+      // does not work with eyeBeam, only used when encoding with several threads
       //_context->flags |= CODEC_FLAG_H263P_SLICE_STRUCT;  
+      _sliceStructured = true;
       break;
     case J:
       // Annex J: Deblocking Filter
@@ -474,6 +478,7 @@ void H263_Base_EncoderContext::DisableAnnex (Annex annex)
       // Annex K: 
       // does not work with eyeBeam
 //      _context->flags &= ~CODEC_FLAG_H263P_SLICE_STRUCT;  
+      _sliceStructured = false;
       break;
     case J:
       // Annex J: Deblocking Filter
@@ -494,6 +499,37 @@ void H263_Base_EncoderContext::DisableAnnex (Annex annex)
   }
 }
 
+void H263_Base_EncoderContext::SetThreads (unsigned threads)
+{
+  if (threads < 1)
+    threads = 1;
+  if (threads > H263P_MAX_THREADS)
+    threads = H263P_MAX_THREADS;
+  _threads = threads;
+  CODEC_TRACER(tracer, "threads set to " << _threads);
+}
+
+void H263_Base_EncoderContext::LoadInputFrame (PluginCodec_Video_FrameHeader * header)
+{
+  int size = header->width * header->height;
+  int frameSize = (size * 3) >> 1;
+  BYTE * data = OPAL_VIDEO_FRAME_DATA_PTR(header);
+
+  // libavcodec encodes directly from aligned input of whole macroblocks,
+  // anything else goes through the padded frame buffer
+  if ((((size_t)data) & 15) != 0 || (header->width & 15) != 0 || (header->height & 15) != 0) {
+    // we need FF_INPUT_BUFFER_PADDING_SIZE allocated bytes after the YVU420P image for the encoder
+    memset (_inputFrameBuffer, 0 , FF_INPUT_BUFFER_PADDING_SIZE);
+    memcpy (_inputFrameBuffer + FF_INPUT_BUFFER_PADDING_SIZE, data, frameSize);
+    memset (_inputFrameBuffer + FF_INPUT_BUFFER_PADDING_SIZE + frameSize, 0 , FF_INPUT_BUFFER_PADDING_SIZE);
+    data = _inputFrameBuffer + FF_INPUT_BUFFER_PADDING_SIZE;
+  }
+
+  _inputFrame->data[0] = data;
+  _inputFrame->data[1] = _inputFrame->data[0] + size;
+  _inputFrame->data[2] = _inputFrame->data[1] + (size / 4);
+}
+
 #define CODEC_TRACER_FLAG(tracer, flag) \
 CODEC_TRACER(tracer, #flag " is " << ((_context->flags & flag) ? "enabled" : "disabled"));
 
@@ -504,6 +540,28 @@ bool H263_Base_EncoderContext::OpenCodec()
     return false;
   }
 
+  unsigned threads = _threads < _maxThreads ? _threads : _maxThreads;
+  if (threads > (unsigned)_height / 16)
+    threads = _height >= 32 ? _height / 16 : 1;
+#ifdef CODEC_FLAG_H263P_SLICE_STRUCT
+  // libavcodec only splits H.263+ pictures between threads in slice structured mode
+  if (threads > 1 && !_sliceStructured) {
+    CODEC_TRACER(tracer, "Annex K not negotiated - encoding with one thread");
+    threads = 1;
+  }
+  if (threads > 1)
+    _context->flags |= CODEC_FLAG_H263P_SLICE_STRUCT;
+  else
+    _context->flags &= ~CODEC_FLAG_H263P_SLICE_STRUCT;
+#else
+  threads = 1;
+#endif
+#ifdef FF_THREAD_SLICE
+  _context->thread_count = threads;
+  _context->thread_type  = FF_THREAD_SLICE;
+#endif
+  CODEC_TRACER(tracer, "thread_count set to " << threads);
+
   CODEC_TRACER(tracer, "Size is " << _width << "x" << _height);
   CODEC_TRACER(tracer, "rc_max_rate is " <<  _context->rc_max_rate);
   CODEC_TRACER(tracer, "GOP is " << _context->gop_size);
@@ -738,16 +796,7 @@ int H263_RFC2190_EncoderContext::EncodeFrames(const BYTE * src, unsigned & srcLe
 
   ++_frameCount;
 
-  int size = header->width * header->height;
-  int frameSize = (size * 3) >> 1;
- 
-  // we need FF_INPUT_BUFFER_PADDING_SIZE allocated bytes after the YVU420P image for the encoder
-  memcpy (_inputFrameBuffer, OPAL_VIDEO_FRAME_DATA_PTR(header), frameSize);
-  memset (_inputFrameBuffer + frameSize, 0 , FF_INPUT_BUFFER_PADDING_SIZE);
-  _inputFrame->data[0] = _inputFrameBuffer;
-
-  _inputFrame->data[1] = _inputFrame->data[0] + size;
-  _inputFrame->data[2] = _inputFrame->data[1] + (size / 4);
+  LoadInputFrame(header);
 #if LIBAVCODEC_VERSION_MAJOR < 54
   _inputFrame->pict_type = (flags & forceIFrame) ? FF_I_TYPE : 0;
 #else
@@ -831,6 +880,7 @@ H263_RFC2429_EncoderContext::H263_RFC2429_EncoderContext()
  : H263_Base_EncoderContext("RFC2429")
 {
   _txH263PFrame = NULL;
+  _maxThreads = H263P_MAX_THREADS;
 }
 
 H263_RFC2429_EncoderContext::~H263_RFC2429_EncoderContext()
@@ -939,7 +989,7 @@ int H263_RFC2429_EncoderContext::EncodeFrames(const BYTE * src, unsigned & srcLe
 #if HAVE_POSIX_MEMALIGN
     if (posix_memalign((void **)&_inputFrameBuffer, 64, header->width*header->height*3/2 + (FF_INPUT_BUFFER_PADDING_SIZE*2)) != 0) {
 #else
-    if ((_inputFrameBuffer = (BYTE *)malloc(header->width*header->height*3/2 + (FF_INPUT_BUFFER_PADDING_SIZE*2))) != NULL) {
+    if ((_inputFrameBuffer = (BYTE *)malloc(header->width*header->height*3/2 + (FF_INPUT_BUFFER_PADDING_SIZE*2))) == NULL) {
 #endif
       TRACE_AND_LOG(tracer, 1, "Unable to allocate memory for frame buffer");
       return 0;
@@ -950,17 +1000,9 @@ int H263_RFC2429_EncoderContext::EncodeFrames(const BYTE * src, unsigned & srcLe
                        << ",size=" << header->width << "x" << header->height
                        << ",I=" << ((flags && forceIFrame) ? "yes" : "no"));
 
-  int size = header->width * header->height;
-  int frameSize = (size * 3) >> 1;
- 
-  // we need FF_INPUT_BUFFER_PADDING_SIZE allocated bytes after the YVU420P image for the encoder
-  memset (_inputFrameBuffer, 0 , FF_INPUT_BUFFER_PADDING_SIZE);
-  memcpy (_inputFrameBuffer + FF_INPUT_BUFFER_PADDING_SIZE, OPAL_VIDEO_FRAME_DATA_PTR(header), frameSize);
-  memset (_inputFrameBuffer + FF_INPUT_BUFFER_PADDING_SIZE + frameSize, 0 , FF_INPUT_BUFFER_PADDING_SIZE);
+  int frameSize = (header->width * header->height * 3) >> 1;
 
-  _inputFrame->data[0] = _inputFrameBuffer + FF_INPUT_BUFFER_PADDING_SIZE;
-  _inputFrame->data[1] = _inputFrame->data[0] + size;
-  _inputFrame->data[2] = _inputFrame->data[1] + (size / 4);
+  LoadInputFrame(header);
 #if LIBAVCODEC_VERSION_MAJOR < 54
   _inputFrame->pict_type = (flags & forceIFrame) ? FF_I_TYPE : 0;
 #else
@@ -998,6 +1040,7 @@ H263_Base_DecoderContext::H263_Base_DecoderContext(const char * _prefix)
 #endif
 {
   _frameCount = 0;
+  _threads = 1;
   _outputFrame = NULL;
   _context = NULL;
 
@@ -1056,6 +1099,11 @@ bool H263_Base_DecoderContext::OpenCodec()
     return 0;
   }
 
+#ifdef FF_THREAD_FRAME
+  _context->thread_count = _threads;
+  _context->thread_type  = FF_THREAD_FRAME | FF_THREAD_SLICE;
+#endif
+
   if (FFMPEGLibraryInstance.AvcodecOpen(_context, _codec) < 0) {
     TRACE_AND_LOG(tracer, 1, "Failed to open H.263 decoder");
     return false;
@@ -1076,6 +1124,33 @@ void H263_Base_DecoderContext::CloseCodec()
   }
 }
 
+void H263_Base_DecoderContext::SetThreads (unsigned threads)
+{
+  WaitAndSignal m(_mutex);
+
+  if (threads < 1)
+    threads = 1;
+  if (threads > H263P_MAX_THREADS)
+    threads = H263P_MAX_THREADS;
+  if (threads == _threads)
+    return;
+
+  _threads = threads;
+  CloseCodec();
+  if (!OpenCodec())
+    TRACE_AND_LOG(tracer, 1, "Failed to reopen decoder with " << _threads << " threads");
+}
+
+// with frame threading the picture is returned some calls later, that is no error
+bool H263_Base_DecoderContext::IsDelayedPicture(int bytesDecoded)
+{
+#ifdef FF_THREAD_FRAME
+  return bytesDecoded >= 0 && (_context->active_thread_type & FF_THREAD_FRAME) != 0;
+#else
+  return false;
+#endif
+}
+
 ///////////////////////////////////////////////////////////////////////////////////
 
 H263_RFC2429_DecoderContext::H263_RFC2429_DecoderContext()
@@ -1155,6 +1230,12 @@ bool H263_RFC2429_DecoderContext::DecodeFrames(const BYTE * src, unsigned & srcL
 
   _rxH263PFrame->BeginNewFrame();
 
+  if (!gotPicture && IsDelayedPicture(bytesDecoded))
+  {
+    TRACE_AND_LOG(tracer, 4, "Decoded "<< bytesDecoded << " bytes, picture delayed by frame threading"); 
+    return 1;
+  }
+
   if (!gotPicture) 
   {
     TRACE_AND_LOG(tracer, 1, "Decoded "<< bytesDecoded << " bytes without getting a Picture"); 
@@ -1291,6 +1372,12 @@ bool H263_RFC2190_DecoderContext::DecodeFrames(const BYTE * src, unsigned & srcL
 
   depacketizer.NewFrame();
 
+  if (!gotPicture && IsDelayedPicture(bytesDecoded)) {
+    flags = 0;
+    TRACE_AND_LOG(tracer, 4, "Decoded "<< bytesDecoded << " bytes, picture delayed by frame threading"); 
+    return ReturnEmptyFrame(dstRTP, dstLen, flags);
+  }
+
   if (!gotPicture) {
     flags = PluginCodec_ReturnCoderRequestIFrame;
     TRACE_AND_LOG(tracer, 1, "Decoded "<< bytesDecoded << " bytes without getting a Picture"); 
@@ -1339,7 +1426,7 @@ bool H263_RFC2190_DecoderContext::DecodeFrames(const BYTE * src, unsigned & srcL
   int size = _context->width * _context->height;
 
   if ((unsigned)dstRTP.GetFrameLen() < (frameBytes + sizeof(PluginCodec_Video_FrameHeader))) {
-    flags = PluginCodec_ReturnCoderRequestIFrame;
+    flags = PluginCodec_ReturnCoderBufferTooSmall | PluginCodec_ReturnCoderRequestIFrame;
     TRACE_AND_LOG(tracer, 1, "Destination buffer " << dstLen << " insufficient for decoded data size " << header->width << "x" << header->height);
     return ReturnEmptyFrame(dstRTP, dstLen, flags);
   }
@@ -1704,6 +1791,8 @@ static int encoder_set_options(const PluginCodec_Definition *,
       context->SetMaxKeyFramePeriod (atoi(option[1]));
     if (STRCMPI(option[0], PLUGINCODEC_OPTION_TEMPORAL_SPATIAL_TRADE_OFF) == 0)
        context->SetTSTO (atoi(option[1]));
+    if (STRCMPI(option[0], "Encoding Threads") == 0)
+      context->SetThreads (atoi(option[1]));
 
     if (STRCMPI(option[0], "Annex D") == 0) {
       if (atoi(option[1]) == 1) {
@@ -1857,6 +1946,24 @@ static int decoder_get_output_data_size(const PluginCodec_Definition * codec, vo
   return sizeof(PluginCodec_Video_FrameHeader) + ((codec->parm.video.maxFrameWidth * codec->parm.video.maxFrameHeight * 3) / 2);
 }
 
+static int decoder_set_options(const PluginCodec_Definition *, 
+                               void * _context,
+                               const char * , 
+                               void * parm, 
+                               unsigned * parmLen)
+{
+  H263_Base_DecoderContext * context = (H263_Base_DecoderContext *)_context;
+  if (parmLen == NULL || *parmLen != sizeof(const char **) || parm == NULL)
+    return 0;
+
+  for (const char * const * option = (const char * const *)parm; *option != NULL; option += 2) {
+    if (STRCMPI(option[0], "Decoding Threads") == 0)
+      context->SetThreads (atoi(option[1]));
+  }
+
+  return 1;
+}
+
 /////////////////////////////////////////////////////////////////////////////
 
 static struct PluginCodec_information licenseInfo = {
@@ -1906,6 +2013,7 @@ static PluginCodec_ControlDefn EncoderControls[] = {
 
 static PluginCodec_ControlDefn DecoderControls[] = {
   { PLUGINCODEC_CONTROL_GET_CODEC_OPTIONS,     get_codec_options },
+  { PLUGINCODEC_CONTROL_SET_CODEC_OPTIONS,     decoder_set_options },
   { PLUGINCODEC_CONTROL_GET_OUTPUT_DATA_SIZE,  decoder_get_output_data_size },
   { NULL }
 };
@@ -2033,6 +2141,13 @@ static struct PluginCodec_Option const annexT =
 static struct PluginCodec_Option const annexD =
   { PluginCodec_BoolOption,    "Annex D",   true,  PluginCodec_MinMerge, "1", "D", "0" };
 
+// local only, H.263+ encoding needs Annex K to use more than one thread
+static struct PluginCodec_Option const encodingThreads =
+  { PluginCodec_IntegerOption, "Encoding Threads", false, PluginCodec_NoMerge, "1", NULL, NULL, 0, "1", STRINGIZE(H263P_MAX_THREADS) };
+
+static struct PluginCodec_Option const decodingThreads =
+  { PluginCodec_IntegerOption, "Decoding Threads", false, PluginCodec_NoMerge, "1", NULL, NULL, 0, "1", STRINGIZE(H263P_MAX_THREADS) };
+
 static struct PluginCodec_Option const * const h263POptionTable[] = {
   &qcifMPI,
   &cifMPI,
@@ -2049,6 +2164,8 @@ static struct PluginCodec_Option const * const h263POptionTable[] = {
   &annexP,
   &annexT,
   &annexD,
+  &encodingThreads,
+  &decodingThreads,
   NULL
 };
 
@@ -2065,6 +2182,7 @@ static struct PluginCodec_Option const * const h263OptionTable[] = {
   &cif4MPI,
   &cif16MPI,
   &annexF,
+  &decodingThreads,
   NULL
 };
 
@@ -2072,6 +2190,7 @@ static struct PluginCodec_Option const * const h263QCIFOptionTable[] = {
   &mediaPacketization,
   &maxBR,
   &qcifMPI,
+  &decodingThreads,
   NULL
 };
 
@@ -2079,6 +2198,7 @@ static struct PluginCodec_Option const * const h263CIFOptionTable[] = {
   &mediaPacketization,
   &maxBR,
   &cifMPI,
+  &decodingThreads,
   NULL
 };
 
@@ -2086,6 +2206,7 @@ static struct PluginCodec_Option const * const h263CIF4OptionTable[] = {
   &mediaPacketization,
   &maxBR,
   &cif4MPI,
+  &decodingThreads,
   NULL
 };
 
@@ -65,6 +65,7 @@ typedef unsigned char BYTE;
 #define H263P_FRAME_RATE          25
 #define H263P_KEY_FRAME_INTERVAL 125
 #define H263P_MIN_QUANT            2
+#define H263P_MAX_THREADS         16
 
 #define H263_CLOCKRATE         90000
 #define H263_QCIF_BITRATE         192000
@@ -138,6 +139,7 @@ class H263_Base_EncoderContext
     void SetTSTO (unsigned tsto);
     void EnableAnnex (Annex annex);
     void DisableAnnex (Annex annex);
+    void SetThreads (unsigned threads);
     bool OpenCodec();
     void CloseCodec();
 
@@ -153,6 +155,7 @@ class H263_Base_EncoderContext
 
   protected:
     virtual bool InitContext() = 0;
+    void LoadInputFrame (PluginCodec_Video_FrameHeader * header);
 
     unsigned char * _inputFrameBuffer;
     AVCodec        *_codec;
@@ -161,6 +164,9 @@ class H263_Base_EncoderContext
 
     int _frameCount;
     int _width, _height;
+    unsigned _threads;
+    unsigned _maxThreads;        // threads the codec/packetisation can use
+    bool _sliceStructured;       // Annex K negotiated
     CriticalSection _mutex;
     const char * prefix;
 #if TRACE_FILE
@@ -215,15 +221,19 @@ class H263_Base_DecoderContext
 
     virtual bool DecodeFrames(const BYTE * src, unsigned & srcLen, BYTE * dst, unsigned & dstLen, unsigned int & flags) = 0;
 
+    void SetThreads (unsigned threads);
+
   protected:
     bool OpenCodec();
     void CloseCodec();
+    bool IsDelayedPicture(int bytesDecoded);
 
     AVCodec        *_codec;
     AVCodecContext *_context;
     AVFrame        *_outputFrame;
 
     int _frameCount;
+    unsigned _threads;
     CriticalSection _mutex;
     const char * prefix;
 #if TRACE_FILE
@@ -296,6 +306,8 @@ static int codec_decoder         ( const struct PluginCodec_Definition *, void *
                                    unsigned int * flag);
 static int decoder_get_output_data_size ( const PluginCodec_Definition * codec, void *, const char *,
                                    void *, unsigned *);
+static int decoder_set_options   ( const struct PluginCodec_Definition *, void * _context, const char *, 
+                                   void * parm, unsigned * parmLen);
 /////////////////////////////////////////////////////////////////////////////
 
 #endif /* __H263P_1998_H__ */
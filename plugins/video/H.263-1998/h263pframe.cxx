@@ -124,6 +124,7 @@ H263PFrame::H263PFrame (uint32_t maxFrameSize)
   _maxPayloadSize = 1400;
   _maxFrameSize = maxFrameSize;
   _minPayloadSize = 0;
+  _startCodeIndex = 0;
 
   _encodedFrame.ptr = (uint8_t*) malloc(maxFrameSize);
   _picHeader.ptr = (uint8_t*) malloc(MAX_HEADER_SIZE);
@@ -158,10 +159,16 @@ void H263PFrame::GetRTPFrame (RTPFrame & frame, unsigned int & flags)
   // and later try to split into packets at these borders
   if (_encodedFrame.pos == 0) {   
     _startCodes.clear();          
-    for (i=0; i < _encodedFrame.len - 1; i++ ) {
-      if ((_encodedFrame.ptr[i] == 0) && (_encodedFrame.ptr[i+1]==0)) {
-        _startCodes.push_back(i);
-      }
+    _startCodeIndex = 0;
+    const uint8_t * ptr = _encodedFrame.ptr;
+    const uint8_t * end = _encodedFrame.ptr + _encodedFrame.len - 1;
+    while (ptr < end) {
+      ptr = (const uint8_t *)memchr(ptr, 0, end - ptr);
+      if (ptr == NULL)
+        break;
+      if (ptr[1] == 0)
+        _startCodes.push_back((uint32_t)(ptr - _encodedFrame.ptr));
+      ptr++;
     }  
     if (_encodedFrame.len > _maxPayloadSize)
       _minPayloadSize = (uint16_t)(_encodedFrame.len / ceil((float)_encodedFrame.len / (float)_maxPayloadSize));
@@ -186,18 +193,18 @@ void H263PFrame::GetRTPFrame (RTPFrame & frame, unsigned int & flags)
   dataPtr [1] = 0;
 
   // skip all start codes below _minPayloadSize
-  while ((!_startCodes.empty()) && (_startCodes.front() < _minPayloadSize)) {
+  while ((_startCodeIndex < _startCodes.size()) && (_startCodes[_startCodeIndex] < _minPayloadSize)) {
     hasStartCode = true;
-    _startCodes.erase(_startCodes.begin());
+    _startCodeIndex++;
   }
 
   // if there is a startcode between _minPayloadSize and _maxPayloadSize set 
   // the packet boundary there, if not, use _maxPayloadSize
-  if ((!_startCodes.empty()) 
-   && ((_startCodes.front() - _encodedFrame.pos) > _minPayloadSize)
-   && ((_startCodes.front() - _encodedFrame.pos) < (unsigned)(_maxPayloadSize - 2))) {
-    frame.SetPayloadSize(_startCodes.front() - _encodedFrame.pos + 2);
-    _startCodes.erase(_startCodes.begin());
+  if ((_startCodeIndex < _startCodes.size()) 
+   && ((_startCodes[_startCodeIndex] - _encodedFrame.pos) > _minPayloadSize)
+   && ((_startCodes[_startCodeIndex] - _encodedFrame.pos) < (unsigned)(_maxPayloadSize - 2))) {
+    frame.SetPayloadSize(_startCodes[_startCodeIndex] - _encodedFrame.pos + 2);
+    _startCodeIndex++;
   }
   else {
     if (_encodedFrame.pos + (_maxPayloadSize - 2) <= _encodedFrame.len)
@@ -172,6 +172,7 @@ private:
   data_t   _encodedFrame;
   header_data_t _picHeader;
   std::vector<uint32_t> _startCodes;
+  size_t _startCodeIndex;
 };
 
 #endif /* __H263PFrame_H__ */
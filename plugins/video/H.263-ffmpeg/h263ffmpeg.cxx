@@ -1372,8 +1372,10 @@ bool H263DecoderContext::DecodeFrames(const BYTE * src, unsigned & srcLen, BYTE
   int frameBytes = (frameWidth * frameHeight * 12) / 8;
 
   // if the frame decodes to more than we can handle, ignore the frame
-  if ((sizeof(PluginCodec_Video_FrameHeader) + frameBytes) > (size_t)dstRTP.GetPayloadSize())
+  if ((sizeof(PluginCodec_Video_FrameHeader) + frameBytes) > (size_t)dstRTP.GetPayloadSize()) {
+    flags = PluginCodec_ReturnCoderBufferTooSmall | PluginCodec_ReturnCoderRequestIFrame;
     return 1;
+  }
 
   PluginCodec_Video_FrameHeader * header = (PluginCodec_Video_FrameHeader *)dstRTP.GetPayloadPtr();
   header->x = header->y = 0;
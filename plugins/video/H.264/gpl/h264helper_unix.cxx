@@ -24,6 +24,9 @@
 #include "shared/pipes.h"
 #include "enc-ctx.h"
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <fstream>
 #include "trace.h"
 #include <stdlib.h> 
@@ -47,12 +50,35 @@ unsigned char * dst  = NULL;
 unsigned flags;
 int ret;
 
+unsigned char * ring = NULL;
+unsigned ringSlotIndex;
+unsigned char * ringSrc = NULL;
+
 X264EncoderContext* x264;
 
 #ifndef X264_LINK_STATIC
 extern X264Library X264Lib;
 #endif
 
+bool attachRing(const char * name)
+{
+  int fd = open(name, O_RDWR);
+  if (fd == -1) { TRACE (1, "H264\tIPC\tCP: Error when opening frame ring"); return false; }
+  void * addr = mmap(NULL, SHM_RING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) { TRACE (1, "H264\tIPC\tCP: Error when mapping frame ring"); return false; }
+
+  shmRingHeader * header = (shmRingHeader *)addr;
+  if (header->magic != SHM_RING_MAGIC || header->slots != SHM_RING_SLOTS ||
+      header->slotSize != SHM_RING_SLOT_SIZE || header->outSize != SHM_RING_OUT_SIZE) {
+    TRACE (1, "H264\tIPC\tCP: Frame ring layout mismatch - using pipes");
+    munmap(addr, SHM_RING_SIZE);
+    return false;
+  }
+  ring = (unsigned char *)addr;
+  return true;
+}
+
 void closeAndExit()
 {
   dlStream.close();
@@ -84,7 +110,7 @@ void flushStream (std::ofstream & stream)
 int main(int argc, char *argv[])
 {
   unsigned status;
-  if (argc != 3) { fprintf(stderr, "Not to be executed directly - exiting\n"); exit (1); }
+  if (argc != 3 && argc != 4) { fprintf(stderr, "Not to be executed directly - exiting\n"); exit (1); }
 
   char * debug_level = getenv ("PTLIB_TRACE_CODECS");
   if (debug_level!=NULL) {
@@ -118,6 +144,9 @@ int main(int argc, char *argv[])
   status = 1;
 #endif
 
+  if (status != 0 && argc == 4 && attachRing(argv[3]))
+    status |= INIT_STATUS_SHM;
+
   readStream(dlStream, (char*)&msg, sizeof(msg));
   writeStream(ulStream,(char*)&msg, sizeof(msg)); 
   writeStream(ulStream,(char*)&status, sizeof(status)); 
@@ -270,6 +299,30 @@ int main(int argc, char *argv[])
           TRACE (1, "H264\tIPC\tCodec not created, yet");
         }
       break;
+    case ENCODE_FRAMES_SHM:
+        readStream(dlStream, (char*)&ringSlotIndex, sizeof(ringSlotIndex));
+        readStream(dlStream, (char*)&srcLen, sizeof(srcLen));
+        readStream(dlStream, (char*)&headerLen, sizeof(headerLen));
+        readStream(dlStream, (char*)&flags, sizeof(flags));
+        if (ring == NULL || ringSlotIndex >= SHM_RING_SLOTS || srcLen > SHM_RING_SLOT_SIZE || headerLen > SHM_RING_OUT_SIZE) {
+          TRACE (1, "H264\tIPC\tCP: Invalid frame ring descriptor - terminating");
+          closeAndExit();
+        }
+        ringSrc = ring + SHM_RING_DATA_OFFSET + ringSlotIndex * SHM_RING_SLOT_SIZE;
+        // fall through intended
+    case ENCODE_FRAMES_SHM_BUFFERED:
+        if (x264 && ringSrc) {
+          unsigned char * out = ring + SHM_RING_DATA_OFFSET + SHM_RING_SLOTS * SHM_RING_SLOT_SIZE;
+          ret = (x264->EncodeFrames( ringSrc,  srcLen, out, dstLen, flags));
+          writeStream(ulStream,(char*)&msg, sizeof(msg));
+          writeStream(ulStream,(char*)&dstLen, sizeof(dstLen));
+          writeStream(ulStream,(char*)&flags, sizeof(flags));
+          writeStream(ulStream,(char*)&ret, sizeof(ret));
+          flushStream(ulStream);
+        } else {
+          TRACE (1, "H264\tIPC\tCodec not created, yet");
+        }
+      break;
 	case SET_MAX_NALSIZE:
         readStream(dlStream, (char*)&val, sizeof(val));
         if (x264) {
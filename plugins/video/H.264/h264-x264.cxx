@@ -472,6 +472,14 @@ int H264DecoderContext::DecodeFrames(const u_char * src, unsigned & srcLen, u_ch
 
   TRACE_UP(4, "H264\tDecoder\tDecoded " << bytesDecoded << " bytes"<< ", Resolution: " << _context->width << "x" << _context->height);
   int frameBytes = (_context->width * _context->height * 3) / 2;
+
+  // The output buffer is sized to the negotiated frame, let the caller grow it
+  if (dstRTP.GetPayloadSize() < sizeof(PluginCodec_Video_FrameHeader) + frameBytes) {
+    TRACE(1, "H264\tDecoder\tDestination buffer " << dstLen << " insufficient for decoded data size " << _context->width << "x" << _context->height);
+    flags = PluginCodec_ReturnCoderBufferTooSmall | requestIFrame;
+    return 1;
+  }
+
   PluginCodec_Video_FrameHeader * header = (PluginCodec_Video_FrameHeader *)dstRTP.GetPayloadPtr();
   header->x = header->y = 0;
   header->width = _context->width;
@@ -29,6 +29,8 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include "trace.h"
 #include "rtpframe.h"
@@ -51,12 +53,18 @@ H264EncCtx::H264EncCtx()
   loaded = false;  
   pipesCreated = false;
   pipesOpened = false;
+  ring = NULL;
+  ringCreated = false;
+  ringAttached = false;
+  ringFrame = false;
+  ringSlotIndex = 0;
   instances++;
 }
 
 H264EncCtx::~H264EncCtx()
 {
   closeAndRemovePipes();
+  closeAndRemoveRing();
 }
 
 bool 
@@ -71,6 +79,10 @@ H264EncCtx::Load()
   }
   pipesCreated = true;  
 
+  // the frame ring is optional, without it frames go over the pipes
+  if (!createRing())
+    closeAndRemoveRing();
+
   if (!findGplProcess()) { 
 
     TRACE(1, "H264\tIPC\tPP: Couldn't find GPL process executable: " << GPL_PROCESS_FILENAME)
@@ -126,7 +138,18 @@ H264EncCtx::Load()
     return false;
   }
 
-  TRACE(1, "H264\tIPC\tPP: Successfully forked child process "<<  pid << " and established communication")
+  if (ringCreated) {
+    // both sides have it mapped now, the name is no longer needed
+    if (::unlink(shmName) == -1) TRACE(1, "H264\tIPC\tPP: Error when trying to remove frame ring - " << strerror(errno));
+    ringCreated = false;
+  }
+  if (status & INIT_STATUS_SHM)
+    ringAttached = true;
+  else
+    closeAndRemoveRing();
+
+  TRACE(1, "H264\tIPC\tPP: Successfully forked child process "<<  pid << " and established communication"
+        << (ringAttached ? " using shared frame ring" : ""))
   loaded = true;  
   return true;
 }
@@ -157,17 +180,23 @@ void H264EncCtx::call(unsigned msg , const u_char * src, unsigned & srcLen, u_ch
 {
   if (startNewFrame) {
 
-    writeStream((char*) &msg, sizeof(msg));
-    if (size) {
-      writeStream((char*) &size, sizeof(size));
-      writeStream((char*) src, size);
+    unsigned len = size ? size : srcLen;
+    ringFrame = ringAttached && len <= SHM_RING_SLOT_SIZE && headerLen <= SHM_RING_OUT_SIZE;
+    if (ringFrame) {
+      ringSlotIndex = (ringSlotIndex + 1) % SHM_RING_SLOTS;
+      memcpy(ringSlot(ringSlotIndex), src, len);
+      memcpy(ringOut(), dst, headerLen);
+      msg = ENCODE_FRAMES_SHM;
+      writeStream((char*) &msg, sizeof(msg));
+      writeStream((char*) &ringSlotIndex, sizeof(ringSlotIndex));
+      writeStream((char*) &len, sizeof(len));
       writeStream((char*) &headerLen, sizeof(headerLen));
-      writeStream((char*) dst, headerLen);
       writeStream((char*) &flags, sizeof(flags) );
     }
     else {
-      writeStream((char*) &srcLen, sizeof(srcLen));
-      writeStream((char*) src, srcLen);
+      writeStream((char*) &msg, sizeof(msg));
+      writeStream((char*) &len, sizeof(len));
+      writeStream((char*) src, len);
       writeStream((char*) &headerLen, sizeof(headerLen));
       writeStream((char*) dst, headerLen);
       writeStream((char*) &flags, sizeof(flags) );
@@ -175,7 +204,7 @@ void H264EncCtx::call(unsigned msg , const u_char * src, unsigned & srcLen, u_ch
   }
   else {
   
-    msg = ENCODE_FRAMES_BUFFERED;
+    msg = ringFrame ? ENCODE_FRAMES_SHM_BUFFERED : ENCODE_FRAMES_BUFFERED;
     writeStream((char*) &msg, sizeof(msg));
   }
   
@@ -183,7 +212,15 @@ void H264EncCtx::call(unsigned msg , const u_char * src, unsigned & srcLen, u_ch
   
   readStream((char*) &msg, sizeof(msg));
   readStream((char*) &dstLen, sizeof(dstLen));
-  readStream((char*) dst, dstLen);
+  if (msg == ENCODE_FRAMES_SHM || msg == ENCODE_FRAMES_SHM_BUFFERED) {
+    if (dstLen > SHM_RING_OUT_SIZE) {
+      TRACE(1, "H264\tIPC\tPP: Invalid frame length " << dstLen << " in frame ring");
+      dstLen = 0;
+    }
+    memcpy(dst, ringOut(), dstLen);
+  }
+  else
+    readStream((char*) dst, dstLen);
   readStream((char*) &flags, sizeof(flags));
   readStream((char*) &ret, sizeof(ret));
 
@@ -193,6 +230,71 @@ void H264EncCtx::call(unsigned msg , const u_char * src, unsigned & srcLen, u_ch
     startNewFrame = false;
 }
 
+bool H264EncCtx::createRing()
+{
+  // prefer tmpfs so the frames never touch a disk backed file
+  struct stat buffer;
+  if (stat("/dev/shm", &buffer) == 0 && S_ISDIR(buffer.st_mode))
+    snprintf ( shmName, sizeof(shmName), "/dev/shm/x264-shm-%d-%u", getpid(),GetInstanceNumber());
+  else
+    snprintf ( shmName, sizeof(shmName), "/tmp/x264-shm-%d-%u", getpid(),GetInstanceNumber());
+
+  int fd = ::open(shmName, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+  if (fd == -1) {
+
+    TRACE(1, "H264\tIPC\tPP: Error when trying to create frame ring - " << strerror(errno));
+    return false;
+  }
+  ringCreated = true;
+
+  if (ftruncate(fd, SHM_RING_SIZE) == -1) {
+
+    TRACE(1, "H264\tIPC\tPP: Error when trying to size frame ring - " << strerror(errno));
+    ::close(fd);
+    return false;
+  }
+
+  void * addr = mmap(NULL, SHM_RING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+
+    TRACE(1, "H264\tIPC\tPP: Error when trying to map frame ring - " << strerror(errno));
+    return false;
+  }
+  ring = (u_char *) addr;
+
+  shmRingHeader * header = (shmRingHeader *) ring;
+  header->slots    = SHM_RING_SLOTS;
+  header->slotSize = SHM_RING_SLOT_SIZE;
+  header->outSize  = SHM_RING_OUT_SIZE;
+  header->magic    = SHM_RING_MAGIC;
+  return true;
+}
+
+void H264EncCtx::closeAndRemoveRing()
+{
+  if (ring != NULL) {
+    if (munmap(ring, SHM_RING_SIZE) == -1) TRACE(1, "H264\tIPC\tPP: Error when trying to unmap frame ring - " << strerror(errno));
+    ring = NULL;
+  }
+  if (ringCreated) {
+    if (::unlink(shmName) == -1) TRACE(1, "H264\tIPC\tPP: Error when trying to remove frame ring - " << strerror(errno));
+    ringCreated = false;
+  }
+  ringAttached = false;
+  ringFrame = false;
+}
+
+u_char * H264EncCtx::ringSlot(unsigned slot)
+{
+  return ring + SHM_RING_DATA_OFFSET + slot * SHM_RING_SLOT_SIZE;
+}
+
+u_char * H264EncCtx::ringOut()
+{
+  return ring + SHM_RING_DATA_OFFSET + SHM_RING_SLOTS * SHM_RING_SLOT_SIZE;
+}
+
 bool H264EncCtx::createPipes()
 {
   umask(0);
@@ -317,7 +419,12 @@ void H264EncCtx::execGplProcess()
 {
   unsigned msg;
   unsigned status = 0;
-  if (execl(gplProcess,"h264_video_pwplugin_helper", dlName,ulName, NULL) == -1) {
+  int result;
+  if (ringCreated)
+    result = execl(gplProcess,"h264_video_pwplugin_helper", dlName,ulName, shmName, NULL);
+  else
+    result = execl(gplProcess,"h264_video_pwplugin_helper", dlName,ulName, NULL);
+  if (result == -1) {
 
     TRACE(1, "H264\tIPC\tPP: Error when trying to execute GPL process  " << gplProcess << " - " << strerror(errno));
     cpDLStream.open(dlName, std::ios::binary);
@@ -47,6 +47,10 @@ class H264EncCtx
   protected:
      bool createPipes();
      void closeAndRemovePipes();
+     bool createRing();
+     void closeAndRemoveRing();
+     u_char * ringSlot(unsigned slot);
+     u_char * ringOut();
      void writeStream (const char* data, unsigned bytes);
      void readStream (char* data, unsigned bytes);
      void flushStream ();
@@ -57,6 +61,7 @@ class H264EncCtx
 
      char dlName [512];
      char ulName [512];
+     char shmName [512];
      char gplProcess [512];
      std::ofstream dlStream;
      std::ifstream ulStream;
@@ -67,6 +72,13 @@ class H264EncCtx
      bool loaded;
      bool pipesCreated;
      bool pipesOpened;
+
+     // shared memory frame ring, only descriptors go over the pipes
+     u_char * ring;
+     bool ringCreated;
+     bool ringAttached;
+     bool ringFrame;
+     unsigned ringSlotIndex;
      
      // only for signaling failed execution of helper process
      std::ifstream cpDLStream;
@@ -48,6 +48,29 @@
 #define SET_PROFILE_LEVEL         13
 #define FASTUPDATE_REQUESTED	  14
 #define SET_MAX_NALSIZE           15
+#define ENCODE_FRAMES_SHM         16
+#define ENCODE_FRAMES_SHM_BUFFERED 17
+
+/* INIT status bit set by the helper when it attached the shared frame ring */
+#define INIT_STATUS_SHM           2
+
+/* Shared memory frame ring between plugin and helper process. The plugin
+   copies each raw frame into the next slot and only passes the slot index
+   and lengths over the pipe, the helper writes the RTP packet into the
+   output area. Frames larger than a slot still go over the pipe. */
+#define SHM_RING_MAGIC            0x48323634
+#define SHM_RING_SLOTS            2
+#define SHM_RING_SLOT_SIZE        (1920 * 1088 * 3 / 2 + 4096)
+#define SHM_RING_OUT_SIZE         (64 * 1024)
+#define SHM_RING_DATA_OFFSET      4096
+#define SHM_RING_SIZE             (SHM_RING_DATA_OFFSET + SHM_RING_SLOTS * SHM_RING_SLOT_SIZE + SHM_RING_OUT_SIZE)
+
+typedef struct {
+  unsigned magic;
+  unsigned slots;
+  unsigned slotSize;
+  unsigned outSize;
+} shmRingHeader;
 
 
 #endif /* __PIPE_H__ */
@@ -0,0 +1,128 @@
+/*
+ * main.cxx
+ *
+ * Test of the endpoint port range tracking.
+ *
+ * The contents of this file are subject to the Mozilla Public License
+ * Version 1.0 (the "License"); you may not use this file except in
+ * compliance with the License. You may obtain a copy of the License at
+ * http://www.mozilla.org/MPL/
+ *
+ * Software distributed under the License is distributed on an "AS IS"
+ * basis, WITHOUT WARRANTY OF ANY KIND, either express or implied. See
+ * the License for the specific language governing rights and limitations
+ * under the License.
+ *
+ * The Original Code is Portable Windows Library.
+ *
+ * Contributor(s): ______________________________________.
+ *
+ * $Id$
+ *
+ */
+
+#include <ptlib.h>
+#include <ptlib/pprocess.h>
+
+#ifdef __GNUC__
+#define H323_STATIC_LIB
+#endif
+
+#include <h323.h>
+#include "../../version.h"
+
+#include <set>
+#include <algorithm>
+
+#define new PNEW
+
+class PortTestProcess : public PProcess
+{
+  PCLASSINFO(PortTestProcess, PProcess)
+
+  public:
+    PortTestProcess();
+
+    void Main();
+
+  protected:
+    void Check(PBoolean ok, const char * what, int line);
+
+    unsigned failures;
+};
+
+PCREATE_PROCESS(PortTestProcess);
+
+#define CHECK(cond) Check(cond, #cond, __LINE__)
+
+static const unsigned PortBase  = 20000;
+static const unsigned PortCount = 8;
+
+
+PortTestProcess::PortTestProcess()
+  : PProcess("H323Plus", "porttest",
+             MAJOR_VERSION, MINOR_VERSION, BUILD_TYPE, BUILD_NUMBER),
+    failures(0)
+{
+}
+
+
+void PortTestProcess::Check(PBoolean ok, const char * what, int line)
+{
+  if (ok)
+    return;
+
+  cout << "FAILED line " << line << ": " << what << endl;
+  failures++;
+}
+
+
+void PortTestProcess::Main()
+{
+  H323EndPoint endpoint;
+  endpoint.SetTCPPorts(PortBase, PortBase + PortCount);
+
+  // Fill the range, every port handed out once
+  std::multiset<WORD> held;
+  for (unsigned i = 0; i < PortCount; i++) {
+    WORD port = endpoint.GetNextTCPPort();
+    CHECK(port >= PortBase && port < PortBase + PortCount);
+    CHECK(held.count(port) == 0);
+    held.insert(port);
+  }
+
+  // With all in use a port is lent again, releasing the loan must not free
+  // the port from under its owner
+  WORD lent = endpoint.GetNextTCPPort();
+  CHECK(held.count(lent) == 1);
+  endpoint.ReleaseTCPPort(lent);
+
+  WORD again = endpoint.GetNextTCPPort();
+  CHECK(held.count(again) == 1);
+  held.insert(again);
+
+  // The owner releasing frees it, and only it
+  held.erase(held.find(lent));
+  endpoint.ReleaseTCPPort(lent);
+
+  WORD reused = endpoint.GetNextTCPPort();
+  CHECK(held.count(reused) == 0);
+  held.insert(reused);
+
+  // Release everything, the whole range is then handed out once more
+  for (std::multiset<WORD>::iterator it = held.begin(); it != held.end(); ++it)
+    endpoint.ReleaseTCPPort(*it);
+  held.clear();
+
+  for (unsigned i = 0; i < PortCount; i++) {
+    WORD port = endpoint.GetNextTCPPort();
+    CHECK(held.count(port) == 0);
+    held.insert(port);
+  }
+
+  cout << (failures == 0 ? "PASSED" : "FAILED") << endl;
+  SetTerminationValue(failures == 0 ? 0 : 1);
+}
+
+
+// End of File ///////////////////////////////////////////////////////////////
@@ -669,7 +669,9 @@ H323_RTPChannel::H323_RTPChannel(H323Connection & conn,
   : H323_RealTimeChannel(conn, cap, direction),
     rtpSession(r),
     rtpCallbacks(*(H323_RTP_Session *)r.GetUserData()), silenceStartTick(0),
-    rec_written(0), rec_ok(false)
+    rec_written(0), rec_ok(false),
+    relayTarget(NULL), relaySource(NULL), relayStarted(FALSE),
+    relayTimestampOffset(0), relayPayloadType(RTP_DataFrame::IllegalPayloadType)
 {
   PTRACE(3, "H323RTP\t" << (receiver ? "Receiver" : "Transmitter")
          << " created using session " << GetSessionID());
@@ -678,6 +680,8 @@ H323_RTPChannel::H323_RTPChannel(H323Connection & conn,
 
 H323_RTPChannel::~H323_RTPChannel()
 {
+  StopRelay();
+
   // Finished with the RTP session, this will delete the session if it is no
   // longer referenced by any logical channels.
   connection.ReleaseSession(GetSessionID());
@@ -691,6 +695,9 @@ void H323_RTPChannel::CleanUpOnTermination()
 
   PTRACE(3, "H323RTP\tCleaning up RTP " << number);
 
+  // Unhook from any relay so neither side uses this channel any more
+  StopRelay();
+
   // Break any I/O blocks and wait for the thread that uses this object to
   // terminate before we allow it to be deleted.
   if ((receiver ? receiveThread : transmitThread) != NULL)
@@ -785,6 +792,125 @@ PBoolean H323_RTPChannel::OnReceivedAckAltPDU(const H245_ArrayOf_GenericInformat
   return rtpCallbacks.OnReceivedAckAltPDU(*this, alternate);
 }
 
+// Guards the links between relayed channels, the forwarding of each frame
+// only takes the relayMutex of the receiving channel.
+static PMutex & GetRelayLinkMutex()
+{
+  static PMutex mutex;
+  return mutex;
+}
+
+
+PBoolean H323_RTPChannel::SetRelayChannel(H323_RTPChannel * target)
+{
+  if (target != NULL) {
+    if (!receiver || target->GetDirection() != IsTransmitter) {
+      PTRACE(1, "H323RTP\tRelay must be from a receiver to a transmitter");
+      return FALSE;
+    }
+
+    if (target->GetCapability().GetFormatName() != capability->GetFormatName()) {
+      PTRACE(1, "H323RTP\tCannot relay " << capability->GetFormatName()
+             << " to " << target->GetCapability().GetFormatName());
+      return FALSE;
+    }
+  }
+
+  PWaitAndSignal link(GetRelayLinkMutex());
+
+  if (target != NULL && target->relaySource != NULL && target->relaySource != this) {
+    PTRACE(1, "H323RTP\tChannel " << target->GetNumber() << " is already a relay target");
+    return FALSE;
+  }
+
+  InternalSetRelayChannel(target);
+  return TRUE;
+}
+
+
+void H323_RTPChannel::InternalSetRelayChannel(H323_RTPChannel * target)
+{
+  H323_RTPChannel * previous;
+  {
+    // Wait for any frame being forwarded to the old target
+    PWaitAndSignal mutex(relayMutex);
+    previous = relayTarget;
+    relayTarget = target;
+  }
+
+  if (previous == target)
+    return;
+
+  // The target switches between its own and relayed media under its
+  // relayMutex, which its transmit thread holds while sending a packet.
+  if (previous != NULL) {
+    PTRACE(3, "H323RTP\tStopped relay of channel " << number << " to " << previous->GetNumber());
+    PWaitAndSignal mutex(previous->relayMutex);
+    previous->relaySource = NULL;
+    previous->relayStopped.Signal();
+  }
+
+  if (target != NULL) {
+    PTRACE(3, "H323RTP\tRelaying channel " << number << " to " << target->GetNumber());
+    PWaitAndSignal mutex(target->relayMutex);
+    target->relayStarted = FALSE;
+    target->relaySource = this;
+  }
+}
+
+
+void H323_RTPChannel::StopRelay()
+{
+  PWaitAndSignal link(GetRelayLinkMutex());
+
+  InternalSetRelayChannel(NULL);
+  if (relaySource != NULL)
+    relaySource->InternalSetRelayChannel(NULL);
+}
+
+
+PBoolean H323_RTPChannel::WaitWhileRelayTarget()
+{
+  // The relaying channel does our transmitting, leave the codec alone
+  while (relaySource != NULL && !terminating)
+    relayStopped.Wait(100);
+
+  return !terminating;
+}
+
+
+PBoolean H323_RTPChannel::RelayFrame(RTP_DataFrame & frame)
+{
+  PWaitAndSignal mutex(relayMutex);
+
+  // Stopped while the frame was on its way
+  if (relaySource == NULL)
+    return TRUE;
+
+  if (!relayStarted) {
+    relayPayloadType = GetRTPPayloadType();
+    relayTimestampOffset = PRandom::Number() - frame.GetTimestamp();
+    frame.SetMarker(TRUE);
+    relayStarted = TRUE;
+  }
+
+  frame.SetPayloadType(relayPayloadType);
+  frame.SetTimestamp(frame.GetTimestamp() + relayTimestampOffset);
+
+  // Our filters still see what is sent, eg so RFC2833 user input goes out
+  PBoolean sendPacket = TRUE;
+  filterMutex.Wait();
+  for (PINDEX i = 0; i < filters.GetSize(); i++)
+    filters[i](frame, (H323_INT)&sendPacket);
+  filterMutex.Signal();
+
+  if (!sendPacket)
+    return TRUE;
+
+  return WriteFrame(frame);
+}
+
+
 PBoolean H323_RTPChannel::ReadFrame(DWORD & rtpTimestamp, RTP_DataFrame & frame)
 {
   return rtpSession.ReadBufferedData(rtpTimestamp, frame);
@@ -860,6 +986,13 @@ void H323_RTPChannel::Transmit()
   unsigned maxFrameSize = isAudio ? maxSampleSize*maxSampleTime : 2000;
   RTP_DataFrame frame(framesInPacket*maxFrameSize);
 
+  // Let a framed audio codec encode the whole packet in one call if it can
+  H323FramedAudioCodec * framedCodec = NULL;
+  if (isAudio && PIsDescendant(codec, H323FramedAudioCodec)) {
+    framedCodec = (H323FramedAudioCodec *)codec;
+    framedCodec->SetFramesInPacket(framesInPacket);
+  }
+
   rtpPayloadType = GetRTPPayloadType();
   if (rtpPayloadType == RTP_DataFrame::IllegalPayloadType) {
      PTRACE(1, "H323RTP\tReceive " << mediaFormat << " thread ended (illegal payload type)");
@@ -897,11 +1030,11 @@ void H323_RTPChannel::Transmit()
      That is for GSM codec say with a single frame, this function will take
      20 milliseconds to complete.
    */
-  while (codec->Read(frame.GetPayloadPtr()+frameOffset, length, frame)) {
+  while ((frameOffset > 0 || WaitWhileRelayTarget()) && codec->Read(frame.GetPayloadPtr()+frameOffset, length, frame)) {
     // Calculate the timestamp and real time to take in processing
     if(isAudio)
     {
-        rtpTimestamp += codec->GetFrameRate();
+        rtpTimestamp += codec->GetFrameRate()*(framedCodec != NULL ? framedCodec->GetLastFrameCount() : 1);
     } 
     else
     { 
@@ -964,12 +1097,22 @@ void H323_RTPChannel::Transmit()
       frameOffset += length;
 
       // Look for special cases
-      if (rtpPayloadType == RTP_DataFrame::G729 && length == 2) {
+      if (rtpPayloadType == RTP_DataFrame::G729 && (length%10) == 2) {
         /* If we have a G729 sid frame (ie 2 bytes instead of 10) then we must
-           not send any more frames in the RTP packet.
+           not send any more frames in the RTP packet. A batch of frames from
+           the codec will always end with the SID.
          */
         frameCount = framesInPacket;
       }
+      else if (framedCodec != NULL && framedCodec->GetFramesInPacket() > 1) {
+        /* A batch is the whole packet. An encoder stopping early, say after a
+           SID, carries the rest over to the next batch, so the packet must
+           end here or the next batch would not fit in the frame buffer.
+         */
+        frameCount += framedCodec->GetLastFrameCount();
+        if (framedCodec->GetLastFrameCount() < framedCodec->GetFramesInPacket())
+          frameCount = framesInPacket;
+      }
       else {
         /* Increment by number of frames that were read in one hit Note a
            codec that does variable length frames should never return more
@@ -1001,8 +1144,12 @@ void H323_RTPChannel::Transmit()
     }
 
     if (sendPacket || (silent && frame.GetPayloadSize() > 0)) {
-      // Send the frame of coded data we have so far to RTP transport
-      if (!WriteFrame(frame))
+      // Send the frame of coded data we have so far to RTP transport. A relay
+      // started while it was being read replaces it, so it is dropped.
+      relayMutex.Wait();
+      PBoolean ok = relaySource != NULL || WriteFrame(frame);
+      relayMutex.Signal();
+      if (!ok)
          break;
 
       // video frames produce many packets per frame especially at
@@ -1087,7 +1234,7 @@ void H323_RTPChannel::Receive()
   PTRACE(2, "H323RTP\tReceive " << mediaFormat << " thread started.");
 
   // if jitter buffer required, start the thread that is on the other end of it
-  if (mediaFormat.NeedsJitterBuffer() && endpoint.UseJitterBuffer())
+  if (mediaFormat.NeedsJitterBuffer() && endpoint.UseJitterBuffer() && relayTarget == NULL)
     rtpSession.SetJitterBufferSize(connection.GetMinAudioJitterDelay()*mediaFormat.GetTimeUnits(),
                                    connection.GetMaxAudioJitterDelay()*mediaFormat.GetTimeUnits(),
                                    endpoint.GetJitterThreadStackSize());
@@ -1111,12 +1258,43 @@ void H323_RTPChannel::Receive()
   PBoolean isAudio = codec->GetMediaFormat().NeedsJitterBuffer();
   PBoolean allowRtpPayloadChange = isAudio;
 
+  // Let a framed audio codec decode all the frames in a packet in one call
+  H323FramedAudioCodec * framedCodec = NULL;
+  if (isAudio && PIsDescendant(codec, H323FramedAudioCodec)) {
+    framedCodec = (H323FramedAudioCodec *)codec;
+    framedCodec->SetFramesInPacket(capability->GetRxFramesInPacket());
+  }
+
   // UniDirectional Channel NAT support
   SendUniChannelBackProbe();
 
   RTP_DataFrame frame;
   while (ReadFrame(rtpTimestamp, frame)) {
 
+    // Pass the still encoded frame straight on if relaying
+    if (relayTarget != NULL) {
+      rtpTimestamp = frame.GetTimestamp() + codecFrameRate;
+
+      // Our filters still run, so RFC2833 user input is reported here
+      if (isAudio) {
+        filterMutex.Wait();
+        for (PINDEX i = 0; i < filters.GetSize(); i++)
+          filters[i](frame, 0);
+        filterMutex.Signal();
+      }
+
+      PWaitAndSignal mutex(relayMutex);
+      if (relayTarget != NULL) {
+        if (frame.GetPayloadType() == rtpPayloadType && frame.GetPayloadSize() > 0 &&
+            !relayTarget->RelayFrame(frame)) {
+          PTRACE(2, "H323RTP\tRelay to channel " << relayTarget->GetNumber() << " failed");
+        }
+        if (terminating)
+          break;
+        continue;
+      }
+    }
+
     if (isAudio) {
       filterMutex.Wait();
       for (PINDEX i = 0; i < filters.GetSize(); i++)
@@ -1175,7 +1353,7 @@ void H323_RTPChannel::Receive()
              for audio codecs or the jitter buffer will not operate correctly.
            */
           rec_ok = codec->Write(ptr, paused ? 0 : payloadSize, frame, rec_written);
-          rtpTimestamp += codecFrameRate;
+          rtpTimestamp += codecFrameRate*(framedCodec != NULL ? framedCodec->GetLastFrameCount() : 1);
           payloadSize -= rec_written != 0 ? rec_written : payloadSize;
           ptr += rec_written;
         }
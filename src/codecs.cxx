@@ -46,6 +46,8 @@
 #include "h323pdu.h"
 #include "h323con.h"
 
+#include <math.h>
+
 #ifdef H323_AEC
 #include <etc/h323aec.h>
 #endif // H323_AEC
@@ -54,6 +56,26 @@ extern "C" {
 #include "g711.h"
 };
 
+// Vectorised G.711 kernels are built on x86 and selected at run time
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+  #if defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+    #define G711_SIMD_KERNELS 1
+    #define G711_TARGET(isa) __attribute__((target(isa)))
+    #include <immintrin.h>
+  #elif defined(_MSC_VER) && _MSC_VER >= 1700
+    #define G711_SIMD_KERNELS 1
+    #define G711_TARGET(isa)
+    #include <intrin.h>
+    #include <immintrin.h>
+  #endif
+#endif
+
+#ifdef H323_AUDIO_CODECS
+// Run time selected signal level kernels, defined with the G.711 kernels
+static unsigned SignalLevelSum(const short * samples, unsigned count);
+static void SignalEnergy(const short * samples, unsigned count, PUInt64 & energy, PUInt64 & deltaEnergy);
+#endif
+
 #define new PNEW
 
 /////////////////////////////////////////////////////////////////////////////
@@ -78,6 +100,10 @@ H323Codec::H323Codec(const OpalMediaFormat & fmt, Direction dir)
 
   rtpSync.m_realTimeStamp = 0;
   rtpSync.m_rtpTimeStamp = 0;
+
+#ifdef H323_AUDIO_CODECS
+  rawResampler = NULL;
+#endif
 }
 
 
@@ -169,12 +195,28 @@ PBoolean H323Codec::ReadRaw(void * data, PINDEX size, PINDEX & length)
     return FALSE;
   }
 
-  if (!rawDataChannel->Read(data, size)) {
-    PTRACE(1, "Codec\tAudio read failed: " << rawDataChannel->GetErrorText(PChannel::LastReadError));
-    return FALSE;
+#ifdef H323_AUDIO_CODECS
+  if (rawResampler != NULL) {
+    // Read at the raw rate and convert before any filters see the data
+    PINDEX rawSamples = rawResampler->GetInputSamples(size/2);
+    if (rawResampleBuffer.GetSize() < rawSamples)
+      rawResampleBuffer.SetSize(rawSamples);
+    if (!rawDataChannel->Read(rawResampleBuffer.GetPointer(), rawSamples*2)) {
+      PTRACE(1, "Codec\tAudio read failed: " << rawDataChannel->GetErrorText(PChannel::LastReadError));
+      return FALSE;
+    }
+    length = rawResampler->Convert(rawResampleBuffer, rawDataChannel->GetLastReadCount()/2, (short *)data, size/2)*2;
+  }
+  else
+#endif
+  {
+    if (!rawDataChannel->Read(data, size)) {
+      PTRACE(1, "Codec\tAudio read failed: " << rawDataChannel->GetErrorText(PChannel::LastReadError));
+      return FALSE;
+    }
+    length = rawDataChannel->GetLastReadCount();
   }
 
-  length = rawDataChannel->GetLastReadCount();
   for (PINDEX i = 0; i < filters.GetSize(); i++) {
       length = filters[i].ProcessFilter(data, size, length);
   }
@@ -198,6 +240,16 @@ PBoolean H323Codec::WriteInternal(void * data, PINDEX length, void * mark)
       length = filters[i].ProcessFilter(data, length, length);
   }
 
+#ifdef H323_AUDIO_CODECS
+  if (rawResampler != NULL) {
+    PINDEX rawSamples = rawResampler->GetOutputSamples(length/2);
+    if (rawResampleBuffer.GetSize() < rawSamples)
+      rawResampleBuffer.SetSize(rawSamples);
+    length = rawResampler->Convert((const short *)data, length/2, rawResampleBuffer.GetPointer(), rawSamples)*2;
+    data = rawResampleBuffer.GetPointer();
+  }
+#endif
+
 #if PTLIB_VER < 290
   if (rawDataChannel->Write(data, length))
 #else
@@ -524,13 +576,24 @@ H323AudioCodec::~H323AudioCodec()
 
   CloseRawDataChannel();
 
+  delete rawResampler;
+
   //mediaFormat.RemoveAllOptions();
 }
 
 
 PBoolean H323AudioCodec::Open(H323Connection & connection)
 {
-  return connection.OpenAudioChannel(direction == Encoder, samplesPerFrame*2, *this);
+  SetRawSampleRate(connection.GetAudioRawSampleRate());
+
+  // The sound channel buffers are at the raw rate, the resampler input when
+  // encoding and its output when decoding.
+  unsigned bufferSize = samplesPerFrame*2;
+  if (rawResampler != NULL)
+    bufferSize = (direction == Encoder ? rawResampler->GetInputSamples(samplesPerFrame)
+                                       : rawResampler->GetOutputSamples(samplesPerFrame))*2;
+
+  return connection.OpenAudioChannel(direction == Encoder, bufferSize, *this);
 }
 
 
@@ -583,6 +646,14 @@ void H323AudioCodec::SetSilenceDetectionMode(SilenceDetectionMode mode,
   // This is the period over which the adaptive algorithm operates
   adaptiveThresholdFrames = (adaptivePeriod+samplesPerFrame-1)/samplesPerFrame;
 
+  if (mode == VoiceActivityDetection) {
+    // Noise floor is set from the first frame
+    vadNoiseFloor = -1;
+    inTalkBurst = FALSE;
+    framesReceived = 0;
+    return;
+  }
+
   if (mode != AdaptiveSilenceDetection) {
     levelThreshold = threshold;
     return;
@@ -608,6 +679,9 @@ PBoolean H323AudioCodec::DetectSilence()
   if (silenceDetectMode == NoSilenceDetection)
     return FALSE;
 
+  if (silenceDetectMode == VoiceActivityDetection)
+    return DetectVoiceActivity();
+
   // Can never have average signal level that high, this indicates that the
   // hardware cannot do silence detection.
   unsigned level = GetAverageSignalLevel();
@@ -620,11 +694,14 @@ PBoolean H323AudioCodec::DetectSilence()
   // Now if signal level above threshold we are "talking"
   PBoolean haveSignal = level > levelThreshold;
 
+  // A batch of frames counts as that many frames of the same level
+  unsigned frames = GetSilenceDetectFrames();
+
   // If no change ie still talking or still silent, resent frame counter
   if (inTalkBurst == haveSignal)
     framesReceived = 0;
   else {
-    framesReceived++;
+    framesReceived += frames;
     // If have had enough consecutive frames talking/silent, swap modes.
     if (framesReceived >= (inTalkBurst ? silenceDeadbandFrames : signalDeadbandFrames)) {
       inTalkBurst = !inTalkBurst;
@@ -656,12 +733,12 @@ PBoolean H323AudioCodec::DetectSilence()
   if (haveSignal) {
     if (level < signalMinimum)
       signalMinimum = level;
-    signalFramesReceived++;
+    signalFramesReceived += frames;
   }
   else {
     if (level > silenceMaximum)
       silenceMaximum = level;
-    silenceFramesReceived++;
+    silenceFramesReceived += frames;
   }
 
   // See if we have had enough frames to look at proportions of silence/signal
@@ -716,11 +793,113 @@ PBoolean H323AudioCodec::DetectSilence()
 }
 
 
+PBoolean H323AudioCodec::DetectVoiceActivity()
+{
+  unsigned energy, deltaEnergy;
+  if (!GetSignalEnergy(energy, deltaEnergy))
+    return FALSE;
+
+  static const double pi = 3.14159265358979323846;
+  static const double MinimumNoiseFloor = 20;  // dB, about -60dBov
+  static const double SignalMargin = 12;       // dB above noise for any signal
+  static const double VoicedMargin = 6;        // dB above noise for voiced signal
+
+  double level = 10*log10(energy + 1.0);
+  if (vadNoiseFloor < 0)
+    vadNoiseFloor = PMAX(level, MinimumNoiseFloor);
+
+  /* Voiced speech has most of its energy below 1kHz, which gives a lower
+     ratio of difference to signal energy than background noise, which tends
+     to be flat. Accept voiced frames at a lower level over the noise floor.
+   */
+  double sampleRate = mediaFormat.GetTimeUnits()*1000.0;
+  double voicedTilt = 2*(1 - cos(2*pi*1000/sampleRate));
+  PBoolean voiced = deltaEnergy < voicedTilt*energy;
+
+  PBoolean haveSignal = level > vadNoiseFloor + SignalMargin ||
+                        (voiced && level > vadNoiseFloor + VoicedMargin);
+
+  // A batch of frames counts as that many frames of the same level
+  unsigned frames = GetSilenceDetectFrames();
+
+  // Follow the noise floor down at once, up slowly in silence, a sixteenth
+  // of the way each frame, and very slowly, at 1dB a second, during signal
+  // in case the background has got louder.
+  if (level < vadNoiseFloor)
+    vadNoiseFloor = level;
+  else if (!haveSignal)
+    vadNoiseFloor += (level - vadNoiseFloor)*(1 - pow(15.0/16, (double)frames));
+  else
+    vadNoiseFloor += frames*samplesPerFrame/sampleRate;
+  if (vadNoiseFloor < MinimumNoiseFloor)
+    vadNoiseFloor = MinimumNoiseFloor;
+
+  // Start talk burst after the signal deadband, end it after the hangover
+  if (inTalkBurst == haveSignal)
+    framesReceived = 0;
+  else {
+    framesReceived += frames;
+    if (framesReceived >= (inTalkBurst ? silenceDeadbandFrames : signalDeadbandFrames)) {
+      inTalkBurst = !inTalkBurst;
+      PTRACE(4, "Codec\tVoice activity transition: "
+             << (inTalkBurst ? "Talk" : "Silent")
+             << " level=" << level << "dB noise=" << vadNoiseFloor << "dB"
+             << (voiced ? " voiced" : ""));
+    }
+  }
+
+  return !inTalkBurst;
+}
+
+
 unsigned H323AudioCodec::GetAverageSignalLevel()
 {
   return UINT_MAX;
 }
 
+
+PBoolean H323AudioCodec::GetSignalEnergy(unsigned & /*energy*/, unsigned & /*deltaEnergy*/)
+{
+  return FALSE;
+}
+
+PBoolean H323AudioCodec::SetRawSampleRate(unsigned rate)
+{
+  unsigned codecRate = mediaFormat.GetTimeUnits()*1000;
+
+  PWaitAndSignal mutex(rawChannelMutex);
+
+  delete rawResampler;
+  rawResampler = NULL;
+
+  if (rate == 0 || rate == codecRate)
+    return TRUE;
+
+  if (codecRate == 0 || ((PUInt64)samplesPerFrame*rate)%codecRate != 0) {
+    PTRACE(2, "Codec\tCannot convert " << mediaFormat << " at " << codecRate << " Hz to " << rate << " Hz");
+    return FALSE;
+  }
+
+  // The resampler converts from the raw channel when encoding, to it when decoding
+  if (direction == Encoder)
+    rawResampler = new H323AudioResampler(rate, codecRate);
+  else
+    rawResampler = new H323AudioResampler(codecRate, rate);
+
+  PTRACE(3, "Codec\t" << mediaFormat << " raw data channel at " << rate << " Hz");
+  return TRUE;
+}
+
+
+unsigned H323AudioCodec::GetRawSampleRate() const
+{
+  if (rawResampler == NULL)
+    return mediaFormat.GetTimeUnits()*1000;
+
+  return direction == Encoder ? rawResampler->GetInputRate() : rawResampler->GetOutputRate();
+}
+
+
 PBoolean H323AudioCodec::SetRawDataHeld(PBoolean hold) { 
 	
   PTimedMutex m;
@@ -738,7 +917,8 @@ H323FramedAudioCodec::H323FramedAudioCodec(const OpalMediaFormat & fmt, Directio
     aec(NULL),
 #endif
     sampleBuffer(samplesPerFrame), bytesPerFrame(mediaFormat.GetFrameSize()), 
-    readBytes(samplesPerFrame*2), writeBytes(samplesPerFrame*2), cntBytes(0)
+    readBytes(samplesPerFrame*2), writeBytes(samplesPerFrame*2), cntBytes(0),
+    framesInPacket(1), framesInBuffer(1), carriedFrames(0)
 {
 
 }
@@ -765,32 +945,56 @@ PBoolean H323FramedAudioCodec::Read(BYTE * buffer, unsigned & length, RTP_DataFr
         return rawDataChannel->Read(buffer, length);
 #endif
 
-  if (!ReadRaw(sampleBuffer.GetPointer(samplesPerFrame), readBytes, cntBytes))
+  // When batching, read the whole packet worth of audio at once. Frames left
+  // over from an encoder that stopped early are already at the start.
+  unsigned frames = framesInPacket;
+  PINDEX wanted = readBytes*(frames - carriedFrames);
+  short * samples = sampleBuffer.GetPointer(samplesPerFrame*frames);
+
+  if (!ReadRaw(samples + carriedFrames*samplesPerFrame, wanted, cntBytes))
     return FALSE;
 
 #ifdef H323_AEC
     if (aec != NULL) {
-       PTRACE(6,"AEC\tSend " << readBytes);
-       aec->Send((BYTE*)sampleBuffer.GetPointer(samplesPerFrame),(unsigned &)readBytes);
+       PTRACE(6,"AEC\tSend " << wanted);
+       for (unsigned i = carriedFrames; i < frames; i++)
+         aec->Send((BYTE*)(samples + i*samplesPerFrame),(unsigned &)readBytes);
     }
 #endif
 
+  carriedFrames = 0;
+
   if (IsRawDataHeld) {
     length = 0;
     return TRUE;
   }
 
-  if (cntBytes != readBytes) {
-    PTRACE(1, "Codec\tRead truncated frame of raw data. Wanted " << readBytes << " and got "<< cntBytes);
+  if (cntBytes != wanted) {
+    PTRACE(1, "Codec\tRead truncated frame of raw data. Wanted " << wanted << " and got "<< cntBytes);
     return FALSE;
   }
   cntBytes = 0;
+  framesInBuffer = frames;
 
   if (DetectSilence()) {
     length = 0;
     return TRUE;
   }
 
+  if (frames > 1) {
+    length = bytesPerFrame*frames;
+    unsigned encoded = frames;
+    if (!EncodeFrames(buffer, length, encoded))
+      return FALSE;
+
+    if (encoded < frames) {
+      carriedFrames = frames - encoded;
+      framesInBuffer = encoded;
+      memmove(samples, samples + encoded*samplesPerFrame, carriedFrames*samplesPerFrame*2);
+    }
+    return TRUE;
+  }
+
   // Default length is the frame size
   length = bytesPerFrame;
   return EncodeFrame(buffer, length);
@@ -833,7 +1037,28 @@ PBoolean H323FramedAudioCodec::Write(const BYTE * buffer,
   }
 #endif
 
-  if (length != 0) {
+  // A batch decode leaves the size of several frames, silence and single
+  // frames are one frame. Otherwise keep the size the codec last decoded.
+  if (framesInBuffer > 1) {
+    framesInBuffer = 1;
+    writeBytes = samplesPerFrame*2;
+  }
+
+  unsigned frames = bytesPerFrame > 0 ? length/bytesPerFrame : 0;
+  if (frames > framesInPacket)
+    frames = framesInPacket;
+
+  if (frames > 1) {
+    // Decode all the whole frames in the packet with one call
+    written = frames*bytesPerFrame;
+    if (DecodeFrames(buffer, written, written, writeBytes, frames))
+      framesInBuffer = frames;
+    else {
+      written = length;
+      length = 0;
+    }
+  }
+  else if (length != 0) {
     if (length > bytesPerFrame)
       length = bytesPerFrame;
     written = bytesPerFrame;
@@ -873,19 +1098,23 @@ unsigned H323FramedAudioCodec::GetAverageSignalLevel()
   if (!samplesPerFrame)
       return 0;
 
-  // Calculate the average signal level of this frame
-  int sum = 0;
+  // Calculate the average signal level of this frame, or frames if batching
+  unsigned samples = samplesPerFrame*framesInBuffer;
+  return SignalLevelSum(sampleBuffer, samples)/samples;
+}
 
-  const short * pcm = sampleBuffer;
-  const short * end = pcm + samplesPerFrame;
-  while (pcm != end) {
-    if (*pcm < 0)
-      sum -= *pcm++;
-    else
-      sum += *pcm++;
-  }
 
-  return sum/samplesPerFrame;
+PBoolean H323FramedAudioCodec::GetSignalEnergy(unsigned & energy, unsigned & deltaEnergy)
+{
+  unsigned samples = samplesPerFrame*framesInBuffer;
+  if (samples == 0)
+    return FALSE;
+
+  PUInt64 sum, deltaSum;
+  SignalEnergy(sampleBuffer, samples, sum, deltaSum);
+  energy = (unsigned)(sum/samples);
+  deltaEnergy = (unsigned)(deltaSum/samples);
+  return TRUE;
 }
 
 
@@ -898,6 +1127,46 @@ PBoolean H323FramedAudioCodec::DecodeFrame(const BYTE * buffer,
 }
 
 
+PBoolean H323FramedAudioCodec::CanBatchFrames() const
+{
+  return FALSE;
+}
+
+
+void H323FramedAudioCodec::SetFramesInPacket(unsigned frames)
+{
+  PWaitAndSignal mutex(rawChannelMutex);
+
+  if (frames < 1 || !CanBatchFrames())
+    frames = 1;
+  else if (frames > MaxFramesInBatch)
+    frames = MaxFramesInBatch;
+
+  PTRACE_IF(4, frames > 1, "Codec\tBatching " << frames << " frames per call for " << mediaFormat);
+
+  framesInPacket = frames;
+  carriedFrames = 0;
+}
+
+
+PBoolean H323FramedAudioCodec::EncodeFrames(BYTE * /*buffer*/,
+                                            unsigned & /*length*/,
+                                            unsigned & /*frames*/)
+{
+  return FALSE;
+}
+
+
+PBoolean H323FramedAudioCodec::DecodeFrames(const BYTE * /*buffer*/,
+                                            unsigned /*length*/,
+                                            unsigned & /*written*/,
+                                            unsigned & /*bytesOutput*/,
+                                            unsigned & /*frames*/)
+{
+  return FALSE;
+}
+
+
 PBoolean H323FramedAudioCodec::DecodeFrame(const BYTE * /*buffer*/,
                                        unsigned /*length*/,
                                        unsigned & /*written*/)
@@ -943,8 +1212,7 @@ PBoolean H323StreamedAudioCodec::EncodeFrame(BYTE * buffer, unsigned &)
   BYTE encoded;
   switch (bitsPerSample) {
     case 8 :
-      for (i = 0; i < (PINDEX)samplesPerFrame; i++)
-        *buffer++ = (BYTE)Encode(sampleBuffer[i]);
+      EncodeSamples(sampleBuffer, buffer, samplesPerFrame);
       break;
     case 5 : // g.726-40 payload encoding....
       for (i = 0; i < (PINDEX)samplesPerFrame;i++)
@@ -1094,8 +1362,8 @@ PBoolean H323StreamedAudioCodec::DecodeFrame(const BYTE * buffer,
   
   switch (bitsPerSample) {
     case 8 :
-      for (i = 0; i < length; i++)
-        *out++ = Decode(*buffer++);
+      DecodeSamples(buffer, out, length);
+      out += length;
       break;
 
     // those case are for ADPCM G.726
@@ -1201,6 +1469,634 @@ PBoolean H323StreamedAudioCodec::DecodeFrame(const BYTE * buffer,
 }
 
 
+void H323StreamedAudioCodec::EncodeSamples(const short * samples, BYTE * buffer, PINDEX count) const
+{
+  while (count-- > 0)
+    *buffer++ = (BYTE)Encode(*samples++);
+}
+
+
+void H323StreamedAudioCodec::DecodeSamples(const BYTE * buffer, short * samples, PINDEX count) const
+{
+  while (count-- > 0)
+    *samples++ = Decode(*buffer++);
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+// G.711 block conversion kernels.
+//
+// Decoding is a straight 256 entry table lookup. Encoding uses tables indexed
+// by the significant bits of the linear sample (13 bits for A-law, 14 bits for
+// u-law), or on x86 processors with SSSE3 or AVX2 a vectorised segment search
+// that converts 8 or 16 samples per instruction. The kernel is chosen once, at
+// start up, from the capabilities of the processor we are running on.
+
+typedef void (*G711EncodeKernel)(const short * samples, BYTE * buffer, PINDEX count);
+
+static short g711_alaw2linear[256];
+static short g711_ulaw2linear[256];
+static BYTE  g711_linear2alaw[8192];
+static BYTE  g711_linear2ulaw[16384];
+
+static void G711TableALawEncode(const short * samples, BYTE * buffer, PINDEX count)
+{
+  while (count-- > 0)
+    *buffer++ = g711_linear2alaw[(*samples++ >> 3) & 0x1fff];
+}
+
+
+static void G711TableuLawEncode(const short * samples, BYTE * buffer, PINDEX count)
+{
+  while (count-- > 0)
+    *buffer++ = g711_linear2ulaw[(*samples++ >> 2) & 0x3fff];
+}
+
+
+#ifdef G711_SIMD_KERNELS
+
+// For 16 bit lanes, x >> (16-n) is done as an unsigned multiply high by 2^n,
+// the multiplier being looked up by segment number with a byte shuffle.
+
+G711_TARGET("ssse3")
+static inline __m128i G711ALawEncode8(__m128i x)
+{
+  const __m128i shifts = _mm_setr_epi8((char)128, (char)128, 64, 32, 16, 8, 4, 2, 0, 0, 0, 0, 0, 0, 0, 0);
+
+  __m128i sign = _mm_srai_epi16(x, 15);
+  __m128i mag  = _mm_xor_si128(_mm_srai_epi16(x, 3), sign);
+
+  __m128i seg = _mm_setzero_si128();
+  seg = _mm_sub_epi16(seg, _mm_cmpgt_epi16(mag, _mm_set1_epi16(0x1f)));
+  seg = _mm_sub_epi16(seg, _mm_cmpgt_epi16(mag, _mm_set1_epi16(0x3f)));
+  seg = _mm_sub_epi16(seg, _mm_cmpgt_epi16(mag, _mm_set1_epi16(0x7f)));
+  seg = _mm_sub_epi16(seg, _mm_cmpgt_epi16(mag, _mm_set1_epi16(0xff)));
+  seg = _mm_sub_epi16(seg, _mm_cmpgt_epi16(mag, _mm_set1_epi16(0x1ff)));
+  seg = _mm_sub_epi16(seg, _mm_cmpgt_epi16(mag, _mm_set1_epi16(0x3ff)));
+  seg = _mm_sub_epi16(seg, _mm_cmpgt_epi16(mag, _mm_set1_epi16(0x7ff)));
+
+  __m128i mult  = _mm_shuffle_epi8(shifts, _mm_or_si128(_mm_slli_epi16(seg, 8), _mm_set1_epi16(0x80)));
+  __m128i quant = _mm_and_si128(_mm_mulhi_epu16(mag, mult), _mm_set1_epi16(0xf));
+  __m128i mask  = _mm_or_si128(_mm_set1_epi16(0x55), _mm_andnot_si128(sign, _mm_set1_epi16(0x80)));
+
+  return _mm_xor_si128(_mm_or_si128(_mm_slli_epi16(seg, 4), quant), mask);
+}
+
+
+G711_TARGET("ssse3")
+static inline __m128i G711uLawEncode8(__m128i x)
+{
+  const __m128i shifts = _mm_setr_epi8((char)128, 64, 32, 16, 8, 4, 2, 1, 0, 0, 0, 0, 0, 0, 0, 0);
+
+  __m128i sign = _mm_srai_epi16(x, 15);
+  __m128i val  = _mm_min_epi16(_mm_add_epi16(_mm_abs_epi16(_mm_srai_epi16(x, 2)), _mm_set1_epi16(0x21)),
+                               _mm_set1_epi16(0x1fff));
+
+  __m128i seg = _mm_setzero_si128();
+  seg = _mm_sub_epi16(seg, _mm_cmpgt_epi16(val, _mm_set1_epi16(0x3f)));
+  seg = _mm_sub_epi16(seg, _mm_cmpgt_epi16(val, _mm_set1_epi16(0x7f)));
+  seg = _mm_sub_epi16(seg, _mm_cmpgt_epi16(val, _mm_set1_epi16(0xff)));
+  seg = _mm_sub_epi16(seg, _mm_cmpgt_epi16(val, _mm_set1_epi16(0x1ff)));
+  seg = _mm_sub_epi16(seg, _mm_cmpgt_epi16(val, _mm_set1_epi16(0x3ff)));
+  seg = _mm_sub_epi16(seg, _mm_cmpgt_epi16(val, _mm_set1_epi16(0x7ff)));
+  seg = _mm_sub_epi16(seg, _mm_cmpgt_epi16(val, _mm_set1_epi16(0xfff)));
+
+  __m128i mult  = _mm_shuffle_epi8(shifts, _mm_or_si128(_mm_slli_epi16(seg, 8), _mm_set1_epi16(0x80)));
+  __m128i quant = _mm_and_si128(_mm_mulhi_epu16(val, mult), _mm_set1_epi16(0xf));
+  __m128i mask  = _mm_or_si128(_mm_set1_epi16(0x7f), _mm_andnot_si128(sign, _mm_set1_epi16(0x80)));
+
+  return _mm_xor_si128(_mm_or_si128(_mm_slli_epi16(seg, 4), quant), mask);
+}
+
+
+G711_TARGET("ssse3")
+static void G711SSSE3ALawEncode(const short * samples, BYTE * buffer, PINDEX count)
+{
+  for (; count >= 16; count -= 16, samples += 16, buffer += 16) {
+    __m128i lo = G711ALawEncode8(_mm_loadu_si128((const __m128i *)samples));
+    __m128i hi = G711ALawEncode8(_mm_loadu_si128((const __m128i *)(samples+8)));
+    _mm_storeu_si128((__m128i *)buffer, _mm_packus_epi16(lo, hi));
+  }
+  G711TableALawEncode(samples, buffer, count);
+}
+
+
+G711_TARGET("ssse3")
+static void G711SSSE3uLawEncode(const short * samples, BYTE * buffer, PINDEX count)
+{
+  for (; count >= 16; count -= 16, samples += 16, buffer += 16) {
+    __m128i lo = G711uLawEncode8(_mm_loadu_si128((const __m128i *)samples));
+    __m128i hi = G711uLawEncode8(_mm_loadu_si128((const __m128i *)(samples+8)));
+    _mm_storeu_si128((__m128i *)buffer, _mm_packus_epi16(lo, hi));
+  }
+  G711TableuLawEncode(samples, buffer, count);
+}
+
+
+G711_TARGET("avx2")
+static inline __m256i G711ALawEncode16(__m256i x)
+{
+  const __m256i shifts = _mm256_setr_epi8((char)128, (char)128, 64, 32, 16, 8, 4, 2, 0, 0, 0, 0, 0, 0, 0, 0,
+                                          (char)128, (char)128, 64, 32, 16, 8, 4, 2, 0, 0, 0, 0, 0, 0, 0, 0);
+
+  __m256i sign = _mm256_srai_epi16(x, 15);
+  __m256i mag  = _mm256_xor_si256(_mm256_srai_epi16(x, 3), sign);
+
+  __m256i seg = _mm256_setzero_si256();
+  seg = _mm256_sub_epi16(seg, _mm256_cmpgt_epi16(mag, _mm256_set1_epi16(0x1f)));
+  seg = _mm256_sub_epi16(seg, _mm256_cmpgt_epi16(mag, _mm256_set1_epi16(0x3f)));
+  seg = _mm256_sub_epi16(seg, _mm256_cmpgt_epi16(mag, _mm256_set1_epi16(0x7f)));
+  seg = _mm256_sub_epi16(seg, _mm256_cmpgt_epi16(mag, _mm256_set1_epi16(0xff)));
+  seg = _mm256_sub_epi16(seg, _mm256_cmpgt_epi16(mag, _mm256_set1_epi16(0x1ff)));
+  seg = _mm256_sub_epi16(seg, _mm256_cmpgt_epi16(mag, _mm256_set1_epi16(0x3ff)));
+  seg = _mm256_sub_epi16(seg, _mm256_cmpgt_epi16(mag, _mm256_set1_epi16(0x7ff)));
+
+  __m256i mult  = _mm256_shuffle_epi8(shifts, _mm256_or_si256(_mm256_slli_epi16(seg, 8), _mm256_set1_epi16(0x80)));
+  __m256i quant = _mm256_and_si256(_mm256_mulhi_epu16(mag, mult), _mm256_set1_epi16(0xf));
+  __m256i mask  = _mm256_or_si256(_mm256_set1_epi16(0x55), _mm256_andnot_si256(sign, _mm256_set1_epi16(0x80)));
+
+  return _mm256_xor_si256(_mm256_or_si256(_mm256_slli_epi16(seg, 4), quant), mask);
+}
+
+
+G711_TARGET("avx2")
+static inline __m256i G711uLawEncode16(__m256i x)
+{
+  const __m256i shifts = _mm256_setr_epi8((char)128, 64, 32, 16, 8, 4, 2, 1, 0, 0, 0, 0, 0, 0, 0, 0,
+                                          (char)128, 64, 32, 16, 8, 4, 2, 1, 0, 0, 0, 0, 0, 0, 0, 0);
+
+  __m256i sign = _mm256_srai_epi16(x, 15);
+  __m256i val  = _mm256_min_epi16(_mm256_add_epi16(_mm256_abs_epi16(_mm256_srai_epi16(x, 2)), _mm256_set1_epi16(0x21)),
+                                  _mm256_set1_epi16(0x1fff));
+
+  __m256i seg = _mm256_setzero_si256();
+  seg = _mm256_sub_epi16(seg, _mm256_cmpgt_epi16(val, _mm256_set1_epi16(0x3f)));
+  seg = _mm256_sub_epi16(seg, _mm256_cmpgt_epi16(val, _mm256_set1_epi16(0x7f)));
+  seg = _mm256_sub_epi16(seg, _mm256_cmpgt_epi16(val, _mm256_set1_epi16(0xff)));
+  seg = _mm256_sub_epi16(seg, _mm256_cmpgt_epi16(val, _mm256_set1_epi16(0x1ff)));
+  seg = _mm256_sub_epi16(seg, _mm256_cmpgt_epi16(val, _mm256_set1_epi16(0x3ff)));
+  seg = _mm256_sub_epi16(seg, _mm256_cmpgt_epi16(val, _mm256_set1_epi16(0x7ff)));
+  seg = _mm256_sub_epi16(seg, _mm256_cmpgt_epi16(val, _mm256_set1_epi16(0xfff)));
+
+  __m256i mult  = _mm256_shuffle_epi8(shifts, _mm256_or_si256(_mm256_slli_epi16(seg, 8), _mm256_set1_epi16(0x80)));
+  __m256i quant = _mm256_and_si256(_mm256_mulhi_epu16(val, mult), _mm256_set1_epi16(0xf));
+  __m256i mask  = _mm256_or_si256(_mm256_set1_epi16(0x7f), _mm256_andnot_si256(sign, _mm256_set1_epi16(0x80)));
+
+  return _mm256_xor_si256(_mm256_or_si256(_mm256_slli_epi16(seg, 4), quant), mask);
+}
+
+
+G711_TARGET("avx2")
+static void G711AVX2ALawEncode(const short * samples, BYTE * buffer, PINDEX count)
+{
+  for (; count >= 32; count -= 32, samples += 32, buffer += 32) {
+    __m256i lo = G711ALawEncode16(_mm256_loadu_si256((const __m256i *)samples));
+    __m256i hi = G711ALawEncode16(_mm256_loadu_si256((const __m256i *)(samples+16)));
+    // Pack works within 128 bit lanes, put the quad words back in order
+    _mm256_storeu_si256((__m256i *)buffer, _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xd8));
+  }
+  G711SSSE3ALawEncode(samples, buffer, count);
+}
+
+
+G711_TARGET("avx2")
+static void G711AVX2uLawEncode(const short * samples, BYTE * buffer, PINDEX count)
+{
+  for (; count >= 32; count -= 32, samples += 32, buffer += 32) {
+    __m256i lo = G711uLawEncode16(_mm256_loadu_si256((const __m256i *)samples));
+    __m256i hi = G711uLawEncode16(_mm256_loadu_si256((const __m256i *)(samples+16)));
+    _mm256_storeu_si256((__m256i *)buffer, _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xd8));
+  }
+  G711SSSE3uLawEncode(samples, buffer, count);
+}
+
+
+enum G711Instructions {
+  G711_Generic,
+  G711_SSSE3,
+  G711_AVX2
+};
+
+static G711Instructions G711DetectInstructions()
+{
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  int maxLeaf = info[0];
+  if (maxLeaf < 1)
+    return G711_Generic;
+
+  __cpuid(info, 1);
+  if ((info[2] & (1 << 9)) == 0)                   // SSSE3
+    return G711_Generic;
+
+  // AVX2 needs the OS to save the YMM registers as well as the CPU support
+  if (maxLeaf >= 7 && (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6) {
+    __cpuidex(info, 7, 0);
+    if ((info[1] & (1 << 5)) != 0)
+      return G711_AVX2;
+  }
+  return G711_SSSE3;
+#else
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return G711_AVX2;
+  if (__builtin_cpu_supports("ssse3"))
+    return G711_SSSE3;
+  return G711_Generic;
+#endif
+}
+
+#endif // G711_SIMD_KERNELS
+
+
+static struct G711Kernels {
+  G711Kernels()
+  {
+    int i;
+    for (i = 0; i < 256; i++) {
+      g711_alaw2linear[i] = (short)alaw2linear(i);
+      g711_ulaw2linear[i] = (short)ulaw2linear(i);
+    }
+    // Index is the sample shifted down to the bits the encoder looks at
+    for (i = 0; i < 8192; i++)
+      g711_linear2alaw[i] = (BYTE)linear2alaw((short)(i << 3));
+    for (i = 0; i < 16384; i++)
+      g711_linear2ulaw[i] = (BYTE)linear2ulaw((short)(i << 2));
+
+    alawEncoder = G711TableALawEncode;
+    ulawEncoder = G711TableuLawEncode;
+
+#ifdef G711_SIMD_KERNELS
+    switch (G711DetectInstructions()) {
+      case G711_AVX2 :
+        alawEncoder = G711AVX2ALawEncode;
+        ulawEncoder = G711AVX2uLawEncode;
+        break;
+      case G711_SSSE3 :
+        alawEncoder = G711SSSE3ALawEncode;
+        ulawEncoder = G711SSSE3uLawEncode;
+        break;
+      default :
+        break;
+    }
+#endif
+  }
+
+  G711EncodeKernel alawEncoder;
+  G711EncodeKernel ulawEncoder;
+} g711Kernels;
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Dot product of a block of samples with a phase of the resampler filter,
+// count is always a multiple of 16. Result is rounded and saturated Q15.
+
+typedef int (*ResamplerDotKernel)(const short * samples, const short * coeffs, unsigned count);
+
+static inline int ResamplerRound(int acc)
+{
+  acc = (acc + 16384) >> 15;
+  return acc > 32767 ? 32767 : (acc < -32768 ? -32768 : acc);
+}
+
+static int ResamplerGenericDot(const short * samples, const short * coeffs, unsigned count)
+{
+  int acc = 0;
+  while (count-- > 0)
+    acc += *samples++ * *coeffs++;
+  return ResamplerRound(acc);
+}
+
+#ifdef G711_SIMD_KERNELS
+
+G711_TARGET("sse2")
+static int ResamplerSSE2Dot(const short * samples, const short * coeffs, unsigned count)
+{
+  __m128i acc = _mm_setzero_si128();
+  for (; count > 0; count -= 16, samples += 16, coeffs += 16) {
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)samples),
+                                            _mm_loadu_si128((const __m128i *)coeffs)));
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(samples+8)),
+                                            _mm_loadu_si128((const __m128i *)(coeffs+8))));
+  }
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4e));
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xb1));
+  return ResamplerRound(_mm_cvtsi128_si32(acc));
+}
+
+G711_TARGET("avx2")
+static int ResamplerAVX2Dot(const short * samples, const short * coeffs, unsigned count)
+{
+  __m256i acc = _mm256_setzero_si256();
+  for (; count > 0; count -= 16, samples += 16, coeffs += 16)
+    acc = _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_loadu_si256((const __m256i *)samples),
+                                                  _mm256_loadu_si256((const __m256i *)coeffs)));
+  __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+  return ResamplerRound(_mm_cvtsi128_si32(sum));
+}
+
+#endif // G711_SIMD_KERNELS
+
+
+static struct ResamplerKernels {
+  ResamplerKernels()
+  {
+    dot = ResamplerGenericDot;
+#ifdef G711_SIMD_KERNELS
+    switch (G711DetectInstructions()) {
+      case G711_AVX2 :
+        dot = ResamplerAVX2Dot;
+        break;
+      case G711_SSSE3 :
+        dot = ResamplerSSE2Dot;
+        break;
+      default :
+        break;
+    }
+#endif
+  }
+
+  ResamplerDotKernel dot;
+} resamplerKernels;
+
+
+static double ResamplerPrototype(unsigned n, unsigned length, double cutoff)
+{
+  static const double pi = 3.14159265358979323846;
+  double t = n - (length - 1)/2.0;
+  double sinc = t == 0 ? 2*cutoff : sin(2*pi*cutoff*t)/(pi*t);
+  double window = 0.42 - 0.5*cos(2*pi*n/(length-1)) + 0.08*cos(4*pi*n/(length-1));
+  return sinc*window;
+}
+
+
+static unsigned ResamplerGCD(unsigned a, unsigned b)
+{
+  while (b != 0) {
+    unsigned t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+
+H323AudioResampler::H323AudioResampler(unsigned inRate, unsigned outRate)
+  : inputRate(inRate),
+    outputRate(outRate)
+{
+  unsigned gcd = ResamplerGCD(inputRate, outputRate);
+  up = outputRate/gcd;
+  down = inputRate/gcd;
+
+  // Windowed sinc low pass at the lower of the two Nyquist rates, longer
+  // when decimating so the transition band stays the same width
+  taps = 16*((down + up - 1)/up);
+  unsigned length = taps*up;
+  double cutoff = 0.45/PMAX(up, down);
+
+  coeffs.SetSize(length);
+  for (unsigned phase = 0; phase < up; phase++) {
+    double sum = 0;
+    unsigned i;
+    for (i = 0; i < taps; i++)
+      sum += ResamplerPrototype(phase + i*up, length, cutoff);
+
+    // Each phase has unity gain, stored reversed so the newest sample is last
+    short * phaseCoeffs = coeffs.GetPointer() + phase*taps;
+    for (i = 0; i < taps; i++)
+      phaseCoeffs[taps-1-i] = (short)floor(ResamplerPrototype(phase + i*up, length, cutoff)*32768/sum + 0.5);
+  }
+
+  history.SetSize(taps-1);
+  position = 0;
+
+  PTRACE(4, "Codec\tResampler " << inputRate << " to " << outputRate
+         << " Hz, " << up << '/' << down << ", " << taps << " taps per phase");
+}
+
+
+PINDEX H323AudioResampler::Convert(const short * input, PINDEX inputSamples, short * output, PINDEX outputMax)
+{
+  // Input is appended to the carried history, so output may overwrite it
+  PINDEX carried = taps-1;
+  if (history.GetSize() < carried+inputSamples)
+    history.SetSize(carried+inputSamples);
+  short * samples = history.GetPointer();
+  memcpy(samples+carried, input, inputSamples*sizeof(short));
+
+  const short * phaseCoeffs = coeffs;
+  ResamplerDotKernel dot = resamplerKernels.dot;
+
+  PINDEX count = 0;
+  unsigned end = (unsigned)inputSamples*up;
+  for (; position < end; position += down) {
+    if (count < outputMax)
+      output[count++] = (short)dot(samples + position/up, phaseCoeffs + (position%up)*taps, taps);
+  }
+  position -= end;
+
+  memmove(samples, samples+inputSamples, carried*sizeof(short));
+  return count;
+}
+
+
+PNotifier H323AudioResampler::GetFilter()
+{
+  return PCREATE_NOTIFIER(OnFilter);
+}
+
+
+void H323AudioResampler::OnFilter(H323Codec::FilterInfo & info, H323_INT)
+{
+  short * samples = (short *)info.buffer;
+  info.bufferLength = Convert(samples, info.bufferLength/2, samples, info.bufferSize/2)*2;
+}
+
+
+/////////////////////////////////////////////////////////////////////////////
+
+// Signal level and energy of PCM for silence and voice activity detection.
+// Energy is of the samples at half amplitude so adjacent differences fit in
+// 16 bits, every square and pair sum then fits in 31 bits.
+
+typedef unsigned (*SignalLevelKernel)(const short * samples, unsigned count);
+typedef void (*SignalEnergyKernel)(const short * samples, unsigned count, PUInt64 & energy, PUInt64 & deltaEnergy);
+
+static unsigned SignalGenericLevelSum(const short * samples, unsigned count)
+{
+  unsigned sum = 0;
+  while (count-- > 0) {
+    int sample = *samples++;
+    sum += sample < 0 ? -sample : sample;
+  }
+  return sum;
+}
+
+static void SignalGenericEnergyTail(const short * samples, unsigned start, unsigned count, PUInt64 & energy, PUInt64 & deltaEnergy)
+{
+  for (unsigned i = start; i < count; i++) {
+    int sample = samples[i] >> 1;
+    int delta = i > 0 ? sample - (samples[i-1] >> 1) : 0;
+    energy += sample*sample;
+    deltaEnergy += delta*delta;
+  }
+}
+
+static void SignalGenericEnergy(const short * samples, unsigned count, PUInt64 & energy, PUInt64 & deltaEnergy)
+{
+  energy = deltaEnergy = 0;
+  SignalGenericEnergyTail(samples, 0, count, energy, deltaEnergy);
+}
+
+#ifdef G711_SIMD_KERNELS
+
+G711_TARGET("ssse3")
+static unsigned SignalSSSE3LevelSum(const short * samples, unsigned count)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc = zero;
+  for (; count >= 8; count -= 8, samples += 8) {
+    // Magnitudes are unsigned, 32768 for the most negative sample
+    __m128i level = _mm_abs_epi16(_mm_loadu_si128((const __m128i *)samples));
+    acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_unpacklo_epi16(level, zero), _mm_unpackhi_epi16(level, zero)));
+  }
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4e));
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xb1));
+  return (unsigned)_mm_cvtsi128_si32(acc) + SignalGenericLevelSum(samples, count);
+}
+
+G711_TARGET("sse2")
+static __m128i SignalSSE2Square(__m128i acc, __m128i values)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i squares = _mm_madd_epi16(values, values);
+  return _mm_add_epi64(acc, _mm_add_epi64(_mm_unpacklo_epi32(squares, zero), _mm_unpackhi_epi32(squares, zero)));
+}
+
+G711_TARGET("sse2")
+static void SignalSSE2Energy(const short * samples, unsigned count, PUInt64 & energy, PUInt64 & deltaEnergy)
+{
+  __m128i sum = _mm_setzero_si128();
+  __m128i deltaSum = _mm_setzero_si128();
+
+  // Differences start at the second sample, each against the one before
+  unsigned i = 1;
+  for (; i+8 <= count; i += 8) {
+    __m128i current = _mm_srai_epi16(_mm_loadu_si128((const __m128i *)(samples+i)), 1);
+    __m128i previous = _mm_srai_epi16(_mm_loadu_si128((const __m128i *)(samples+i-1)), 1);
+    sum = SignalSSE2Square(sum, current);
+    deltaSum = SignalSSE2Square(deltaSum, _mm_sub_epi16(current, previous));
+  }
+
+  PInt64 sums[2], deltaSums[2];
+  _mm_storeu_si128((__m128i *)sums, sum);
+  _mm_storeu_si128((__m128i *)deltaSums, deltaSum);
+  energy = sums[0] + sums[1];
+  deltaEnergy = deltaSums[0] + deltaSums[1];
+
+  if (count > 0) {
+    int first = samples[0] >> 1;
+    energy += first*first;
+  }
+  SignalGenericEnergyTail(samples, i, count, energy, deltaEnergy);
+}
+
+G711_TARGET("avx2")
+static unsigned SignalAVX2LevelSum(const short * samples, unsigned count)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i acc = zero;
+  for (; count >= 16; count -= 16, samples += 16) {
+    __m256i level = _mm256_abs_epi16(_mm256_loadu_si256((const __m256i *)samples));
+    acc = _mm256_add_epi32(acc, _mm256_add_epi32(_mm256_unpacklo_epi16(level, zero), _mm256_unpackhi_epi16(level, zero)));
+  }
+  __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+  return (unsigned)_mm_cvtsi128_si32(sum) + SignalSSSE3LevelSum(samples, count);
+}
+
+G711_TARGET("avx2")
+static __m256i SignalAVX2Square(__m256i acc, __m256i values)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i squares = _mm256_madd_epi16(values, values);
+  return _mm256_add_epi64(acc, _mm256_add_epi64(_mm256_unpacklo_epi32(squares, zero), _mm256_unpackhi_epi32(squares, zero)));
+}
+
+G711_TARGET("avx2")
+static void SignalAVX2Energy(const short * samples, unsigned count, PUInt64 & energy, PUInt64 & deltaEnergy)
+{
+  __m256i sum = _mm256_setzero_si256();
+  __m256i deltaSum = _mm256_setzero_si256();
+
+  unsigned i = 1;
+  for (; i+16 <= count; i += 16) {
+    __m256i current = _mm256_srai_epi16(_mm256_loadu_si256((const __m256i *)(samples+i)), 1);
+    __m256i previous = _mm256_srai_epi16(_mm256_loadu_si256((const __m256i *)(samples+i-1)), 1);
+    sum = SignalAVX2Square(sum, current);
+    deltaSum = SignalAVX2Square(deltaSum, _mm256_sub_epi16(current, previous));
+  }
+
+  PInt64 sums[4], deltaSums[4];
+  _mm256_storeu_si256((__m256i *)sums, sum);
+  _mm256_storeu_si256((__m256i *)deltaSums, deltaSum);
+  energy = sums[0] + sums[1] + sums[2] + sums[3];
+  deltaEnergy = deltaSums[0] + deltaSums[1] + deltaSums[2] + deltaSums[3];
+
+  if (count > 0) {
+    int first = samples[0] >> 1;
+    energy += first*first;
+  }
+  SignalGenericEnergyTail(samples, i, count, energy, deltaEnergy);
+}
+
+#endif // G711_SIMD_KERNELS
+
+
+static struct SignalKernels {
+  SignalKernels()
+  {
+    levelSum = SignalGenericLevelSum;
+    energy = SignalGenericEnergy;
+#ifdef G711_SIMD_KERNELS
+    switch (G711DetectInstructions()) {
+      case G711_AVX2 :
+        levelSum = SignalAVX2LevelSum;
+        energy = SignalAVX2Energy;
+        break;
+      case G711_SSSE3 :
+        levelSum = SignalSSSE3LevelSum;
+        energy = SignalSSE2Energy;
+        break;
+      default :
+        break;
+    }
+#endif
+  }
+
+  SignalLevelKernel  levelSum;
+  SignalEnergyKernel energy;
+} signalKernels;
+
+
+static unsigned SignalLevelSum(const short * samples, unsigned count)
+{
+  return signalKernels.levelSum(samples, count);
+}
+
+
+static void SignalEnergy(const short * samples, unsigned count, PUInt64 & energy, PUInt64 & deltaEnergy)
+{
+  signalKernels.energy(samples, count, energy, deltaEnergy);
+}
+
+
 /////////////////////////////////////////////////////////////////////////////
 
 H323_ALawCodec::H323_ALawCodec(Direction dir,
@@ -1219,13 +2115,26 @@ H323_ALawCodec::H323_ALawCodec(Direction dir,
 
 int H323_ALawCodec::EncodeSample(short sample)
 {
-  return linear2alaw(sample);
+  return g711_linear2alaw[(sample >> 3) & 0x1fff];
 }
 
 
 short H323_ALawCodec::DecodeSample(int sample)
 {
-  return (short)alaw2linear((unsigned char)sample);
+  return g711_alaw2linear[(unsigned char)sample];
+}
+
+
+void H323_ALawCodec::EncodeBlock(const short * samples, BYTE * buffer, PINDEX count)
+{
+  g711Kernels.alawEncoder(samples, buffer, count);
+}
+
+
+void H323_ALawCodec::DecodeBlock(const BYTE * buffer, short * samples, PINDEX count)
+{
+  while (count-- > 0)
+    *samples++ = g711_alaw2linear[*buffer++];
 }
 
 
@@ -1246,13 +2155,26 @@ H323_muLawCodec::H323_muLawCodec(Direction dir,
 
 int H323_muLawCodec::EncodeSample(short sample)
 {
-  return linear2ulaw(sample);
+  return g711_linear2ulaw[(sample >> 2) & 0x3fff];
 }
 
 
 short H323_muLawCodec::DecodeSample(int sample)
 {
-  return (short)ulaw2linear((unsigned char)sample);
+  return g711_ulaw2linear[(unsigned char)sample];
+}
+
+
+void H323_muLawCodec::EncodeBlock(const short * samples, BYTE * buffer, PINDEX count)
+{
+  g711Kernels.ulawEncoder(samples, buffer, count);
+}
+
+
+void H323_muLawCodec::DecodeBlock(const BYTE * buffer, short * samples, PINDEX count)
+{
+  while (count-- > 0)
+    *samples++ = g711_ulaw2linear[*buffer++];
 }
 
 
@@ -95,6 +95,10 @@ H323Gatekeeper::H323Gatekeeper(H323EndPoint & ep, H323Transport * trans)
   willRespondToIRR = FALSE;
   monitorStop = FALSE;
 
+  // Lightweight RRQ and periodic IRR only differ in sequence numbers and call identifiers
+  EnablePDUTemplate(H225_RasMessage::e_registrationRequest);
+  EnablePDUTemplate(H225_RasMessage::e_infoRequestResponse);
+
   monitor = PThread::Create(PCREATE_NOTIFIER(MonitorMain), 0,
                             PThread::NoAutoDeleteThread,
                             PThread::NormalPriority,
@@ -44,6 +44,8 @@
 #ifdef H323_GNUGK
 
 #include "gnugknat.h"
+#include <map>
+#include <vector>
 
 #if defined(_WIN32) && !defined(P_FORCE_STATIC_PLUGIN)
 #error "gnugknat.cxx must be compiled without precompiled headers"
@@ -56,10 +58,12 @@ PCREATE_NAT_PLUGIN(GnuGk);
 #endif
 
 
-WORD GNUGK_Feature::keepalive = 10;
+#define GNUGK_LOOP_POLL        200   // ms the event loop waits on the channels before checking keep-alives
+#define GNUGK_RECONNECT_WAIT  1000   // ms between attempts to reconnect a lost channel
+#define GNUGK_READ_SIZE       4096   // bytes the event loop reads from a readable channel
 
-GNUGKTransport * GNUGK_Feature::curtransport = NULL;
-PBoolean GNUGK_Feature::connectionlost = FALSE;
+WORD GNUGK_Feature::keepalive = 10;
+PBoolean GNUGK_Feature::consolidated = FALSE;
 
 ///////////////////////////////////////////////////////////////////////////////////
 
@@ -72,6 +76,10 @@ class GNUGKTransportThread : public PThread
    public:
     GNUGKTransportThread(H323EndPoint & endpoint, GNUGKTransport * transport, WORD KeepAlive =0);
 
+    /** Thread to handle a call whose Setup was read by the event loop
+     */
+    GNUGKTransportThread(H323EndPoint & endpoint, GNUGKTransport * transport, const H323SignalPDU & setup);
+
    protected:
     void Main();
     PDECLARE_NOTIFIER(PTimer, GNUGKTransportThread, Ping);    /// Timer to notify to poll for External IP
@@ -82,10 +90,61 @@ class GNUGKTransportThread : public PThread
 
     PTime   lastupdate;
 
+    PBoolean      hasSetup;
+    H323SignalPDU setupPDU;
 };
 
 /////////////////////////////////////////////////////////////////////////////
 
+// Consolidated mode event loop
+
+class GNUGKEventLoop : public PObject
+{
+   PCLASSINFO(GNUGKEventLoop, PObject)
+
+   public:
+    GNUGKEventLoop();
+
+    /** Service the channel from the loop, FALSE if it cannot be waited on with a select
+     */
+    PBoolean Add(GNUGKTransport * transport);
+
+    /** Stop servicing the channel, does not return while the loop is using it
+     */
+    void Remove(GNUGKTransport * transport);
+
+   protected:
+    struct Channel {
+      PSocket     * socket;
+      PTimeInterval nextKeepAlive;
+      PTimeInterval nextReconnect;
+      PBoolean      lost;
+      PBoolean      reconnecting;
+    };
+    typedef std::map<GNUGKTransport *, Channel> ChannelMap;
+
+    PBoolean IsServiced(GNUGKTransport * transport);
+    void ReadChannel(GNUGKTransport * transport);
+    void ChannelFailed(GNUGKTransport * transport);
+
+    PDECLARE_NOTIFIER(PThread, GNUGKEventLoop, Main);
+    PDECLARE_NOTIFIER(PThread, GNUGKEventLoop, ReconnectMain);
+
+    ChannelMap channels;
+    std::vector<GNUGKTransport *> reconnectQueue;
+
+    PMutex     mutex;            // Protects the channels and the queue
+    PMutex     roundMutex;       // Held while the loop services the channels
+    PMutex     reconnectMutex;   // Held while a channel is reconnecting
+    GNUGKTransport * reconnecting; // Channel being reconnected
+    PThread  * thread;
+    PThread  * reconnectThread;
+};
+
+static GNUGKEventLoop gnugkEventLoop;
+
+/////////////////////////////////////////////////////////////////////////////
+
 GNUGKTransportThread::GNUGKTransportThread(H323EndPoint & ep, GNUGKTransport * t, WORD KeepAlive)
   : PThread(ep.GetSignallingThreadStackSize(),
             AutoDeleteThread,
@@ -105,10 +164,26 @@ GNUGKTransportThread::GNUGKTransportThread(H323EndPoint & ep, GNUGKTransport * t
       Keep.RunContinuous(keepAlive * 1000); 
    }
 
+   hasSetup = FALSE;
+
 // Start the Thread
    Resume();
 }
 
+GNUGKTransportThread::GNUGKTransportThread(H323EndPoint & ep, GNUGKTransport * t, const H323SignalPDU & setup)
+  : PThread(ep.GetSignallingThreadStackSize(),
+            AutoDeleteThread,
+            NormalPriority,
+            "H225 Answer:%0x"),
+             transport(t), setupPDU(setup)
+{
+   isConnected = TRUE;
+   keepAlive = 0;
+   hasSetup = TRUE;
+
+   Resume();
+}
+
 void GNUGKTransportThread::Ping(PTimer &, H323_INT)
 { 
 
@@ -131,6 +206,12 @@ void GNUGKTransportThread::Ping(PTimer &, H323_INT)
 
 void GNUGKTransportThread::Main()
 {
+  if (hasSetup) {
+      PTRACE(3, "GNUGK\tStarted Call Thread");
+      transport->HandleGNUGKSetup(setupPDU, this);
+      return;
+  }
+
   PTRACE(3, "GNUGK\tStarted Listening-KeepAlive Thread");
 
   PBoolean ret = TRUE;
@@ -142,7 +223,7 @@ void GNUGKTransportThread::Main()
 
       if (!ret && transport->CloseTransport()) {  // Closing down Instruction
             PTRACE(3, "GNUGK\tShutting down GnuGk Thread");
-            GNUGK_Feature::curtransport = NULL;
+            transport->GetFeature()->curtransport = NULL;
             transport->ConnectionLost(TRUE);
 
       } else if (!ret) {   // We have a socket failure wait 1 sec and try again.
@@ -167,6 +248,225 @@ void GNUGKTransportThread::Main()
   PTRACE(3, "GNUGK\tTransport Closed");
 }
 
+/////////////////////////////////////////////////////////////////////////////
+
+GNUGKEventLoop::GNUGKEventLoop()
+  : reconnecting(NULL), thread(NULL), reconnectThread(NULL)
+{
+}
+
+PBoolean GNUGKEventLoop::Add(GNUGKTransport * transport)
+{
+    PChannel * channel = transport->GetReadChannel();
+    if (channel == NULL || !PIsDescendant(channel, PSocket))
+        return FALSE;
+
+    PWaitAndSignal m(mutex);
+
+    Channel & entry = channels[transport];
+    entry.socket = (PSocket *)channel;
+    entry.nextKeepAlive = PTimer::Tick() + PTimeInterval(GNUGK_Feature::keepalive * 1000);
+    entry.lost = FALSE;
+    entry.reconnecting = FALSE;
+
+    if (thread == NULL)
+        thread = PThread::Create(PCREATE_NOTIFIER(Main), 0,
+                                 PThread::AutoDeleteThread, PThread::NormalPriority, "GnuGk Loop");
+    PTRACE(4, "GNUGK\tEvent loop servicing " << channels.size() << " channels");
+    return TRUE;
+}
+
+void GNUGKEventLoop::Remove(GNUGKTransport * transport)
+{
+    PBoolean busy;
+    {
+        PWaitAndSignal m(mutex);
+        if (channels.erase(transport) == 0)
+            return;
+        for (size_t i = 0; i < reconnectQueue.size(); ++i) {
+            if (reconnectQueue[i] == transport)
+                reconnectQueue.erase(reconnectQueue.begin()+i--);
+        }
+        busy = (reconnecting == transport);
+    }
+
+    // Make sure the loop is finished with the channel, when closed from the
+    // loop itself the round is already held.
+    roundMutex.Wait();
+    roundMutex.Signal();
+
+    // Only wait for a reconnection of this channel, never for another one
+    if (busy) {
+        reconnectMutex.Wait();
+        reconnectMutex.Signal();
+    }
+}
+
+void GNUGKEventLoop::Main(PThread &, H323_INT)
+{
+    PTRACE(3, "GNUGK\tStarted Event Loop");
+
+    for (;;) {
+        PSocket::SelectList readList;
+        std::map<PSocket *, GNUGKTransport *> sockets;
+        std::vector<GNUGKTransport *> keepAlives;
+
+        // A channel being removed waits for the round to finish before it is
+        // closed, so the sockets selected on stay valid for the whole round.
+        roundMutex.Wait();
+
+        mutex.Wait();
+        if (channels.empty()) {
+            thread = NULL;
+            mutex.Signal();
+            roundMutex.Signal();
+            break;
+        }
+
+        PTimeInterval now = PTimer::Tick();
+        for (ChannelMap::iterator it = channels.begin(); it != channels.end(); ++it) {
+            Channel & entry = it->second;
+            if (entry.lost) {
+                if (!entry.reconnecting && now >= entry.nextReconnect) {
+                    entry.reconnecting = TRUE;
+                    reconnectQueue.push_back(it->first);
+                }
+                continue;
+            }
+            readList.Append(entry.socket);
+            sockets[entry.socket] = it->first;
+            if (GNUGK_Feature::keepalive > 0 && now >= entry.nextKeepAlive) {
+                keepAlives.push_back(it->first);
+                entry.nextKeepAlive = now + PTimeInterval(GNUGK_Feature::keepalive * 1000);
+            }
+        }
+        if (!reconnectQueue.empty() && reconnectThread == NULL)
+            reconnectThread = PThread::Create(PCREATE_NOTIFIER(ReconnectMain), 0,
+                                 PThread::AutoDeleteThread, PThread::NormalPriority, "GnuGk Reconnect");
+        mutex.Signal();
+
+        for (size_t i = 0; i < keepAlives.size(); ++i) {
+            if (IsServiced(keepAlives[i]))
+                keepAlives[i]->InitialPDU();
+        }
+
+        PBoolean selected = !sockets.empty() && PSocket::Select(readList, GNUGK_LOOP_POLL) == PChannel::NoError;
+        if (selected) {
+            for (PINDEX i = 0; i < readList.GetSize(); ++i) {
+                GNUGKTransport * transport = sockets[&readList[i]];
+                if (transport != NULL && IsServiced(transport))
+                    ReadChannel(transport);
+            }
+        }
+
+        roundMutex.Signal();
+
+        if (!selected)
+            PThread::Sleep(GNUGK_LOOP_POLL);
+    }
+
+    PTRACE(3, "GNUGK\tEvent Loop Stopped");
+}
+
+PBoolean GNUGKEventLoop::IsServiced(GNUGKTransport * transport)
+{
+    PWaitAndSignal m(mutex);
+    return channels.find(transport) != channels.end();
+}
+
+void GNUGKEventLoop::ReadChannel(GNUGKTransport * transport)
+{
+    // Read only what is waiting, a partial PDU is completed in a later round
+    // rather than blocking every other channel until the rest arrives.
+    if (!transport->ReadAvailable()) {
+        ChannelFailed(transport);
+        return;
+    }
+
+    // Handle all the PDUs which arrived together
+    while (transport->HasBufferedPDU()) {
+        H323SignalPDU pdu;
+        PBoolean setup = FALSE;
+        if (!transport->ReadGNUGKSignallingPDU(pdu, setup)) {
+            ChannelFailed(transport);
+            return;
+        }
+
+        if (setup) {
+            // The channel becomes the signalling channel of the call, handled by a thread of its own
+            mutex.Wait();
+            channels.erase(transport);
+            mutex.Signal();
+            new GNUGKTransportThread(transport->GetEndPoint(), transport, pdu);
+            return;
+        }
+    }
+}
+
+void GNUGKEventLoop::ChannelFailed(GNUGKTransport * transport)
+{
+    if (transport->CloseTransport()) {  // Closing down Instruction
+        PTRACE(3, "GNUGK\tShutting down GnuGk channel");
+        transport->GetFeature()->curtransport = NULL;
+        transport->ConnectionLost(TRUE);
+        mutex.Wait();
+        channels.erase(transport);
+        mutex.Signal();
+        return;
+    }
+
+    PTRACE(3, "GNUGK\tConnection Lost! Retrying Connection..");
+    transport->ConnectionLost(TRUE);
+
+    PWaitAndSignal m(mutex);
+    ChannelMap::iterator it = channels.find(transport);
+    if (it != channels.end()) {
+        it->second.lost = TRUE;
+        it->second.nextReconnect = PTimer::Tick();
+    }
+}
+
+void GNUGKEventLoop::ReconnectMain(PThread &, H323_INT)
+{
+    for (;;) {
+        mutex.Wait();
+        if (reconnectQueue.empty()) {
+            reconnectThread = NULL;
+            mutex.Signal();
+            break;
+        }
+        GNUGKTransport * transport = reconnectQueue.front();
+        reconnectQueue.erase(reconnectQueue.begin());
+        reconnectMutex.Wait();
+        reconnecting = transport;
+        mutex.Signal();
+
+        PBoolean connected = !transport->CloseTransport() && transport->Connect();
+        if (connected) {
+            PTRACE(3, "GNUGK\tConnection ReEstablished");
+            transport->ConnectionLost(FALSE);
+        } else {
+            PTRACE(3, "GNUGK\tReconnect Failed! Waiting " << GNUGK_RECONNECT_WAIT << "ms");
+        }
+
+        mutex.Wait();
+        ChannelMap::iterator it = channels.find(transport);
+        if (it != channels.end()) {
+            PChannel * channel = transport->GetReadChannel();
+            it->second.reconnecting = FALSE;
+            if (connected && channel != NULL && PIsDescendant(channel, PSocket)) {
+                it->second.socket = (PSocket *)channel;
+                it->second.lost = FALSE;
+                it->second.nextKeepAlive = PTimer::Tick() + PTimeInterval(GNUGK_Feature::keepalive * 1000);
+            } else
+                it->second.nextReconnect = PTimer::Tick() + PTimeInterval(GNUGK_RECONNECT_WAIT);
+        }
+        reconnecting = NULL;
+        mutex.Signal();
+        reconnectMutex.Signal();
+    }
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////
 
 GNUGKTransport::GNUGKTransport(H323EndPoint & endpoint,
@@ -176,11 +476,12 @@ GNUGKTransport::GNUGKTransport(H323EndPoint & endpoint,
                 )
    : H323TransportTCP(endpoint, binding), GKid(gkid), Feature(feat)
 {
-    GNUGK_Feature::curtransport = this;
+    Feature->curtransport = this;
     ReadTimeOut = PMaxTimeInterval;
     isConnected = FALSE;
     closeTransport = FALSE;
     remoteShutDown = FALSE;
+    inEventLoop = FALSE;
 }
 
 GNUGKTransport::~GNUGKTransport()
@@ -191,7 +492,16 @@ GNUGKTransport::~GNUGKTransport()
 PBoolean GNUGKTransport::HandleGNUGKSignallingSocket(H323SignalPDU & pdu)
 {
   for (;;) {
+      PBoolean setup = FALSE;
+      if (!ReadGNUGKSignallingPDU(pdu, setup))
+          return FALSE;
+      if (setup)
+          return TRUE;
+  }
+}
 
+PBoolean GNUGKTransport::ReadGNUGKSignallingPDU(H323SignalPDU & pdu, PBoolean & setup)
+{
       if (!IsOpen())
           return FALSE;
 
@@ -201,6 +511,8 @@ PBoolean GNUGKTransport::HandleGNUGKSignallingSocket(H323SignalPDU & pdu)
             if (GetErrorNumber(PChannel::LastReadError) == 0) {
               PTRACE(3, "GNUGK\tRemote SHUT DOWN or Intermediary Shutdown!");
               remoteShutDown = TRUE;
+              Feature->curtransport = NULL;
+              Close();
             }
             return FALSE;
       } else if ((rpdu.GetQ931().GetMessageType() == Q931::InformationMsg) &&
@@ -208,30 +520,77 @@ PBoolean GNUGKTransport::HandleGNUGKSignallingSocket(H323SignalPDU & pdu)
               // Handle unsolicited Information Message
       } else if (rpdu.GetQ931().GetMessageType() == Q931::SetupMsg) {
               pdu = rpdu;
-              return TRUE;
+              setup = TRUE;
       } else {
          PTRACE(3, "GNUGK\tUnknown PDU Received");
              return FALSE;
       }
+      return TRUE;
+}
 
-  }
+PBoolean GNUGKTransport::HasBufferedPDU() const
+{
+    PINDEX available = readBufferEnd - readBufferStart;
+    if (available < 1)
+        return FALSE;
+
+    // ReadPDU fails a bad TPKT straight away
+    const BYTE * tpkt = (const BYTE *)readBuffer + readBufferStart;
+    if (tpkt[0] != 3)
+        return TRUE;
+    if (available < 4)
+        return FALSE;
+
+    PINDEX packetLength = (tpkt[2] << 8)|tpkt[3];
+    return packetLength < 4 || available >= packetLength;
+}
+
+PBoolean GNUGKTransport::ReadAvailable()
+{
+    if (!IsOpen())
+        return FALSE;
+
+    // Move the partial PDU to the start of the buffer and make room after it
+    PINDEX available = readBufferEnd - readBufferStart;
+    if (readBufferStart > 0) {
+        memmove(readBuffer.GetPointer(), (const BYTE *)readBuffer + readBufferStart, available);
+        readBufferStart = 0;
+        readBufferEnd = available;
+    }
+    if (readBuffer.GetSize() - readBufferEnd < GNUGK_READ_SIZE)
+        readBuffer.SetSize(readBufferEnd + GNUGK_READ_SIZE);
+
+    if (Read(readBuffer.GetPointer() + readBufferEnd, readBuffer.GetSize() - readBufferEnd) &&
+        GetLastReadCount() > 0) {
+        readBufferEnd += GetLastReadCount();
+        return TRUE;
+    }
+
+    PTRACE(3, "GNUGK\tSocket Read Failure");
+    if (GetErrorNumber(PChannel::LastReadError) == 0) {
+        PTRACE(3, "GNUGK\tRemote SHUT DOWN or Intermediary Shutdown!");
+        remoteShutDown = TRUE;
+        Feature->curtransport = NULL;
+        Close();
+    }
+    return FALSE;
 }
 
 PBoolean GNUGKTransport::HandleGNUGKSignallingChannelPDU(PThread * thread)
 {
 
   H323SignalPDU pdu;
-  if (!HandleGNUGKSignallingSocket(pdu)) {
-    if (remoteShutDown) {   // Intentional Shutdown?
-      GNUGK_Feature::curtransport = NULL;
-      Close();
-    }
+  if (!HandleGNUGKSignallingSocket(pdu))
     return FALSE;
-  }
 
+  return HandleGNUGKSetup(pdu, thread);
+}
+
+PBoolean GNUGKTransport::HandleGNUGKSetup(H323SignalPDU & pdu, PThread * thread)
+{
     // Create a new transport to the GK as this one will be closed at the end of the call.
       isConnected = TRUE;
-      GNUGK_Feature::curtransport = NULL;
+      Feature->curtransport = NULL;
       CreateNewTransport();
 
     // Process the Tokens
@@ -289,6 +648,8 @@ PBoolean GNUGKTransport::ReadPDU(PBYTEArray & pdu)
 PBoolean GNUGKTransport::Connect() 
 { 
         PTRACE(4, "GNUGK\tConnecting to GK"  );
+    // Any partial PDU belonged to the lost connection
+    readBufferStart = readBufferEnd = 0;
     if (!H323TransportTCP::Connect())
         return FALSE;
     
@@ -302,16 +663,16 @@ void GNUGKTransport::ConnectionLost(PBoolean established)
     if (closeTransport)
         return;
          PTRACE(4,"GnuGK\tConnection lost " << established 
-              << " have " << GNUGK_Feature::connectionlost);
-    if (GNUGK_Feature::connectionlost != established) {
+              << " have " << Feature->connectionlost);
+    if (Feature->connectionlost != established) {
        GetEndPoint().NATLostConnection(established);
-       GNUGK_Feature::connectionlost = established;
+       Feature->connectionlost = established;
     }
 }
 
 PBoolean GNUGKTransport::IsConnectionLost()  
 { 
-    return GNUGK_Feature::connectionlost; 
+    return Feature->connectionlost; 
 }
 
 
@@ -366,7 +727,7 @@ PBoolean GNUGKTransport::CreateNewTransport()
 
     if (transport->Connect()) {
           PTRACE(3, "GNUGK\tConnected to " << transport->GetRemoteAddress());
-        new GNUGKTransportThread(transport->GetEndPoint(), transport,GNUGK_Feature::keepalive);
+        transport->StartService();
         if (transport->IsConnectionLost())
              transport->ConnectionLost(FALSE);
         return TRUE;
@@ -374,8 +735,22 @@ PBoolean GNUGKTransport::CreateNewTransport()
     return FALSE;
 }
 
+void GNUGKTransport::StartService()
+{
+    if (GNUGK_Feature::consolidated && gnugkEventLoop.Add(this)) {
+        inEventLoop = TRUE;
+        return;
+    }
+
+    new GNUGKTransportThread(GetEndPoint(), this, GNUGK_Feature::keepalive);
+}
+
 PBoolean GNUGKTransport::Close() 
 { 
+   // Before the shutdown lock, which the event loop may be waiting for
+   if (inEventLoop)
+       gnugkEventLoop.Remove(this);
+
    PWaitAndSignal m(shutdownMutex);
 
    PTRACE(4, "GNUGK\tClosing GnuGK NAT channel.");    
@@ -396,7 +771,7 @@ PBoolean GNUGKTransport::IsListening() const
   if (h245listener == NULL)
     return FALSE;
 
-  if (GNUGK_Feature::connectionlost)
+  if (Feature->connectionlost)
     return FALSE;
 
   return h245listener->IsOpen();
@@ -408,7 +783,7 @@ GNUGK_Feature::GNUGK_Feature(H323EndPoint & EP,
                              H323TransportAddress & remoteAddress, 
                              PString gkid,
                              WORD KeepAlive )
-     :  ep(EP), address(remoteAddress), GKid(gkid)
+     :  ep(EP), address(remoteAddress), GKid(gkid), curtransport(NULL), connectionlost(FALSE)
 {
     PTRACE(4, "GNUGK\tCreating GNUGK Feature.");    
     keepalive = KeepAlive;
@@ -431,7 +806,7 @@ PBoolean GNUGK_Feature::CreateNewTransport()
 
     if (transport->Connect()) {
      PTRACE(3, "GNUGK\tConnected to " << transport->GetRemoteAddress());
-        new GNUGKTransportThread(transport->GetEndPoint(), transport,keepalive);
+        transport->StartService();
         return TRUE;
     }
 
@@ -442,7 +817,7 @@ PBoolean GNUGK_Feature::CreateNewTransport()
 PBoolean GNUGK_Feature::ReRegister(const PString & newid)
 {
   // If there is a change in the gatekeeper id then notify the update socket
-    if ((GNUGK_Feature::curtransport != NULL) && curtransport->SetGKID(newid))
+    if ((curtransport != NULL) && curtransport->SetGKID(newid))
                  return curtransport->InitialPDU();       // Send on existing Transport
 
    return FALSE;
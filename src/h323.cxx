@@ -468,6 +468,9 @@ H323Connection::H323Connection(H323EndPoint & ep,
   q931Cause = Q931::ErrorInCauseIE;
 
   bandwidthAvailable = endpoint.GetInitialBandwidth();
+#ifdef H323_AUDIO_CODECS
+  audioRawSampleRate = 0;
+#endif
 
   useQ931Display = endpoint.UseQ931Display();
 
@@ -1370,19 +1373,32 @@ PBoolean H323Connection::DecodeFastStartCaps(const H225_ArrayOf_PASN_OctetString
   // Extract capabilities from the fast start OpenLogicalChannel structures
   PINDEX i;
   for (i = 0; i < fastStartCaps.GetSize(); i++) {
-    H245_OpenLogicalChannel open;
-    if (fastStartCaps[i].DecodeSubType(open)) {
-      PTRACE(4, "H225\tFast start open:\n  " << setprecision(2) << open);
-      unsigned error;
-      H323Channel * channel = CreateLogicalChannel(open, TRUE, error);
-      if (channel != NULL) {
-        if (channel->GetDirection() == H323Channel::IsTransmitter)
-          channel->SetNumber(logicalChannels->GetNextChannelNumber());
-        fastStartChannels.Append(channel);
-      }
+    // Only decode enough to see if we can handle the proposal at all
+    H323FastStartView view(fastStartCaps[i]);
+    if (!view.IsValid()) {
+      PTRACE(1, "H225\tInvalid fast start PDU decode:\n  " << view.GetPDU());
+      continue;
     }
-    else {
-      PTRACE(1, "H225\tInvalid fast start PDU decode:\n  " << open);
+
+    if (view.GetH2250Parameters() == NULL || localCapabilities.FindCapability(view.GetDataType()) == NULL) {
+      PTRACE(4, "H225\tFast start proposal " << view.GetChannelNumber() << " session "
+             << view.GetSessionID() << " not supported, skipping");
+      continue;
+    }
+
+    if (!view.Decode()) {
+      PTRACE(1, "H225\tInvalid fast start PDU decode:\n  " << view.GetPDU());
+      continue;
+    }
+
+    const H245_OpenLogicalChannel & open = view.GetPDU();
+    PTRACE(4, "H225\tFast start open:\n  " << setprecision(2) << open);
+    unsigned error;
+    H323Channel * channel = CreateLogicalChannel(open, TRUE, error);
+    if (channel != NULL) {
+      if (channel->GetDirection() == H323Channel::IsTransmitter)
+        channel->SetNumber(logicalChannels->GetNextChannelNumber());
+      fastStartChannels.Append(channel);
     }
   }
 
@@ -2995,19 +3011,23 @@ PBoolean H323Connection::HandleFastStartAcknowledge(const H225_ArrayOf_PASN_Octe
   // with a channel we requested AND it has all the information needed in the
   // m_multiplexParameters, then we can start the channel.
   for (i = 0; i < array.GetSize(); i++) {
-    H245_OpenLogicalChannel open;
-    if (array[i].DecodeSubType(open)) {
-      PTRACE(4, "H225\tFast start open:\n  " << setprecision(2) << open);
-      PBoolean reverse = open.HasOptionalField(H245_OpenLogicalChannel::e_reverseLogicalChannelParameters);
-      const H245_DataType & dataType = reverse ? open.m_reverseLogicalChannelParameters.m_dataType
-                                               : open.m_forwardLogicalChannelParameters.m_dataType;
-      H323Capability * replyCapability = localCapabilities.FindCapability(dataType);
+    // Full decode of the OLC is deferred until it matches a channel we requested
+    H323FastStartView view(array[i]);
+    if (view.IsValid()) {
+      PBoolean reverse = view.IsReverse();
+      H323Capability * replyCapability = localCapabilities.FindCapability(view.GetDataType());
       if (replyCapability != NULL) {
         for (PINDEX ch = 0; ch < fastStartChannels.GetSize(); ch++) {
           H323Channel & channelToStart = fastStartChannels[ch];
           H323Channel::Directions dir = channelToStart.GetDirection();
           if ((dir == H323Channel::IsReceiver) == reverse &&
                channelToStart.GetCapability() == *replyCapability) {
+            if (!view.Decode()) {
+              PTRACE(1, "H225\tInvalid fast start PDU decode:\n  " << setprecision(2) << view.GetPDU());
+              break;
+            }
+            const H245_OpenLogicalChannel & open = view.GetPDU();
+            PTRACE(4, "H225\tFast start open:\n  " << setprecision(2) << open);
             unsigned error = 1000;
             if (channelToStart.OnReceivedPDU(open, error)) {
               H323Capability * channelCapability;
@@ -3043,7 +3063,7 @@ PBoolean H323Connection::HandleFastStartAcknowledge(const H225_ArrayOf_PASN_Octe
       }
     }
     else {
-      PTRACE(1, "H225\tInvalid fast start PDU decode:\n  " << setprecision(2) << open);
+      PTRACE(1, "H225\tInvalid fast start PDU decode:\n  " << setprecision(2) << view.GetPDU());
     }
   }
 
@@ -3196,6 +3216,9 @@ PBoolean H323Connection::StartControlNegotiations(PBoolean renegotiate)
   if(renegotiate)  // makes reopening of media channels possible 
     connectionState = HasExecutedSignalConnect;
 
+  // Send the TCS and MSD to the remote together
+  H323TransportWriteBatch batch(h245Tunneling ? NULL : controlChannel);
+
   // Begin the capability exchange procedure
   if (!capabilityExchangeProcedure->Start(renegotiate)) {
     PTRACE(1, "H245\tStart of Capability Exchange failed");
@@ -3208,6 +3231,11 @@ PBoolean H323Connection::StartControlNegotiations(PBoolean renegotiate)
     return FALSE;
   }
 
+  if (!batch.End()) {
+    PTRACE(1, "H245\tWrite PDU fail: " << controlChannel->GetErrorText(PChannel::LastWriteError));
+    return HandleControlChannelFailure();
+  }
+
   endSessionNeeded = TRUE;
   return TRUE;
 }
@@ -4335,8 +4363,15 @@ void H323Connection::InternalEstablishedConnectionCheck()
 
     // If we are early starting, start channels as soon as possible instead of
     // waiting for connect PDU
-    if (earlyStart && FindChannel(RTP_Session::DefaultAudioSessionID, FALSE) == NULL)
+    if (earlyStart && FindChannel(RTP_Session::DefaultAudioSessionID, FALSE) == NULL) {
+      // Open the logical channels with a single write
+      H323TransportWriteBatch batch(h245Tunneling ? NULL : controlChannel);
       OnSelectLogicalChannels();
+      if (!batch.End()) {
+        PTRACE(1, "H245\tWrite PDU fail: " << controlChannel->GetErrorText(PChannel::LastWriteError));
+        HandleControlChannelFailure();
+      }
+    }
   }
 
 #ifdef H323_T120
@@ -4367,15 +4402,27 @@ void H323Connection::InternalEstablishedConnectionCheck()
       !mediaWaitForConnect &&
        connectionState == AwaitingSignalConnect &&
        FindChannel(RTP_Session::DefaultAudioSessionID, TRUE) != NULL &&
-       FindChannel(RTP_Session::DefaultAudioSessionID, FALSE) == NULL)
+       FindChannel(RTP_Session::DefaultAudioSessionID, FALSE) == NULL) {
+    H323TransportWriteBatch batch(h245Tunneling ? NULL : controlChannel);
     OnSelectLogicalChannels();
+    if (!batch.End()) {
+      PTRACE(1, "H245\tWrite PDU fail: " << controlChannel->GetErrorText(PChannel::LastWriteError));
+      HandleControlChannelFailure();
+    }
+  }
 
   if (connectionState != HasExecutedSignalConnect)
     return;
 
   // Check if we have already got a transmitter running, select one if not
-  if (FindChannel(RTP_Session::DefaultAudioSessionID, FALSE) == NULL)
+  if (FindChannel(RTP_Session::DefaultAudioSessionID, FALSE) == NULL) {
+    H323TransportWriteBatch batch(h245Tunneling ? NULL : controlChannel);
     OnSelectLogicalChannels();
+    if (!batch.End()) {
+      PTRACE(1, "H245\tWrite PDU fail: " << controlChannel->GetErrorText(PChannel::LastWriteError));
+      HandleControlChannelFailure();
+    }
+  }
 
   connectionState = EstablishedConnection;
 
@@ -5692,8 +5739,16 @@ PBoolean H323Connection::ReceivedH46024AMessage(bool toStart)
 
             for (std::map<unsigned,NAT_Sockets>::const_iterator r = m_NATSockets.begin(); r != m_NATSockets.end(); ++r) {
                 NAT_Sockets sockets = r->second;
-                ((H46019UDPSocket *)sockets.rtp)->H46024Adirect(toStart);
-                ((H46019UDPSocket *)sockets.rtcp)->H46024Adirect(toStart);
+                H46019UDPSocket * rtp = (H46019UDPSocket *)sockets.rtp;
+                H46019UDPSocket * rtcp = (H46019UDPSocket *)sockets.rtcp;
+                // Both sockets go direct on the kind of path the RTCP probing found,
+                // the RTP address of a reflexive path is derived from the RTCP one.
+                H46019UDPSocket::probe_candidate kind = H46019UDPSocket::e_candidateAlternate;
+                PIPSocket::Address addr;  WORD port = 0;  unsigned muxID = 0;
+                if (rtcp->GetDirectCandidate(kind, addr, port, muxID) && kind == H46019UDPSocket::e_candidateReflexive)
+                    rtp->AddReflexiveRTPCandidate(addr, port, muxID);
+                rtp->H46024Adirect(toStart, kind);
+                rtcp->H46024Adirect(toStart, kind);
             }
     //    }
 
@@ -5974,6 +6029,12 @@ PBoolean H323Connection::OnReceivedGenericMessage(h245MessageType type, const PS
                             H323TransportAddress add = H323TransportAddress(address[i].m_rtpAddress); 
                             ((H46019UDPSocket *)sockets.rtp)->H46024Bdirect(add,muxID);
                         }
+                        if (address[i].HasOptionalField(H46024B_AlternateAddress::e_rtcpAddress)) {
+                            // Probed along with the Annex A candidates
+                            PIPSocket::Address ip;  WORD port = 0;
+                            H323TransportAddress(address[i].m_rtcpAddress).GetIpAndPort(ip,port);
+                            ((H46019UDPSocket *)sockets.rtcp)->AddProbeCandidate(ip,port,muxID,H46019UDPSocket::e_candidateAnnexB);
+                        }
                     }
             }
             H323ControlPDU pdu;
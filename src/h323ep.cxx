@@ -500,6 +500,26 @@ class H225CallThread : public PThread
 };
 
 
+class H323MakeCallThread : public PThread
+{
+  PCLASSINFO(H323MakeCallThread, PThread)
+
+  public:
+    H323MakeCallThread(H323EndPoint & endpoint,
+                       const PString & remoteParty,
+                       void * userData,
+                       PBoolean supplimentary);
+
+  protected:
+    void Main();
+
+    H323EndPoint & endpoint;
+    PString        remoteParty;
+    void         * userData;
+    PBoolean       supplimentary;
+};
+
+
 class H323ConnectionsCleaner : public PThread
 {
   PCLASSINFO(H323ConnectionsCleaner, PThread)
@@ -607,6 +627,35 @@ void H225CallThread::Main()
 }
 
 
+/////////////////////////////////////////////////////////////////////////////
+
+H323MakeCallThread::H323MakeCallThread(H323EndPoint & ep,
+                                       const PString & party,
+                                       void * data,
+                                       PBoolean supp)
+  : PThread(ep.GetSignallingThreadStackSize(),
+            NoAutoDeleteThread,
+            NormalPriority,
+            "H323 MakeCall:%0x"),
+    endpoint(ep),
+    remoteParty(party),
+    userData(data),
+    supplimentary(supp)
+{
+  Resume();
+}
+
+
+void H323MakeCallThread::Main()
+{
+  PTRACE(3, "H323\tResolving " << remoteParty << " for call");
+
+  PString token;
+  endpoint.MakeCall(remoteParty, token, userData, supplimentary);
+  endpoint.OnMakeCallAsync(remoteParty, token, userData);
+}
+
+
 /////////////////////////////////////////////////////////////////////////////
 
 H323ConnectionsCleaner::H323ConnectionsCleaner(H323EndPoint & ep)
@@ -753,6 +802,9 @@ H323EndPoint::H323EndPoint()
 
   rtpIpPorts.current = rtpIpPorts.base = 5001;
   rtpIpPorts.max = 5999;
+  rtpIpPorts.tracked = TRUE;
+  tcpPorts.tracked = TRUE;
+  rtpSocketPool = new RTP_UDPSocketPool(*this);
 
   // use dynamic port allocation by default
   tcpPorts.current = tcpPorts.base = tcpPorts.max = 0;
@@ -943,6 +995,9 @@ H323EndPoint::~H323EndPoint()
   }
 #endif
 
+  // ClearAllCalls() in the descendant destructor should have waited for these
+  PTRACE_IF(2, !makeCallThreads.empty(), "H323\tMakeCallAsync() calls still running in endpoint destructor");
+
   // And shut down the gatekeeper (if there was one)
   RemoveGatekeeper();
 
@@ -962,6 +1017,13 @@ H323EndPoint::~H323EndPoint()
   // Clean up any connections that the cleaner thread missed
   CleanUpConnections();
 
+  // Pre-opened RTP sockets go before the port ranges they came from
+  delete rtpSocketPool;
+
+  for (std::map<PString, PortInfo *>::iterator i = rtpIpInterfacePorts.begin(); i != rtpIpInterfacePorts.end(); ++i)
+    delete i->second;
+  rtpIpInterfacePorts.clear();
+
 #ifdef H323_TLS
   if (m_transportContext) {
     delete m_transportContext;
@@ -1874,6 +1936,62 @@ H323Connection * H323EndPoint::MakeCallLocked(const PString & remoteParty,
 
 }
 
+
+PBoolean H323EndPoint::MakeCallAsync(const PString & remoteParty,
+                                     void * userData,
+                                     PBoolean supplimentary)
+{
+  if (remoteParty.IsEmpty())
+    return FALSE;
+
+  PWaitAndSignal m(makeCallThreadsMutex);
+
+  // Reap the threads of calls already made
+  std::deque<PThread *>::iterator i = makeCallThreads.begin();
+  while (i != makeCallThreads.end()) {
+    if ((*i)->IsTerminated()) {
+      delete *i;
+      i = makeCallThreads.erase(i);
+    }
+    else
+      ++i;
+  }
+
+  makeCallThreads.push_back(new H323MakeCallThread(*this, remoteParty, userData, supplimentary));
+  return TRUE;
+}
+
+
+void H323EndPoint::WaitForMakeCallThreads()
+{
+  // A thread calling back from OnMakeCallAsync() cannot wait for itself
+  PThread * current = PThread::Current();
+
+  for (;;) {
+    makeCallThreadsMutex.Wait();
+    std::deque<PThread *>::iterator i = makeCallThreads.begin();
+    while (i != makeCallThreads.end() && *i == current)
+      ++i;
+    if (i == makeCallThreads.end()) {
+      makeCallThreadsMutex.Signal();
+      break;
+    }
+    PThread * thread = *i;
+    makeCallThreads.erase(i);
+    makeCallThreadsMutex.Signal();
+
+    thread->WaitForTermination();
+    delete thread;
+  }
+}
+
+
+void H323EndPoint::OnMakeCallAsync(const PString & /*remoteParty*/,
+                                   const PString & /*token*/,
+                                   void * /*userData*/)
+{
+}
+
 H323Connection * H323EndPoint::InternalMakeCall(const PString & trasferFromToken,
                                                 const PString & callIdentity,
                                                 unsigned capabilityLevel,
@@ -2062,6 +2180,212 @@ static PBoolean FindRoutes(const PString & domain, WORD port, std::vector<Lookup
   return routes.size() != 0;
 }
 */
+
+#define H323_DNS_CACHE_SIZE   256   // Entries before expired ones are purged
+
+H323DNSCache::H323DNSCache()
+  : m_foundTTL(0, 0, 5), m_notFoundTTL(0, 30)
+{
+}
+
+
+H323DNSCache::~H323DNSCache()
+{
+  Clear();
+}
+
+
+void H323DNSCache::SetTimeToLive(const PTimeInterval & found, const PTimeInterval & notFound)
+{
+  PWaitAndSignal m(m_mutex);
+  m_foundTTL = found;
+  m_notFoundTTL = notFound;
+}
+
+
+void H323DNSCache::Clear()
+{
+  PWaitAndSignal m(m_mutex);
+
+  // Lookups in progress are finished by the threads doing them
+  EntryMap::iterator i = m_entries.begin();
+  while (i != m_entries.end()) {
+    if (i->second.pending == NULL)
+      m_entries.erase(i++);
+    else
+      ++i;
+  }
+}
+
+
+PBoolean H323DNSCache::LookupSRV(const PString & url, const PString & service, PStringList & results)
+{
+  PINDEX at = url.Find('@');
+  if (at == P_MAX_INDEX || at == url.GetLength()-1)
+    return FALSE;
+
+  PString user = url.Left(at);
+  PString domain = url.Mid(at+1);
+  PINDEX end = domain.FindOneOf(":;");
+  if (end != P_MAX_INDEX)
+    domain = domain.Left(end);
+
+  PStringList addresses;
+  if (!Lookup(e_SRV, service + domain, PString::Empty(), addresses))
+    return FALSE;
+
+  for (PINDEX i = 0; i < addresses.GetSize(); i++)
+    results.AppendString(user + "@" + addresses[i]);
+  return TRUE;
+}
+
+
+PBoolean H323DNSCache::ENUMLookup(const PString & number, const PString & service, PString & result)
+{
+  PStringList urls;
+  if (!Lookup(e_ENUM, number, service, urls) || urls.GetSize() == 0)
+    return FALSE;
+
+  result = urls[0];
+  return TRUE;
+}
+
+
+PBoolean H323DNSCache::GetHostAddress(const PString & host, PIPSocket::Address & addr)
+{
+  PStringList addresses;
+  if (!Lookup(e_Host, host, PString::Empty(), addresses) || addresses.GetSize() == 0)
+    return FALSE;
+
+  addr = PIPSocket::Address(addresses[0]);
+  return addr.IsValid();
+}
+
+
+PBoolean H323DNSCache::QuerySRV(const PString & name, PStringList & results)
+{
+  PDNS::SRVRecordList srvRecords;
+  if (!PDNS::GetRecords(name, srvRecords))
+    return FALSE;
+
+  PDNS::SRVRecord * recPtr = srvRecords.GetFirst();
+  while (recPtr != NULL) {
+    // Skip targets that did not resolve
+    if (recPtr->hostAddress.IsValid() && !recPtr->hostAddress.IsAny())
+      results.AppendString(recPtr->hostAddress.AsString() + ":" + PString(PString::Unsigned, recPtr->port));
+    recPtr = srvRecords.GetNext();
+  }
+  return results.GetSize() > 0;
+}
+
+
+PBoolean H323DNSCache::QueryENUM(const PString & number, const PString & service, PStringList & results)
+{
+  PString str;
+  if (!PDNS::ENUMLookup(number, service, str))
+    return FALSE;
+
+  results.AppendString(str);
+  return TRUE;
+}
+
+
+PBoolean H323DNSCache::QueryHost(const PString & host, PStringList & results)
+{
+  PIPSocket::Address addr;
+  if (!PIPSocket::GetHostAddress(host, addr))
+    return FALSE;
+
+  results.AppendString(addr.AsString());
+  return TRUE;
+}
+
+
+PBoolean H323DNSCache::Lookup(QueryType type, const PString & name, const PString & param, PStringList & results)
+{
+  PString key = psprintf("%u ", type) + param + " " + name.ToLower();
+
+  m_mutex.Wait();
+
+  PTimeInterval now = PTimer::Tick();
+  EntryMap::iterator it = m_entries.find(key);
+  if (it != m_entries.end()) {
+    Entry & entry = it->second;
+    if (entry.pending != NULL) {
+      // Someone else is looking it up, wait for their answer
+      Pending * pending = entry.pending;
+      pending->waiters++;
+      m_mutex.Signal();
+      pending->done.Wait();
+
+      m_mutex.Wait();
+      results = pending->results;
+      PBoolean found = pending->found;
+      if (--pending->waiters == 0)
+        delete pending;
+      m_mutex.Signal();
+      return found;
+    }
+    if (entry.expires > now) {
+      PTRACE(5, "H323\tDNS cache " << (entry.found ? "hit" : "negative hit") << " for " << name);
+      results = entry.results;
+      PBoolean found = entry.found;
+      m_mutex.Signal();
+      return found;
+    }
+  }
+
+  if (m_entries.size() >= H323_DNS_CACHE_SIZE) {
+    EntryMap::iterator i = m_entries.begin();
+    while (i != m_entries.end()) {
+      if (i->second.pending == NULL && i->second.expires <= now)
+        m_entries.erase(i++);
+      else
+        ++i;
+    }
+  }
+
+  Pending * pending = new Pending;
+  m_entries[key].pending = pending;
+  m_mutex.Signal();
+
+  PStringList found;
+  PBoolean ok = FALSE;
+  switch (type) {
+    case e_SRV :
+      ok = QuerySRV(name, found);
+      break;
+    case e_ENUM :
+      ok = QueryENUM(name, param, found);
+      break;
+    case e_Host :
+      ok = QueryHost(name, found);
+      break;
+  }
+  PTRACE(4, "H323\tDNS lookup of " << name << (ok ? " found " : " failed ") << found.GetSize() << " results");
+
+  m_mutex.Wait();
+  Entry & entry = m_entries[key];
+  entry.results = found;
+  entry.found = ok;
+  entry.expires = PTimer::Tick() + (ok ? m_foundTTL : m_notFoundTTL);
+  entry.pending = NULL;
+
+  // The last waiter to wake deletes the pending record
+  if (pending->waiters == 0)
+    delete pending;
+  else {
+    pending->results = found;
+    pending->found = ok;
+    for (unsigned i = 0; i < pending->waiters; i++)
+      pending->done.Signal();
+  }
+  m_mutex.Signal();
+
+  results = found;
+  return ok;
+}
+
 #endif
 
 PBoolean H323EndPoint::ResolveCallParty(const PString & _remoteParty, PStringList & addresses)
@@ -2091,7 +2415,7 @@ PBoolean H323EndPoint::ResolveCallParty(const PString & _remoteParty, PStringLis
         break;
         if (i >= number.GetLength()) {
            PString str;
-          if (PDNS::ENUMLookup(number, "E2U+h323", str)) {
+          if (dnsCache.ENUMLookup(number, "E2U+h323", str)) {
             str.Replace("+","");
             if ((str.Find("//1") != P_MAX_INDEX) &&
                  (str.Find('@') != P_MAX_INDEX)) {
@@ -2126,7 +2450,7 @@ PBoolean H323EndPoint::ResolveCallParty(const PString & _remoteParty, PStringLis
        PBoolean found = FALSE;
 
        if (!found) str.RemoveAll();
-       if (!found && (PDNS::LookupSRV(number,"_h323cs._tcp.",str))) {
+       if (!found && (dnsCache.LookupSRV(number,"_h323cs._tcp.",str))) {
            for (PINDEX i=0; i<str.GetSize(); i++) {
              PString dom = str[i].Mid(str[i].Find('@')+1);
              if (dom.Left(7) == "0.0.0.0") {
@@ -2140,7 +2464,7 @@ PBoolean H323EndPoint::ResolveCallParty(const PString & _remoteParty, PStringLis
        }
 /*
        if (!found) str.RemoveAll();
-       if (!found && (PDNS::LookupSRV(number,"_h323ls._udp.",str))) {
+       if (!found && (dnsCache.LookupSRV(number,"_h323ls._udp.",str))) {
            for (PINDEX j=0; j<str.GetSize(); j++) {
             PString a = str[j].Mid(str[j].Find('@')+1);
                 H323TransportAddress newAddr, gkAddr(a);
@@ -2419,10 +2743,29 @@ PBoolean H323EndPoint::ParsePartyName(const PString & _remoteParty,
     }
 #endif   // P_DNS
 */
-  } 
+  }
 
-  if (!address)
+  if (!address) {
+#if P_DNS
+    // Resolve a host name through the DNS cache so repeated calls to the
+    // same host do not each wait on the resolver.
+    PString host = address.Mid(address.Find('$')+1);
+    PString service;
+    PINDEX colon = host.Find(':', host.FindLast(']') != P_MAX_INDEX ? host.FindLast(']') : 0);
+    if (colon != P_MAX_INDEX) {
+      service = host.Mid(colon+1);
+      host = host.Left(colon);
+    }
+    unsigned port = service.AsUnsigned();
+    PIPSocket::Address ip;
+    if (host != "*" && host[0] != '[' && !PIPSocket::Address(host).IsValid() && (service.IsEmpty() || port != 0) &&
+        dnsCache.GetHostAddress(host, ip)) {
+      address = H323TransportAddress(ip, (WORD)port);
+      PTRACE(4, "H323\tResolved host " << host << " to " << address);
+    }
+#endif
     return TRUE;
+  }
 
   // We do not have a gk and user did not explicitly supply a host, so lets
   // do a check to see if it is a valid IP address or hostname if not registered.
@@ -2650,6 +2993,10 @@ void H323EndPoint::ClearAllCalls(H323Connection::CallEndReason reason,
     The real work is done in the H323ConnectionsCleaner thread.
    */
 
+  // Calls still being made by MakeCallAsync() are finished first
+  if (wait)
+    WaitForMakeCallThreads();
+
   connectionsMutex.Wait();
 
   // Add all connections to the to be deleted set
@@ -3068,7 +3415,7 @@ PBoolean H323EndPoint::OpenAudioChannel(H323Connection & /*connection*/,
 
 #ifdef P_AUDIO
 
-  int rate = codec.GetMediaFormat().GetTimeUnits() * 1000;
+  int rate = codec.GetRawSampleRate();
 
   PString deviceName;
   PString deviceDriver;
@@ -3789,6 +4136,12 @@ void H323EndPoint::PortInfo::Set(unsigned newBase,
   current = base = (WORD)newBase;
   max = (WORD)newMax;
 
+  // Start tracking afresh, ports already handed out are released harmlessly
+  inUse.clear();
+  freeList.clear();
+  lent.clear();
+  used = 0;
+
   mutex.Signal();
 }
 
@@ -3803,11 +4156,106 @@ WORD H323EndPoint::PortInfo::GetNext(unsigned increment)
   if (current == 0)
     return 0;
 
+  if (tracked) {
+    unsigned slots = max > base + increment ? (max - base)/increment : 1;
+    if (step != increment || inUse.size() != (slots+7)/8) {
+      step = increment;
+      inUse.assign((slots+7)/8, 0);
+      freeList.clear();
+      lent.clear();
+      used = 0;
+    }
+
+    // Reuse released ports first, oldest release first
+    while (!freeList.empty()) {
+      WORD p = freeList.front();
+      freeList.pop_front();
+      unsigned idx = (p - base)/step;
+      if (p >= base && idx < slots && (inUse[idx>>3] & (1 << (idx&7))) == 0) {
+        inUse[idx>>3] |= (BYTE)(1 << (idx&7));
+        used++;
+        return p;
+      }
+    }
+
+    // Then the next port not in use after the last one handed out, skipping
+    // whole bytes of the bitmap at a time when they are full.
+    if (used < slots) {
+      unsigned idx = (current - base)/step;
+      for (unsigned n = 0; n < slots; ) {
+        if (inUse[idx>>3] == 0xff && (idx&7) == 0 && idx+8 <= slots) {
+          idx += 8;
+          n += 8;
+        }
+        else if ((inUse[idx>>3] & (1 << (idx&7))) == 0) {
+          inUse[idx>>3] |= (BYTE)(1 << (idx&7));
+          used++;
+          unsigned next = base + (idx+1)*step;
+          current = (WORD)(next > (unsigned)(max-increment) ? base : next);
+          return (WORD)(base + idx*step);
+        }
+        else {
+          idx++;
+          n++;
+        }
+        if (idx >= slots)
+          idx = 0;
+      }
+    }
+
+    // Everything is in use, hand out the next anyway. It is lent on top of
+    // its owner, so the first Release() of it only returns the loan and the
+    // port stays marked until it has been released by both.
+    PTRACE(2, "H323\tAll " << slots << " ports from " << base << " to " << max << " in use");
+    WORD p = current;
+    current = (WORD)(current + increment);
+    lent[p]++;
+    return p;
+  }
+
   WORD p = current;
   current = (WORD)(current + increment);
   return p;
 }
 
+
+PBoolean H323EndPoint::PortInfo::Reserve(WORD port)
+{
+  PWaitAndSignal m(mutex);
+
+  unsigned idx = (port - base)/step;
+  if (!tracked || port < base || idx >= inUse.size()*8)
+    return TRUE;
+
+  if ((inUse[idx>>3] & (1 << (idx&7))) != 0)
+    return FALSE;
+
+  inUse[idx>>3] |= (BYTE)(1 << (idx&7));
+  used++;
+  return TRUE;
+}
+
+
+void H323EndPoint::PortInfo::Release(WORD port)
+{
+  PWaitAndSignal m(mutex);
+
+  unsigned idx = (port - base)/step;
+  if (!tracked || port < base || idx >= inUse.size()*8 || (inUse[idx>>3] & (1 << (idx&7))) == 0)
+    return;
+
+  std::map<WORD, unsigned>::iterator loan = lent.find(port);
+  if (loan != lent.end()) {
+    if (--loan->second == 0)
+      lent.erase(loan);
+    return;
+  }
+
+  inUse[idx>>3] &= (BYTE)~(1 << (idx&7));
+  used--;
+  freeList.push_back(port);
+}
+
 #ifdef H323_H46019M
 unsigned H323EndPoint::MuxIDInfo::GetNext(unsigned increment)
 {
@@ -3836,6 +4284,12 @@ WORD H323EndPoint::GetNextTCPPort()
 }
 
 
+void H323EndPoint::ReleaseTCPPort(WORD port)
+{
+  tcpPorts.Release(port);
+}
+
+
 void H323EndPoint::SetUDPPorts(unsigned udpBase, unsigned udpMax)
 {
   udpPorts.Set(udpBase, udpMax, 199, 0);
@@ -3854,6 +4308,7 @@ WORD H323EndPoint::GetNextUDPPort()
 
 void H323EndPoint::SetRtpIpPorts(unsigned rtpIpBase, unsigned rtpIpMax)
 {
+  rtpSocketPool->Clear();
   rtpIpPorts.Set((rtpIpBase+1)&0xfffe, rtpIpMax&0xfffe, 999, 5000);
 
 #ifdef P_STUN
@@ -3862,11 +4317,57 @@ void H323EndPoint::SetRtpIpPorts(unsigned rtpIpBase, unsigned rtpIpMax)
 }
 
 
+void H323EndPoint::SetRtpIpPorts(const PIPSocket::Address & iface, unsigned rtpIpBase, unsigned rtpIpMax)
+{
+  rtpSocketPool->Clear();
+
+  PWaitAndSignal m(rtpIpInterfaceMutex);
+
+  PortInfo * & info = rtpIpInterfacePorts[iface.AsString()];
+  if (info == NULL) {
+    info = new PortInfo;
+    info->tracked = TRUE;
+  }
+  info->Set((rtpIpBase+1)&0xfffe, rtpIpMax&0xfffe, 999, 5000);
+}
+
+
+H323EndPoint::PortInfo & H323EndPoint::GetRtpIpPortInfo(const PIPSocket::Address & iface)
+{
+  PWaitAndSignal m(rtpIpInterfaceMutex);
+
+  if (!rtpIpInterfacePorts.empty()) {
+    std::map<PString, PortInfo *>::iterator i = rtpIpInterfacePorts.find(iface.AsString());
+    if (i != rtpIpInterfacePorts.end())
+      return *i->second;
+  }
+  return rtpIpPorts;
+}
+
+
 WORD H323EndPoint::GetRtpIpPortPair()
 {
   return rtpIpPorts.GetNext(2);
 }
 
+
+WORD H323EndPoint::GetRtpIpPortPair(const PIPSocket::Address & iface)
+{
+  return GetRtpIpPortInfo(iface).GetNext(2);
+}
+
+
+PBoolean H323EndPoint::ReserveRtpIpPortPair(WORD port, const PIPSocket::Address & iface)
+{
+  return GetRtpIpPortInfo(iface).Reserve(port);
+}
+
+
+void H323EndPoint::ReleaseRtpIpPortPair(WORD port, const PIPSocket::Address & iface)
+{
+  GetRtpIpPortInfo(iface).Release(port);
+}
+
 #ifdef H323_H46019M
 void H323EndPoint::SetMultiplexPort(unsigned rtpPort)
 {
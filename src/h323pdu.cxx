@@ -1238,7 +1238,9 @@ PBoolean H323SignalPDU::ProcessReadData(H323Transport & transport, const PBYTEAr
     return FALSE;
   }
 
-  if (!q931pdu.HasIE(Q931::UserUserIE)) {
+  const BYTE * userUserData;
+  PINDEX userUserLength;
+  if (!q931pdu.GetIE(Q931::UserUserIE, userUserData, userUserLength)) {
     m_h323_uu_pdu.m_h323_message_body.SetTag(H225_H323_UU_PDU_h323_message_body::e_empty);
     PTRACE(1, "H225\tNo Q931 User-User Information Element,"
               "\nRaw PDU:\n" << hex << setfill('0')
@@ -1248,7 +1250,9 @@ PBoolean H323SignalPDU::ProcessReadData(H323Transport & transport, const PBYTEAr
     return TRUE;
   }
 
-  PPER_Stream strm = q931pdu.GetIE(Q931::UserUserIE);
+  // Decode the UUIE straight out of the received data, without copying it
+  PBYTEArray userUser(userUserData, userUserLength, FALSE);
+  PPER_Stream strm(userUser);
   if (!Decode(strm)) {
     PTRACE(1, "H225\tRead error: PER decode failure in Q.931 User-User Information Element,"
               "\nRaw PDU:\n" << hex << setfill('0')
@@ -1271,9 +1275,13 @@ PBoolean H323SignalPDU::Write(H323Transport & transport, H323Connection * connec
   if (!q931pdu.HasIE(Q931::UserUserIE) && m_h323_uu_pdu.m_h323_message_body.IsValid())
     BuildQ931();
 
+  // Single pass encode of the Q.931 straight into the output buffer
+  PINDEX length;
+  PINDEX size = q931pdu.GetEncodedSize();
   PBYTEArray rawData;
-  if (!q931pdu.Encode(rawData))
+  if (!q931pdu.Encode(rawData.GetPointer(size), size, length))
     return FALSE;
+  rawData.SetSize(length);
 
   if (connection != NULL) {
       int tag = m_h323_uu_pdu.m_h323_message_body.GetTag();
@@ -1927,6 +1935,120 @@ H245_EndSessionCommand & H323ControlPDU::BuildEndSessionCommand(unsigned reason)
 }
 
 
+/////////////////////////////////////////////////////////////////////////////
+
+H323FastStartView::H323FastStartView(const PASN_OctetString & encoded)
+  : rawData(encoded.GetValue()),
+    valid(FALSE),
+    reverse(FALSE),
+    decoded(FALSE)
+{
+  PPER_Stream strm = rawData;
+
+  if (!open.PreambleDecode(strm))
+    return;
+  if (!open.m_forwardLogicalChannelNumber.Decode(strm))
+    return;
+
+  if (open.HasOptionalField(H245_OpenLogicalChannel::e_reverseLogicalChannelParameters)) {
+    // Forward parameters are only nullData in this case, so decode in full to
+    // get to the reverse parameters, which are the ones we need.
+    if (!open.m_forwardLogicalChannelParameters.Decode(strm))
+      return;
+
+    H245_OpenLogicalChannel_reverseLogicalChannelParameters & param = open.m_reverseLogicalChannelParameters;
+    if (!param.PreambleDecode(strm))
+      return;
+    if (!param.m_dataType.Decode(strm))
+      return;
+    if (param.HasOptionalField(H245_OpenLogicalChannel_reverseLogicalChannelParameters::e_multiplexParameters) &&
+                                                          !param.m_multiplexParameters.Decode(strm))
+      return;
+    reverse = TRUE;
+  }
+  else {
+    H245_OpenLogicalChannel_forwardLogicalChannelParameters & param = open.m_forwardLogicalChannelParameters;
+    if (!param.PreambleDecode(strm))
+      return;
+    if (param.HasOptionalField(H245_OpenLogicalChannel_forwardLogicalChannelParameters::e_portNumber) &&
+                                                          !param.m_portNumber.Decode(strm))
+      return;
+    if (!param.m_dataType.Decode(strm))
+      return;
+    if (!param.m_multiplexParameters.Decode(strm))
+      return;
+  }
+
+  valid = TRUE;
+}
+
+
+unsigned H323FastStartView::GetChannelNumber() const
+{
+  return open.m_forwardLogicalChannelNumber;
+}
+
+
+const H245_DataType & H323FastStartView::GetDataType() const
+{
+  return reverse ? open.m_reverseLogicalChannelParameters.m_dataType
+                 : open.m_forwardLogicalChannelParameters.m_dataType;
+}
+
+
+const H245_H2250LogicalChannelParameters * H323FastStartView::GetH2250Parameters() const
+{
+  if (!valid)
+    return NULL;
+
+  if (reverse) {
+    const H245_OpenLogicalChannel_reverseLogicalChannelParameters & param = open.m_reverseLogicalChannelParameters;
+    if (!param.HasOptionalField(H245_OpenLogicalChannel_reverseLogicalChannelParameters::e_multiplexParameters) ||
+         param.m_multiplexParameters.GetTag() !=
+              H245_OpenLogicalChannel_reverseLogicalChannelParameters_multiplexParameters::e_h2250LogicalChannelParameters)
+      return NULL;
+    return &(const H245_H2250LogicalChannelParameters &)param.m_multiplexParameters;
+  }
+
+  const H245_OpenLogicalChannel_forwardLogicalChannelParameters & param = open.m_forwardLogicalChannelParameters;
+  if (param.m_multiplexParameters.GetTag() !=
+              H245_OpenLogicalChannel_forwardLogicalChannelParameters_multiplexParameters::e_h2250LogicalChannelParameters)
+    return NULL;
+  return &(const H245_H2250LogicalChannelParameters &)param.m_multiplexParameters;
+}
+
+
+unsigned H323FastStartView::GetSessionID() const
+{
+  const H245_H2250LogicalChannelParameters * param = GetH2250Parameters();
+  return param != NULL ? (unsigned)param->m_sessionID : 0;
+}
+
+
+PBoolean H323FastStartView::GetMediaAddress(H323TransportAddress & address) const
+{
+  const H245_H2250LogicalChannelParameters * param = GetH2250Parameters();
+  if (param == NULL || !param->HasOptionalField(H245_H2250LogicalChannelParameters::e_mediaChannel))
+    return FALSE;
+
+  address = H323TransportAddress(param->m_mediaChannel);
+  return TRUE;
+}
+
+
+PBoolean H323FastStartView::Decode()
+{
+  if (decoded)
+    return TRUE;
+
+  PPER_Stream strm = rawData;
+  open = H245_OpenLogicalChannel();
+  decoded = open.Decode(strm);
+  valid = decoded;
+  return decoded;
+}
+
+
 /////////////////////////////////////////////////////////////////////////////
 
 H323RasPDU::H323RasPDU()
@@ -2104,6 +2226,45 @@ void H323RasPDU::DeletePDU()
 }
 
 
+PBoolean H323RasPDU::SetTemplateFields(H323PDUTemplate & tmpl)
+{
+  switch (GetTag()) {
+    case H225_RasMessage::e_registrationRequest :
+    {
+      H225_RegistrationRequest & rrq = *this;
+      // Tokens change on every PDU, never worth a template
+      if (rrq.HasOptionalField(H225_RegistrationRequest::e_tokens) ||
+          rrq.HasOptionalField(H225_RegistrationRequest::e_cryptoTokens))
+        return FALSE;
+      tmpl.AddField(rrq.m_requestSeqNum);
+      break;
+    }
+
+    case H225_RasMessage::e_infoRequestResponse :
+    {
+      H225_InfoRequestResponse & irr = *this;
+      if (irr.HasOptionalField(H225_InfoRequestResponse::e_tokens) ||
+          irr.HasOptionalField(H225_InfoRequestResponse::e_cryptoTokens))
+        return FALSE;
+      tmpl.AddField(irr.m_requestSeqNum);
+      // Periodic in call IRR only differ by the call they refer to
+      if (irr.HasOptionalField(H225_InfoRequestResponse::e_perCallInfo) && irr.m_perCallInfo.GetSize() == 1) {
+        H225_InfoRequestResponse_perCallInfo_subtype & info = irr.m_perCallInfo[0];
+        tmpl.AddField(info.m_callReferenceValue);
+        tmpl.AddField(info.m_conferenceID);
+        tmpl.AddField(info.m_callIdentifier.m_guid);
+      }
+      break;
+    }
+
+    default :
+      break;
+  }
+
+  return TRUE;
+}
+
+
 H225_GatekeeperRequest & H323RasPDU::BuildGatekeeperRequest(unsigned seqNum)
 {
   SetTag(e_gatekeeperRequest);
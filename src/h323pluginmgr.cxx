@@ -44,6 +44,10 @@
 #include <mediafmt.h>
 #include <openh323buildopts.h>
 
+#include <map>
+#include <deque>
+#include <vector>
+
 #define H323CAP_TAG_PREFIX    "h323"
 static const char GET_CODEC_OPTIONS_CONTROL[]       = "get_codec_options";
 static const char FREE_CODEC_OPTIONS_CONTROL[]      = "free_codec_options";
@@ -112,6 +116,7 @@ inline static bool IsValidMPI(int mpi) {
 }
 
 #define FASTPICTUREINTERVAL  1000
+#define DECODE_FAILURES_BEFORE_GROWING 3   // Decoder buffer grows after this many failed frames in a row
 
 #endif // H323_VIDEO
 
@@ -197,13 +202,6 @@ class OpalPluginCodec : public OpalFactoryCodec {
 
 #ifdef H323_AUDIO_CODECS
 
-extern "C" {
-  unsigned char linear2ulaw(int pcm_val);
-  int ulaw2linear(unsigned char u_val);
-  unsigned char linear2alaw(int pcm_val);
-  int alaw2linear(unsigned char u_val);
-};
-
 #define DECLARE_FIXED_CODEC(name, format, bps, frameTime, samples, bytes, fpp, maxfpp, payload, sdp) \
 class name##_Base : public OpalFactoryCodec { \
   PCLASSINFO(name##_Base, OpalFactoryCodec) \
@@ -260,8 +258,7 @@ int OpalG711ALaw64k_Encoder::Encode(const void * _from, unsigned * fromLen, void
   unsigned count = *fromLen / 2;
   *toLen         = count;
 
-  while (count-- > 0)
-    *to++ = linear2alaw(*from++);
+  H323_ALawCodec::EncodeBlock(from, to, count);
 
   return 1;
 }
@@ -277,8 +274,7 @@ int OpalG711ALaw64k_Decoder::Encode(const void * _from, unsigned * fromLen, void
   unsigned count = *fromLen;
   *toLen         = count * 2;
 
-  while (count-- > 0)
-    *to++ = (short)alaw2linear(*from++);
+  H323_ALawCodec::DecodeBlock(from, to, count);
 
   return 1;
 }
@@ -296,8 +292,7 @@ int OpalG711ALaw64k20_Encoder::Encode(const void * _from, unsigned * fromLen, vo
   unsigned count = *fromLen / 2;
   *toLen         = count;
 
-  while (count-- > 0)
-    *to++ = linear2alaw(*from++);
+  H323_ALawCodec::EncodeBlock(from, to, count);
 
   return 1;
 }
@@ -313,8 +308,7 @@ int OpalG711ALaw64k20_Decoder::Encode(const void * _from, unsigned * fromLen, vo
   unsigned count = *fromLen;
   *toLen         = count * 2;
 
-  while (count-- > 0)
-    *to++ = (short)alaw2linear(*from++);
+  H323_ALawCodec::DecodeBlock(from, to, count);
 
   return 1;
 }
@@ -332,8 +326,7 @@ int OpalG711uLaw64k_Encoder::Encode(const void * _from, unsigned * fromLen, void
   unsigned count = *fromLen / 2;
   *toLen         = count;
 
-  while (count-- > 0)
-    *to++ = linear2ulaw(*from++);
+  H323_muLawCodec::EncodeBlock(from, to, count);
 
   return 1;
 }
@@ -349,8 +342,7 @@ int OpalG711uLaw64k_Decoder::Encode(const void * _from, unsigned * fromLen, void
   unsigned count = *fromLen;
   *toLen         = count * 2;
 
-  while (count-- > 0)
-    *to++ = (short)ulaw2linear(*from++);
+  H323_muLawCodec::DecodeBlock(from, to, count);
 
   return 1;
 }
@@ -368,8 +360,7 @@ int OpalG711uLaw64k20_Encoder::Encode(const void * _from, unsigned * fromLen, vo
   unsigned count = *fromLen / 2;
   *toLen         = count;
 
-  while (count-- > 0)
-    *to++ = linear2ulaw(*from++);
+  H323_muLawCodec::EncodeBlock(from, to, count);
 
   return 1;
 }
@@ -385,8 +376,7 @@ int OpalG711uLaw64k20_Decoder::Encode(const void * _from, unsigned * fromLen, vo
   unsigned count = *fromLen;
   *toLen         = count * 2;
 
-  while (count-- > 0)
-    *to++ = (short)ulaw2linear(*from++);
+  H323_muLawCodec::DecodeBlock(from, to, count);
 
   return 1;
 }
@@ -1120,6 +1110,15 @@ class H323PluginFramedAudioCodec : public H323FramedAudioCodec
          context = (*codec->createCodec)(codec); 
          UpdatePluginOptions(codec,context,GetWritableMediaFormat());
       } else context = NULL; 
+
+      // Plug ins may optionally code several frames per call
+      batchFunction = NULL;
+      PluginCodec_ControlDefn * ctl = codec != NULL ? GetCodecControl(codec, PLUGINCODEC_CONTROL_GET_BATCH_FUNCTION) : NULL;
+      if (ctl != NULL) {
+        unsigned len = sizeof(batchFunction);
+        if ((*ctl->control)(codec, context, PLUGINCODEC_CONTROL_GET_BATCH_FUNCTION, &batchFunction, &len) == 0)
+          batchFunction = NULL;
+      }
     }
 
     ~H323PluginFramedAudioCodec()
@@ -1178,12 +1177,90 @@ class H323PluginFramedAudioCodec : public H323FramedAudioCodec
       }
     }
 
+    PBoolean CanBatchFrames() const
+    { return batchFunction != NULL; }
+
+    PBoolean EncodeFrames(
+      BYTE * buffer,      /// Buffer into which encoded bytes are placed
+      unsigned & length,  /// Actual length of encoded data buffer
+      unsigned & frames   /// Frames to encode, and frames encoded
+    )
+    {
+      if (batchFunction == NULL || direction != Encoder)
+        return FALSE;
+
+      unsigned lens[MaxFramesInBatch];
+      PluginCodec_FrameBatch batch;
+      batch.from       = sampleBuffer.GetPointer();
+      batch.fromStride = codec->parm.audio.samplesPerFrame*2;
+      batch.to         = buffer;
+      batch.toStride   = codec->parm.audio.bytesPerFrame;
+      batch.toLens     = lens;
+      batch.count      = PMIN(frames, (unsigned)MaxFramesInBatch);
+      batch.flags      = 0;
+
+      int coded = (*batchFunction)(codec, context, &batch);
+      if (coded <= 0)
+        return FALSE;
+
+      // Close up any frames shorter than the stride
+      length = 0;
+      for (int i = 0; i < coded; i++) {
+        if (length != i*batch.toStride)
+          memmove(buffer+length, buffer+i*batch.toStride, lens[i]);
+        length += lens[i];
+      }
+
+      frames = coded;
+      return TRUE;
+    }
+
+    PBoolean DecodeFrames(
+      const BYTE * buffer,     /// Buffer from which encoded data is found
+      unsigned length,         /// Length of encoded data buffer
+      unsigned & written,      /// Number of bytes used from data buffer
+      unsigned & bytesDecoded, /// Number of bytes output from frame
+      unsigned & frames        /// Frames to decode, and frames decoded
+    )
+    {
+      if (batchFunction == NULL || direction != Decoder)
+        return FALSE;
+
+      unsigned lens[MaxFramesInBatch];
+      PluginCodec_FrameBatch batch;
+      batch.from       = buffer;
+      batch.fromStride = codec->parm.audio.bytesPerFrame;
+      batch.count      = PMIN(PMIN(frames, length/batch.fromStride), (unsigned)MaxFramesInBatch);
+      batch.to         = sampleBuffer.GetPointer(codec->parm.audio.samplesPerFrame*batch.count);
+      batch.toStride   = codec->parm.audio.samplesPerFrame*2;
+      batch.toLens     = lens;
+      batch.flags      = 0;
+
+      int coded = (*batchFunction)(codec, context, &batch);
+      if (coded <= 0)
+        return FALSE;
+
+      // Close up any frames shorter than the stride
+      BYTE * samples = (BYTE *)batch.to;
+      bytesDecoded = 0;
+      for (int i = 0; i < coded; i++) {
+        if (bytesDecoded != i*batch.toStride)
+          memmove(samples+bytesDecoded, samples+i*batch.toStride, lens[i]);
+        bytesDecoded += lens[i];
+      }
+
+      written = coded*batch.fromStride;
+      frames = coded;
+      return TRUE;
+    }
+
     virtual void SetTxQualityLevel(int qlevel)
     { SetCodecControl(codec, context, SET_CODEC_OPTIONS_CONTROL, "set_quality", qlevel); }
 
   protected:
     void * context;
     PluginCodec_Definition * codec;
+    PluginCodec_BatchFunction batchFunction;
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -1318,8 +1395,340 @@ protected:
 };
 #endif
 
+/////////////////////////////////////////////////////////////////////////////
+// Pool of the large frame buffers used by plugin video codecs. Encoders take
+// a buffer sized to the frame they grab, decoders one for the largest frame
+// a plugin may output. Released buffers are kept for reuse up to a limit,
+// so channel start up and frame size changes do not reallocate megabytes.
+
+#define VIDEO_FRAME_POOL_LIMIT  (16*1024*1024)
+
+class H323VideoFramePool
+{
+  public:
+    static RTP_DataFrame Acquire(PINDEX payloadSize);
+    static void Release(RTP_DataFrame & frame);
+    static void SetLimit(PINDEX bytes);
+
+  protected:
+    static PMutex & GetMutex();
+    static std::list<RTP_DataFrame> & GetIdle();
+
+    static PINDEX idleBytes;
+    static PINDEX limit;
+};
+
+PINDEX H323VideoFramePool::idleBytes = 0;
+PINDEX H323VideoFramePool::limit = VIDEO_FRAME_POOL_LIMIT;
+
+PMutex & H323VideoFramePool::GetMutex()
+{
+    static PMutex mutex;
+    return mutex;
+}
+
+std::list<RTP_DataFrame> & H323VideoFramePool::GetIdle()
+{
+    static std::list<RTP_DataFrame> idle;
+    return idle;
+}
+
+RTP_DataFrame H323VideoFramePool::Acquire(PINDEX payloadSize)
+{
+    PINDEX needed = payloadSize + RTP_DataFrame::MinHeaderSize;
+    {
+        PWaitAndSignal m(GetMutex());
+
+        // Best fit, but never hand out a buffer more than twice the size needed
+        std::list<RTP_DataFrame> & idle = GetIdle();
+        std::list<RTP_DataFrame>::iterator best = idle.end();
+        for (std::list<RTP_DataFrame>::iterator r = idle.begin(); r != idle.end(); ++r) {
+            if (r->GetSize() >= needed && r->GetSize() <= needed*2 &&
+                (best == idle.end() || r->GetSize() < best->GetSize()))
+                best = r;
+        }
+        if (best != idle.end()) {
+            RTP_DataFrame frame = *best;
+            idleBytes -= frame.GetSize();
+            idle.erase(best);
+            // Plugins write into the header, start with a clean one
+            BYTE * header = frame.GetPointer();
+            memset(header, 0, RTP_DataFrame::MinHeaderSize);
+            header[0] = '\x80';
+            frame.SetPayloadSize(payloadSize);
+            return frame;
+        }
+    }
+    return RTP_DataFrame(payloadSize, TRUE);
+}
+
+void H323VideoFramePool::Release(RTP_DataFrame & frame)
+{
+    {
+        PWaitAndSignal m(GetMutex());
+        if (frame.GetSize() > 0 && frame.IsUnique() && idleBytes + frame.GetSize() <= limit) {
+            idleBytes += frame.GetSize();
+            GetIdle().push_back(frame);
+        }
+    }
+    frame = RTP_DataFrame(0);
+}
+
+void H323VideoFramePool::SetLimit(PINDEX bytes)
+{
+    PWaitAndSignal m(GetMutex());
+    limit = bytes;
+
+    std::list<RTP_DataFrame> & idle = GetIdle();
+    while (idleBytes > limit && !idle.empty()) {
+        idleBytes -= idle.front().GetSize();
+        idle.pop_front();
+    }
+}
+
 #ifdef H323_VIDEO
 
+/////////////////////////////////////////////////////////////////////////////
+// Plugin encoder shared by the transmitting video channels of connections
+// in the same video encoder group with identical media format options.
+// Whichever channel first needs a new frame grabs and encodes it, the RTP
+// payloads are kept for a few frames so every channel sends the same ones.
+
+#define SHARED_ENCODER_HISTORY  8
+
+class H323PluginSharedVideoEncoder : public PObject
+{
+  PCLASSINFO(H323PluginSharedVideoEncoder, PObject);
+  public:
+    struct Packet {
+      PBYTEArray payload;
+      PBoolean   marker;
+    };
+
+    struct Frame {
+      unsigned seq;
+      std::vector<Packet> packets;
+    };
+
+    /**Join the encoder for the key, creating it if needed. The context is
+       either handed over to a new encoder or destroyed and replaced by the
+       one already shared.
+      */
+    static H323PluginSharedVideoEncoder * Attach(
+      const PString & key,
+      PluginCodec_Definition * codec,
+      void * & context
+    );
+
+    /**Leave the encoder, the last one out destroys it.
+      */
+    static void Detach(H323PluginSharedVideoEncoder * encoder, const void * channel);
+
+    /**Request an I-Frame. Requests made before the next frame is encoded
+       are coalesced into one.
+      */
+    void OnFastUpdatePicture();
+
+    /**Encode all the packets of a grabbed frame. Called with mutex held.
+      */
+    PBoolean EncodeFrame(
+      RTP_DataFrame & src,
+      unsigned srcLen,
+      unsigned maxOutput
+    );
+
+    /**Get an encoded frame still in the history, NULL if too old or not
+       yet encoded. Called with mutex held.
+      */
+    const Frame * GetFrame(unsigned seq) const;
+
+    unsigned GetNextFrame() const { return nextFrame; }
+
+    /**Record the flow control bit rate, in units of 100 bits/s, for a
+       channel. Zero withdraws its request. Returns the rate the encoder
+       should use, the lowest asked for by any attached channel.
+      */
+    long SetChannelBitRate(const void * channel, long bitRate);
+
+    /**Get the rate the encoder should use if it has changed since the
+       last call, else zero.
+      */
+    long TakeBitRateChange();
+
+    PMutex mutex;
+
+  protected:
+    H323PluginSharedVideoEncoder(const PString & key, PluginCodec_Definition * codec, void * context);
+    ~H323PluginSharedVideoEncoder();
+
+    PString                  key;
+    PluginCodec_Definition * codec;
+    void *                   context;
+    unsigned                 refCount;
+
+    std::deque<Frame>        frames;
+    unsigned                 nextFrame;
+
+    PMutex                   intraMutex;
+    bool                     intraPending;
+
+    std::map<const void *, long> channelBitRates;
+    long                     bitRate;
+    bool                     bitRateChanged;
+};
+
+typedef std::map<PString, H323PluginSharedVideoEncoder *> H323SharedVideoEncoderMap;
+static H323SharedVideoEncoderMap sharedVideoEncoders;
+static PMutex sharedVideoEncodersMutex;
+
+H323PluginSharedVideoEncoder::H323PluginSharedVideoEncoder(const PString & _key, PluginCodec_Definition * _codec, void * _context)
+  : key(_key), codec(_codec), context(_context), refCount(1), nextFrame(0), intraPending(true),
+    bitRate(0), bitRateChanged(false)
+{
+}
+
+H323PluginSharedVideoEncoder::~H323PluginSharedVideoEncoder()
+{
+    if (codec != NULL && codec->destroyCodec != NULL)
+        (*codec->destroyCodec)(codec, context);
+}
+
+H323PluginSharedVideoEncoder * H323PluginSharedVideoEncoder::Attach(const PString & key, PluginCodec_Definition * codec, void * & context)
+{
+    PWaitAndSignal m(sharedVideoEncodersMutex);
+
+    H323SharedVideoEncoderMap::iterator r = sharedVideoEncoders.find(key);
+    if (r == sharedVideoEncoders.end()) {
+        PTRACE(3, "PLUGIN\tCreated shared " << codec->descr << " encoder");
+        H323PluginSharedVideoEncoder * encoder = new H323PluginSharedVideoEncoder(key, codec, context);
+        sharedVideoEncoders.insert(H323SharedVideoEncoderMap::value_type(key, encoder));
+        return encoder;
+    }
+
+    H323PluginSharedVideoEncoder * encoder = r->second;
+    if (context != NULL && context != encoder->context && codec->destroyCodec != NULL)
+        (*codec->destroyCodec)(codec, context);
+    context = encoder->context;
+    encoder->refCount++;
+    PTRACE(3, "PLUGIN\tJoined shared " << codec->descr << " encoder, " << encoder->refCount << " channels");
+    return encoder;
+}
+
+void H323PluginSharedVideoEncoder::Detach(H323PluginSharedVideoEncoder * encoder, const void * channel)
+{
+    PWaitAndSignal m(sharedVideoEncodersMutex);
+
+    if (--encoder->refCount > 0) {
+        encoder->SetChannelBitRate(channel, 0);
+        return;
+    }
+
+    sharedVideoEncoders.erase(encoder->key);
+    delete encoder;
+}
+
+long H323PluginSharedVideoEncoder::SetChannelBitRate(const void * channel, long rate)
+{
+    PWaitAndSignal m(mutex);
+
+    if (rate > 0)
+        channelBitRates[channel] = rate;
+    else
+        channelBitRates.erase(channel);
+
+    long lowest = 0;
+    for (std::map<const void *, long>::iterator r = channelBitRates.begin(); r != channelBitRates.end(); ++r) {
+        if (lowest == 0 || r->second < lowest)
+            lowest = r->second;
+    }
+
+    if (lowest != bitRate) {
+        PTRACE(4, "PLUGIN\tShared encoder flow control " << bitRate*100 << " -> " << lowest*100);
+        bitRate = lowest;
+        bitRateChanged = lowest > 0;
+    }
+    return bitRate;
+}
+
+long H323PluginSharedVideoEncoder::TakeBitRateChange()
+{
+    PWaitAndSignal m(mutex);
+
+    if (!bitRateChanged)
+        return 0;
+
+    bitRateChanged = false;
+    return bitRate;
+}
+
+void H323PluginSharedVideoEncoder::OnFastUpdatePicture()
+{
+    PWaitAndSignal m(intraMutex);
+
+    if (intraPending) {
+        PTRACE(5, "PLUGIN\tShared encoder VideoFastUpdate coalesced");
+        return;
+    }
+    EventCodecControl(codec, context, "on_fast_update", "");
+    intraPending = true;
+}
+
+PBoolean H323PluginSharedVideoEncoder::EncodeFrame(RTP_DataFrame & src, unsigned srcLen, unsigned maxOutput)
+{
+    Frame frame;
+    frame.seq = nextFrame;
+
+    RTP_DataFrame output;
+    output.SetMinSize(maxOutput);
+
+    unsigned flags;
+    do {
+        unsigned fromLen = srcLen;
+        unsigned toLen = maxOutput;
+        {
+            PWaitAndSignal m(intraMutex);
+            flags = intraPending ? PluginCodec_CoderForceIFrame : 0;
+        }
+
+        if ((codec->codecFunction)(codec, context, src.GetPointer(), &fromLen, output.GetPointer(), &toLen, &flags) == 0) {
+            PTRACE(3, "PLUGIN\tError encoding frame from plugin " << codec->descr);
+            return FALSE;
+        }
+
+        if ((flags & PluginCodec_ReturnCoderIFrame) != 0) {
+            PWaitAndSignal m(intraMutex);
+            PTRACE(intraPending ? 3 : 5, "PLUGIN\tShared encoder sent I-Frame" << (intraPending ? ", in response to VideoFastUpdate" : ""));
+            intraPending = false;
+        }
+
+        if (toLen > (unsigned)output.GetHeaderSize()) {
+            Packet packet;
+            packet.payload = PBYTEArray(output.GetPayloadPtr(), toLen - output.GetHeaderSize());
+            packet.marker = output.GetMarker();
+            frame.packets.push_back(packet);
+        }
+    } while ((flags & PluginCodec_ReturnCoderLastFrame) == 0);
+
+    // The frame is complete even if the plugin marked an empty last packet
+    if (!frame.packets.empty())
+        frame.packets.back().marker = TRUE;
+
+    frames.push_back(frame);
+    if (frames.size() > SHARED_ENCODER_HISTORY)
+        frames.pop_front();
+    nextFrame++;
+    return TRUE;
+}
+
+const H323PluginSharedVideoEncoder::Frame * H323PluginSharedVideoEncoder::GetFrame(unsigned seq) const
+{
+    if (frames.empty() || seq < frames.front().seq || seq >= nextFrame)
+        return NULL;
+    return &frames[seq - frames.front().seq];
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////
+
 class H323PluginVideoCodec : public H323VideoCodec
 {
   PCLASSINFO(H323PluginVideoCodec, H323VideoCodec);
@@ -1406,6 +1815,10 @@ class H323PluginVideoCodec : public H323VideoCodec
     
     // The following require implementation in the plugin codec
     virtual void OnFastUpdatePicture() {
+      if (sharedEncoder != NULL) {
+        sharedEncoder->OnFastUpdatePicture();
+        return;
+      }
       EventCodecControl(codec, context, "on_fast_update", "");
       sendIntra = true;
     }
@@ -1421,10 +1834,28 @@ class H323PluginVideoCodec : public H323VideoCodec
     { EventCodecControl(codec, context, "on_lost_picture", ""); } 
 
   protected:
+    PBoolean GrabFrame(
+      PVideoChannel * videoIn,
+      PluginCodec_Video_FrameHeader * frameHeader,
+      PBoolean & grabbed
+    );
+
+    PBoolean ReadShared(
+      PVideoChannel * videoIn,
+      PluginCodec_Video_FrameHeader * frameHeader,
+      unsigned & length,
+      RTP_DataFrame & dst
+    );
+
+    void ResizeFrameBuffer();
+
+    bool ApplyFlowControl(long bitRate);
+
     void *       context;
     PluginCodec_Definition * codec;
     int          bufferSize;
     RTP_DataFrame bufferRTP;
+    unsigned     decodeFailures;
     int          maxWidth;
     int          maxHeight;
 
@@ -1448,6 +1879,10 @@ class H323PluginVideoCodec : public H323VideoCodec
     unsigned int flags;
     int          pluginRetVal;
 
+    H323PluginSharedVideoEncoder * sharedEncoder;
+    unsigned     sharedFrame;
+    PINDEX       sharedPacket;
+
 #ifdef H323_FRAMEBUFFER
     H323PluginFrameBuffer  m_frameBuffer;
 #endif
@@ -1587,12 +2022,21 @@ bool OpalPluginCodec::CodecControl(const char * name, void * parm, unsigned int
 
 H323PluginVideoCodec::H323PluginVideoCodec(const OpalMediaFormat & fmt, Direction direction, PluginCodec_Definition * _codec, const H323Capability * cap)
     : H323VideoCodec(fmt, direction), context(NULL), codec(_codec), 
-      bufferSize(sizeof(PluginCodec_Video_FrameHeader) + (PLUGIN_MAX_WIDTH * PLUGIN_MAX_HEIGHT * 3)/2 + PLUGIN_RTP_HEADER_SIZE), bufferRTP(bufferSize-PLUGIN_RTP_HEADER_SIZE, TRUE), 
+      bufferSize(sizeof(PluginCodec_Video_FrameHeader) + (PLUGIN_MAX_WIDTH * PLUGIN_MAX_HEIGHT * 3)/2 + PLUGIN_RTP_HEADER_SIZE), bufferRTP(0), decodeFailures(0),
       maxWidth(fmt.GetOptionInteger(OpalVideoFormat::FrameWidthOption)), maxHeight(fmt.GetOptionInteger(OpalVideoFormat::FrameHeightOption)),
       bytesPerFrame((maxHeight * maxWidth * 3)/2), lastFrameTimeRTP(0), targetFrameTimeMs(fmt.GetOptionInteger(OpalVideoFormat::FrameTimeOption)),
       flowRequest(0), lastPacketSent(true), sendIntra(true), lastFrameTick(0), nowFrameTick(0), lastFUPTick(0), nowFUPTick(0), outputDataSize(MAX_MTU_SIZE), 
-      fromLen(0), toLen(0), flags(0), pluginRetVal(0)
+      fromLen(0), toLen(0), flags(0), pluginRetVal(0), sharedEncoder(NULL), sharedFrame(UINT_MAX), sharedPacket(0)
 {
+    // The encoder buffer only needs to hold the frame being grabbed and grows
+    // with the frame size. Decoders are sized to the largest frame negotiated,
+    // and grow to the plugin maximum if the plugin finds that too small, or
+    // keeps failing to decode in case it cannot say so.
+    if (direction == Encoder || (maxWidth > 0 && maxHeight > 0))
+        bufferRTP = H323VideoFramePool::Acquire(sizeof(PluginCodec_Video_FrameHeader) + bytesPerFrame);
+    else
+        bufferRTP = H323VideoFramePool::Acquire(bufferSize - PLUGIN_RTP_HEADER_SIZE);
+
     if (codec && codec->createCodec) {
         context = (*codec->createCodec)(codec); 
         UpdatePluginOptions(codec,context,GetWritableMediaFormat());
@@ -1620,20 +2064,42 @@ H323PluginVideoCodec::~H323PluginVideoCodec()
     m_frameBuffer.Terminate();
     m_frameBuffer.WaitForTermination();
 #endif
-    // Set the buffer memory to zero to prevent
-    // memory leak
-    bufferRTP.SetSize(0);
+    // Return the frame buffer to the pool
+    H323VideoFramePool::Release(bufferRTP);
 
-    if (codec != NULL && codec->destroyCodec != NULL)
+    if (sharedEncoder != NULL)
+        H323PluginSharedVideoEncoder::Detach(sharedEncoder, this);
+    else if (codec != NULL && codec->destroyCodec != NULL)
         (*codec->destroyCodec)(codec, context);
 }
 
+bool H323PluginVideoCodec::ApplyFlowControl(long bitRate)
+{
+    // Other channels encode from a shared context concurrently
+    if (sharedEncoder != NULL) {
+        PWaitAndSignal m(sharedEncoder->mutex);
+        return SetFlowControl(codec,context,mediaFormat,bitRate);
+    }
+    return SetFlowControl(codec,context,mediaFormat,bitRate);
+}
+
 PBoolean H323PluginVideoCodec::SetMaxBitRate(unsigned bitRate)  
 { 
-    if (SetFlowControl(codec,context,mediaFormat,bitRate/100)) {
+    // A shared encoder runs at the lowest rate asked for by its channels
+    if (sharedEncoder != NULL) {
+        long sharedRate = sharedEncoder->SetChannelBitRate(this, bitRate/100);
+        if (sharedRate > 0)
+            bitRate = sharedRate*100;
+    }
+
+    if (ApplyFlowControl(bitRate/100)) {
          frameWidth = mediaFormat.GetOptionInteger(OpalVideoFormat::FrameWidthOption); 
          frameHeight =  mediaFormat.GetOptionInteger(OpalVideoFormat::FrameHeightOption);
          targetFrameTimeMs = mediaFormat.GetOptionInteger(OpalVideoFormat::FrameTimeOption);
+         if (direction == Encoder) {
+             PWaitAndSignal mutex(videoHandlerActive);
+             ResizeFrameBuffer();
+         }
          mediaFormat.SetBandwidth(bitRate);
          return true;
     }
@@ -1671,8 +2137,11 @@ void H323PluginVideoCodec::OnFlowControl(long bitRateRestriction)
     return;
   }
 
-  flowRequest = bitRateRestriction;
-
+  // A shared encoder is flow controlled by whichever channel grabs next
+  if (sharedEncoder != NULL)
+    sharedEncoder->SetChannelBitRate(this, bitRateRestriction);
+  else
+    flowRequest = bitRateRestriction;
 }
 
 PBoolean H323PluginVideoCodec::SetSupportedFormats(std::list<PVideoFrameInfo> & info)
@@ -1722,6 +2191,129 @@ PBoolean H323PluginVideoCodec::SetSupportedFormats(std::list<PVideoFrameInfo> &
     }
 }
 
+PBoolean H323PluginVideoCodec::GrabFrame(PVideoChannel * videoIn, PluginCodec_Video_FrameHeader * frameHeader, PBoolean & grabbed)
+{
+    grabbed = FALSE;
+
+    videoIn->RestrictAccess();
+
+    if (!videoIn->IsGrabberOpen()) {
+        PTRACE(1, "PLUGIN\tVideo grabber is not initialised, close down video transmission thread");
+        videoIn->EnableAccess();
+        return FALSE;
+    }
+
+#if PTLIB_VER >= 290
+    if (sharedEncoder != NULL && lastFrameTimeRTP)
+        flowRequest = sharedEncoder->TakeBitRateChange();
+
+    if (flowRequest && lastFrameTimeRTP) {
+        PStringArray options;
+        if (videoIn->FlowControl((void *)&options)    // test if implemented with empty options
+            && ApplyFlowControl(flowRequest)) {
+            PTRACE(4, "PLUGIN\tApplying Flow Control " << flowRequest);
+            options = LoadInputDeviceOptions(mediaFormat); 
+            if (videoIn->FlowControl((void *)&options)) {  
+                frameHeader->width  = videoIn->GetGrabWidth();
+                frameHeader->height = videoIn->GetGrabHeight();
+                // Send a FPU when setting flow control.
+                if (sharedEncoder != NULL)
+                    sharedEncoder->OnFastUpdatePicture();
+                else
+                    sendIntra = true;
+            }
+        } else if (videoIn->GetVideoReader() && videoIn->GetVideoReader()->GetCaptureMode() == 0) {
+                frameHeader->width  = videoIn->GetGrabWidth();
+                frameHeader->height = videoIn->GetGrabHeight();
+        }
+        flowRequest = 0;
+    }
+#endif
+
+    if (!SetFrameSize(frameHeader->width, frameHeader->height)) {
+        PTRACE(1, "PLUGIN\tFailed to resize, close down video transmission thread");
+        videoIn->EnableAccess();
+        return FALSE;
+    }
+
+    // The frame size may have been changed without a resize (flow control),
+    // make sure the buffer holds the frame about to be grabbed.
+    ResizeFrameBuffer();
+
+    // A resize may have replaced the frame buffer
+    frameHeader = (PluginCodec_Video_FrameHeader *)bufferRTP.GetPayloadPtr();
+    unsigned char * data = OPAL_VIDEO_FRAME_DATA_PTR(frameHeader);
+    if (!rawDataChannel->Read(data, bytesPerFrame)) {
+        PTRACE(3, "PLUGIN\tFailed to read data from video grabber");
+        videoIn->EnableAccess();
+        return TRUE;
+    }
+
+    videoIn->EnableAccess();
+
+    RenderFrame(data, NULL);
+    grabbed = TRUE;
+
+    nowFrameTick = PTimer::Tick().GetMilliSeconds();
+    lastFrameTimeRTP = (nowFrameTick - lastFrameTick)*90;
+    lastFrameTick = nowFrameTick;
+    return TRUE;
+}
+
+PBoolean H323PluginVideoCodec::ReadShared(PVideoChannel * videoIn, PluginCodec_Video_FrameHeader * frameHeader, unsigned & length, RTP_DataFrame & dst)
+{
+    PWaitAndSignal mutex(sharedEncoder->mutex);
+
+    // Start, or restart after falling behind the history, on an I-Frame
+    if (sharedFrame > sharedEncoder->GetNextFrame() ||
+        (sharedFrame < sharedEncoder->GetNextFrame() && sharedEncoder->GetFrame(sharedFrame) == NULL)) {
+        PTRACE(sharedFrame == UINT_MAX ? 4 : 3, "PLUGIN\tShared encoder " << (sharedFrame == UINT_MAX ? "joined" : "resynchronising") << ", requesting I-Frame");
+        sharedFrame = sharedEncoder->GetNextFrame();
+        sharedPacket = 0;
+        sharedEncoder->OnFastUpdatePicture();
+    }
+
+    // No channel has encoded this frame yet, grab and encode it for all of them
+    if (sharedFrame == sharedEncoder->GetNextFrame()) {
+        PBoolean grabbed;
+        if (!GrabFrame(videoIn, frameHeader, grabbed))
+            return FALSE;
+        if (!grabbed) {
+            length = 0;
+            dst.SetPayloadSize(0);
+            return TRUE;
+        }
+        if (!sharedEncoder->EncodeFrame(bufferRTP, bufferRTP.GetHeaderSize() + bufferRTP.GetPayloadSize(), outputDataSize)) {
+            length = 0;
+            return FALSE;
+        }
+    }
+
+    const H323PluginSharedVideoEncoder::Frame * frame = sharedEncoder->GetFrame(sharedFrame);
+    if (frame == NULL || frame->packets.empty()) {
+        sharedFrame++;
+        sharedPacket = 0;
+        lastPacketSent = TRUE;
+        length = 0;
+        dst.SetPayloadSize(0);
+        return TRUE;
+    }
+
+    const H323PluginSharedVideoEncoder::Packet & packet = frame->packets[sharedPacket];
+    length = packet.payload.GetSize();
+    dst.SetPayloadSize(length);
+    memcpy(dst.GetPayloadPtr(), (const BYTE *)packet.payload, length);
+    dst.SetMarker(packet.marker);
+
+    if (++sharedPacket >= (PINDEX)frame->packets.size()) {
+        sharedFrame++;
+        sharedPacket = 0;
+    }
+    lastPacketSent = (sharedPacket == 0);
+
+    return TRUE;
+}
+
 PBoolean H323PluginVideoCodec::Read(BYTE * /*buffer*/, unsigned & length, RTP_DataFrame & dst)
 {
     PWaitAndSignal mutex(videoHandlerActive);
@@ -1768,58 +2360,18 @@ PBoolean H323PluginVideoCodec::Read(BYTE * /*buffer*/, unsigned & length, RTP_Da
         return false;
     }
 
+    if (sharedEncoder != NULL)
+        return ReadShared(videoIn, frameHeader, length, dst);
 
     if (lastPacketSent) {
-        videoIn->RestrictAccess();
-
-        if (!videoIn->IsGrabberOpen()) {
-            PTRACE(1, "PLUGIN\tVideo grabber is not initialised, close down video transmission thread");
-            videoIn->EnableAccess();
+        PBoolean grabbed;
+        if (!GrabFrame(videoIn, frameHeader, grabbed))
             return FALSE;
-        }
-
-#if PTLIB_VER >= 290
-        if (flowRequest && lastFrameTimeRTP) {
-            PStringArray options;
-            if (videoIn->FlowControl((void *)&options)    // test if implemented with empty options
-                && SetFlowControl(codec,context,mediaFormat, flowRequest)) {
-                PTRACE(4, "PLUGIN\tApplying Flow Control " << flowRequest);
-                options = LoadInputDeviceOptions(mediaFormat); 
-                if (videoIn->FlowControl((void *)&options)) {  
-                    frameHeader->width  = videoIn->GetGrabWidth();
-                    frameHeader->height = videoIn->GetGrabHeight();
-                    sendIntra = true;  // Send a FPU when setting flow control.
-                }
-            } else if (videoIn->GetVideoReader() && videoIn->GetVideoReader()->GetCaptureMode() == 0) {
-                    frameHeader->width  = videoIn->GetGrabWidth();
-                    frameHeader->height = videoIn->GetGrabHeight();
-            }
-            flowRequest = 0;
-        }
-#endif
-
-        if (!SetFrameSize(frameHeader->width, frameHeader->height)) {
-            PTRACE(1, "PLUGIN\tFailed to resize, close down video transmission thread");
-            videoIn->EnableAccess();
-            return FALSE;
-        }
-
-        unsigned char * data = OPAL_VIDEO_FRAME_DATA_PTR(frameHeader);
-        if (!rawDataChannel->Read(data, bytesPerFrame)) {
-            PTRACE(3, "PLUGIN\tFailed to read data from video grabber");
-            videoIn->EnableAccess();
+        if (!grabbed) {
             length=0;
             dst.SetPayloadSize(0);
             return TRUE; // and hope the error condition will fix itself
         }
-
-        videoIn->EnableAccess();
-
-        RenderFrame(data, NULL);
-
-        nowFrameTick = PTimer::Tick().GetMilliSeconds();
-        lastFrameTimeRTP = (nowFrameTick - lastFrameTick)*90;
-        lastFrameTick = nowFrameTick;
     }
     else
         lastFrameTimeRTP = 0;
@@ -1833,7 +2385,7 @@ PBoolean H323PluginVideoCodec::Read(BYTE * /*buffer*/, unsigned & length, RTP_Da
     dst.SetMinSize(outputDataSize);
     bytesPerFrame = outputDataSize;
 
-    fromLen = bufferSize;
+    fromLen = bufferRTP.GetHeaderSize() + bufferRTP.GetPayloadSize();
     toLen = outputDataSize;
     flags = sendIntra ? PluginCodec_CoderForceIFrame : 0;
 
@@ -1865,6 +2417,16 @@ PBoolean H323PluginVideoCodec::Read(BYTE * /*buffer*/, unsigned & length, RTP_Da
 
 PBoolean H323PluginVideoCodec::Open(H323Connection & connection) {
 
+    if (direction == Encoder && context != NULL && sharedEncoder == NULL && !connection.GetVideoEncoderGroup().IsEmpty()) {
+        PStringStream key;
+        key << connection.GetVideoEncoderGroup() << '\n' << codec->descr;
+        for (PINDEX i = 0; i < mediaFormat.GetOptionCount(); i++) {
+            const OpalMediaOption & option = mediaFormat.GetOption(i);
+            key << '\n' << option.GetName() << '=' << option.AsString();
+        }
+        sharedEncoder = H323PluginSharedVideoEncoder::Attach(key, codec, context);
+    }
+
 #ifdef H323_FRAMEBUFFER
     if (direction == Decoder && connection.HasVideoFrameBuffer()) 
         m_frameBuffer.SetCodec(this);
@@ -1940,7 +2502,7 @@ PBoolean H323PluginVideoCodec::WriteInternal(const BYTE * /*buffer*/, unsigned l
 #endif
 
   fromLen = src.GetHeaderSize() + src.GetPayloadSize();
-  toLen = bufferSize;
+  toLen = bufferRTP.GetSize();
   flags=0;
 
   pluginRetVal = (codec->codecFunction)(codec, context, 
@@ -1949,6 +2511,19 @@ PBoolean H323PluginVideoCodec::WriteInternal(const BYTE * /*buffer*/, unsigned l
                               &flags);
 
   for(;;) {
+      // Only the bundled plugins report PluginCodec_ReturnCoderBufferTooSmall,
+      // others just fail on a frame larger than negotiated. Treat an error,
+      // or a run of frames that only ask for an I-Frame, the same way while
+      // the buffer is below the plugin maximum.
+      if (!pluginRetVal || (flags & PluginCodec_ReturnCoderRequestIFrame) != 0) {
+        if (bufferRTP.GetSize() < bufferSize &&
+            (!pluginRetVal || ++decodeFailures >= DECODE_FAILURES_BEFORE_GROWING)) {
+          PTRACE(3,"PLUGIN\tDecoder " << codec->descr << " failing, assuming the buffer is too small");
+          pluginRetVal = 1;
+          flags |= PluginCodec_ReturnCoderBufferTooSmall | PluginCodec_ReturnCoderRequestIFrame;
+        }
+      }
+
       if (!pluginRetVal) {
         PTRACE(3,"PLUGIN\tError decoding frame from plugin " << codec->descr);
         return FALSE;
@@ -1963,8 +2538,22 @@ PBoolean H323PluginVideoCodec::WriteInternal(const BYTE * /*buffer*/, unsigned l
             sendIntra = false;
         }
       }
+
+      // The remote sent a larger frame than was negotiated, grow to the plugin
+      // maximum, drop this frame and recover on the I-Frame requested above.
+      if (flags & PluginCodec_ReturnCoderBufferTooSmall) {
+        if (bufferRTP.GetSize() < bufferSize) {
+          PTRACE(3,"PLUGIN\tDecoded frame larger than negotiated, growing buffer to " << bufferSize);
+          H323VideoFramePool::Release(bufferRTP);
+          bufferRTP = H323VideoFramePool::Acquire(bufferSize - PLUGIN_RTP_HEADER_SIZE);
+        }
+        written = length;
+        return TRUE;
+      }
       
       if (flags & PluginCodec_ReturnCoderLastFrame) {
+        decodeFailures = 0;
+
         PluginCodec_Video_FrameHeader * header = (PluginCodec_Video_FrameHeader *)(bufferRTP.GetPayloadPtr());
         if (!header)
             return false;
@@ -1978,6 +2567,7 @@ PBoolean H323PluginVideoCodec::WriteInternal(const BYTE * /*buffer*/, unsigned l
         if(flags & PluginCodec_ReturnCoderMoreFrame) {
            PTRACE(6,"PLUGIN\tMore Frames to decode");
            flags=0;
+           toLen = bufferRTP.GetSize();
            pluginRetVal = (codec->codecFunction)(codec, context, 
                               (const BYTE *)0, &fromLen,
                               bufferRTP.GetPointer(toLen), &toLen,
@@ -2061,20 +2651,32 @@ PBoolean H323PluginVideoCodec::SetFrameSize(int _width, int _height,int _sar_wid
 
     PTRACE(3,"PLUGIN\tResize to w:" << frameWidth << " h:" << frameHeight); 
 
-    bytesPerFrame = (frameHeight * frameWidth * 3)/2;
-
-    if (direction == Encoder) {
-        bufferRTP.SetPayloadSize(sizeof(PluginCodec_Video_FrameHeader) + bytesPerFrame);
-        PluginCodec_Video_FrameHeader * header = 
-                    (PluginCodec_Video_FrameHeader *)(bufferRTP.GetPayloadPtr());
-        header->x = header->y = 0;
-        header->width         = frameWidth;
-        header->height        = frameHeight;
-    }
+    if (direction == Encoder)
+        ResizeFrameBuffer();
+    else
+        bytesPerFrame = (frameHeight * frameWidth * 3)/2;
 
     return TRUE;
 }
 
+void H323PluginVideoCodec::ResizeFrameBuffer()
+{
+    bytesPerFrame = (frameHeight * frameWidth * 3)/2;
+
+    // Change to a pooled buffer of the right size rather than grow this one
+    PINDEX payloadSize = sizeof(PluginCodec_Video_FrameHeader) + bytesPerFrame;
+    if (bufferRTP.GetSize() < bufferRTP.GetHeaderSize() + payloadSize) {
+        H323VideoFramePool::Release(bufferRTP);
+        bufferRTP = H323VideoFramePool::Acquire(payloadSize);
+    } else
+        bufferRTP.SetPayloadSize(payloadSize);
+    PluginCodec_Video_FrameHeader * header = 
+                (PluginCodec_Video_FrameHeader *)(bufferRTP.GetPayloadPtr());
+    header->x = header->y = 0;
+    header->width         = frameWidth;
+    header->height        = frameHeight;
+}
+
 unsigned H323PluginVideoCodec::GetVideoMode(void) 
 { 
    if (mediaFormat.GetOptionBoolean(OpalVideoFormat::DynamicVideoQualityOption))
@@ -2832,6 +3434,11 @@ void H323PluginCodecManager::AddFormat(const OpalMediaFormat & fmt)
   H323PluginCodecManager::GetMediaFormatList().Append(new OpalMediaFormat(fmt));
 }
 
+void H323PluginCodecManager::SetVideoFramePoolLimit(PINDEX bytes)
+{
+    H323VideoFramePool::SetLimit(bytes);
+}
+
 OpalMediaFormat::List H323PluginCodecManager::GetMediaFormats() 
 {
   return GetMediaFormatList();
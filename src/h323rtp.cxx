@@ -80,14 +80,14 @@ H323_RTP_UDP::H323_RTP_UDP(const H323Connection & conn,
                                         RTP_UDP & rtp_udp,
                                         RTP_QOS * rtpQos)
   : H323_RTP_Session(conn),
-    rtp(rtp_udp)
+    rtp(rtp_udp),
+    endpoint(conn.GetEndPoint()),
+    portPair(0)
 {
   const H323Transport & transport = connection.GetControlChannel();
   PIPSocket::Address localAddress;
   transport.GetLocalAddress().GetIpAddress(localAddress);
 
-  H323EndPoint & endpoint = connection.GetEndPoint();
-
   PIPSocket::Address remoteAddress;
   transport.GetRemoteAddress().GetIpAddress(remoteAddress);
 
@@ -106,21 +106,56 @@ H323_RTP_UDP::H323_RTP_UDP(const H323Connection & conn,
   }
 #endif
 
-  WORD firstPort = endpoint.GetRtpIpPortPair();
-  WORD nextPort = firstPort;
-  while (!rtp.Open(localAddress,
-                   nextPort, nextPort,
-                   endpoint.GetRtpIpTypeofService(),
-                   conn,
+  portInterface = localAddress;
+
+  // Without a NAT method or QoS spec a pair bound ahead of time will do,
+  // its port is already reserved for us.
+  PUDPSocket * dataSocket;
+  PUDPSocket * controlSocket;
+  if (
+#ifdef P_STUN
+      meth == NULL &&
+#endif
+      rtpQos == NULL &&
+      endpoint.GetRtpSocketPool().Take(portInterface, endpoint.GetRtpIpTypeofService(), dataSocket, controlSocket) &&
+      rtp.Open(localAddress, dataSocket, controlSocket))
+    portPair = rtp.GetLocalDataPort();
+  else {
+    // Ports that would not bind are held until we are done so they are not
+    // handed straight back to us, then released to be tried again later.
+    std::vector<WORD> busyPorts;
+    WORD firstPort = endpoint.GetRtpIpPortPair(portInterface);
+    WORD nextPort = firstPort;
+    PBoolean opened = TRUE;
+    while (!rtp.Open(localAddress,
+                     nextPort, nextPort,
+                     endpoint.GetRtpIpTypeofService(),
+                     conn,
 #ifdef P_STUN
-                   meth,
+                     meth,
 #else
-                   NULL,
+                     NULL,
 #endif
-                   rtpQos)) {
-    nextPort = endpoint.GetRtpIpPortPair();
-    if (nextPort == firstPort)
+                     rtpQos)) {
+      busyPorts.push_back(nextPort);
+      nextPort = endpoint.GetRtpIpPortPair(portInterface);
+      if (nextPort == firstPort) {
+        opened = FALSE;
+        break;
+      }
+    }
+    for (size_t i = 0; i < busyPorts.size(); i++)
+      endpoint.ReleaseRtpIpPortPair(busyPorts[i], portInterface);
+    if (!opened)
       return;
+
+    // A NAT method may have bound another pair. Those drawing on the endpoint
+    // range have marked it already, either way the pair is ours while bound.
+    portPair = rtp.GetLocalDataPort();
+    if (portPair != nextPort) {
+      endpoint.ReleaseRtpIpPortPair(nextPort, portInterface);
+      endpoint.ReserveRtpIpPortPair(portPair, portInterface);
+    }
   }
 
   localAddress = rtp.GetLocalAddress();
@@ -128,6 +163,13 @@ H323_RTP_UDP::H323_RTP_UDP(const H323Connection & conn,
   rtp.SetLocalAddress(localAddress);
 }
 
+H323_RTP_UDP::~H323_RTP_UDP()
+{
+  // The RTP_UDP sockets are closed by now, so the pair is free again
+  if (portPair != 0)
+    endpoint.ReleaseRtpIpPortPair(portPair, portInterface);
+}
+
 unsigned H323_RTP_UDP::GetSessionID() const
 {
     return rtp.GetSessionID();
@@ -44,18 +44,303 @@
 static PTimeInterval ResponseRetirementAge(0, 30); // Seconds
 
 
+// Number of consecutive template misses before giving up for a while, the
+// pause doubles each time the template gives up without a hit in between.
+static const unsigned TemplateMaxMisses = 3;
+static const unsigned TemplateBackoff = 32;
+static const unsigned TemplateMaxBackoffShift = 5;
+
+
 #define new PNEW
 
 
+/////////////////////////////////////////////////////////////////////////////////
+
+static void EncodeTemplatePDU(const PASN_Object & pdu, PBYTEArray & data)
+{
+  PPER_Stream strm;
+  pdu.Encode(strm);
+  strm.CompleteEncoding();
+  data = strm;
+}
+
+
+static PBoolean FindBitDifference(const PBYTEArray & a, const PBYTEArray & b, PINDEX & first, PINDEX & last)
+{
+  if (a.GetSize() != b.GetSize())
+    return FALSE;
+
+  first = P_MAX_INDEX;
+  last = P_MAX_INDEX;
+  for (PINDEX i = 0; i < a.GetSize(); i++) {
+    BYTE diff = (BYTE)(a[i] ^ b[i]);
+    if (diff == 0)
+      continue;
+    for (PINDEX bit = 0; bit < 8; bit++) {
+      if ((diff & (0x80 >> bit)) != 0) {
+        if (first == P_MAX_INDEX)
+          first = i*8 + bit;
+        last = i*8 + bit;
+      }
+    }
+  }
+
+  return first != P_MAX_INDEX;
+}
+
+
+static void SetTemplateBits(BYTE * data, PINDEX offset, unsigned value, PINDEX count)
+{
+  // PER is most significant bit first
+  for (PINDEX i = 0; i < count; i++) {
+    PINDEX bit = offset + i;
+    BYTE mask = (BYTE)(0x80 >> (bit%8));
+    if ((value & (1 << (count - i - 1))) != 0)
+      data[bit/8] |= mask;
+    else
+      data[bit/8] &= ~mask;
+  }
+}
+
+
+H323PDUTemplate::H323PDUTemplate()
+  : snapshot(NULL),
+    hits(0),
+    misses(0),
+    consecutiveMisses(0),
+    giveUps(0),
+    backoff(0)
+{
+}
+
+
+H323PDUTemplate::~H323PDUTemplate()
+{
+  delete snapshot;
+}
+
+
+void H323PDUTemplate::ClearFields()
+{
+  liveFields.clear();
+}
+
+
+void H323PDUTemplate::AddField(PASN_Integer & field)
+{
+  Field info;
+  info.object = &field;
+  info.isInteger = TRUE;
+  liveFields.push_back(info);
+}
+
+
+void H323PDUTemplate::AddField(PASN_OctetString & field)
+{
+  Field info;
+  info.object = &field;
+  info.isInteger = FALSE;
+  liveFields.push_back(info);
+}
+
+
+void H323PDUTemplate::Encode(PASN_Object & pdu, PPER_Stream & strm)
+{
+  if (backoff == 0) {
+    if (Matches(pdu)) {
+      hits++;
+      consecutiveMisses = 0;
+      giveUps = 0;
+      strm.SetSize(encoding.GetSize());
+      memcpy(strm.GetPointer(), (const BYTE *)encoding, encoding.GetSize());
+      Patch(strm);
+      return;
+    }
+
+    misses++;
+    if (++consecutiveMisses <= TemplateMaxMisses) {
+      if (Compile(pdu)) {
+        strm.SetSize(encoding.GetSize());
+        memcpy(strm.GetPointer(), (const BYTE *)encoding, encoding.GetSize());
+        return;
+      }
+    }
+    else {
+      backoff = TemplateBackoff << giveUps;
+      PTRACE(4, "Trans\tPDU template missed " << consecutiveMisses
+             << " times, using full encode for " << backoff << " PDUs");
+      consecutiveMisses = 0;
+      if (giveUps < TemplateMaxBackoffShift)
+        giveUps++;
+    }
+  }
+  else
+    backoff--;
+
+  pdu.Encode(strm);
+  strm.CompleteEncoding();
+}
+
+
+PBoolean H323PDUTemplate::Compile(PASN_Object & pdu)
+{
+  delete snapshot;
+  snapshot = NULL;
+
+  fields = liveFields;
+  for (PINDEX i = 0; i < (PINDEX)fields.size(); i++) {
+    if (!LocateField(pdu, i)) {
+      PTRACE(3, "Trans\tCould not locate field " << i << " for PDU template");
+      fields.clear();
+      return FALSE;
+    }
+  }
+
+  EncodeTemplatePDU(pdu, encoding);
+  snapshot = (PASN_Object *)pdu.Clone();
+  return TRUE;
+}
+
+
+PBoolean H323PDUTemplate::LocateField(PASN_Object & pdu, PINDEX idx)
+{
+  Field & info = fields[idx];
+  PBYTEArray low, high;
+  PINDEX first, last;
+
+  if (info.isInteger) {
+    PASN_Integer & field = (PASN_Integer &)*info.object;
+    if (!field.IsConstrained() || field.GetLowerLimit() < 0)
+      return FALSE;
+
+    unsigned lower = field.GetLowerLimit();
+    unsigned range = field.GetUpperLimit() - lower;
+    if (range == 0 || range > 65535)
+      return FALSE;
+
+    // Aligned PER uses the minimum bits up to one octet, then two octets
+    PINDEX nBits = 1;
+    while ((range >> nBits) != 0)
+      nBits++;
+    if (nBits > 8)
+      nBits = 16;
+
+    PBYTEArray one;
+    info.value = field.GetValue();
+    field.SetValue(lower);
+    EncodeTemplatePDU(pdu, low);
+    field.SetValue(lower+1);
+    EncodeTemplatePDU(pdu, one);
+    field.SetValue(lower+range);
+    EncodeTemplatePDU(pdu, high);
+    field.SetValue(info.value);
+
+    // Changing the least significant bit locates the end of the field
+    if (!FindBitDifference(low, one, first, last) || first != last || last+1 < nBits)
+      return FALSE;
+
+    info.bitOffset = last + 1 - nBits;
+    info.bitCount = nBits;
+    info.lower = lower;
+
+    // Check nothing outside the field changes with the value
+    return FindBitDifference(low, high, first, last) && first >= info.bitOffset && last < info.bitOffset + nBits;
+  }
+
+  PASN_OctetString & field = (PASN_OctetString &)*info.object;
+  PINDEX size = field.GetSize();
+  if (size == 0 || field.GetLowerLimit() != (int)field.GetUpperLimit() || size != (PINDEX)field.GetUpperLimit())
+    return FALSE;
+
+  PBYTEArray zeros(size), ones(size);
+  memset(ones.GetPointer(), 0xff, size);
+
+  info.octets = field.GetValue();
+  field.SetValue(zeros);
+  EncodeTemplatePDU(pdu, low);
+  field.SetValue(ones);
+  EncodeTemplatePDU(pdu, high);
+  field.SetValue(info.octets);
+
+  if (!FindBitDifference(low, high, first, last) || last - first + 1 != size*8)
+    return FALSE;
+
+  info.bitOffset = first;
+  info.bitCount = size*8;
+  return TRUE;
+}
+
+
+PBoolean H323PDUTemplate::Matches(PASN_Object & pdu)
+{
+  if (snapshot == NULL || fields.size() != liveFields.size())
+    return FALSE;
+
+  PINDEX i;
+  for (i = 0; i < (PINDEX)fields.size(); i++) {
+    if (fields[i].isInteger != liveFields[i].isInteger)
+      return FALSE;
+  }
+
+  // Give the variable fields the values they were compiled with, so the
+  // rest of the PDU can be compared. This is much cheaper than an encode.
+  std::vector<Field> current = liveFields;
+  for (i = 0; i < (PINDEX)fields.size(); i++) {
+    if (fields[i].isInteger) {
+      PASN_Integer & field = (PASN_Integer &)*liveFields[i].object;
+      current[i].value = field.GetValue();
+      field.SetValue(fields[i].value);
+    }
+    else {
+      PASN_OctetString & field = (PASN_OctetString &)*liveFields[i].object;
+      current[i].octets = field.GetValue();
+      field.SetValue(fields[i].octets);
+    }
+  }
+
+  PBoolean same = snapshot->Compare(pdu) == PObject::EqualTo;
+
+  for (i = 0; i < (PINDEX)fields.size(); i++) {
+    if (fields[i].isInteger)
+      ((PASN_Integer &)*liveFields[i].object).SetValue(current[i].value);
+    else
+      ((PASN_OctetString &)*liveFields[i].object).SetValue(current[i].octets);
+  }
+
+  return same;
+}
+
+
+void H323PDUTemplate::Patch(PBYTEArray & data) const
+{
+  BYTE * ptr = data.GetPointer();
+
+  for (PINDEX i = 0; i < (PINDEX)fields.size(); i++) {
+    const Field & info = fields[i];
+    if (info.isInteger) {
+      unsigned value = ((const PASN_Integer &)*liveFields[i].object).GetValue();
+      SetTemplateBits(ptr, info.bitOffset, value - info.lower, info.bitCount);
+    }
+    else {
+      PBYTEArray octets = ((const PASN_OctetString &)*liveFields[i].object).GetValue();
+      for (PINDEX j = 0; j < octets.GetSize(); j++)
+        SetTemplateBits(ptr, info.bitOffset + j*8, octets[j], 8);
+    }
+  }
+}
+
+
 /////////////////////////////////////////////////////////////////////////////////
 
 H323TransactionPDU::H323TransactionPDU()
+  : encodingTemplate(NULL)
 {
 }
 
 
 H323TransactionPDU::H323TransactionPDU(const H235Authenticators & auth)
-  : authenticators(auth)
+  : authenticators(auth),
+    encodingTemplate(NULL)
 {
 }
 
@@ -95,8 +380,18 @@ PBoolean H323TransactionPDU::Read(H323Transport & transport)
 PBoolean H323TransactionPDU::Write(H323Transport & transport)
 {
   PPER_Stream strm;
-  GetPDU().Encode(strm);
-  strm.CompleteEncoding();
+  PBoolean useTemplate = FALSE;
+  if (encodingTemplate != NULL && authenticators.IsEmpty()) {
+    encodingTemplate->ClearFields();
+    useTemplate = SetTemplateFields(*encodingTemplate);
+  }
+
+  if (useTemplate)
+    encodingTemplate->Encode(GetPDU(), strm);
+  else {
+    GetPDU().Encode(strm);
+    strm.CompleteEncoding();
+  }
 
   // Finalise the security if present
   for (PINDEX i = 0; i < authenticators.GetSize(); i++)
@@ -167,6 +462,9 @@ void H323Transactor::Construct()
 H323Transactor::~H323Transactor()
 {
   StopChannel();
+
+  for (std::map<unsigned, H323PDUTemplate *>::iterator it = pduTemplates.begin(); it != pduTemplates.end(); ++it)
+    delete it->second;
 }
 
 
@@ -389,7 +687,31 @@ PBoolean H323Transactor::WritePDU(H323TransactionPDU & pdu)
   if (idx != P_MAX_INDEX)
     responses[idx].SetPDU(pdu);
 
-  return pdu.Write(*transport);
+  return WriteWithTemplate(pdu);
+}
+
+
+void H323Transactor::EnablePDUTemplate(unsigned tag)
+{
+  PWaitAndSignal mutex(pduWriteMutex);
+
+  if (pduTemplates.find(tag) == pduTemplates.end())
+    pduTemplates[tag] = new H323PDUTemplate;
+}
+
+
+PBoolean H323Transactor::WriteWithTemplate(H323TransactionPDU & pdu)
+{
+  PWaitAndSignal mutex(pduWriteMutex);
+
+  std::map<unsigned, H323PDUTemplate *>::iterator it = pduTemplates.find(pdu.GetChoice().GetTag());
+  if (it == pduTemplates.end())
+    return pdu.Write(*transport);
+
+  pdu.SetEncodingTemplate(it->second);
+  PBoolean ok = pdu.Write(*transport);
+  pdu.SetEncodingTemplate(NULL);
+  return ok;
 }
 
 
@@ -404,7 +726,7 @@ PBoolean H323Transactor::WriteTo(H323TransactionPDU & pdu,
     if (callback)
       return WritePDU(pdu);
 
-    return pdu.Write(*transport);
+    return WriteWithTemplate(pdu);
   }
 
   pduWriteMutex.Wait();
@@ -418,7 +740,7 @@ PBoolean H323Transactor::WriteTo(H323TransactionPDU & pdu,
       if (callback)
         ok = WritePDU(pdu);
       else
-        ok = pdu.Write(*transport);
+        ok = WriteWithTemplate(pdu);
     }
   }
 
@@ -53,6 +53,7 @@
 
 #include <h323.h>
 #include <list>
+#include <algorithm>
 
 ///////////////////////////////////////////////////////////////////////
 
@@ -1106,6 +1107,7 @@ H460_FeatureSet::H460_FeatureSet()
 {
     ep = NULL;
     baseSet = NULL;
+    dispatchValid = FALSE;
 }
 
 H460_FeatureSet::~H460_FeatureSet()
@@ -1124,6 +1126,7 @@ H460_FeatureSet::~H460_FeatureSet()
 H460_FeatureSet::H460_FeatureSet(H460_FeatureSet * _base)
 {
     Features.DisallowDeleteObjects();   // Derived FeatureSets should not delete Objects.
+    dispatchValid = FALSE;
     AttachBaseFeatureSet(_base);
     AttachEndPoint(_base->GetEndPoint());
 }
@@ -1133,6 +1136,7 @@ H460_FeatureSet::H460_FeatureSet(const H225_FeatureSet & fs)
     Features.DisallowDeleteObjects();   // Built FeatureSet should not delete Objects.
     ep = NULL;
     baseSet = NULL;
+    dispatchValid = FALSE;
     CreateFeatureSet(fs);
 }
 
@@ -1141,6 +1145,7 @@ H460_FeatureSet::H460_FeatureSet(const H225_ArrayOf_GenericData & generic)
     Features.DisallowDeleteObjects();   // Built FeatureSet should not delete Objects.
     ep = NULL;
     baseSet = NULL;
+    dispatchValid = FALSE;
 
     for (PINDEX i=0; i < generic.GetSize(); i++) {
        AddFeature((H460_Feature *)&generic[i]);
@@ -1152,13 +1157,27 @@ PBoolean H460_FeatureSet::ProcessFirstPDU(const H225_FeatureSet & fs)
   
 PTRACE(6,"H460\tCreate Common FeatureSet");
 
-    H460_FeatureSet remote = H460_FeatureSet(fs);
+    // The remote features by ID string, collected once for the whole set
+    std::map<PString, bool> remote;
+    const H225_ArrayOf_FeatureDescriptor * lists[3] = { NULL, NULL, NULL };
+    if (fs.HasOptionalField(H225_FeatureSet::e_neededFeatures))
+        lists[0] = &fs.m_neededFeatures;
+    if (fs.HasOptionalField(H225_FeatureSet::e_desiredFeatures))
+        lists[1] = &fs.m_desiredFeatures;
+    if (fs.HasOptionalField(H225_FeatureSet::e_supportedFeatures))
+        lists[2] = &fs.m_supportedFeatures;
+    for (PINDEX l = 0; l < 3; ++l) {
+        if (lists[l] != NULL) {
+            for (PINDEX i = 0; i < lists[l]->GetSize(); ++i)
+                remote[GetFeatureIDPDU((*lists[l])[i]).IDString()] = true;
+        }
+    }
 
  /// Remove the features the remote does not support.
     for (PINDEX i=Features.GetSize()-1;  i > -1;  i--) {
         H460_Feature & feat = Features.GetDataAt(i);
         H460_FeatureID id = feat.GetFeatureID();
-        if (!remote.HasFeature(id) && !feat.CommonFeature())
+        if (remote.find(id.IDString()) == remote.end() && !feat.CommonFeature())
              RemoveFeature(id);
         else
            PTRACE(4,"H460\tUse Common Feature " << id);
@@ -1247,6 +1266,7 @@ PBoolean H460_FeatureSet::LoadFeatureSet(int inst, H323Connection * con)
       }
 
   DeleteFeatureList(featurelist);
+  BuildDispatchTable();
   return TRUE;
 }
 
@@ -1272,6 +1292,7 @@ PBoolean H460_FeatureSet::AddFeature(H460_Feature * Nfeat)
 
     PTRACE(4, "H460\tLoaded " << Nfeat->GetFeatureIDAsString());
 
+    dispatchValid = FALSE;
     return Features.SetAt(Nfeat->GetFeatureID(),Nfeat);
 
 }
@@ -1295,6 +1316,7 @@ void H460_FeatureSet::RemoveFeature(H460_FeatureID id)
     }
     PTRACE(4, info);
 
+    dispatchValid = FALSE;
     Features.RemoveAt(id);
 }
 
@@ -1317,8 +1339,11 @@ PBoolean H460_FeatureSet::CreateFeatureSetPDU(H225_FeatureSet & fs, unsigned Mes
     
     PBoolean buildPDU = FALSE;
 
-    for (PINDEX i = 0; i < Features.GetSize(); i++) {    // Iterate thro the features
-       H460_Feature & feat = Features.GetDataAt(i);
+    // Only the features handling the message
+    const std::vector<H460_Feature *> & handlers = GetDispatch(MessageID);
+
+    for (size_t i = 0; i < handlers.size(); i++) {    // Iterate thro the features
+       H460_Feature & feat = *handlers[i];
 
         PTRACE(6,"H460\tExamining " << feat.GetFeatureIDAsString());
         if (advertise != feat.FeatureAdvertised(MessageID)) {
@@ -1420,41 +1445,27 @@ PTRACE(6,"H460\tRead FeatureSet " << PTracePDU(MessageID) << " PDU");
        }
     }
 
-      H460_FeatureID ID;
-
-      if (fs.HasOptionalField(H225_FeatureSet::e_neededFeatures) 
-          && fs.m_neededFeatures.GetSize()>0) {
-        const H225_ArrayOf_FeatureDescriptor & fsn = fs.m_neededFeatures;
-          for (PINDEX i=fsn.GetSize()-1; i >= 0; --i) {  // iterate backwards
-              H225_FeatureDescriptor & fd = fsn[i];
-              ID = GetFeatureIDPDU(fd);
-
-              if (HasFeature(ID))
-                    ReadFeaturePDU(Features[ID],fd,MessageID);
-          }
-      }
-
-      if (fs.HasOptionalField(H225_FeatureSet::e_desiredFeatures) 
-          && fs.m_desiredFeatures.GetSize()>0) {
-        const H225_ArrayOf_FeatureDescriptor & fsd = fs.m_desiredFeatures;
-          for (PINDEX i=fsd.GetSize()-1; i >= 0; --i) {  // iterate backwards
-              H225_FeatureDescriptor & fd = fsd[i];
-              ID = GetFeatureIDPDU(fd);
-
-              if (HasFeature(ID))
-                    ReadFeaturePDU(Features[ID],fd,MessageID);
-          }
-      }
-
-      if (fs.HasOptionalField(H225_FeatureSet::e_supportedFeatures) 
-          && fs.m_supportedFeatures.GetSize()>0) {
-        const H225_ArrayOf_FeatureDescriptor & fss = fs.m_supportedFeatures; 
-          for (PINDEX i=fss.GetSize()-1; i >= 0; --i) {  // iterate backwards
-              H225_FeatureDescriptor & fd = fss[i];    
-              ID = GetFeatureIDPDU(fd);
-
-              if (HasFeature(ID))
-                    ReadFeaturePDU(Features[ID],fd,MessageID);
+      const H225_ArrayOf_FeatureDescriptor * lists[3] = { NULL, NULL, NULL };
+      if (fs.HasOptionalField(H225_FeatureSet::e_neededFeatures))
+          lists[0] = &fs.m_neededFeatures;
+      if (fs.HasOptionalField(H225_FeatureSet::e_desiredFeatures))
+          lists[1] = &fs.m_desiredFeatures;
+      if (fs.HasOptionalField(H225_FeatureSet::e_supportedFeatures))
+          lists[2] = &fs.m_supportedFeatures;
+
+      for (PINDEX l = 0; l < 3; ++l) {
+          if (lists[l] == NULL)
+              continue;
+          const H225_ArrayOf_FeatureDescriptor & fsl = *lists[l];
+          for (PINDEX i=fsl.GetSize()-1; i >= 0; --i) {  // iterate backwards
+              const H225_FeatureDescriptor & fd = fsl[i];
+              H460_Feature * feat = FindFeaturePDU(fd);
+              if (feat == NULL)
+                  continue;
+
+              const std::vector<H460_Feature *> & readers = GetDispatch(MessageID);
+              if (std::find(readers.begin(), readers.end(), feat) != readers.end())
+                    ReadFeaturePDU(*feat,fd,MessageID);
           }
       }
 
@@ -1776,6 +1787,7 @@ void H460_FeatureSet::DisableAllFeatures(int msgtype)
            H460_Feature & feat = Features.GetDataAt(i);
            if (feat.FeatureAdvertised(msgtype)) {
                PTRACE(4,"H460\tRemoving " << feat.GetFeatureIDAsString());
+               dispatchValid = FALSE;
                removelist.push_back(feat.GetFeatureID());
                if (feat.GetFeaturePurpose() !=  H460_Feature::FeatureBaseAll)
                  delete &feat;
@@ -1823,6 +1835,92 @@ PBoolean H460_FeatureSet::HasFeature(const H460_FeatureID & id)
     return FALSE;
 }
 
+static const unsigned H460_MessageTypes[] = {
+    H460_MessageType::e_gatekeeperRequest,
+    H460_MessageType::e_gatekeeperConfirm,
+    H460_MessageType::e_gatekeeperReject,
+    H460_MessageType::e_registrationRequest,
+    H460_MessageType::e_registrationConfirm,
+    H460_MessageType::e_registrationReject,
+    H460_MessageType::e_admissionRequest,
+    H460_MessageType::e_admissionConfirm,
+    H460_MessageType::e_admissionReject,
+    H460_MessageType::e_locationRequest,
+    H460_MessageType::e_locationConfirm,
+    H460_MessageType::e_locationReject,
+    H460_MessageType::e_nonStandardMessage,
+    H460_MessageType::e_serviceControlIndication,
+    H460_MessageType::e_serviceControlResponse,
+    H460_MessageType::e_unregistrationRequest,
+    H460_MessageType::e_inforequest,
+    H460_MessageType::e_inforequestresponse,
+    H460_MessageType::e_disengagerequest,
+    H460_MessageType::e_disengageconfirm,
+    H460_MessageType::e_setup,
+    H460_MessageType::e_callProceeding,
+    H460_MessageType::e_connect,
+    H460_MessageType::e_alerting,
+    H460_MessageType::e_facility,
+    H460_MessageType::e_releaseComplete
+};
+
+void H460_FeatureSet::BuildDispatchTable()
+{
+    dispatchTable.clear();
+    stdFeatureIndex.clear();
+    featureIndex.clear();
+
+    for (PINDEX i = 0; i < Features.GetSize(); i++) {
+        H460_Feature & feat = Features.GetDataAt(i);
+        H460_FeatureID id = feat.GetFeatureID();
+        if (id.GetFeatureType() == H225_GenericIdentifier::e_standard)
+            stdFeatureIndex[(unsigned)id] = &feat;
+        else
+            featureIndex[id.IDString()] = &feat;
+    }
+    dispatchValid = TRUE;
+
+    for (PINDEX m = 0; m < (PINDEX)PARRAYSIZE(H460_MessageTypes); m++)
+        GetDispatch(H460_MessageTypes[m]);
+
+    PTRACE(5,"H460\tDispatch table built for " << Features.GetSize() << " features");
+}
+
+const std::vector<H460_Feature *> & H460_FeatureSet::GetDispatch(unsigned MessageID)
+{
+    if (!dispatchValid)
+        BuildDispatchTable();
+
+    std::map<unsigned, std::vector<H460_Feature *> >::iterator r = dispatchTable.find(MessageID);
+    if (r != dispatchTable.end())
+        return r->second;
+
+    // Messages outside the table are added when first used
+    std::vector<H460_Feature *> & handlers = dispatchTable[MessageID];
+    for (PINDEX i = 0; i < Features.GetSize(); i++) {
+        H460_Feature & feat = Features.GetDataAt(i);
+        if (feat.FeatureHandled(MessageID))
+            handlers.push_back(&feat);
+    }
+    return handlers;
+}
+
+H460_Feature * H460_FeatureSet::FindFeaturePDU(const H225_FeatureDescriptor & pdu)
+{
+    if (!dispatchValid)
+        BuildDispatchTable();
+
+    const H225_GenericIdentifier & id = pdu.m_id;
+    if (id.GetTag() == H225_GenericIdentifier::e_standard) {
+        const PASN_Integer & sid = id;
+        std::map<unsigned, H460_Feature *>::const_iterator r = stdFeatureIndex.find(sid.GetValue());
+        return r != stdFeatureIndex.end() ? r->second : NULL;
+    }
+
+    std::map<PString, H460_Feature *>::const_iterator r = featureIndex.find(GetFeatureIDPDU(pdu).IDString());
+    return r != featureIndex.end() ? r->second : NULL;
+}
+
 PBoolean H460_FeatureSet::SupportNonCallService(const H460_FeatureID & id) const
 {
     for (PINDEX i =0; i < Features.GetSize(); i++) {
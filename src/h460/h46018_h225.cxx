@@ -56,9 +56,16 @@
 #define H46019_KEEPALIVE_TIME       19   // Sec between keepalive messages
 #define H46019_KEEPALIVE_COUNT      3    // Number of probes per message
 #define H46019_KEEPALIVE_INTERVAL   100  // ms between each probe
+#define H46019_KEEPALIVE_SLOTS      256  // Keep alive timing wheel slots of H46019_KEEPALIVE_INTERVAL
 
-#define H46024A_MAX_PROBE_COUNT  15
-#define H46024A_PROBE_INTERVAL  200
+#define H46024A_MAX_PROBE_COUNT  15      // Probes sent to each candidate
+#define H46024A_PROBE_INTERVAL  200     // Between probes to the same candidate, ms
+#define H46024A_PROBE_PACE      20      // Between any two probes, ms
+#define H46024A_PROBE_SETTLE    100     // Wait for a faster reply after the first, ms
+#define H46024A_MAX_REFLEXIVE   4       // Probe sources remembered as candidates
+
+#define H46019M_READ_BATCH       32   // Datagrams drained from a multiplex socket when readable
+#define H46019M_BUFFER_SIZE      2000 // Largest multiplexed datagram
 
 #if PTLIB_VER >= 2130
 PCREATE_NAT_PLUGIN(H46019, "H.460.19");
@@ -70,12 +77,12 @@ PCREATE_NAT_PLUGIN(H46019);
 
 // Listening/Keep Alive Thread
 
-class H46018TransportThread : public PThread
+class H46018TransportThread : public PThread, public H46019KeepAliveScheduler::Client
 {
    PCLASSINFO(H46018TransportThread, PThread)
 
    public:
-    H46018TransportThread(H323EndPoint & endpoint, H46018Transport * transport);
+    H46018TransportThread(H323EndPoint & endpoint, H46018Handler & handler, H46018Transport * transport);
     ~H46018TransportThread();
 
     void ConnectionEstablished();
@@ -83,11 +90,13 @@ class H46018TransportThread : public PThread
    protected:
     void Main();
 
+    virtual void OnKeepAlive();
+    virtual PTimeInterval GetLastKeepAliveTime() const;
+
     PBoolean    isConnected;
+    H46018Handler & handler;
     H46018Transport * transport;
 
-    PDECLARE_NOTIFIER(PTimer, H46018TransportThread, KeepAlive);
-    PTimer    m_keepAlive;
     unsigned  m_keepAliveInterval;
 
     PTime   lastupdate;
@@ -96,9 +105,9 @@ class H46018TransportThread : public PThread
 
 /////////////////////////////////////////////////////////////////////////////
 
-H46018TransportThread::H46018TransportThread(H323EndPoint & ep, H46018Transport * t)
+H46018TransportThread::H46018TransportThread(H323EndPoint & ep, H46018Handler & h, H46018Transport * t)
   : PThread(ep.GetSignallingThreadStackSize(), AutoDeleteThread,
-            NormalPriority,"H46019 Answer:%0x"),transport(t)
+            NormalPriority,"H46019 Answer:%0x"),handler(h),transport(t)
 {  
 
     isConnected = false;
@@ -110,7 +119,7 @@ H46018TransportThread::H46018TransportThread(H323EndPoint & ep, H46018Transport
 
 H46018TransportThread::~H46018TransportThread()
 {
-    m_keepAlive.Stop();
+    handler.GetKeepAliveScheduler().Remove(*this);
 }
 
 void H46018TransportThread::Main()
@@ -127,7 +136,7 @@ void H46018TransportThread::Main()
             break;
         } 
     }
-    m_keepAlive.Stop();
+    handler.GetKeepAliveScheduler().Remove(*this);
 
     PTRACE(3, "H46018\tTransport Closed");
 }
@@ -135,11 +144,15 @@ void H46018TransportThread::Main()
 void H46018TransportThread::ConnectionEstablished()
 {
      PTRACE(3, "H46019\tStarted KeepAlive");
-     m_keepAlive.SetNotifier(PCREATE_NOTIFIER(KeepAlive));
-     m_keepAlive.RunContinuous(m_keepAliveInterval * 1000);
+     handler.GetKeepAliveScheduler().Add(*this, m_keepAliveInterval);
+}
+
+PTimeInterval H46018TransportThread::GetLastKeepAliveTime() const
+{
+  return transport ? transport->GetLastWriteTime() : PTimeInterval(0);
 }
 
-void H46018TransportThread::KeepAlive(PTimer &, H323_INT)
+void H46018TransportThread::OnKeepAlive()
 {
   // Send empty RFC1006 TPKT
   BYTE tpkt[4];
@@ -158,6 +171,184 @@ void H46018TransportThread::KeepAlive(PTimer &, H323_INT)
 
 ///////////////////////////////////////////////////////////////////////////////////////
 
+H46019KeepAliveScheduler::H46019KeepAliveScheduler()
+  : m_wheel(H46019_KEEPALIVE_SLOTS), m_currentTick(0), m_thread(NULL), m_shutdown(false)
+{
+}
+
+H46019KeepAliveScheduler::~H46019KeepAliveScheduler()
+{
+    if (m_thread != NULL) {
+        m_shutdown = true;
+        m_wakeUp.Signal();
+        m_thread->WaitForTermination();
+        delete m_thread;
+    }
+
+    // Entries still in the wheel include all those removed but not yet deleted
+    for (PINDEX i = 0; i < H46019_KEEPALIVE_SLOTS; ++i) {
+        for (size_t j = 0; j < m_wheel[i].size(); ++j)
+            delete m_wheel[i][j];
+    }
+}
+
+void H46019KeepAliveScheduler::Add(Client & client, unsigned interval, unsigned initial)
+{
+    PWaitAndSignal m(m_mutex);
+
+    if (m_shutdown || interval == 0)
+        return;
+
+    PBoolean wasIdle = m_entries.empty();
+    if (wasIdle)
+        m_tickTime = PTimer::Tick();
+
+    EntryMap::iterator it = m_entries.find(&client);
+    if (it != m_entries.end()) {
+        it->second->removed = true;
+        m_entries.erase(it);
+    }
+
+    Entry * entry = new Entry;
+    entry->client   = &client;
+    entry->interval = interval*1000;
+    entry->initial  = initial;
+    entry->rounds   = 0;
+    entry->next     = 0;
+    entry->removed  = false;
+    m_entries.insert(EntryMap::value_type(&client, entry));
+
+    // First initial keep-alive goes on the next tick, otherwise the first regular one is due
+    Schedule(entry, initial > 0 ? 0 : entry->interval - PRandom::Number() % (entry->interval/10 + 1));
+
+    if (m_thread == NULL)
+        m_thread = PThread::Create(PCREATE_NOTIFIER(WorkerMain), 0,
+                                   PThread::NoAutoDeleteThread, PThread::NormalPriority, "H46019 KeepAlive");
+    else if (wasIdle)
+        m_wakeUp.Signal();
+}
+
+void H46019KeepAliveScheduler::Remove(Client & client, PBoolean wait)
+{
+    {
+        PWaitAndSignal m(m_mutex);
+        EntryMap::iterator it = m_entries.find(&client);
+        if (it == m_entries.end())
+            return;
+        it->second->removed = true;   // Deleted by the worker thread
+        m_entries.erase(it);
+    }
+
+    // Make sure any keep-alive being sent to the client is finished
+    if (wait) {
+        m_sendMutex.Wait();
+        m_sendMutex.Signal();
+    }
+}
+
+PBoolean H46019KeepAliveScheduler::IsScheduled(Client & client) const
+{
+    PWaitAndSignal m(m_mutex);
+    return m_entries.find(&client) != m_entries.end();
+}
+
+void H46019KeepAliveScheduler::Schedule(Entry * entry, PInt64 delay)
+{
+    PInt64 ticks = delay/H46019_KEEPALIVE_INTERVAL;
+    if (ticks < 1)
+        ticks = 1;
+
+    entry->rounds = (unsigned)((ticks-1)/H46019_KEEPALIVE_SLOTS);
+    m_wheel[(size_t)((m_currentTick + ticks) % H46019_KEEPALIVE_SLOTS)].push_back(entry);
+}
+
+void H46019KeepAliveScheduler::WorkerMain(PThread &, H323_INT)
+{
+    PTRACE(4, "H46019\tKeepAlive scheduler started");
+
+    std::vector<Entry *> due;
+    while (!m_shutdown) {
+        m_mutex.Wait();
+        PBoolean idle = m_entries.empty();
+        PTimeInterval wait = m_tickTime + H46019_KEEPALIVE_INTERVAL - PTimer::Tick();
+        m_mutex.Signal();
+
+        if (idle)
+            m_wakeUp.Wait();
+        else if (wait > 0)
+            m_wakeUp.Wait(wait);
+
+        if (m_shutdown)
+            break;
+
+        // Advance the wheel to now, collecting what is due and deleting removed entries
+        m_mutex.Wait();
+        PTimeInterval now = PTimer::Tick();
+        while (now - m_tickTime >= H46019_KEEPALIVE_INTERVAL) {
+            m_tickTime += H46019_KEEPALIVE_INTERVAL;
+            std::vector<Entry *> & slot = m_wheel[(size_t)(++m_currentTick % H46019_KEEPALIVE_SLOTS)];
+            size_t kept = 0;
+            for (size_t i = 0; i < slot.size(); ++i) {
+                Entry * entry = slot[i];
+                if (entry->removed)
+                    delete entry;
+                else if (entry->rounds > 0) {
+                    entry->rounds--;
+                    slot[kept++] = entry;
+                } else
+                    due.push_back(entry);
+            }
+            slot.resize(kept);
+        }
+        m_mutex.Signal();
+
+        if (due.empty())
+            continue;
+
+        // Send the batch, a client being removed waits for this to finish
+        m_sendMutex.Wait();
+        for (size_t i = 0; i < due.size(); ++i) {
+            Entry * entry = due[i];
+            m_mutex.Wait();
+            PBoolean removed = entry->removed;
+            m_mutex.Signal();
+            if (removed)
+                continue;
+
+            if (entry->initial > 0) {
+                entry->initial--;
+                entry->next = entry->initial > 0 ? H46019_KEEPALIVE_INTERVAL : entry->interval;
+            } else {
+                // Skip the keep-alive if other traffic has kept the binding open
+                PTimeInterval last = entry->client->GetLastKeepAliveTime();
+                PInt64 since = (now - last).GetMilliSeconds();
+                if (last > entry->lastSent && since < entry->interval) {
+                    entry->next = (unsigned)(entry->interval - since);
+                    continue;
+                }
+                entry->next = entry->interval - PRandom::Number() % (entry->interval/10 + 1);
+            }
+            entry->client->OnKeepAlive();
+            entry->lastSent = PTimer::Tick();
+        }
+        m_sendMutex.Signal();
+
+        m_mutex.Wait();
+        for (size_t i = 0; i < due.size(); ++i) {
+            if (due[i]->removed)
+                delete due[i];
+            else
+                Schedule(due[i], due[i]->next);
+        }
+        m_mutex.Signal();
+        due.clear();
+    }
+
+    PTRACE(4, "H46019\tKeepAlive scheduler stopped");
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+
 
 H46018SignalPDU::H46018SignalPDU(const OpalGloballyUniqueID & callIdentifier)
 {
@@ -278,6 +469,7 @@ PBoolean H46018Transport::HandleH46018SignallingChannelPDU(PThread * thread)
 PBoolean H46018Transport::WritePDU( const PBYTEArray & pdu )
 {
     PWaitAndSignal m(WriteMutex);
+    lastWrite = PTimer::Tick();
     return H323TransportTCP::WritePDU(pdu);
 
 }
@@ -438,7 +630,7 @@ void H46018Handler::SocketThread(PThread &,  H323_INT)
 
     if (transport->Connect(m_callId)) {
         PTRACE(3, "H46018\tConnected to " << transport->GetRemoteAddress());
-        new H46018TransportThread(EP, transport);
+        new H46018TransportThread(EP, *this, transport);
         lastCallIdentifer = m_callId.AsString();
     } else {
         PTRACE(3, "H46018\tCALL ABORTED: Failed connect to " << transport->GetRemoteAddress());
@@ -494,6 +686,8 @@ PBoolean                      PNatMethod_H46019::multiplex=false;
 muxSocketMap                  PNatMethod_H46019::rtpSocketMap;
 muxPortMap                    PNatMethod_H46019::rtpPortMap;
 muxSocketMap                  PNatMethod_H46019::rtcpSocketMap;
+H46019MultiplexTable          PNatMethod_H46019::rtpSocketTable;
+H46019MultiplexTable          PNatMethod_H46019::rtcpSocketTable;
 PBoolean                      PNatMethod_H46019::muxShutdown;
 PMutex                        PNatMethod_H46019::muxMutex;
 #endif
@@ -521,6 +715,8 @@ PNatMethod_H46019::~PNatMethod_H46019()
         rtpSocketMap.clear();
         rtpPortMap.clear();
         rtcpSocketMap.clear();
+        rtpSocketTable.RemoveAll();
+        rtcpSocketTable.RemoveAll();
 
         if (muxSockets.rtp) {
             muxSockets.rtp->Close();
@@ -640,22 +836,46 @@ PBoolean PNatMethod_H46019::CreateSocketPair(PUDPSocket * & socket1,
     } else
 #endif
     {
-       socket1 = new H46019UDPSocket(*handler,info,true);     /// Data 
-       socket2 = new H46019UDPSocket(*handler,info,false);    /// Signal
-
-        /// Make sure we have sequential ports
-        while ((!OpenSocket(*socket1, pairedPortInfo,binding)) ||
-               (!OpenSocket(*socket2, pairedPortInfo,binding)) ||
-               (socket2->GetPort() != socket1->GetPort() + 1) )
-            {
-                delete socket1;
-                delete socket2;
-                socket1 = new H46019UDPSocket(*handler,info,true);    /// Data 
-                socket2 = new H46019UDPSocket(*handler,info,false);    /// Signal
-            }
+       H323EndPoint * ep = handler->GetEndPoint();
+
+       /// Take sequential pairs from the endpoint range, skipping those in use.
+       /// The pair bound is handed on to the RTP session which releases it.
+       std::vector<WORD> busyPorts;
+       WORD firstPort = ep->GetRtpIpPortPair(binding);
+       WORD port = firstPort;
+       for (;;) {
+            socket1 = new H46019UDPSocket(*handler,info,true);     /// Data 
+            socket2 = new H46019UDPSocket(*handler,info,false);    /// Signal
+            if (port != 0 &&
+                socket1->Listen(binding, 1, port) &&
+                socket2->Listen(binding, 1, (WORD)(port+1)))
+                break;
+
+            delete socket1;
+            delete socket2;
+            socket1 = socket2 = NULL;
+
+            if (port != 0)
+                busyPorts.push_back(port);
+            port = ep->GetRtpIpPortPair(binding);
+            if (port == 0 || port == firstPort)
+                break;
+       }
 
-            PTRACE(5, "H46019\tUDP ports "
-                   << socket1->GetPort() << '-' << socket2->GetPort());
+       for (size_t i = 0; i < busyPorts.size(); i++)
+            ep->ReleaseRtpIpPortPair(busyPorts[i], binding);
+
+       if (socket1 == NULL) {
+            PTRACE(2, "H46019\tFailed to bind to " << binding << " local UDP port range "
+                   << ep->GetRtpIpPortBase() << '-' << ep->GetRtpIpPortMax());
+            return FALSE;
+       }
+
+       socket1->SetReadTimeout(500);
+       socket2->SetReadTimeout(500);
+
+       PTRACE(5, "H46019\tUDP ports "
+              << socket1->GetPort() << '-' << socket2->GetPort());
     }
       
     SetConnectionSockets(socket1,socket2,info);
@@ -827,148 +1047,234 @@ void PNatMethod_H46019::StartMultiplexListener()
                                     "GkMonitor:%x");
 }
 
-void PNatMethod_H46019::ReadThread(PThread &,  H323_INT)
+// Datagrams read from a multiplex socket in one go
+class H46019MultiplexBatch
 {
-  
-  PINDEX bufferLen = 2000;
-  RTP_MultiDataFrame buffer(bufferLen);
-  PINDEX len = bufferLen;
-  PIPSocket::Address addr;
-  WORD port=0;
+  public:
+    H46019MultiplexBatch()
+      : count(0)
+    {
+      for (PINDEX i = 0; i < H46019M_READ_BATCH; i++)
+        frames[i] = new RTP_MultiDataFrame(H46019M_BUFFER_SIZE);
+    }
+
+    ~H46019MultiplexBatch()
+    {
+      for (PINDEX i = 0; i < H46019M_READ_BATCH; i++)
+        delete frames[i];
+    }
+
+    PINDEX Read(PUDPSocket & socket, PBoolean direct);
+
+    RTP_MultiDataFrame * frames[H46019M_READ_BATCH];
+    PINDEX               length[H46019M_READ_BATCH];
+    PIPSocket::Address   addr[H46019M_READ_BATCH];
+    WORD                 port[H46019M_READ_BATCH];
+    PINDEX               count;
+};
 
-  PUDPSocket * socket = NULL;
-  H46019MultiplexSocket::MuxType socketRead;
 
+PINDEX H46019MultiplexBatch::Read(PUDPSocket & socket, PBoolean direct)
+{
+  count = 0;
+
+#if defined(P_LINUX) && defined(MSG_WAITFORONE)
+  if (direct) {
+    // One system call for everything waiting on the socket
+    struct mmsghdr msgs[H46019M_READ_BATCH];
+    struct iovec iov[H46019M_READ_BATCH];
+    struct sockaddr_storage from[H46019M_READ_BATCH];
+    memset(msgs, 0, sizeof(msgs));
+    for (PINDEX i = 0; i < H46019M_READ_BATCH; i++) {
+      iov[i].iov_base = frames[i]->GetPointer();
+      iov[i].iov_len = frames[i]->GetSize();
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+      msgs[i].msg_hdr.msg_name = &from[i];
+      msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+    }
+
+    int received = ::recvmmsg(socket.GetHandle(), msgs, H46019M_READ_BATCH, MSG_DONTWAIT, NULL);
+    if (received <= 0) {
+      PTRACE_IF(2, errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR,
+                "H46019M\tMultiplex read error " << errno);
+      return 0;
+    }
+
+    for (int i = 0; i < received; i++) {
+      struct sockaddr * sa = (struct sockaddr *)&from[i];
+      if ((msgs[i].msg_hdr.msg_flags & MSG_TRUNC) != 0) {
+        PTRACE(2, "H46019M\tRead UDP packet too large for buffer of " << frames[i]->GetSize() << " bytes.");
+        continue;
+      }
+      length[count] = msgs[i].msg_len;
+      addr[count] = PIPSocket::Address(sa->sa_family, msgs[i].msg_hdr.msg_namelen, sa);
+#if P_HAS_IPV6
+      if (sa->sa_family == AF_INET6)
+        port[count] = ntohs(((struct sockaddr_in6 *)sa)->sin6_port);
+      else
+#endif
+        port[count] = ntohs(((struct sockaddr_in *)sa)->sin_port);
+      if (count != i) {
+        // Keep the batch contiguous after a dropped datagram
+        RTP_MultiDataFrame * frame = frames[count];
+        frames[count] = frames[i];
+        frames[i] = frame;
+      }
+      count++;
+    }
+    return count;
+  }
+#endif
+
+  // The listener sets a zero read timeout so this stops when the socket is empty
+  while (count < H46019M_READ_BATCH) {
+    PINDEX len = frames[count]->GetSize();
+    if (!socket.ReadFrom(frames[count]->GetPointer(), len, addr[count], port[count])) {
+      if (count == 0) {
+        switch (socket.GetErrorNumber(PChannel::LastReadError)) {
+          case ECONNRESET :
+          case ECONNREFUSED :
+            PTRACE(2, "H46019M\tUDP Port on remote not ready.");
+            break;
+
+          case EMSGSIZE :
+            PTRACE(2, "H46019M\tRead UDP packet too large for buffer of " << len << " bytes.");
+            break;
+        }
+      }
+      break;
+    }
+    length[count++] = socket.GetLastReadCount();
+  }
+  return count;
+}
+
+
+void PNatMethod_H46019::ReadThread(PThread &,  H323_INT)
+{
   PUDPSocket & dataSocket = *GetMultiplexReadSocket(true);
   PUDPSocket & ctrlSocket = *GetMultiplexReadSocket(false);
 
-  int select = 0;
+  // Sockets are drained when readable, the reads after the first must not wait
+  dataSocket.SetReadTimeout(0);
+  ctrlSocket.SetReadTimeout(0);
+
+  // System calls straight on the socket unless another NAT method supplied it
+  PBoolean direct = ((H46019MultiplexSocket *)GetMultiplexSocket(true))->GetSubSocket() == NULL;
+
+  H46019MultiplexBatch batch;
+
   while (!muxShutdown) { 
-        
-      if (select == 0)
-         select = PIPSocket::Select(dataSocket,ctrlSocket);
-
-      switch (select) {
-        case -1:
-            socketRead = H46019MultiplexSocket::e_rtp;
-            socket = &dataSocket;
-            select = 0;
-            break;
-        case -2:
-        case -3:
-            socketRead = H46019MultiplexSocket::e_rtcp;
-            socket = &ctrlSocket;
-            if (select == -3) select = -1;  // loop back to read RTP socket
-            else select = 0;
-            break;
-        default:
-            select = 0;
-            continue;
+      int select = PIPSocket::Select(dataSocket,ctrlSocket);
+      if (muxShutdown)
+          break;
+
+      for (int i = 0; i < 2; i++) {
+          PBoolean rtp = i == 0;
+          if (select != -3 && select != (rtp ? -1 : -2))
+              continue;
+
+          if (batch.Read(rtp ? dataSocket : ctrlSocket, direct) == 0)
+              continue;
+
+          // Route the whole batch with one lock, registrations wait for it
+          PWaitAndSignal m(muxMutex);
+          for (PINDEX j = 0; j < batch.count && !muxShutdown; j++)
+              DispatchMultiplexFrame(rtp, *batch.frames[j], batch.length[j], batch.addr[j], batch.port[j]);
       }
+  }
 
-         if (!muxShutdown && socket && socket->ReadFrom(buffer.GetPointer(),len,addr,port)) {
-             int actRead = socket->GetLastReadCount();
-             int muxHeader = buffer.GetMultiHeaderSize();
-             std::map<unsigned,PUDPSocket*>::const_iterator it;
-             switch (socketRead) {
-               case H46019MultiplexSocket::e_rtp:
-               {
-                 DWORD multiplexID=0;
-                 if (PNatMethod_H46019::IsMultiplexed() && !buffer.IsValidRTPPayload()) {
-                     if (!buffer.IsNotMultiplexed()) {
-                         PTRACE(2,"H46019M\tBad RTP MUX Packet received from " << addr << ":" << port);
-                         continue;
-                     }
-                     // We have received a valid RTP UnMuxed Packet.
-                     muxHeader=0;  // Read from the first byte.
-                     multiplexID = ResolveMuxIDFromSourceAddress(rtpSocketMap, rtpPortMap, addr, port);
-                 } else {
-                     multiplexID = buffer.GetMultiplexID();
-                 }
-
-                 it = rtpSocketMap.find(multiplexID);
-                 if (it == rtpSocketMap.end()) {
-                     unsigned badMUXid = multiplexID;
-                     unsigned rightMUXid=0;
-                     unsigned detected = ResolveSession(rtpSocketMap, badMUXid, true, addr, port, rightMUXid);
-                     if (!detected) {
-                          PTRACE(2,"H46019M\tReceived RTP packet with unknown MUX ID " << badMUXid << " " << addr << ":" << port);
-                          continue;
-                     }
-                     it = rtpSocketMap.find(detected);
-                     if (it == rtpSocketMap.end()) continue;
-
-                     if (rightMUXid == 0) {
-                          PTRACE(2,"H46019M\tERROR: Receive UnMultiplex Packet " << " " << addr << ":" << port);
-                          ((H46019UDPSocket *)it->second)->WriteMultiplexBuffer(buffer.GetPointer(), actRead, addr, port);
-                           continue;
-                     }
-                     PTRACE(2,"H46019M\tERROR: Recover Receive Multiplex Session " << rightMUXid  << " incorrectly sent as " << badMUXid);
-                 } 
-                 break;
-               }
-               case H46019MultiplexSocket::e_rtcp:
-                 it = rtcpSocketMap.find(buffer.GetMultiplexID());
-                 if (it == rtcpSocketMap.end()) {
-                     PTRACE(2,"H46019M\tReceived RTCP packet with unknown MUX ID " 
-                                        << buffer.GetMultiplexID() << " " << addr << ":" << port);
-                     continue;
-                 }
-                 break;
-               default:
-                     PTRACE(2,"H46019M\tUnknown Muxed RTP packet received from " << addr << ":" << port);
-                     continue;
-             }
-
-             ((H46019UDPSocket *)it->second)->WriteMultiplexBuffer(buffer.GetPointer()+muxHeader, actRead-muxHeader, addr, port);
-             len = bufferLen;
-         } else {
-             if (muxShutdown) continue;
-
-              switch (socket->GetErrorNumber(PChannel::LastReadError)) {
-                case ECONNRESET :
-/*                PTRACE(2, "H46019M\tUDP Port Reset! Closing all Sockets");
-                  if (socketRead == H46019MultiplexSocket::e_rtp)
-                             CloseAllSessions(rtpSocketMap);
-                   continue; */
-                case ECONNREFUSED :
-                  PTRACE(2, "H46019M\tUDP Port on remote not ready.");
-                  continue;
-
-                case EMSGSIZE :
-                  PTRACE(2, "H46019M\tRead UDP packet too large for buffer of " << len << " bytes.");
-                  continue;
-
-                case EBADF : // Interface went down
-                case EINTR :
-                case EAGAIN : // Shouldn't happen, but it does.
-                  continue;
-              }
-         }
-     }
+  m_readThread = NULL;
+  PTRACE(4, "H46019M\tMultiplex Read Shutdown");
+}
+
+
+void PNatMethod_H46019::DispatchMultiplexFrame(PBoolean rtp, RTP_MultiDataFrame & frame, PINDEX len,
+                                               const PIPSocket::Address & addr, WORD port)
+{
+  int muxHeader = frame.GetMultiHeaderSize();
+  if (len <= muxHeader) {
+      PTRACE(2,"H46019M\tShort MUX Packet received from " << addr << ":" << port);
+      return;
+  }
+
+  PUDPSocket * socket;
+  if (rtp) {
+      DWORD multiplexID=0;
+      if (PNatMethod_H46019::IsMultiplexed() && !frame.IsValidRTPPayload()) {
+          if (!frame.IsNotMultiplexed()) {
+              PTRACE(2,"H46019M\tBad RTP MUX Packet received from " << addr << ":" << port);
+              return;
+          }
+          // We have received a valid RTP UnMuxed Packet.
+          muxHeader=0;  // Read from the first byte.
+          multiplexID = ResolveMuxIDFromSourceAddress(rtpSocketMap, rtpPortMap, addr, port);
+      } else {
+          multiplexID = frame.GetMultiplexID();
+      }
+
+      socket = rtpSocketTable.GetAt(multiplexID);
+      if (socket == NULL) {
+          unsigned badMUXid = multiplexID;
+          unsigned rightMUXid=0;
+          unsigned detected = ResolveSession(rtpSocketMap, badMUXid, true, addr, port, rightMUXid);
+          if (!detected) {
+              PTRACE(2,"H46019M\tReceived RTP packet with unknown MUX ID " << badMUXid << " " << addr << ":" << port);
+              return;
+          }
+          socket = rtpSocketTable.GetAt(detected);
+          if (socket == NULL)
+              return;
+
+          if (rightMUXid == 0) {
+              PTRACE(2,"H46019M\tERROR: Receive UnMultiplex Packet " << " " << addr << ":" << port);
+              ((H46019UDPSocket *)socket)->WriteMultiplexBuffer(frame.GetPointer(), len, addr, port);
+              return;
+          }
+          PTRACE(2,"H46019M\tERROR: Recover Receive Multiplex Session " << rightMUXid  << " incorrectly sent as " << badMUXid);
+      }
+  } else {
+      socket = rtcpSocketTable.GetAt(frame.GetMultiplexID());
+      if (socket == NULL) {
+          PTRACE(2,"H46019M\tReceived RTCP packet with unknown MUX ID " 
+                             << frame.GetMultiplexID() << " " << addr << ":" << port);
+          return;
+      }
+  }
 
-     m_readThread = NULL;
-     PTRACE(4, "H46019M\tMultiplex Read Shutdown");
+  ((H46019UDPSocket *)socket)->WriteMultiplexBuffer(frame.GetPointer()+muxHeader, len-muxHeader, addr, port);
 }
 
 void PNatMethod_H46019::RegisterSocket(bool rtp, unsigned id, PUDPSocket * socket)
 {
-    if (rtp)
-       rtpSocketMap.insert(pair<unsigned, PUDPSocket*>(id,socket));
-    else
-       rtcpSocketMap.insert(pair<unsigned, PUDPSocket*>(id,socket));
+    PWaitAndSignal m(muxMutex);
+
+    if (rtp) {
+       if (rtpSocketMap.insert(pair<unsigned, PUDPSocket*>(id,socket)).second)
+           rtpSocketTable.SetAt(id, socket);
+    } else {
+       if (rtcpSocketMap.insert(pair<unsigned, PUDPSocket*>(id,socket)).second)
+           rtcpSocketTable.SetAt(id, socket);
+    }
 }
 
 void PNatMethod_H46019::UnregisterSocket(bool rtp, unsigned id)
 {
+    PWaitAndSignal m(muxMutex);
+
     if (rtp) {
         std::map<unsigned,PUDPSocket*>::iterator it = rtpSocketMap.find(id);
-        if (it != rtpSocketMap.end())
+        if (it != rtpSocketMap.end()) {
              rtpSocketMap.erase(it);
+             rtpSocketTable.RemoveAt(id);
+        }
     } else {
         std::map<unsigned,PUDPSocket*>::iterator it = rtcpSocketMap.find(id);
-        if (it != rtcpSocketMap.end())
+        if (it != rtcpSocketMap.end()) {
              rtcpSocketMap.erase(it);
+             rtcpSocketTable.RemoveAt(id);
+        }
     }
 
     if (rtp && rtpSocketMap.size() == 0) {
@@ -987,6 +1293,157 @@ void PNatMethod_H46019::UnregisterSocket(bool rtp, unsigned id)
     }
 }
 
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+H46019MultiplexTable::H46019MultiplexTable()
+  : m_used(0), m_count(0)
+{
+    RemoveAll();
+}
+
+static inline unsigned H46019MultiplexHash(unsigned id, size_t size)
+{
+    return (id * 2654435761U) & (unsigned)(size - 1);
+}
+
+PUDPSocket * H46019MultiplexTable::GetAt(unsigned id) const
+{
+    if (id == 0)
+        return NULL;
+
+    for (unsigned i = H46019MultiplexHash(id, m_entries.size()); ; i = (i + 1) & (m_entries.size() - 1)) {
+        const Entry & entry = m_entries[i];
+        if (entry.id == id)
+            return entry.socket;
+        if (entry.id == 0)
+            return NULL;
+    }
+}
+
+void H46019MultiplexTable::SetAt(unsigned id, PUDPSocket * socket)
+{
+    if (id == 0)
+        return;
+
+    // Keep at least a quarter of the entries never used so searches end
+    // quickly, clearing out removed entries or growing when mostly in use
+    if ((m_used + 1)*4 > m_entries.size()*3)
+        Resize(m_count*2 >= m_entries.size() ? m_entries.size()*2 : m_entries.size());
+
+    unsigned removed = UINT_MAX;
+    unsigned i;
+    for (i = H46019MultiplexHash(id, m_entries.size()); m_entries[i].id != 0; i = (i + 1) & (m_entries.size() - 1)) {
+        if (m_entries[i].id == id) {
+            if (m_entries[i].socket == NULL)
+                m_count++;
+            m_entries[i].socket = socket;
+            return;
+        }
+        if (m_entries[i].socket == NULL && removed == UINT_MAX)
+            removed = i;
+    }
+
+    if (removed != UINT_MAX)
+        i = removed;
+    else
+        m_used++;
+    m_entries[i].id = id;
+    m_entries[i].socket = socket;
+    m_count++;
+}
+
+void H46019MultiplexTable::RemoveAt(unsigned id)
+{
+    if (id == 0)
+        return;
+
+    // Entry keeps its ID so searches for later entries carry on past it
+    for (unsigned i = H46019MultiplexHash(id, m_entries.size()); m_entries[i].id != 0; i = (i + 1) & (m_entries.size() - 1)) {
+        if (m_entries[i].id == id) {
+            if (m_entries[i].socket != NULL)
+                m_count--;
+            m_entries[i].socket = NULL;
+            return;
+        }
+    }
+}
+
+void H46019MultiplexTable::RemoveAll()
+{
+    Entry empty = { 0, NULL };
+    m_entries.assign(64, empty);
+    m_used = 0;
+    m_count = 0;
+}
+
+void H46019MultiplexTable::Resize(unsigned size)
+{
+    std::vector<Entry> old;
+    old.swap(m_entries);
+
+    Entry empty = { 0, NULL };
+    m_entries.assign(size, empty);
+    m_used = 0;
+    m_count = 0;
+
+    // Removed entries are dropped, so the table may not need to grow
+    for (size_t j = 0; j < old.size(); j++) {
+        if (old[j].socket != NULL)
+            SetAt(old[j].id, old[j].socket);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+
+H46019MultiQueue::H46019MultiQueue()
+  : m_head(0), m_tail(0)
+{
+}
+
+PBoolean H46019MultiQueue::Push(const void * buf, PINDEX len, const PIPSocket::Address & addr, WORD port)
+{
+    if (m_count >= QueueSize)
+        return false;
+
+    H46019MultiPacket & packet = m_packets[m_tail];
+    packet.fromAddr = addr;
+    packet.fromPort = port;
+    packet.length = len;
+    if (packet.frame.GetSize() < len)
+        packet.frame.SetSize(len);
+    memcpy(packet.frame.GetPointer(), buf, len);
+
+    m_tail = (m_tail + 1) & (QueueSize - 1);
+    ++m_count;
+    return true;
+}
+
+PBoolean H46019MultiQueue::Pop(void * buf, PINDEX & len, PIPSocket::Address & addr, WORD & port)
+{
+    if (m_count == 0)
+        return false;
+
+    const H46019MultiPacket & packet = m_packets[m_head];
+    addr = packet.fromAddr;
+    port = packet.fromPort;
+    if (len > packet.length)
+        len = packet.length;
+    memcpy(buf, (const BYTE *)packet.frame, len);
+
+    m_head = (m_head + 1) & (QueueSize - 1);
+    --m_count;
+    return true;
+}
+
+void H46019MultiQueue::Clear()
+{
+    while (m_count > 0) {
+        m_head = (m_head + 1) & (QueueSize - 1);
+        --m_count;
+    }
+}
+
 #endif
 
 /////////////////////////////////////////////////////////////////////////////////////////////
@@ -1068,14 +1525,15 @@ PBoolean H46019MultiplexSocket::Close()
 H46019UDPSocket::H46019UDPSocket(H46018Handler & _handler, H323Connection::SessionInformation * info, bool _rtpSocket)
 : m_Handler(_handler), m_Session(info->GetSessionID()), m_Token(info->GetCallToken()),
   m_CallId(info->GetCallIdentifer()), m_CUI(info->GetCUI()),
-  keepport(0), keeppayload(0), keepTTL(0), keepseqno(0), keepStartTime(NULL), initialKeep(NULL),
+  keepport(0), keeppayload(0), keepTTL(0), keepseqno(0), keepStartTime(NULL),
 #ifdef H323_H46019M
-  m_recvMultiplexID(info->GetRecvMultiplexID()), m_sendMultiplexID(0), m_multiBuffer(0), m_shutDown(false),
+  m_recvMultiplexID(info->GetRecvMultiplexID()), m_sendMultiplexID(0), m_shutDown(false),
 #endif
 #if defined(H323_H46024A) || defined(H323_H46024B)
   m_CUIrem(PString()), m_locAddr(PIPSocket::GetDefaultIpAny()),  m_locPort(0),
   m_remAddr(PIPSocket::GetDefaultIpAny()),  m_remPort(0), m_detAddr(PIPSocket::GetDefaultIpAny()),  m_detPort(0),
-  m_pendAddr(PIPSocket::GetDefaultIpAny()), m_pendPort(0), m_probes(0), SSRC(PRandom::Number()),
+  m_pendAddr(PIPSocket::GetDefaultIpAny()), m_pendPort(0), SSRC(PRandom::Number()),
+  m_nextCandidate(0), m_bestCandidate(P_MAX_INDEX), m_probeEcho(0),
 #endif
   m_altAddr(PIPSocket::GetDefaultIpAny()), m_altPort(0), m_altMuxID(0),
 #ifdef H323_H46024A
@@ -1092,7 +1550,7 @@ H46019UDPSocket::H46019UDPSocket(H46018Handler & _handler, H323Connection::Sessi
 H46019UDPSocket::~H46019UDPSocket()
 {
     Close();
-    Keep.Stop();
+    m_Handler.GetKeepAliveScheduler().Remove(*this);
     delete keepStartTime;
 
 #ifdef H323_H46019M
@@ -1150,7 +1608,7 @@ void H46019UDPSocket::InitialiseKeepAlive()
 {
     PWaitAndSignal m(PingMutex);
 
-    if (Keep.IsRunning()) {
+    if (m_Handler.GetKeepAliveScheduler().IsScheduled(*this)) {
         PTRACE(6,"H46019UDP\t" << (rtpSocket ? "RTP" : "RTCP") << " ping already running.");
         return;
     }
@@ -1162,12 +1620,9 @@ void H46019UDPSocket::InitialiseKeepAlive()
         PTRACE(4,"H46019UDP\tStart " << (rtpSocket ? "RTP" : "RTCP") << " pinging " 
                         << keepip << ":" << keepport << " every " << keepTTL << " secs.");
 
-        Keep.SetNotifier(PCREATE_NOTIFIER(Ping));
-        Keep.RunContinuous(keepTTL * 1000);   // This will fire at keepTTL sec time.
-
         //  To start before keepTTL interval do a number of special probes to ensure the gatekeeper
         //  is reached to allow media to flow properly.
-        initialKeep = PThread::Create(PCREATE_NOTIFIER(StartKeepAlives), 0, PThread::AutoDeleteThread); 
+        m_Handler.GetKeepAliveScheduler().Add(*this, keepTTL, H46019_KEEPALIVE_COUNT);
 
     } else {
         PTRACE(2,"H46019UDP\t"  << (rtpSocket ? "RTP" : "RTCP") << " PING NOT Ready " 
@@ -1176,21 +1631,19 @@ void H46019UDPSocket::InitialiseKeepAlive()
     }
 }
 
-void H46019UDPSocket::StartKeepAlives(PThread &,  H323_INT)
+void H46019UDPSocket::OnKeepAlive()
 { 
-    // Send a number of keep alive probes to ensure at least one reaches the gatekeeper.
-    // This thread MUST terminate prior to Ping timer firing at keepTTL (default 19 sec).
-    PINDEX i=0;
-    while (i<H46019_KEEPALIVE_COUNT && Keep.IsRunning()) {
-        if (i>0) PThread::Sleep(H46019_KEEPALIVE_INTERVAL);
-        rtpSocket ? SendRTPPing(keepip,keepport) : SendRTCPPing();
-        i++;
-    }
+    rtpSocket ? SendRTPPing(keepip,keepport) : SendRTCPPing();
 }
 
-void H46019UDPSocket::Ping(PTimer &,  H323_INT)
-{ 
-    rtpSocket ? SendRTPPing(keepip,keepport) : SendRTCPPing();
+PTimeInterval H46019UDPSocket::GetLastKeepAliveTime() const
+{
+    return keepLastSent;
+}
+
+void H46019UDPSocket::StopKeepAlive()
+{
+    m_Handler.GetKeepAliveScheduler().Remove(*this, false);
 }
 
 void H46019UDPSocket::SendRTPPing(const PIPSocket::Address & ip, const WORD & port, unsigned id) {
@@ -1360,70 +1813,39 @@ PBoolean H46019UDPSocket::WriteMultiplexBuffer(const void * buf, PINDEX len, con
                 << "Switching to " << addr << ":" << port << " from " << m_remAddr << ":" << m_remPort);
             m_detAddr = addr;  m_detPort = port;
             SetProbeState(e_direct);
-            Keep.Stop();  // Stop the keepAlive Packets
+            StopKeepAlive();  // Stop the keepAlive Packets
             m_h46024b = false;
         }
 #endif
         return true;
     }
 
-    H46019MultiPacket packet;
-        packet.fromAddr = addr;
-        packet.fromPort = port;
-        packet.frame.SetSize(len);
-        memcpy(packet.frame.GetPointer(), buf, len);
-
-    m_multiMutex.Wait();
-      m_multQueue.push(packet);
-    m_multiMutex.Signal();
-    m_multiBuffer++;
+#if defined(H323_H46024A) || defined(H323_H46024B)
+    // Probes are handled on arrival as the RTCP socket may not be read
+    // until media is flowing
+    if (!rtpSocket && len > 1 && ((const BYTE *)buf)[1] == RTP_ControlFrame::e_ApplDefined) {
+        PTRACE(6,"H46024A\tReading RTCP Probe Packet.");
+        if (!ReceivedPacket(buf, len, addr, port))
+            return true;
+    }
+#endif
 
-    if (!rtpSocket) {
-        RTP_ControlFrame frame(len); 
-        memcpy(frame.GetPointer(),buf,len);
-        if (frame.GetPayloadType() == RTP_ControlFrame::e_ApplDefined) {
-            PTRACE(6,"H46024A\tReading RTCP Probe Packet.");
-            PBYTEArray tempData;
-            tempData.SetSize(2048);
-            int tempLen = 2048;
-            Address tempAddr;
-            return ReadFrom((void *)tempData.GetPointer(), tempLen, tempAddr, port);
-        }
+    if (!m_multQueue.Push(buf, len, addr, port)) {
+        PTRACE(5, "H46019M\t" << (rtpSocket ? "RTP" : "RTCP") << " queue full for session "
+                  << m_Session << ", packet dropped");
+        return false;
     }
     return true;
 }
 
 PBoolean H46019UDPSocket::ReadMultiplexBuffer(void * buf, PINDEX & len, Address & addr, WORD & port)
 {
-
-     if (m_multiBuffer == 0 || m_multQueue.size() == 0)
-        return false;
-
-    m_multiMutex.Wait();
-     H46019MultiPacket & packet = m_multQueue.front();
-
-      addr = packet.fromAddr;
-      port = packet.fromPort;
-      len = packet.frame.GetSize();
-      memcpy(buf, packet.frame.GetPointer(), len);
-
-      m_multQueue.pop();
-    m_multiMutex.Signal();
-
-    m_multiBuffer--;
-    return true;
+    return m_multQueue.Pop(buf, len, addr, port);
 }
 
 void H46019UDPSocket::ClearMultiplexBuffer()
 {
-     if (m_multiBuffer > 0) {
-       m_multiMutex.Wait();
-         while (!m_multQueue.empty()) {
-            m_multQueue.pop();
-         }
-       m_multiMutex.Signal();
-     }
-     m_multiBuffer = 0;
+    m_multQueue.Clear();
 }
     
 PBoolean H46019UDPSocket::DoPseudoRead(int & selectStatus)
@@ -1432,14 +1854,14 @@ PBoolean H46019UDPSocket::DoPseudoRead(int & selectStatus)
        return false;
 
    if (rtpSocket) {
-	   while (!m_shutDown && m_multiBuffer == 0)
+	   while (!m_shutDown && m_multQueue.GetCount() == 0)
           selectBlock.Delay(3);
    }
 
    if (m_shutDown)
        selectStatus += PSocket::Interrupted;
    else
-       selectStatus += ((m_multiBuffer > 0) ? (rtpSocket ? -1 : -2) : 0);
+       selectStatus += ((m_multQueue.GetCount() > 0) ? (rtpSocket ? -1 : -2) : 0);
 
    return rtpSocket;
 }
@@ -1497,6 +1919,74 @@ PBoolean H46019UDPSocket::GetPeerAddress(PIPSocketAddressAndPort & addr)
 }
 #endif
 
+#if defined(H323_H46024A) || defined(H323_H46024B)
+PINDEX H46019UDPSocket::FindCandidate(const Address & addr, WORD port) const
+{
+    for (PINDEX i = 0; i < (PINDEX)m_candidates.size(); ++i) {
+        if (m_candidates[i].addr == addr && m_candidates[i].port == port)
+            return i;
+    }
+    return P_MAX_INDEX;
+}
+
+PINDEX H46019UDPSocket::FindCandidate(probe_candidate kind) const
+{
+    for (PINDEX i = 0; i < (PINDEX)m_candidates.size(); ++i) {
+        if (m_candidates[i].kind == kind)
+            return i;
+    }
+    return P_MAX_INDEX;
+}
+
+void H46019UDPSocket::AddProbeCandidate(const Address & addr, WORD port, unsigned muxID, probe_candidate kind)
+{
+    if (!addr.IsValid() || addr.IsAny() || addr.IsLoopback() || port == 0)
+        return;
+
+    PWaitAndSignal m(probeMutex);
+
+    if (FindCandidate(addr, port) != P_MAX_INDEX)
+        return;
+
+    ProbeCandidate candidate;
+    candidate.addr = addr;
+    candidate.port = port;
+    candidate.muxID = muxID;
+    candidate.kind = kind;
+    candidate.sent = 0;
+    candidate.verified = false;
+    m_candidates.push_back(candidate);
+
+    PTRACE(4,"H46024A\ts:" << m_Session << (rtpSocket ? " RTP " : " RTCP ") << "Candidate " 
+                        << m_candidates.size() << " " << addr << ":" << port << " kind " << kind);
+}
+
+PBoolean H46019UDPSocket::GetDirectCandidate(probe_candidate & kind, Address & addr, WORD & port, unsigned & muxID)
+{
+    PWaitAndSignal m(probeMutex);
+
+    if (m_bestCandidate >= (PINDEX)m_candidates.size())
+        return false;
+
+    const ProbeCandidate & c = m_candidates[m_bestCandidate];
+    kind = c.kind;
+    addr = c.addr;  port = c.port;  muxID = c.muxID;
+    return true;
+}
+
+void H46019UDPSocket::AddReflexiveRTPCandidate(const Address & addr, WORD port, unsigned muxID)
+{
+    // Multiplexed RTP and RTCP share the remote port, otherwise RTP is
+    // taken to be mapped on the port below RTCP.
+    WORD rtpPort = muxID > 0 ? port : (WORD)(port-1);
+
+    PTRACE(4,"H46024A\ts:" << m_Session << " RTP reflexive candidate " << addr << ":" << rtpPort 
+                        << " derived from RTCP " << addr << ":" << port);
+
+    AddProbeCandidate(addr, rtpPort, m_altMuxID, e_candidateReflexive);
+}
+#endif
+
 #ifdef H323_H46024A
 
 
@@ -1546,6 +2036,8 @@ void H46019UDPSocket::SetAlternateAddresses(const H323TransportAddress & address
     PTRACE(6,"H46024A\ts: " << m_Session << (rtpSocket ? " RTP " : " RTCP ")  
         << "Remote Alt: " << m_altAddr << ":" << m_altPort << " CUI: " << cui);
 
+    AddProbeCandidate(m_altAddr, m_altPort, m_altMuxID, e_candidateAlternate);
+
     if (!rtpSocket) {
         m_CUIrem = cui;
         if (GetProbeState() < e_idle) {
@@ -1591,15 +2083,15 @@ PBoolean H46019UDPSocket::IsAlternateAddress(const Address & address,WORD port)
 void H46019UDPSocket::StartProbe()
 {
 
-    PTRACE(4,"H46024A\ts: " << m_Session << " Starting direct connection probe.");
+    PTRACE(4,"H46024A\ts: " << m_Session << " Starting direct connection probe of " 
+                        << m_candidates.size() << " candidates.");
 
     SetProbeState(e_probing);
-    m_probes = 0;
     m_Probe.SetNotifier(PCREATE_NOTIFIER(Probe));
-    m_Probe.RunContinuous(H46024A_PROBE_INTERVAL); 
+    m_Probe.RunContinuous(H46024A_PROBE_PACE); 
 }
 
-void H46019UDPSocket::BuildProbe(RTP_ControlFrame & report, bool probing)
+void H46019UDPSocket::BuildProbe(RTP_ControlFrame & report, bool probing, DWORD tick)
 {
     report.SetPayloadType(RTP_ControlFrame::e_ApplDefined);
     report.SetCount((probing ? 0 : 1));  // SubType Probe
@@ -1616,6 +2108,7 @@ void H46019UDPSocket::BuildProbe(RTP_ControlFrame & report, bool probing)
         PMessageDigest::Result bin_digest;
         PMessageDigestSHA1::Encode(m_CallId.AsString() + m_CUIrem, bin_digest);
         memcpy(&data.cui[0], bin_digest.GetPointer(), bin_digest.GetSize());
+        data.tick = tick;
 
         memcpy(report.GetPayloadPtr(),&data,sizeof(probe_packet));
 
@@ -1623,36 +2116,87 @@ void H46019UDPSocket::BuildProbe(RTP_ControlFrame & report, bool probing)
 
 void H46019UDPSocket::Probe(PTimer &,  H323_INT)
 { 
-    m_probes++;
+    PIPSocket::Address addr;  WORD port = 0;  unsigned muxID = 0;
+    bool decided = false;
 
-    if (m_probes > H46024A_MAX_PROBE_COUNT) {
-        m_Probe.Stop();
-        return;
+    {
+        PWaitAndSignal m(probeMutex);
+
+        if (m_state != e_probing)
+            return;
+
+        PTimeInterval now = PTimer::Tick();
+
+        // Find the fastest verified candidate and whether any are still to answer
+        PINDEX best = P_MAX_INDEX;
+        bool pending = false;
+        for (PINDEX i = 0; i < (PINDEX)m_candidates.size(); ++i) {
+            const ProbeCandidate & c = m_candidates[i];
+            if (c.verified) {
+                if (best == P_MAX_INDEX || c.rtt < m_candidates[best].rtt)
+                    best = i;
+            } else if (c.sent < H46024A_MAX_PROBE_COUNT)
+                pending = true;
+        }
+
+        // Choose once the others have had a little time to beat the first reply
+        if (best != P_MAX_INDEX && (!pending || now >= m_probeDecide)) {
+            m_bestCandidate = best;
+            addr = m_candidates[best].addr;  port = m_candidates[best].port;
+            PTRACE(4, "H46024A\ts:" << m_Session << " Direct path " << addr << ":" << port 
+                        << " chosen, RTT " << m_candidates[best].rtt.GetMilliSeconds() << "ms");
+            decided = true;
+        } else if (!pending) {
+            PTRACE(4, "H46024A\ts:" << m_Session << " No direct path found, staying with proxied media.");
+            m_Probe.Stop();
+            return;
+        } else {
+            // Send the next check due, in turn so all the candidates are probed together
+            PINDEX count = m_candidates.size();
+            for (PINDEX n = 0; n < count; ++n) {
+                PINDEX i = (m_nextCandidate + n) % count;
+                ProbeCandidate & c = m_candidates[i];
+                if (c.verified || c.sent >= H46024A_MAX_PROBE_COUNT ||
+                    (c.sent > 0 && now - c.lastSent < H46024A_PROBE_INTERVAL))
+                    continue;
+                c.sent++;
+                c.lastSent = now;
+                addr = c.addr;  port = c.port;  muxID = c.muxID;
+                m_nextCandidate = i+1;
+                break;
+            }
+            if (port == 0)
+                return;
+        }
     }
 
-    if (GetProbeState() != e_probing)
+    if (decided) {
+        m_Probe.Stop();
+        SetProbeState(e_verify_sender);
+        ProbeReceived(true, addr, port);
         return;
+    }
 
     RTP_ControlFrame report;
     report.SetSize(4+sizeof(probe_packet));
-    BuildProbe(report, true);
+    BuildProbe(report, true, (DWORD)PTimer::Tick().GetMilliSeconds());
 
      if (!WriteTo(report.GetPointer(),report.GetSize(),
-                 m_altAddr, m_altPort, m_altMuxID)) {
+                 addr, port, muxID)) {
         switch (GetErrorNumber()) {
             case ECONNRESET :
             case ECONNREFUSED :
-                PTRACE(2, "H46024A\t" << m_altAddr << ":" << m_altPort << " not ready.");
+                PTRACE(2, "H46024A\t" << addr << ":" << port << " not ready.");
                 break;
 
             default:
-                PTRACE(1, "H46024A\t" << m_altAddr << ":" << m_altPort 
+                PTRACE(1, "H46024A\t" << addr << ":" << port 
                     << ", Write error on port ("
                     << GetErrorNumber(PChannel::LastWriteError) << "): "
                     << GetErrorText(PChannel::LastWriteError));
         }
     } else {
-        PTRACE(6, "H46024A\ts" << m_Session <<" RTCP Probe sent: " << m_altAddr << ":" << m_altPort);    
+        PTRACE(6, "H46024A\ts" << m_Session <<" RTCP Probe sent: " << addr << ":" << port);    
     }
 }
 
@@ -1664,7 +2208,10 @@ void H46019UDPSocket::ProbeReceived(bool probe, const PIPSocket::Address & addr,
     } else if (addr.IsValid() && !addr.IsLoopback() && !addr.IsAny()) {
         RTP_ControlFrame reply;
         reply.SetSize(4+sizeof(probe_packet));
-        BuildProbe(reply, false);
+        probeMutex.Wait();
+        DWORD echo = m_probeEcho;
+        probeMutex.Signal();
+        BuildProbe(reply, false, echo);
         if (SendRTCPFrame(reply,addr,port,m_altMuxID)) {
             PTRACE(4, "H46024A\tRTCP Reply packet sent: " << addr << ":" << port);
         }
@@ -1674,32 +2221,63 @@ void H46019UDPSocket::ProbeReceived(bool probe, const PIPSocket::Address & addr,
 
 }
 
-void H46019UDPSocket::H46024Adirect(bool starter)
+void H46019UDPSocket::H46024Adirect(bool starter, probe_candidate kind)
 {
     if (GetProbeState() == e_direct)  // We might already be doing Annex B
         return;
 
     if (starter) {  // We start the direct channel 
         m_detAddr = m_altAddr;  m_detPort = m_altPort;
+
+        // Use the path probing chose, or our address of the same kind
+        probeMutex.Wait();
+        PINDEX i = m_bestCandidate;
+        if (i >= (PINDEX)m_candidates.size())
+            i = FindCandidate(kind);
+        if (i != P_MAX_INDEX) {
+            m_detAddr = m_candidates[i].addr;  m_detPort = m_candidates[i].port;
+            m_altMuxID = m_candidates[i].muxID;
+        }
+        probeMutex.Signal();
+
         PTRACE(4, "H46024A\ts:" << m_Session << (rtpSocket ? " RTP " : " RTCP ")  
                         << "Switching to " << m_detAddr << ":" << m_detPort);
         SetProbeState(e_direct);
     } else         // We wait for the remote to start channel
         SetProbeState(e_wait);
 
-    Keep.Stop();  // Stop the keepAlive Packets
+    StopKeepAlive();  // Stop the keepAlive Packets
 }
 #endif
 
 PBoolean H46019UDPSocket::ReadFrom(void * buf, PINDEX len, Address & addr, WORD & port)
 {
-    
+    for (;;) {
 #ifdef H323_H46019M
-    while (ReadSocket(buf, len, addr, port)) {
+        PINDEX size = len;
+        if (!ReadSocket(buf, size, addr, port))
 #else
-    while (PUDPSocket::ReadFrom(buf, len, addr, port)) {
+        if (!PUDPSocket::ReadFrom(buf, len, addr, port))
+#endif
+            return false;
+#if defined(H323_H46024A) || defined(H323_H46024B)
+#ifdef H323_H46019M
+        // Multiplexed RTCP probes were checked by WriteMultiplexBuffer() as
+        // they arrived, checking them again here would race with it.
+        if (m_recvMultiplexID != 0 && !rtpSocket && GetLastReadCount() > 1 &&
+            ((const BYTE *)buf)[1] == RTP_ControlFrame::e_ApplDefined)
+            return true;
+#endif
+        if (!ReceivedPacket(buf, GetLastReadCount(), addr, port))
+            continue;  // don't forward on probe packets.
 #endif
+        return true;
+    }
+}
+
 #if defined(H323_H46024A) || defined(H323_H46024B)
+PBoolean H46019UDPSocket::ReceivedPacket(const void * buf, PINDEX len, const Address & addr, WORD port)
+{
       bool probe = false; bool success = false;
       RTP_ControlFrame frame(2048);
         /// Set the detected routed remote address (on first packet received)
@@ -1713,7 +2291,7 @@ PBoolean H46019UDPSocket::ReadFrom(void * buf, PINDEX len, Address & addr, WORD
                 << "Switching to " << addr << ":" << port << " from " << m_remAddr << ":" << m_remPort);
             m_detAddr = addr;  m_detPort = port;
             SetProbeState(e_direct);
-            Keep.Stop();  // Stop the keepAlive Packets
+            StopKeepAlive();  // Stop the keepAlive Packets
             m_h46024b = false;
         }
 #endif
@@ -1725,18 +2303,18 @@ PBoolean H46019UDPSocket::ReadFrom(void * buf, PINDEX len, Address & addr, WORD
             case e_verify_receiver:                        // RTCP only
                 frame.SetSize(len);
                 memcpy(frame.GetPointer(),buf,len);
-                if (ReceivedProbePacket(frame,probe,success)) {
+                if (ReceivedProbePacket(frame,addr,port,probe,success)) {
                     if (success)
                         ProbeReceived(probe,addr,port);
-                    else {
+                    else if (!probe) {
                         m_pendAddr = addr; m_pendPort = port;
                     }
-                  continue;  // don't forward on probe packets.
+                  return false;  // don't forward on probe packets.
                 }
                 break;
             case e_wait:
                 if (addr == keepip) {// We got a keepalive ping...
-                     Keep.Stop();  // Stop the keepAlive Packets
+                     StopKeepAlive();  // Stop the keepAlive Packets
                 } else if ((addr == m_altAddr) && (port == m_altPort)) {
                     PTRACE(4, "H46024A\ts:" << m_Session << (rtpSocket ? " RTP " : " RTCP ")  << "Already sending direct!");
                     m_detAddr = addr;  m_detPort = port;
@@ -1757,11 +2335,9 @@ PBoolean H46019UDPSocket::ReadFrom(void * buf, PINDEX len, Address & addr, WORD
             default:
                 break;
         }
-#endif // H46024A/B
         return true;
-    } 
-       return false; 
 }
+#endif // H46024A/B
 
 PBoolean H46019UDPSocket::WriteTo(const void * buf, PINDEX len, const Address & addr, WORD port)
 {
@@ -1771,6 +2347,9 @@ PBoolean H46019UDPSocket::WriteTo(const void * buf, PINDEX len, const Address &
 
 PBoolean H46019UDPSocket::WriteTo(const void * buf, PINDEX len, const Address & addr, WORD port, unsigned id)
 {
+    if (addr == keepip && port == keepport)
+        keepLastSent = PTimer::Tick();
+
 #if defined(H323_H46024A) || defined(H323_H46024B)
     if (GetProbeState() == e_direct)
 #ifdef H323_H46019M
@@ -1789,15 +2368,41 @@ PBoolean H46019UDPSocket::WriteTo(const void * buf, PINDEX len, const Address &
 
 
 #ifdef H323_H46024A
-PBoolean H46019UDPSocket::ReceivedProbePacket(const RTP_ControlFrame & frame, bool & probe, bool & success)
+PBoolean H46019UDPSocket::ReceivedProbePacket(const RTP_ControlFrame & frame, const Address & addr, WORD port, bool & probe, bool & success)
 {
     if (frame.GetPayloadType() != RTP_ControlFrame::e_ApplDefined) {
         // Not a probe packet ignore
         return false;  
     }
 
+    // The digest is of our CUI, so it can be checked before the remote's is known
+    if (frame.GetPayloadSize() < 12+20) {
+        PTRACE(4, "H46024A\ts:" << m_Session <<" RTCP Probe too short, IGNORING!");
+        return false;
+    }
+    BYTE * data = frame.GetPayloadPtr();
+    PBYTEArray bytes(20);
+    memcpy(bytes.GetPointer(),data+12, 20);
+    PMessageDigest::Result bin_digest;
+    PMessageDigestSHA1::Encode(m_CallId.AsString() + m_CUI, bin_digest);
+    PBYTEArray val(bin_digest.GetPointer(),bin_digest.GetSize());
+    bool verified = (bytes == val);
+
     if (m_CUIrem.IsEmpty()) {
         PTRACE(4, "H46024A\ts:" << m_Session <<" Probe received too early. local not setup. IGNORING!");
+        // Where the remote probes from is a path worth probing back, but
+        // only learn it from the remote so we are not made to probe others.
+        if (!verified)
+            return false;
+        probeMutex.Wait();
+        PINDEX reflexive = 0;
+        for (PINDEX i = 0; i < (PINDEX)m_candidates.size(); ++i) {
+            if (m_candidates[i].kind == e_candidateReflexive)
+                reflexive++;
+        }
+        probeMutex.Signal();
+        if (reflexive < H46024A_MAX_REFLEXIVE)
+            AddProbeCandidate(addr, port, m_altMuxID, e_candidateReflexive);
         return false;
     }
 
@@ -1809,33 +2414,80 @@ PBoolean H46019UDPSocket::ReceivedProbePacket(const RTP_ControlFrame & frame, bo
         return false;  
     }
 
-    if (cstate > e_probing) {
+    probe = (frame.GetCount() > 0);
+
+    // Requests are still answered once verified, a remote probing several
+    // of our addresses at once wants a reply on each.
+    if (cstate > e_verify_receiver || (cstate == e_verify_receiver && probe)) {
         PTRACE(6, "H46024A\ts:" << m_Session <<" received RTCP probe packet. IGNORING! Already authenticated.");
         return false;
     }
-
-    probe = (frame.GetCount() > 0);
     PTRACE(4, "H46024A\ts:" << m_Session <<" RTCP Probe " << (probe ? "Reply" : "Request") << " received.");
 
-    BYTE * data = frame.GetPayloadPtr();
-    PBYTEArray bytes(20);
-    memcpy(bytes.GetPointer(),data+12, 20);
-    PMessageDigest::Result bin_digest;
-    PMessageDigestSHA1::Encode(m_CallId.AsString() + m_CUI, bin_digest);
-    PBYTEArray val(bin_digest.GetPointer(),bin_digest.GetSize());
-
-    if (bytes != val) {
+    if (!verified) {
         PTRACE(4, "H46024A\ts:" << m_Session <<" RTCP Probe " << (probe ? "Reply" : "Request") << " verify FAILURE");
         return false;
     }
 
     PTRACE(4, "H46024A\ts:" << m_Session <<" RTCP Probe " << (probe ? "Reply" : "Request") << " verified.");
-    if (probe)  // We have a reply
-        SetProbeState(e_verify_sender);
-    else 
-        SetProbeState(e_verify_receiver);
 
-    m_Probe.Stop();
+    // Replies echo the tick of the request they answer, remotes which do not
+    // send it are timed from the last probe sent to the candidate.
+    bool hasTick = frame.GetPayloadSize() >= (PINDEX)sizeof(probe_packet);
+    DWORD tick = 0;
+    if (hasTick) {
+        probe_packet packet;
+        memcpy(&packet, data, sizeof(probe_packet));
+        tick = packet.tick;
+    }
+
+    if (probe) {  // We have a reply, the probe timer chooses between those received
+        PWaitAndSignal m(probeMutex);
+        PTimeInterval now = PTimer::Tick();
+        PINDEX i = FindCandidate(addr, port);
+        if (i == P_MAX_INDEX) {
+            AddProbeCandidate(addr, port, m_altMuxID, e_candidateReflexive);
+            i = FindCandidate(addr, port);
+        }
+        if (i != P_MAX_INDEX && !m_candidates[i].verified) {
+            ProbeCandidate & c = m_candidates[i];
+            c.verified = true;
+            DWORD elapsed = (DWORD)now.GetMilliSeconds() - tick;
+            if (hasTick && c.sent > 0 && elapsed <= (DWORD)(H46024A_MAX_PROBE_COUNT * H46024A_PROBE_INTERVAL))
+                c.rtt = PTimeInterval(elapsed);
+            else
+                c.rtt = c.sent > 0 ? now - c.lastSent : PTimeInterval(H46024A_PROBE_INTERVAL);
+            PTRACE(4, "H46024A\ts:" << m_Session << " Candidate " << addr << ":" << port 
+                        << " RTT " << c.rtt.GetMilliSeconds() << "ms");
+
+            bool first = true;
+            for (PINDEX j = 0; j < (PINDEX)m_candidates.size(); ++j) {
+                if (j != i && m_candidates[j].verified)
+                    first = false;
+            }
+            if (first)
+                m_probeDecide = now + PTimeInterval(H46024A_PROBE_SETTLE);
+        }
+        success = false;
+        return true;
+    }
+
+    // Once one of our probes has been answered we are the side choosing the
+    // path, a later request (say one delayed on a slower path) is answered
+    // but must not turn us into the receiver, as the remote already is one.
+    probeMutex.Wait();
+    m_probeEcho = tick;
+    bool answered = false;
+    for (PINDEX i = 0; i < (PINDEX)m_candidates.size(); ++i) {
+        if (m_candidates[i].verified)
+            answered = true;
+    }
+    probeMutex.Signal();
+
+    if (cstate < e_verify_receiver && !answered) {
+        SetProbeState(e_verify_receiver);
+        m_Probe.Stop();
+    }
     success = true;
 
     return true;
@@ -1854,6 +2506,8 @@ void H46019UDPSocket::H46024Bdirect(const H323TransportAddress & address, unsign
     PTRACE(6,"H46024b\ts: " << m_Session << " RTP Remote Alt: " << m_altAddr << ":" << m_altPort 
                             << " " << m_altMuxID);
 
+    AddProbeCandidate(m_altAddr, m_altPort, m_altMuxID, e_candidateAnnexB);
+
     m_h46024b = true;
 
     // Sending an empty RTP frame to the alternate address
@@ -50,11 +50,10 @@
 #define MAX_STACK_DESCRETION  REC_FRAME_TIME * 2
 #define FAST_UPDATE_INTERVAL  REC_FRAME_TIME * 3
 #define MAX_VIDEO_KBPS       384000.0
+#define FLOW_QUANTUM         1500         // Round robin bytes per turn for weight 1
+#define PACING_BURST         20           // ms of pipe bandwidth that may be sent at once
 
 
-#define PACKETDELAY(sz,mbps) \
-      int((double(sz) / (mbps *0.5)) * 1000.0);
-
 //-------------------------------------------
 
 const unsigned H46026_ProtocolID[] = { 0,0,8,2250,0,H225_PROTOCOL_VERSION };
@@ -224,12 +223,17 @@ H46026_ArrayOf_FrameData & H46026UDPBuffer::GetData()
 
 void H46026UDPBuffer::SetFrame(const PBYTEArray & data)
 {
-    m_size += data.GetSize();
+    SetFrame(data, data.GetSize());
+}
+
+void H46026UDPBuffer::SetFrame(const BYTE * data, PINDEX len)
+{
+    m_size += len;
     int sz = m_data.m_frame.GetSize();
     m_data.m_frame.SetSize(sz+1);
     m_data.m_frame[sz].SetTag(m_rtp ? H46026_FrameData::e_rtp : H46026_FrameData::e_rtcp);
     PASN_OctetString & raw = m_data.m_frame[sz];
-    raw = data;
+    raw.SetValue(data, len);
 }
 
 H46026_UDPFrame & H46026UDPBuffer::GetBuffer()
@@ -288,8 +292,22 @@ strm << "ver=" << (unsigned)((theArray[0]>>6)&3)
 
 //-------------------------------------------
 
+H46026FlowQueue::H46026FlowQueue(unsigned crv, int sessionId, int priority)
+: m_crv(crv), m_sessionId(sessionId), m_priority(priority), m_weight(1), m_bytes(0), m_deficit(0),
+  m_backlogged(false), m_frameStart(true), m_dropping(false), m_lastFastUpdate(0), m_droppedFrames(0)
+{
+}
+
+PBoolean H46026FlowQueue::IsStrict() const
+{
+    return (m_priority == socketOrder::Priority_Critical) || (m_priority == socketOrder::Priority_High);
+}
+
+//-------------------------------------------
+
 H46026ChannelManager::H46026ChannelManager()
-:  m_mbps(MAX_VIDEO_KBPS), m_socketPacketReady(false), m_currentPacketTime(0), m_pktCounter(0)
+:  m_mbps(MAX_VIDEO_KBPS), m_socketPacketReady(false), m_currentPacketTime(0), m_pktCounter(0),
+   m_queuedBytes(0), m_credit(0), m_rateEstimate(MAX_VIDEO_KBPS), m_lastOutTime(0), m_lastOutBytes(0)
 {
 
 // Initialise the Information PDU RTP Message structure.
@@ -322,8 +340,9 @@ H46026ChannelManager::~H46026ChannelManager()
     PWaitAndSignal m(m_queueMutex);
 
     ClearBufferEntries(m_rtpBuffer, 0);
-    while (!m_socketQueue.empty())
-        m_socketQueue.pop();
+    for (H46026FlowMap::iterator i = m_flows.begin(); i != m_flows.end(); ++i)
+        delete i->second;
+    m_flows.clear();
 }
 
  void H46026ChannelManager::RTPFrameIn(unsigned crv, PINDEX sessionId, PBoolean rtp, const PBYTEArray & data) 
@@ -333,12 +352,29 @@ H46026ChannelManager::~H46026ChannelManager()
 
  void H46026ChannelManager::SetPipeBandwidth(unsigned bps)
  {
+     PWaitAndSignal m(m_queueMutex);
      m_mbps = double(bps);
+     m_rateEstimate = m_mbps;
  }
 
+unsigned H46026ChannelManager::GetEstimatedBandwidth() const
+{
+    PWaitAndSignal m(m_queueMutex);
+    return (unsigned)m_rateEstimate;
+}
+
+void H46026ChannelManager::SetFlowWeight(unsigned crv, PINDEX sessionId, unsigned weight)
+{
+    PWaitAndSignal m(m_queueMutex);
+    GetFlow(crv, sessionId, socketOrder::Priority_Discretion)->m_weight = weight > 0 ? weight : 1;
+}
+
 void H46026ChannelManager::BufferRelease(unsigned crv)
 {
     ClearBufferEntries(m_rtpBuffer, crv);
+
+    PWaitAndSignal m(m_queueMutex);
+    ClearFlows(crv);
 }
 
 PBoolean H46026ChannelManager::SignalMsgOut(const Q931 & pdu)
@@ -349,7 +385,6 @@ PBoolean H46026ChannelManager::SignalMsgOut(const Q931 & pdu)
     prior.crv = pdu.GetCallReference();
     prior.priority = socketOrder::Priority_High;
     prior.packTime = PTimer::Tick().GetMilliSeconds();
-    prior.delay = PACKETDELAY(pdu.GetIE(Q931::UserUserIE).GetSize(),m_mbps);
     return WriteQueue(pdu, prior);
 }
 
@@ -362,7 +397,6 @@ PBoolean H46026ChannelManager::SignalMsgOut(const BYTE * data, PINDEX len)
     prior.crv = 0;
     prior.priority = socketOrder::Priority_High;
     prior.packTime = PTimer::Tick().GetMilliSeconds();
-    prior.delay = PACKETDELAY(len,m_mbps);
     return WriteQueue(msg, prior);
 }
 
@@ -379,7 +413,7 @@ H46026UDPBuffer * H46026ChannelManager::GetRTPBuffer(unsigned crv, int sessionId
     return m_rtpBuffer[crv][sessionId];
 }
 
-PBoolean H46026ChannelManager::PackageFrame(PBoolean rtp, unsigned crv, PacketTypes id, PINDEX sessionId, H46026_UDPFrame & data)
+PBoolean H46026ChannelManager::PackageFrame(PBoolean rtp, unsigned crv, PacketTypes id, PINDEX sessionId, H46026_UDPFrame & data, PBoolean frameEnd)
 {
     // Build Packet
     Q931 mediaPDU;
@@ -406,12 +440,11 @@ PBoolean H46026ChannelManager::PackageFrame(PBoolean rtp, unsigned crv, PacketTy
         prior.priority = socketOrder::Priority_Low;
     prior.id = NextPacketCounter();
     prior.packTime = PTimer::Tick().GetMilliSeconds();
-    prior.delay = PACKETDELAY(mediaPDU.GetIE(Q931::UserUserIE).GetSize(),m_mbps);   
 
     if (PTrace::CanTrace(6)) {
         PStringStream info;
-        info <<  "Build #" << prior.id << (rtp ? "\nMedia" : " Control") << ":" << H46026MediaTypeAsString(id) << "  Delay:" << prior.delay 
-            << "ms  Priority:" << H46026PriorityAsString(prior.priority) << "\n" << H46026MediaFrameAnalysis(data);
+        info <<  "Build #" << prior.id << (rtp ? "\nMedia" : " Control") << ":" << H46026MediaTypeAsString(id)
+            << "  Priority:" << H46026PriorityAsString(prior.priority) << "\n" << H46026MediaFrameAnalysis(data);
         if (PTrace::CanTrace(7)) {
             if (rtp) info  << data;
             else info << "\n" << data;
@@ -422,7 +455,7 @@ PBoolean H46026ChannelManager::PackageFrame(PBoolean rtp, unsigned crv, PacketTy
     }
 
     // Write to the output Queue
-    return WriteQueue(mediaPDU, prior);
+    return WriteQueue(mediaPDU, prior, frameEnd);
 }
 
 PBoolean H46026ChannelManager::RTPFrameOut(unsigned crv, PacketTypes id, PINDEX sessionId, PBoolean rtp, PBYTEArray & data)
@@ -434,7 +467,6 @@ PBoolean H46026ChannelManager::RTPFrameOut(unsigned crv, PacketTypes id, PINDEX
 {
     PWaitAndSignal m(m_writeMutex);
 
-    H46026_MediaFrame msg(data,len);
     if (rtp) {
         H46026UDPBuffer * buffer = GetRTPBuffer(crv,sessionId);
         if (!buffer) return false;
@@ -442,22 +474,22 @@ PBoolean H46026ChannelManager::RTPFrameOut(unsigned crv, PacketTypes id, PINDEX
         PBoolean toSend = false;
         switch (id) {
             case e_Audio: 
-                buffer->SetFrame(msg);
+                buffer->SetFrame(data, len);
                 if (buffer->GetPacketCount() >= MAX_AUDIO_FRAMES)
                     toSend = true;
                 break;
             case e_Video:
             case e_extVideo:
                 if (buffer->GetSize() + len > MAX_VIDEO_PAYLOAD) {
-                    PackageFrame(rtp, crv, id, sessionId, buffer->GetBuffer());
+                    PackageFrame(rtp, crv, id, sessionId, buffer->GetBuffer(), false);
                     buffer->ClearBuffer();
                 }
-                buffer->SetFrame(msg);
-                toSend = msg.GetMarker();
+                buffer->SetFrame(data, len);
+                toSend = (len > 1) && ((data[1]&0x80) != 0);  // RTP marker, end of frame
                 break;
             case e_Data:
             default:
-                buffer->SetFrame(msg);
+                buffer->SetFrame(data, len);
                 toSend = true;
         }
         if (toSend) {
@@ -467,9 +499,9 @@ PBoolean H46026ChannelManager::RTPFrameOut(unsigned crv, PacketTypes id, PINDEX
         } else
             return ProcessQueue();
     } else {
-       H46026UDPBuffer data(sessionId,rtp);
-       data.SetFrame(msg);
-       return PackageFrame(rtp, crv, id, sessionId, data.GetBuffer());
+       H46026UDPBuffer frame(sessionId,rtp);
+       frame.SetFrame(data, len);
+       return PackageFrame(rtp, crv, id, sessionId, frame.GetBuffer());
     }
 }
 
@@ -477,32 +509,151 @@ PBoolean H46026ChannelManager::ProcessQueue()
 {
     PWaitAndSignal m(m_queueMutex);
 
-    if (m_socketQueue.size() == 0) {
+    if (m_queuedBytes == 0) {
         m_socketPacketReady = false;
         return true;
     }
 
+    // Only the video flows that have fallen behind lose frames
     PInt64 nowTime = PTimer::Tick().GetMilliSeconds();
-    PInt64 stackTime = nowTime - m_socketQueue.top().second.packTime;
+    std::list<H46026FlowQueue*>::iterator i = m_roundRobin.begin();
+    while (i != m_roundRobin.end()) {
+        H46026FlowQueue * flow = *i++;     // DropFrames may remove it from the list
+        if (flow->m_priority == socketOrder::Priority_Discretion)
+            DropFrames(flow, nowTime);
+    }
+
+    m_socketPacketReady = (m_queuedBytes > 0);
+
+    return true;
+}
 
-    PBoolean dropPacket = ((m_socketQueue.top().second.priority == socketOrder::Priority_Discretion) && 
-            (stackTime > MAX_STACK_DESCRETION));
+H46026FlowQueue * H46026ChannelManager::GetFlow(unsigned crv, int sessionId, int priority)
+{
+    PInt64 key = ((PInt64)crv << 32) | ((PInt64)(sessionId & 0xffffff) << 8) | priority;
+    H46026FlowMap::iterator f = m_flows.find(key);
+    if (f != m_flows.end())
+        return f->second;
 
-    if (dropPacket) {
+    H46026FlowQueue * flow = new H46026FlowQueue(crv, sessionId, priority);
+    m_flows.insert(H46026FlowMap::value_type(key, flow));
+    return flow;
+}
 
-        PTRACE(5,"H46026\tPossible pipe blockage detected. Delay " << stackTime << " Dropping video frames...");
-        unsigned crv = m_socketQueue.top().second.crv;
-        PINDEX sessionId = m_socketQueue.top().second.sessionId;
-        while (m_socketQueue.size()>0 && m_socketQueue.top().second.priority == socketOrder::Priority_Discretion) {
-            m_socketQueue.pop();
+H46026FlowQueue * H46026ChannelManager::NextFlow()
+{
+    // Signal, audio and data first, whichever has waited longest
+    if (!m_strictFlows.empty()) {
+        std::list<H46026FlowQueue*>::iterator i = m_strictFlows.begin();
+        H46026FlowQueue * oldest = *i;
+        for (++i; i != m_strictFlows.end(); ++i) {
+            if ((*i)->m_queue.front().header.packTime < oldest->m_queue.front().header.packTime)
+                oldest = *i;
         }
-        FastUpdatePictureRequired(crv, sessionId);
-        // TODO: Flow Control based on the Time in the queue (stackTime) - SH
+        return oldest;
+    }
+
+    // Deficit round robin over the rest, each turn adds a weighted quantum
+    while (!m_roundRobin.empty()) {
+        H46026FlowQueue * flow = m_roundRobin.front();
+        if (flow->m_deficit >= flow->m_queue.front().data.GetSize())
+            return flow;
+        flow->m_deficit += FLOW_QUANTUM * flow->m_weight;
+        m_roundRobin.pop_front();
+        m_roundRobin.push_back(flow);
     }
+    return NULL;
+}
 
-    m_socketPacketReady = (m_socketQueue.size() > 0);
+void H46026ChannelManager::PopFlow(H46026FlowQueue * flow, H46026FlowQueue::Entry & entry)
+{
+    entry = flow->m_queue.front();
+    flow->m_queue.pop_front();
 
-    return true;
+    PINDEX sz = entry.data.GetSize();
+    flow->m_bytes -= sz;
+    m_queuedBytes -= sz;
+    if (!flow->IsStrict())
+        flow->m_deficit = (flow->m_deficit > sz) ? flow->m_deficit - sz : 0;
+
+    if (flow->m_queue.empty()) {
+        flow->m_deficit = 0;
+        flow->m_backlogged = false;
+        if (flow->IsStrict())
+            m_strictFlows.remove(flow);
+        else
+            m_roundRobin.remove(flow);
+    }
+}
+
+void H46026ChannelManager::DropFrames(H46026FlowQueue * flow, PInt64 nowTime)
+{
+    if (flow->m_queue.empty())
+        return;
+
+    PInt64 stackTime = nowTime - flow->m_queue.front().header.packTime;
+    if (stackTime <= MAX_STACK_DESCRETION)
+        return;
+
+    // Drop whole frames from the head until what is left can be sent in time
+    unsigned frames = 0;
+    PBoolean frameEnd = true;
+    H46026FlowQueue::Entry entry;
+    while (!flow->m_queue.empty() &&
+           (!frameEnd || (nowTime - flow->m_queue.front().header.packTime > MAX_STACK_DESCRETION/2))) {
+        PopFlow(flow, entry);
+        frameEnd = entry.frameEnd;
+        if (frameEnd)
+            frames++;
+    }
+    // The rest of a frame being dropped has not been queued yet
+    if (!frameEnd) {
+        flow->m_dropping = true;
+        frames++;
+    }
+
+    flow->m_droppedFrames += frames;
+    PTRACE(5,"H46026\tPipe blockage on call " << flow->m_crv << " session " << flow->m_sessionId << " delay " << stackTime 
+                << "ms. Dropped " << frames << " video frames");
+    RequestFastUpdate(flow, nowTime);
+}
+
+void H46026ChannelManager::RequestFastUpdate(H46026FlowQueue * flow, PInt64 nowTime)
+{
+    if (nowTime - flow->m_lastFastUpdate < FAST_UPDATE_INTERVAL)
+        return;
+
+    flow->m_lastFastUpdate = nowTime;
+    FastUpdatePictureRequired(flow->m_crv, flow->m_sessionId);
+}
+
+void H46026ChannelManager::RefillCredit(PInt64 nowTime)
+{
+    double rate = m_mbps / 8000.0;    // bytes per ms
+    m_credit += rate * (nowTime - m_currentPacketTime);
+    double burst = PMAX(rate * PACING_BURST, (double)FLOW_QUANTUM);
+    if (m_credit > burst)
+        m_credit = burst;
+    m_currentPacketTime = nowTime;
+}
+
+void H46026ChannelManager::ClearFlows(unsigned crv)
+{
+    // Media of the call no longer needs sending, queued signalling does
+    H46026FlowMap::iterator i = m_flows.begin();
+    while (i != m_flows.end()) {
+        H46026FlowQueue * flow = i->second;
+        if (flow->m_crv != crv || (flow->m_sessionId == 0 && !flow->m_queue.empty())) {
+            ++i;
+            continue;
+        }
+        H46026FlowQueue::Entry entry;
+        while (!flow->m_queue.empty())
+            PopFlow(flow, entry);
+        delete flow;
+        m_flows.erase(i++);
+    }
+    m_socketPacketReady = (m_queuedBytes > 0);
 }
 
 unsigned H46026ChannelManager::NextPacketCounter()
@@ -569,42 +720,109 @@ PBoolean H46026ChannelManager::SocketOut(PBYTEArray & data, PINDEX & len)
 
 PBoolean H46026ChannelManager::SocketOut(BYTE * data, PINDEX & len)
 {
+    std::vector<PBYTEArray> messages;
+    if (!SocketOut(messages, 0))
+        return false;
+
+    len = messages[0].GetSize();
+    memcpy(data, (const BYTE *)messages[0], len);
+    return true;
+}
+
+PBoolean H46026ChannelManager::SocketOut(std::vector<PBYTEArray> & messages, PINDEX maxBytes)
+{
+    messages.clear();
+
     if (!m_socketPacketReady)
         return false;
 
+    PWaitAndSignal m(m_queueMutex);
+
     PInt64 nowTime = PTimer::Tick().GetMilliSeconds();
-    if (m_currentPacketTime > nowTime)
-        return false;
+    RefillCredit(nowTime);
 
-    PBoolean gotPacket = false;
-    m_queueMutex.Wait();
-        if (m_socketQueue.size() > 0) {
-            PTRACE(6,"H46026\tSending #" << m_socketQueue.top().second.id << " delay " << m_socketQueue.top().second.delay << "ms");
-            m_currentPacketTime = nowTime + m_socketQueue.top().second.delay;
-            len = m_socketQueue.top().first.GetSize();
-            memcpy(data, (const BYTE *)m_socketQueue.top().first, len);
-            m_socketQueue.pop();
-            gotPacket = true;
-        } else {
-            m_currentPacketTime = nowTime;
-        }
-    m_queueMutex.Signal();
+    // If the last batch left a backlog, the time since is how long the pipe took to take it.
+    if (m_lastOutBytes > 0 && nowTime > m_lastOutTime) {
+        double sample = PMIN(m_lastOutBytes * 8000.0 / (nowTime - m_lastOutTime), m_mbps);
+        m_rateEstimate += (sample - m_rateEstimate) / 8;
+    }
+    m_lastOutBytes = 0;
+
+    PINDEX total = 0;
+    H46026FlowQueue::Entry entry;
+    while (m_credit > 0 && m_queuedBytes > 0) {
+        H46026FlowQueue * flow = NextFlow();
+        if (flow == NULL)
+            break;
+        PINDEX sz = flow->m_queue.front().data.GetSize();
+        if (!messages.empty() && total + sz > maxBytes)
+            break;
+        PopFlow(flow, entry);
+        PTRACE(6,"H46026\tSending #" << entry.header.id << " " << H46026PriorityAsString(entry.header.priority) << " " << sz << " bytes");
+        messages.push_back(entry.data);
+        total += sz;
+        m_credit -= sz;
+    }
+
+    m_socketPacketReady = (m_queuedBytes > 0);
+    if (m_socketPacketReady) {
+        m_lastOutTime = nowTime;
+        m_lastOutBytes = total;
+    }
 
-    return gotPacket;
+    return !messages.empty();
 }
 
-PBoolean H46026ChannelManager::WriteQueue(const Q931 & msg, const socketOrder::MessageHeader & prior)
+PBoolean H46026ChannelManager::WriteQueue(const Q931 & msg, const socketOrder::MessageHeader & prior, PBoolean frameEnd)
 {
     PTRACE(6,"H46026\tPack #" << prior.id << " Type:" << msg.GetMessageTypeName());
     PBYTEArray data;
     msg.Encode(data);
-    return WriteQueue(data, prior);
+    return WriteQueue(data, prior, frameEnd);
 }
 
-PBoolean H46026ChannelManager::WriteQueue(const PBYTEArray & data, const socketOrder::MessageHeader & prior)
+PBoolean H46026ChannelManager::WriteQueue(const PBYTEArray & data, const socketOrder::MessageHeader & prior, PBoolean frameEnd)
 {
     m_queueMutex.Wait();
-     m_socketQueue.push(pair<PBYTEArray, socketOrder::MessageHeader>(data, prior) );
+    H46026FlowQueue * flow = GetFlow(prior.crv, prior.sessionId, prior.priority);
+
+    if (prior.priority == socketOrder::Priority_Discretion) {
+        PBoolean frameStart = flow->m_frameStart;
+        flow->m_frameStart = frameEnd;
+
+        // Don't start a frame that cannot be sent in time at the measured pipe rate
+        if (frameStart && !flow->m_dropping && m_rateEstimate > 0 &&
+                    (m_queuedBytes + data.GetSize()) * 8000.0 / m_rateEstimate > MAX_STACK_DESCRETION * 2) {
+            PTRACE(5,"H46026\tPipe full on call " << prior.crv << " session " << prior.sessionId 
+                        << " backlog " << m_queuedBytes << " bytes. Dropping video frame");
+            flow->m_droppedFrames++;
+            flow->m_dropping = true;
+            RequestFastUpdate(flow, PTimer::Tick().GetMilliSeconds());
+        }
+
+        if (flow->m_dropping) {
+            if (frameEnd)
+                flow->m_dropping = false;
+            m_queueMutex.Signal();
+            return true;
+        }
+    }
+
+    H46026FlowQueue::Entry entry;
+    entry.data = data;
+    entry.header = prior;
+    entry.frameEnd = frameEnd;
+    flow->m_queue.push_back(entry);
+    flow->m_bytes += data.GetSize();
+    m_queuedBytes += data.GetSize();
+
+    if (!flow->m_backlogged) {
+        flow->m_backlogged = true;
+        if (flow->IsStrict())
+            m_strictFlows.push_back(flow);
+        else
+            m_roundRobin.push_back(flow);
+    }
     m_queueMutex.Signal();
 
     return ProcessQueue();
@@ -97,6 +97,21 @@ PBoolean H460_FeatureOID1::SupportNonCallService()
 	return true; 
 }
 
+PBoolean H460_FeatureOID1::FeatureHandled(int mtype)
+{
+     switch (mtype) {
+        case H460_MessageType::e_admissionRequest:
+        case H460_MessageType::e_setup:
+        case H460_MessageType::e_callProceeding:
+        case H460_MessageType::e_alerting:
+        case H460_MessageType::e_facility:
+        case H460_MessageType::e_releaseComplete:
+            return true;
+        default:
+            return false;
+     }
+}
+
 PBoolean H460_FeatureOID1::OnSendSetup_UUIE(H225_FeatureDescriptor & pdu) 
 {
 
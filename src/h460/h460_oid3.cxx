@@ -385,6 +385,19 @@ int H460_FeatureOID3::GetPurpose()
         return FeaturePresence; 
 }
 
+PBoolean H460_FeatureOID3::FeatureHandled(int mtype)
+{
+     switch (mtype) {
+        case H460_MessageType::e_gatekeeperRequest:
+        case H460_MessageType::e_registrationRequest:
+        case H460_MessageType::e_registrationConfirm:
+        case H460_MessageType::e_serviceControlIndication:
+            return true;
+        default:
+            return false;
+     }
+}
+
 PBoolean H460_FeatureOID3::OnSendGatekeeperRequest(H225_FeatureDescriptor & pdu) 
 { 
     if (handler == NULL)
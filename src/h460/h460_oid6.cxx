@@ -84,6 +84,20 @@ void H460_FeatureOID6::AttachEndPoint(H323EndPoint * _ep)
     EP = _ep; 
 }
 
+PBoolean H460_FeatureOID6::FeatureHandled(int mtype)
+{
+     switch (mtype) {
+        case H460_MessageType::e_gatekeeperRequest:
+        case H460_MessageType::e_gatekeeperConfirm:
+        case H460_MessageType::e_registrationRequest:
+        case H460_MessageType::e_registrationReject:
+        case H460_MessageType::e_unregistrationRequest:
+            return true;
+        default:
+            return false;
+     }
+}
+
 PBoolean H460_FeatureOID6::OnSendGatekeeperRequest(H225_FeatureDescriptor & pdu) 
 { 
     H460_FeatureOID feat = H460_FeatureOID(baseOID); 
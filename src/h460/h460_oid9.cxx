@@ -85,6 +85,17 @@ void H460_FeatureOID9::AttachConnection(H323Connection * _conn)
    m_con = _conn;
 }
 
+PBoolean H460_FeatureOID9::FeatureHandled(int mtype)
+{
+     switch (mtype) {
+        case H460_MessageType::e_admissionRequest:
+        case H460_MessageType::e_admissionConfirm:
+            return true;
+        default:
+            return false;
+     }
+}
+
 PBoolean H460_FeatureOID9::OnSendAdmissionRequest(H225_FeatureDescriptor & pdu) 
 { 
     // Build Message
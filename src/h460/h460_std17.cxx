@@ -640,23 +640,22 @@ void H46017Transport::SetTunnel(H46026Tunnel * mgr)
 
 void H46017Transport::SocketWrite(PThread &,  H323_INT)
 {
-    PBYTEArray tpkt(10004);  // 10K buffer with RFC1006 Header
-    tpkt[0] = 3;
-    tpkt[1] = 0;
-
-    PINDEX sz = 0;
-    int packetLength = 0;
+    // Everything the pipe can take is copied into one buffer of RFC1006
+    // TPKTs and written with a single call.
+    std::vector<PBYTEArray> messages;
     while (!closeTransport) {
-        if (m_socketMgr->SocketOut(tpkt.GetPointer()+4,sz)) {
-            packetLength = sz + 4;
-            tpkt[2] = (BYTE)(packetLength >> 8);
-            tpkt[3] = (BYTE)packetLength;
-            Write((const BYTE *)tpkt, packetLength);
+        if (m_socketMgr->SocketOut(messages, 10000)) {
+            PWaitAndSignal m(writeMutex);
+            if (!WriteCoalescedTPKTs(&messages[0], messages.size())) {
+                PTRACE(2, "H46017\tTunnel write failed: " << GetErrorText(PChannel::LastWriteError));
+                if (!IsOpen())
+                    break;
+            }
         } else {
             PThread::Sleep(2);
         }
     }
-    tpkt.SetSize(0);
+    messages.clear();
     PTRACE(2,"H46017\tTunnel Write Thread ended");
 }
 #endif
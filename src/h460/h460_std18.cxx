@@ -98,6 +98,20 @@ void H460_FeatureStd18::SetTransportSecurity(const H323TransportSecurity & callS
         handler->SetTransportSecurity(callSecurity);
 }
 
+PBoolean H460_FeatureStd18::FeatureHandled(int mtype)
+{
+     switch (mtype) {
+        case H460_MessageType::e_gatekeeperRequest:
+        case H460_MessageType::e_gatekeeperConfirm:
+        case H460_MessageType::e_registrationRequest:
+        case H460_MessageType::e_registrationConfirm:
+        case H460_MessageType::e_serviceControlIndication:
+            return true;
+        default:
+            return false;
+     }
+}
+
 PBoolean H460_FeatureStd18::OnSendGatekeeperRequest(H225_FeatureDescriptor & pdu) 
 { 
     if (!isEnabled)
@@ -227,6 +241,19 @@ PBoolean H460_FeatureStd19::FeatureAdvertised(int mtype)
      }
 }
 
+PBoolean H460_FeatureStd19::FeatureHandled(int mtype)
+{
+     switch (mtype) {
+        case H460_MessageType::e_setup:
+        case H460_MessageType::e_callProceeding:
+        case H460_MessageType::e_alerting:
+        case H460_MessageType::e_connect:
+            return true;
+        default:
+            return false;
+     }
+}
+
 PBoolean H460_FeatureStd19::OnSendSetup_UUIE(H225_FeatureDescriptor & pdu) 
 { 
     if (!isEnabled || !isAvailable)
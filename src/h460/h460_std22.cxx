@@ -150,6 +150,22 @@ void ReadFeature(H323TransportSecurity * transec, H460_FeatureStd * feat)
         transec->EnableIPSec(true);
 }
 
+PBoolean H460_FeatureStd22::FeatureHandled(int mtype)
+{
+     switch (mtype) {
+        case H460_MessageType::e_gatekeeperRequest:
+        case H460_MessageType::e_gatekeeperConfirm:
+        case H460_MessageType::e_registrationRequest:
+        case H460_MessageType::e_registrationConfirm:
+        case H460_MessageType::e_admissionRequest:
+        case H460_MessageType::e_admissionConfirm:
+        case H460_MessageType::e_serviceControlIndication:
+            return true;
+        default:
+            return false;
+     }
+}
+
 PBoolean H460_FeatureStd22::OnSendGatekeeperRequest(H225_FeatureDescriptor & pdu)
 {
     if (!EP || !EP->GetTransportSecurity()->HasSecurity())
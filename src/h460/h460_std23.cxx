@@ -94,8 +94,23 @@ PCREATE_NAT_PLUGIN(H46024, "H.460.24");
 PCREATE_NAT_PLUGIN(H46024);
 #endif
 
+int recheckTime = 300000;      // 5 minutes
+static int natCacheTime = 600000;     // 10 minutes
+static int natTestTimeout = 500;      // Per STUN request, milliseconds
+static int natTestRetries = 2;
+
+// NAT test results by local interface and STUN server, so re-registering
+// on an unchanged network does not wait for the test again.
+struct H46024NatResult {
+    PSTUNClient::NatTypes type;
+    PIPSocket::Address    externalIP;
+    PTime                 expires;
+};
+static PMutex natCacheMutex;
+static std::map<PString, H46024NatResult> natCache;
+
 PNatMethod_H46024::PNatMethod_H46024()
-: mainThread(NULL)
+: mainThread(NULL), shutdown(false)
 {
     natType = PSTUNClient::UnknownNat;
     isAvailable = false;
@@ -106,7 +121,13 @@ PNatMethod_H46024::PNatMethod_H46024()
 PNatMethod_H46024::~PNatMethod_H46024()
 {
     natType = PSTUNClient::UnknownNat;
-    delete mainThread;
+
+    shutdown = true;
+    recheck.Signal();
+    if (mainThread != NULL) {
+        mainThread->WaitForTermination();
+        delete mainThread;
+    }
 }
 
 void PNatMethod_H46024::SetPortInformation(PortInfo & pairedPortInfo, WORD portPairBase, WORD portPairMax)
@@ -143,6 +164,12 @@ void PNatMethod_H46024::Start(const PString & server,H460_FeatureStd23 * _feat)
     SetPortRanges(ep->GetRtpIpPortBase(), ep->GetRtpIpPortMax(), ep->GetRtpIpPortBase(), ep->GetRtpIpPortMax());
 #endif
 
+    // Bound the test so an unreachable server or blocked UDP fails quickly
+    SetTimeout(natTestTimeout);
+    SetRetries(natTestRetries);
+
+    cacheKey = PIPSocket::GetGatewayInterfaceAddress().AsString() + '|' + server;
+
     mainThread  = PThread::Create(PCREATE_NOTIFIER(MainMethod), 0,  
                        PThread::NoAutoDeleteThread, PThread::NormalPriority, "H.460.24");
 }
@@ -180,26 +207,76 @@ PSTUNClient::NatTypes PNatMethod_H46024::NATTest()
     return testtype;
 }
 
-int recheckTime = 300000;    // 5 minutes
+bool PNatMethod_H46024::GetCachedNATType(PSTUNClient::NatTypes & type, PIPSocket::Address & extIP)
+{
+    PWaitAndSignal m(natCacheMutex);
+
+    std::map<PString, H46024NatResult>::iterator it = natCache.find(cacheKey);
+    if (it == natCache.end())
+        return false;
+
+    if (it->second.expires < PTime()) {
+        natCache.erase(it);
+        return false;
+    }
+
+    type = it->second.type;
+    extIP = it->second.externalIP;
+    return true;
+}
+
+void PNatMethod_H46024::SetCachedNATType(PSTUNClient::NatTypes type, const PIPSocket::Address & extIP)
+{
+    PWaitAndSignal m(natCacheMutex);
+
+    if (type == PSTUNClient::UnknownNat) {
+        natCache.erase(cacheKey);
+        return;
+    }
+
+    H46024NatResult & result = natCache[cacheKey];
+    result.type = type;
+    result.externalIP = extIP;
+    result.expires = PTime() + PTimeInterval(natCacheTime);
+}
 
 void PNatMethod_H46024::MainMethod(PThread &,  H323_INT)
 {
+    // Report a recent result straight away, the test is then done again
+    // only as the periodic recheck.
+    PSTUNClient::NatTypes cachedType;
+    PIPSocket::Address cachedIP;
+    bool cached = GetCachedNATType(cachedType, cachedIP);
+    if (cached) {
+        PTRACE(4,"Std23\tUsing cached NAT Type " << cachedType << " for " << cacheKey);
+        natType = cachedType;
+        feat->GetEndPoint()->NATMethodCallBack(GetName(),2,natType);
+        feat->OnNATTypeDetection(natType, cachedIP);
+    }
 
-    while (natType == PSTUNClient::UnknownNat ||
-                natType == PSTUNClient::ConeNat) {
-        PSTUNClient::NatTypes testtype = NATTest();
-        if (natType != testtype) {
-            natType = testtype;
+    while (!shutdown && (natType == PSTUNClient::UnknownNat ||
+                natType == PSTUNClient::ConeNat)) {
+        if (cached)
+            cached = false;
+        else {
+            PSTUNClient::NatTypes testtype = NATTest();
             PIPSocket::Address extIP;
-            if (GetExternalAddress(extIP)) {
-                feat->GetEndPoint()->NATMethodCallBack(GetName(),2,natType);
-                feat->OnNATTypeDetection(natType, extIP);
+            bool haveIP = GetExternalAddress(extIP);
+            if (haveIP)
+                SetCachedNATType(testtype, extIP);
+
+            if (natType != testtype) {
+                natType = testtype;
+                if (haveIP) {
+                    feat->GetEndPoint()->NATMethodCallBack(GetName(),2,natType);
+                    feat->OnNATTypeDetection(natType, extIP);
+                }
             }
         }
 
         if (natType == PSTUNClient::ConeNat) {
             isAvailable = true;
-            PThread::Sleep(recheckTime);
+            recheck.Wait(recheckTime);
             continue;
         }
 
@@ -329,6 +406,8 @@ void PNatMethod_H46024::SetConnectionSockets(PUDPSocket * data, PUDPSocket * con
 
 H460_FEATURE(Std23);
 
+PBoolean H460_FeatureStd23::earlyUPnP = FALSE;
+
 H460_FeatureStd23::H460_FeatureStd23()
 : H460_FeatureStd(23)
 {
@@ -345,6 +424,7 @@ H460_FeatureStd23::H460_FeatureStd23()
   useAlternate = 0;
   natNotify = false;
 
+  reRegistrationTimer.SetNotifier(PCREATE_NOTIFIER(OnReRegistrationTimeout));
 }
 
 H460_FeatureStd23::~H460_FeatureStd23()
@@ -360,6 +440,19 @@ void H460_FeatureStd23::AttachEndPoint(H323EndPoint * _ep)
     isavailable = (EP->GetSTUN() == NULL);
 }
 
+PBoolean H460_FeatureStd23::FeatureHandled(int mtype)
+{
+     switch (mtype) {
+        case H460_MessageType::e_gatekeeperRequest:
+        case H460_MessageType::e_gatekeeperConfirm:
+        case H460_MessageType::e_registrationRequest:
+        case H460_MessageType::e_registrationConfirm:
+            return true;
+        default:
+            return false;
+     }
+}
+
 PBoolean H460_FeatureStd23::OnSendGatekeeperRequest(H225_FeatureDescriptor & pdu) 
 { 
     if (!isEnabled)
@@ -522,12 +615,12 @@ bool H460_FeatureStd23::DetectALG(const PIPSocket::Address & detectAddress)
 void H460_FeatureStd23::StartSTUNTest(const PString & server)
 {
     PString s;
-#ifdef P_DNS
+#if P_DNS
     PStringList SRVs;
     PStringList x = server.Tokenise(":");
     PString number = "h323:user@" + x[0];
-    if (PDNS::LookupSRV(number,"_stun._udp.",SRVs))
-        s = SRVs[0];
+    if (EP->GetDNSCache().LookupSRV(number,"_stun._udp.",SRVs))
+        s = SRVs[0].Mid(SRVs[0].Find('@')+1);
     else
 #endif
         s = server;
@@ -540,12 +633,18 @@ void H460_FeatureStd23::StartSTUNTest(const PString & server)
 #ifdef H323_UPnP
     PString name = PString();
     if (IsAlternateAvailable(name)) {
-          EP->NATMethodCallBack(name,1,"Available");
-          EP->ForceGatekeeperReRegistration();
-    } else
+        EP->NATMethodCallBack(name,1,"Available");
+        EP->ForceGatekeeperReRegistration();
+        EP->GetNatMethods().AddMethod(xnat);
+        return;
+    }
+
+    // Only when asked for, look for a UPnP device while the STUN test runs
+    if (earlyUPnP)
+        EP->InitialiseUPnP();
 #endif
-        xnat->Start(s,this);
 
+    xnat->Start(s,this);
     EP->GetNatMethods().AddMethod(xnat);
 }
 
@@ -573,7 +672,12 @@ bool H460_FeatureStd23::IsAlternateAvailable(PString & name)
 
 void H460_FeatureStd23::DelayedReRegistration()
 {
-    PThread::Sleep(1000);
+    // Don't hold up the RCF being processed
+    reRegistrationTimer.SetInterval(1000);
+}
+
+void H460_FeatureStd23::OnReRegistrationTimeout(PTimer &, H323_INT)
+{
     EP->ForceGatekeeperReRegistration();  // We have an ALG so notify the gatekeeper   
 }
 
@@ -661,6 +765,19 @@ void H460_FeatureStd24::AttachConnection(H323Connection * _conn)
    CON = _conn; 
 }
 
+PBoolean H460_FeatureStd24::FeatureHandled(int mtype)
+{
+     switch (mtype) {
+        case H460_MessageType::e_admissionRequest:
+        case H460_MessageType::e_admissionConfirm:
+        case H460_MessageType::e_admissionReject:
+        case H460_MessageType::e_setup:
+            return true;
+        default:
+            return false;
+     }
+}
+
 PBoolean H460_FeatureStd24::OnSendAdmissionRequest(H225_FeatureDescriptor & pdu) 
 { 
     // Ignore if already not enabled or manually using STUN
@@ -95,6 +95,20 @@ PBoolean H460_FeatureStd25::FeatureAdvertised(int mtype)
      }
 }
 
+PBoolean H460_FeatureStd25::FeatureHandled(int mtype)
+{
+     switch (mtype) {
+        case H460_MessageType::e_admissionRequest:
+        case H460_MessageType::e_admissionConfirm:
+        case H460_MessageType::e_setup:
+        case H460_MessageType::e_alerting:
+        case H460_MessageType::e_connect:
+            return true;
+        default:
+            return false;
+     }
+}
+
 PBoolean H460_FeatureStd25::OnSendAdmissionRequest(H225_FeatureDescriptor & pdu)
 {
     if (!enabled)
@@ -126,6 +126,21 @@ PBoolean H460_FeatureStd26::FeatureAdvertised(int mtype)
      }
 }
 
+PBoolean H460_FeatureStd26::FeatureHandled(int mtype)
+{
+     switch (mtype) {
+        case H460_MessageType::e_admissionRequest:
+        case H460_MessageType::e_admissionConfirm:
+        case H460_MessageType::e_setup:
+        case H460_MessageType::e_callProceeding:
+        case H460_MessageType::e_alerting:
+        case H460_MessageType::e_connect:
+            return true;
+        default:
+            return false;
+     }
+}
+
 PBoolean H460_FeatureStd26::OnSendAdmissionRequest(H225_FeatureDescriptor & pdu)
 {
     if (!handler)  // if no h46017 handler then no H460.26 support.
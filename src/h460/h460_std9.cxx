@@ -96,6 +96,19 @@ PBoolean H460_FeatureStd9::FeatureAdvertised(int mtype)
      }
 }
 
+PBoolean H460_FeatureStd9::FeatureHandled(int mtype)
+{
+     switch (mtype) {
+        case H460_MessageType::e_admissionRequest:
+        case H460_MessageType::e_admissionConfirm:
+        case H460_MessageType::e_inforequestresponse:
+        case H460_MessageType::e_disengagerequest:
+            return true;
+        default:
+            return false;
+     }
+}
+
 PBoolean H460_FeatureStd9::OnSendAdmissionRequest(H225_FeatureDescriptor & pdu)
 {
     // Build Message
@@ -122,6 +122,18 @@ PBoolean H460_FeatureX1::CommonFeature()
     return m_supported;
 }
 
+PBoolean H460_FeatureX1::FeatureHandled(int mtype)
+{
+     switch (mtype) {
+        case H460_MessageType::e_setup:
+        case H460_MessageType::e_connect:
+        case H460_MessageType::e_facility:
+            return true;
+        default:
+            return false;
+     }
+}
+
 PBoolean H460_FeatureX1::OnSendSetup_UUIE(H225_FeatureDescriptor & pdu)
 {
     if (!m_enabled)
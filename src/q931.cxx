@@ -165,36 +165,151 @@ Q931::Q931()
   messageType = NationalEscapeMsg;
   fromDestination = FALSE;
   callReference = 0;
+  ClearIEs();
 }
 
 
 Q931::Q931(const Q931 & other)
 {
+  ClearIEs();
   operator=(other);
 }
 
 
 Q931 & Q931::operator=(const Q931 & other)
 {
+  if (this == &other)
+    return *this;
+
   callReference = other.callReference;
   fromDestination = other.fromDestination;
   protocolDiscriminator = other.protocolDiscriminator;
   messageType = other.messageType;
 
-  informationElements.RemoveAll();
-  for (PINDEX i = 0; i < other.informationElements.GetSize(); i++)
-    informationElements.SetAt(other.informationElements.GetKeyAt(i), new PBYTEArray(other.informationElements.GetDataAt(i)));
+  memcpy(ieIndex, other.ieIndex, sizeof(ieIndex));
+  informationElements = other.informationElements;
+
+  // Copies may outlive the buffer the original was decoded from
+  receivedData = other.receivedData;
+  receivedData.MakeUnique();
+
+  inlineUsed = other.inlineUsed;
+  memcpy(inlineData, other.inlineData, inlineUsed);
+
+  overflowUsed = other.overflowUsed;
+  if (overflowUsed > 0)
+    memcpy(overflowData.GetPointer(overflowUsed), (const BYTE *)other.overflowData, overflowUsed);
+
+  storageWasted = other.storageWasted;
 
   return *this;
 }
 
 
+void Q931::ClearIEs()
+{
+  memset(ieIndex, 0, sizeof(ieIndex));
+  informationElements.clear();  // Keep the allocations for reuse
+
+  receivedData = PBYTEArray();
+  inlineUsed = 0;
+  overflowUsed = 0;
+  storageWasted = 0;
+}
+
+
+const Q931::InformationElement * Q931::FindIE(unsigned ie) const
+{
+  WORD index = ieIndex[ie&0xff];
+  if (index == 0 || informationElements[index-1].source == IEAbsent)
+    return NULL;
+  return &informationElements[index-1];
+}
+
+
+Q931::InformationElement & Q931::AddIE(unsigned ie)
+{
+  // A removed element keeps its place in the table for when it is set again
+  WORD & index = ieIndex[ie&0xff];
+  if (index == 0) {
+    InformationElement element;
+    element.offset = 0;
+    element.length = 0;
+    element.source = IEAbsent;
+    informationElements.push_back(element);
+    index = (WORD)informationElements.size();
+  }
+  return informationElements[index-1];
+}
+
+
+void Q931::StoreIE(InformationElement & element, const BYTE * data, PINDEX length)
+{
+  if (inlineUsed + length <= InlineIESize) {
+    element.source = IEInline;
+    element.offset = inlineUsed;
+    memcpy(inlineData + inlineUsed, data, length);
+    inlineUsed += length;
+  }
+  else {
+    element.source = IEOverflow;
+    element.offset = overflowUsed;
+    memcpy(overflowData.GetPointer(overflowUsed + length) + overflowUsed, data, length);
+    overflowUsed += length;
+  }
+  element.length = length;
+}
+
+
+void Q931::ReleaseIE(InformationElement & element)
+{
+  if (element.source == IEInline || element.source == IEOverflow)
+    storageWasted += element.length;
+  element.source = IEAbsent;
+}
+
+
+void Q931::CompactIEs()
+{
+  // Store the locally set elements again from the start of the buffers
+  BYTE oldInline[InlineIESize];
+  memcpy(oldInline, inlineData, inlineUsed);
+  PBYTEArray oldOverflow((const BYTE *)overflowData, overflowUsed);
+
+  inlineUsed = 0;
+  overflowUsed = 0;
+  storageWasted = 0;
+
+  for (size_t i = 0; i < informationElements.size(); i++) {
+    InformationElement & element = informationElements[i];
+    if (element.source == IEInline)
+      StoreIE(element, oldInline + element.offset, element.length);
+    else if (element.source == IEOverflow)
+      StoreIE(element, (const BYTE *)oldOverflow + element.offset, element.length);
+  }
+}
+
+
+const BYTE * Q931::GetIEPointer(const InformationElement & element) const
+{
+  switch (element.source) {
+    case IEReceived :
+      return (const BYTE *)receivedData + element.offset;
+    case IEInline :
+      return inlineData + element.offset;
+    case IEOverflow :
+      return (const BYTE *)overflowData + element.offset;
+  }
+  return NULL;
+}
+
+
 void Q931::BuildFacility(int callRef, PBoolean fromDest)
 {
   messageType = FacilityMsg;
   callReference = callRef;
   fromDestination = fromDest;
-  informationElements.RemoveAll();
+  ClearIEs();
   PBYTEArray data;
   SetIE(FacilityIE, data);
 }
@@ -205,7 +320,7 @@ void Q931::BuildInformation(int callRef, PBoolean fromDest)
   messageType = InformationMsg;
   callReference = callRef;
   fromDestination = fromDest;
-  informationElements.RemoveAll();
+  ClearIEs();
 }
 
 
@@ -218,7 +333,7 @@ void Q931::BuildProgress(int callRef,
   messageType = ProgressMsg;
   callReference = callRef;
   fromDestination = fromDest;
-  informationElements.RemoveAll();
+  ClearIEs();
   SetProgressIndicator(description, codingStandard, location);
 }
 
@@ -228,7 +343,7 @@ void Q931::BuildNotify(int callRef, PBoolean fromDest)
   messageType = NotifyMsg;
   callReference = callRef;
   fromDestination = fromDest;
-  informationElements.RemoveAll();
+  ClearIEs();
 }
 
 
@@ -237,7 +352,7 @@ void Q931::BuildSetupAcknowledge(int callRef)
   messageType = SetupAckMsg;
   callReference = callRef;
   fromDestination = TRUE;
-  informationElements.RemoveAll();
+  ClearIEs();
 }
 
 
@@ -246,7 +361,7 @@ void Q931::BuildCallProceeding(int callRef)
   messageType = CallProceedingMsg;
   callReference = callRef;
   fromDestination = TRUE;
-  informationElements.RemoveAll();
+  ClearIEs();
 }
 
 
@@ -255,7 +370,7 @@ void Q931::BuildAlerting(int callRef)
   messageType = AlertingMsg;
   callReference = callRef;
   fromDestination = TRUE;
-  informationElements.RemoveAll();
+  ClearIEs();
 }
 
 
@@ -267,7 +382,7 @@ void Q931::BuildSetup(int callRef)
   else
     callReference = callRef;
   fromDestination = FALSE;
-  informationElements.RemoveAll();
+  ClearIEs();
   SetBearerCapabilities(TransferSpeech, 1);
 }
 
@@ -277,7 +392,7 @@ void Q931::BuildConnect(int callRef)
   messageType = ConnectMsg;
   callReference = callRef;
   fromDestination = TRUE;
-  informationElements.RemoveAll();
+  ClearIEs();
   //SetBearerCapabilities(TransferSpeech, 1); <- Codian interop issue - SH
 }
 
@@ -286,7 +401,7 @@ void Q931::BuildConnectAck(int callRef, PBoolean fromDest)
   messageType = ConnectAckMsg;
   callReference = callRef;
   fromDestination = fromDest;
-  informationElements.RemoveAll();
+  ClearIEs();
 }
 
 
@@ -295,7 +410,7 @@ void Q931::BuildStatus(int callRef, PBoolean fromDest)
   messageType = StatusMsg;
   callReference = callRef;
   fromDestination = fromDest;
-  informationElements.RemoveAll();
+  ClearIEs();
   SetCallState(CallState_Active);
   // Cause field as per Q.850
   SetCause(StatusEnquiryResponse);
@@ -307,7 +422,7 @@ void Q931::BuildStatusEnquiry(int callRef, PBoolean fromDest)
   messageType = StatusEnquiryMsg;
   callReference = callRef;
   fromDestination = fromDest;
-  informationElements.RemoveAll();
+  ClearIEs();
 }
 
 
@@ -316,14 +431,14 @@ void Q931::BuildReleaseComplete(int callRef, PBoolean fromDest)
   messageType = ReleaseCompleteMsg;
   callReference = callRef;
   fromDestination = fromDest;
-  informationElements.RemoveAll();
+  ClearIEs();
 }
 
 
 PBoolean Q931::Decode(const PBYTEArray & data)
 {
   // Clear all existing data before reading new
-  informationElements.RemoveAll();
+  ClearIEs();
 
   if (data.GetSize() < 5) // Packet too short
     return FALSE;
@@ -344,13 +459,16 @@ PBoolean Q931::Decode(const PBYTEArray & data)
 
   messageType = (MsgTypes)data[2+callRefLen];
 
-  // Have preamble, start getting the informationElements into buffers
+  // Have preamble, index the informationElements in place, no copying
+  receivedData = data;
+
   PINDEX offset = 3+callRefLen;
   while (offset < data.GetSize()) {
     // Get field discriminator
     int discriminator = data[offset++];
 
-    PBYTEArray * item = new PBYTEArray;
+    InformationElement & element = AddIE(discriminator);
+    element.length = 0;
 
     // For discriminator with high bit set there is no data
     if ((discriminator&0x80) == 0) {
@@ -366,7 +484,7 @@ PBoolean Q931::Decode(const PBYTEArray & data)
 
         // before decrementing the length, make sure it is not zero
         if (len == 0) {
-          delete item;
+          ClearIEs();
           return FALSE;
         }
 
@@ -375,36 +493,53 @@ PBoolean Q931::Decode(const PBYTEArray & data)
       }
 
       if (offset + len > data.GetSize()) {
-        delete item;
+        ClearIEs();
         return FALSE;
       }
 
-      memcpy(item->GetPointer(len), (const BYTE *)data+offset, len);
-      offset += len;
+      element.length = len;
     }
 
-    informationElements.SetAt(discriminator, item);
+    element.offset = offset;
+    element.source = IEReceived;
+    offset += element.length;
   }
 
   return TRUE;
 }
 
 
-PBoolean Q931::Encode(PBYTEArray & data) const
+PINDEX Q931::GetEncodedSize() const
 {
   PINDEX totalBytes = 5;
-  unsigned discriminator;
-  for (discriminator = 0; discriminator < 256; discriminator++) {
-    if (informationElements.Contains(discriminator)) {
+  for (unsigned discriminator = 0; discriminator < 256; discriminator++) {
+    const InformationElement * element = FindIE(discriminator);
+    if (element != NULL) {
       if (discriminator < 128)
-        totalBytes += informationElements[discriminator].GetSize() +
-                            (discriminator != UserUserIE ? 2 : 4);
+        totalBytes += element->length + (discriminator != UserUserIE ? 2 : 4);
       else
         totalBytes++;
     }
   }
+  return totalBytes;
+}
+
 
-  if (!data.SetMinSize(totalBytes))
+PBoolean Q931::Encode(PBYTEArray & data) const
+{
+  PINDEX length;
+  PINDEX totalBytes = GetEncodedSize();
+  if (!Encode(data.GetPointer(totalBytes), totalBytes, length))
+    return FALSE;
+
+  return data.SetSize(length);
+}
+
+
+PBoolean Q931::Encode(BYTE * data, PINDEX size, PINDEX & length) const
+{
+  length = 0;
+  if (size < GetEncodedSize())
     return FALSE;
 
   // Put in Q931 header
@@ -421,34 +556,37 @@ PBoolean Q931::Encode(PBYTEArray & data) const
   // The following assures disciminators are in ascending value order
   // as required by Q931 specification
   PINDEX offset = 5;
-  for (discriminator = 0; discriminator < 256; discriminator++) {
-    if (informationElements.Contains(discriminator)) {
-      if (discriminator < 128) {
-        int len = informationElements[discriminator].GetSize();
-
-        if (discriminator != UserUserIE) {
-          data[offset++] = (BYTE)discriminator;
-          data[offset++] = (BYTE)len;
-        }
-        else {
-          len++; // Allow for protocol discriminator
-          data[offset++] = (BYTE)discriminator;
-          data[offset++] = (BYTE)(len >> 8);
-          data[offset++] = (BYTE)len;
-          len--; // Then put the length back again
-          // We shall assume that the user-user field is an ITU protocol block (5)
-          data[offset++] = 5;
-        }
+  for (unsigned discriminator = 0; discriminator < 256; discriminator++) {
+    const InformationElement * element = FindIE(discriminator);
+    if (element == NULL)
+      continue;
 
-        memcpy(&data[offset], (const BYTE *)informationElements[discriminator], len);
-        offset += len;
+    if (discriminator < 128) {
+      int len = element->length;
+
+      if (discriminator != UserUserIE) {
+        data[offset++] = (BYTE)discriminator;
+        data[offset++] = (BYTE)len;
       }
-      else
+      else {
+        len++; // Allow for protocol discriminator
         data[offset++] = (BYTE)discriminator;
+        data[offset++] = (BYTE)(len >> 8);
+        data[offset++] = (BYTE)len;
+        len--; // Then put the length back again
+        // We shall assume that the user-user field is an ITU protocol block (5)
+        data[offset++] = 5;
+      }
+
+      memcpy(&data[offset], GetIEPointer(*element), len);
+      offset += len;
     }
+    else
+      data[offset++] = (BYTE)discriminator;
   }
 
-  return data.SetSize(offset);
+  length = offset;
+  return TRUE;
 }
 
 
@@ -464,17 +602,17 @@ void Q931::PrintOn(ostream & strm) const
        << setw(indent+14) << "messageType = " << GetMessageTypeName() << '\n';
 
   for (unsigned discriminator = 0; discriminator < 256; discriminator++) {
-    if (informationElements.Contains(discriminator)) {
+    if (FindIE(discriminator) != NULL) {
+      PBYTEArray value = GetIE((InformationElementCodes)discriminator);
       strm << setw(indent+4) << "IE: " << (InformationElementCodes)discriminator;
       if (discriminator == CauseIE) {
-        if (informationElements[discriminator].GetSize() > 1)
-          strm << " - " << (CauseValues)(informationElements[discriminator][1]&0x7f);
+        if (value.GetSize() > 1)
+          strm << " - " << (CauseValues)(value[1]&0x7f);
       }
       strm << " = {\n"
            << hex << setfill('0') << resetiosflags(ios::floatfield)
            << setprecision(indent+2) << setw(16);
 
-      PBYTEArray value = informationElements[discriminator];
       if (value.GetSize() <= 32 || (flags&ios::floatfield) != ios::fixed)
         strm << value;
       else {
@@ -583,27 +721,57 @@ unsigned Q931::GenerateCallReference()
 
 PBoolean Q931::HasIE(InformationElementCodes ie) const
 {
-  return informationElements.Contains(POrdinalKey(ie));
+  return FindIE(ie) != NULL;
 }
 
 
 PBYTEArray Q931::GetIE(InformationElementCodes ie) const
 {
-  if (informationElements.Contains(POrdinalKey(ie)))
-    return informationElements[ie];
+  const BYTE * data;
+  PINDEX length;
+  if (GetIE(ie, data, length))
+    return PBYTEArray(data, length);
 
   return PBYTEArray();
 }
 
 
+PBoolean Q931::GetIE(InformationElementCodes ie, const BYTE * & data, PINDEX & length) const
+{
+  const InformationElement * element = FindIE(ie);
+  if (element == NULL)
+    return FALSE;
+
+  data = GetIEPointer(*element);
+  length = element->length;
+  return TRUE;
+}
+
+
 void Q931::SetIE(InformationElementCodes ie, const PBYTEArray & userData)
 {
-  informationElements.SetAt(ie, new PBYTEArray(userData));
+  PINDEX length = userData.GetSize();
+
+  // Overwrite in place if it fits in locally owned storage
+  InformationElement * element = &AddIE(ie);
+  if ((element->source == IEInline || element->source == IEOverflow) && length <= element->length) {
+    memcpy((BYTE *)GetIEPointer(*element), (const BYTE *)userData, length);
+    storageWasted += element->length - length;
+    element->length = length;
+    return;
+  }
+
+  ReleaseIE(*element);
+  if (storageWasted > 0 && storageWasted >= (inlineUsed + overflowUsed)/2)
+    CompactIEs();
+
+  StoreIE(*element, userData, length);
 }
 
 void Q931::RemoveIE(InformationElementCodes ie)
 {
-  informationElements.RemoveAt(ie);
+  if (ieIndex[ie&0xff] != 0)
+    ReleaseIE(informationElements[ieIndex[ie&0xff]-1]);
 }
 
 unsigned Q931::SetBearerTransferRate(unsigned bitrate)
@@ -44,6 +44,7 @@
 
 #include "rtp.h"
 #include "h323con.h"
+#include "h323ep.h"
 
 #ifdef H323_AUDIO_CODECS
 #include "jitter.h"
@@ -1559,6 +1560,34 @@ PBoolean RTP_UDP::Open(PIPSocket::Address _localAddress,
   SetMinBufferSize(*controlSocket, SO_RCVBUF);
   SetMinBufferSize(*controlSocket, SO_SNDBUF);
 
+  OnOpened();
+  return TRUE;
+}
+
+
+PBoolean RTP_UDP::Open(PIPSocket::Address _localAddress,
+                       PUDPSocket * _dataSocket,
+                       PUDPSocket * _controlSocket)
+{
+  if (_dataSocket == NULL || _controlSocket == NULL)
+    return FALSE;
+
+  delete dataSocket;
+  delete controlSocket;
+  dataSocket = _dataSocket;
+  controlSocket = _controlSocket;
+
+  localAddress = _localAddress;
+  localDataPort = dataSocket->GetPort();
+  localControlPort = controlSocket->GetPort();
+
+  OnOpened();
+  return TRUE;
+}
+
+
+void RTP_UDP::OnOpened()
+{
   shutdownRead = FALSE;
   shutdownWrite = FALSE;
 
@@ -1568,8 +1597,6 @@ PBoolean RTP_UDP::Open(PIPSocket::Address _localAddress,
   PTRACE(2, "RTP_UDP\tSession " << sessionID << " created: "
          << localAddress << ':' << localDataPort << '-' << localControlPort
          << " ssrc=" << syncSourceOut);
-  
-  return TRUE;
 }
 
 
@@ -1964,4 +1991,238 @@ PBoolean RTP_UDP::WriteControl(RTP_ControlFrame & frame)
 }
 
 
+/////////////////////////////////////////////////////////////////////////////
+
+RTP_UDPSocketPool::RTP_UDPSocketPool(H323EndPoint & ep, PINDEX sz)
+  : endpoint(ep),
+    size(sz),
+    refillThread(NULL),
+    shutdown(FALSE)
+{
+}
+
+
+RTP_UDPSocketPool::~RTP_UDPSocketPool()
+{
+  Shutdown();
+}
+
+
+void RTP_UDPSocketPool::SetSize(PINDEX sz)
+{
+  mutex.Wait();
+  size = sz;
+  mutex.Signal();
+
+  // The refill thread closes any surplus, disabling closes them all now
+  if (sz == 0)
+    Clear();
+  else
+    refill.Signal();
+}
+
+
+PBoolean RTP_UDPSocketPool::Take(const PIPSocket::Address & iface,
+                                 BYTE tos,
+                                 PUDPSocket * & dataSocket,
+                                 PUDPSocket * & controlSocket)
+{
+  Pair pair;
+
+  {
+    PWaitAndSignal m(mutex);
+
+    if (size == 0 || shutdown)
+      return FALSE;
+
+    // First use of an interface only registers it, it is filled from now on
+    Interface & info = interfaces[iface.AsString()];
+    info.address = iface;
+
+    if (refillThread == NULL)
+      refillThread = PThread::Create(PCREATE_NOTIFIER(RefillMain), 0,
+                                     PThread::NoAutoDeleteThread,
+                                     PThread::LowPriority,
+                                     "RTP Pool");
+    refill.Signal();
+
+    if (info.pairs.empty()) {
+      PTRACE(4, "RTP\tNo pre-opened socket pair on " << iface);
+      return FALSE;
+    }
+
+    pair = info.pairs.front();
+    info.pairs.pop_front();
+  }
+
+  if (pair.tos != tos && !pair.data->SetOption(IP_TOS, tos, IPPROTO_IP)) {
+    PTRACE(1, "RTP_UDP\tCould not set TOS field in IP header: " << pair.data->GetErrorText());
+  }
+
+  dataSocket = pair.data;
+  controlSocket = pair.control;
+
+  PTRACE(4, "RTP\tTaken pre-opened socket pair " << iface << ':' << pair.port);
+  return TRUE;
+}
+
+
+void RTP_UDPSocketPool::Clear()
+{
+  std::vector<Pair> closing;
+  std::vector<PIPSocket::Address> addresses;
+
+  mutex.Wait();
+  for (std::map<PString, Interface>::iterator i = interfaces.begin(); i != interfaces.end(); ++i) {
+    while (!i->second.pairs.empty()) {
+      closing.push_back(i->second.pairs.front());
+      addresses.push_back(i->second.address);
+      i->second.pairs.pop_front();
+    }
+  }
+  mutex.Signal();
+
+  for (size_t i = 0; i < closing.size(); i++)
+    ClosePair(addresses[i], closing[i]);
+}
+
+
+void RTP_UDPSocketPool::Shutdown()
+{
+  mutex.Wait();
+  shutdown = TRUE;
+  PThread * thread = refillThread;
+  refillThread = NULL;
+  mutex.Signal();
+
+  if (thread != NULL) {
+    refill.Signal();
+    thread->WaitForTermination();
+    delete thread;
+  }
+
+  Clear();
+}
+
+
+PBoolean RTP_UDPSocketPool::OpenPair(const PIPSocket::Address & iface, Pair & pair)
+{
+  // Ports that would not bind are held until we are done so they are not
+  // handed straight back to us, then released to be tried again later.
+  std::vector<WORD> busyPorts;
+  WORD firstPort = endpoint.GetRtpIpPortPair(iface);
+  WORD port = firstPort;
+  PBoolean opened = FALSE;
+
+  pair.data = new H323UDPSocket();
+  pair.control = new H323UDPSocket();
+
+  while (port != 0) {
+    if (pair.data->Listen(iface, 1, port) && pair.control->Listen(iface, 1, (WORD)(port+1))) {
+      opened = TRUE;
+      break;
+    }
+    pair.data->Close();
+    pair.control->Close();
+
+    busyPorts.push_back(port);
+    port = endpoint.GetRtpIpPortPair(iface);
+    if (port == firstPort)
+      break;
+  }
+
+  for (size_t i = 0; i < busyPorts.size(); i++)
+    endpoint.ReleaseRtpIpPortPair(busyPorts[i], iface);
+
+  if (!opened) {
+    PTRACE(2, "RTP\tCould not pre-open socket pair on " << iface);
+    delete pair.data;
+    delete pair.control;
+    return FALSE;
+  }
+
+  pair.port = port;
+  pair.tos = endpoint.GetRtpIpTypeofService();
+
+  if (!pair.data->SetOption(IP_TOS, pair.tos, IPPROTO_IP)) {
+    PTRACE(1, "RTP_UDP\tCould not set TOS field in IP header: " << pair.data->GetErrorText());
+  }
+
+  SetMinBufferSize(*pair.data,    SO_RCVBUF);
+  SetMinBufferSize(*pair.data,    SO_SNDBUF);
+  SetMinBufferSize(*pair.control, SO_RCVBUF);
+  SetMinBufferSize(*pair.control, SO_SNDBUF);
+
+  return TRUE;
+}
+
+
+void RTP_UDPSocketPool::ClosePair(const PIPSocket::Address & iface, Pair & pair)
+{
+  delete pair.data;
+  delete pair.control;
+  endpoint.ReleaseRtpIpPortPair(pair.port, iface);
+}
+
+
+void RTP_UDPSocketPool::RefillMain(PThread &, H323_INT)
+{
+  PTRACE(4, "RTP\tSocket pool refill thread started");
+
+  for (;;) {
+    refill.Wait();
+
+    for (;;) {
+      PIPSocket::Address iface;
+      Pair surplus;
+      PBoolean close = FALSE;
+
+      // Find one interface short of (or over) its pairs, done when none is
+      {
+        PWaitAndSignal m(mutex);
+        if (shutdown)
+          break;
+
+        std::map<PString, Interface>::iterator i;
+        for (i = interfaces.begin(); i != interfaces.end(); ++i) {
+          if ((PINDEX)i->second.pairs.size() > size) {
+            surplus = i->second.pairs.back();
+            i->second.pairs.pop_back();
+            close = TRUE;
+            break;
+          }
+          if ((PINDEX)i->second.pairs.size() < size)
+            break;
+        }
+        if (i == interfaces.end())
+          break;
+        iface = i->second.address;
+      }
+
+      if (close) {
+        ClosePair(iface, surplus);
+        continue;
+      }
+
+      Pair pair;
+      if (!OpenPair(iface, pair))
+        break;  // Range exhausted, try again when next asked
+
+      PWaitAndSignal m(mutex);
+      if (shutdown) {
+        ClosePair(iface, pair);
+        break;
+      }
+      interfaces[iface.AsString()].pairs.push_back(pair);
+    }
+
+    PWaitAndSignal m(mutex);
+    if (shutdown)
+      break;
+  }
+
+  PTRACE(4, "RTP\tSocket pool refill thread ended");
+}
+
+
 /////////////////////////////////////////////////////////////////////////////
@@ -54,6 +54,9 @@
 #include <openssl/err.h>
 #endif
 
+// Initial size of the TCP receive buffer, enough for several typical TPKTs
+static const PINDEX TPKTReadBufferSize = 4096;
+
 // TCP KeepAlive 
 static int KeepAliveInterval = 19;
 
@@ -1039,6 +1042,17 @@ PBoolean H323Transport::Write(const void * buf, PINDEX len)
         return PIndirectChannel::Write(buf,len);
 }
 
+void H323Transport::BeginWriteBatch()
+{
+}
+
+
+PBoolean H323Transport::EndWriteBatch()
+{
+  return TRUE;
+}
+
+
 PBoolean H323Transport::OnSocketOpen()
 {
     return true;
@@ -1516,6 +1530,15 @@ void H323TransportIP::SetUpTransportPDU(H245_TransportAddress & pdu, unsigned po
 
 /////////////////////////////////////////////////////////////////////////////
 
+// Ports found in use by something else go back to the range only after the
+// scan, otherwise the free list would hand them straight back again.
+static void ReleaseBusyTCPPorts(H323EndPoint & endpoint, const std::vector<WORD> & ports)
+{
+  for (size_t i = 0; i < ports.size(); i++)
+    endpoint.ReleaseTCPPort(ports[i]);
+}
+
+
 #ifdef H323_TLS
 H323TransportTCP::H323TransportTCP(H323EndPoint & end,
                                    PIPSocket::Address binding,
@@ -1533,6 +1556,10 @@ H323TransportTCP::H323TransportTCP(H323EndPoint & end,
 #endif
 {
   h245listener = NULL;
+  rangePort = 0;
+  writeBatchDepth = 0;
+  readBufferStart = 0;
+  readBufferEnd = 0;
 
   // construct listener socket if required
   if (listen) {
@@ -1540,13 +1567,18 @@ H323TransportTCP::H323TransportTCP(H323EndPoint & end,
 
     localPort = end.GetNextTCPPort();
     WORD firstPort = localPort;
+    std::vector<WORD> busyPorts;
     while (!h245listener->Listen(binding, 5, localPort)) {
+      busyPorts.push_back(localPort);
       localPort = end.GetNextTCPPort();
       if (localPort == firstPort)
         break;
     }
 
+    ReleaseBusyTCPPorts(end, busyPorts);
+
     if (h245listener->IsOpen()) {
+      rangePort = localPort;
       localPort = h245listener->GetPort();
       PTRACE(3, "H225\tTCP Listen for H245 on " << binding << ':' << localPort);
     }
@@ -1562,6 +1594,9 @@ H323TransportTCP::H323TransportTCP(H323EndPoint & end,
 H323TransportTCP::~H323TransportTCP()
 {
   delete h245listener;  // Delete any H245 listener that may be present
+
+  if (rangePort != 0)
+    endpoint.ReleaseTCPPort(rangePort);
 }
 
 
@@ -1758,36 +1793,66 @@ PBoolean H323TransportTCP::ReadBlock(void * buf, PINDEX len)
 
 PBoolean H323TransportTCP::ReadPDU(PBYTEArray & pdu)
 {
-  // Make sure is a RFC1006 TPKT
-  switch (ReadChar()) {
-    case -1 :
-      return FALSE;
+  // Data is read in as large a block as is available, so a burst of TPKTs
+  // from the remote arrives with one read and the following calls to this
+  // function are satisfied from the buffer without touching the socket.
 
-    case 3 :  // Only support version 3
-      break;
+  PTimeInterval oldTimeout = GetReadTimeout();
+  PBoolean ok = TRUE;
 
-    default :  // Unknown version number
-      return SetErrorValues(Miscellaneous, 0x41000000);
-  }
+  for (;;) {
+    PINDEX available = readBufferEnd - readBufferStart;
+    PINDEX packetLength = 4;
 
-  // Save timeout
-  PTimeInterval oldTimeout = GetReadTimeout();
+    if (available > 0) {
+      const BYTE * tpkt = (const BYTE *)readBuffer + readBufferStart;
+
+      // Make sure is a RFC1006 TPKT, only support version 3
+      if (tpkt[0] != 3) {
+        ok = SetErrorValues(Miscellaneous, 0x41000000);
+        break;
+      }
 
-  // Should get all of PDU in 5 seconds or something is seriously wrong,
-  SetReadTimeout(5000);
+      if (available >= 4) {
+        packetLength = ((tpkt[2] << 8)|tpkt[3]);
+        if (packetLength < 4) {
+          PTRACE(1, "H323TCP\tDwarf PDU received (length " << packetLength << ")");
+          ok = FALSE;
+          break;
+        }
+
+        if (available >= packetLength) {
+          pdu.SetSize(packetLength - 4);
+          memcpy(pdu.GetPointer(), tpkt + 4, packetLength - 4);
+          readBufferStart += packetLength;
+          if (readBufferStart == readBufferEnd)
+            readBufferStart = readBufferEnd = 0;
+          break;
+        }
+      }
+
+      // Should get all of PDU in 5 seconds or something is seriously wrong,
+      SetReadTimeout(5000);
+    }
 
-  // Get TPKT length
-  BYTE header[3];
-  PBoolean ok = ReadBlock(header, sizeof(header));
-  if (ok) {
-    PINDEX packetLength = ((header[1] << 8)|header[2]);
-    if (packetLength < 4) {
-      PTRACE(1, "H323TCP\tDwarf PDU received (length " << packetLength << ")");
+    // Move the partial PDU to the start of the buffer and make room for it
+    if (readBufferStart > 0) {
+      memmove(readBuffer.GetPointer(), (const BYTE *)readBuffer + readBufferStart, available);
+      readBufferStart = 0;
+      readBufferEnd = available;
+    }
+
+    PINDEX required = PMAX(packetLength, TPKTReadBufferSize);
+    if (readBuffer.GetSize() < required)
+      readBuffer.SetSize(required);
+
+    if (!Read(readBuffer.GetPointer() + readBufferEnd, readBuffer.GetSize() - readBufferEnd) ||
+        GetLastReadCount() == 0) {
       ok = FALSE;
-    } else {
-      packetLength -= 4;
-      ok = ReadBlock(pdu.GetPointer(packetLength), packetLength);
+      break;
     }
+
+    readBufferEnd += GetLastReadCount();
   }
 
   SetReadTimeout(oldTimeout);
@@ -1798,21 +1863,67 @@ PBoolean H323TransportTCP::ReadPDU(PBYTEArray & pdu)
 
 PBoolean H323TransportTCP::WritePDU(const PBYTEArray & pdu)
 {
-  // We copy the data into a new buffer so we can do a single write call. This
-  // is necessary as we have disabled the Nagle TCP delay algorithm to improve
-  // network performance.
+  PWaitAndSignal m(writeMutex);
 
-  int packetLength = pdu.GetSize() + 4;
+  // Hold the PDU until the batch completes, the reference counted copy does
+  // not duplicate the encoded data.
+  if (writeBatchDepth > 0) {
+    writeQueue.push_back(pdu);
+    return TRUE;
+  }
 
-  // Send RFC1006 TPKT length
-  PBYTEArray tpkt(packetLength);
-  tpkt[0] = 3;
-  tpkt[1] = 0;
-  tpkt[2] = (BYTE)(packetLength >> 8);
-  tpkt[3] = (BYTE)packetLength;
-  memcpy(tpkt.GetPointer()+4, (const BYTE *)pdu, pdu.GetSize());
+  return WriteCoalescedTPKTs(&pdu, 1);
+}
+
+
+void H323TransportTCP::BeginWriteBatch()
+{
+  PWaitAndSignal m(writeMutex);
+  writeBatchDepth++;
+}
+
+
+PBoolean H323TransportTCP::EndWriteBatch()
+{
+  PWaitAndSignal m(writeMutex);
 
-  return Write((const BYTE *)tpkt, packetLength);
+  if (writeBatchDepth == 0 || --writeBatchDepth > 0 || writeQueue.empty())
+    return TRUE;
+
+  PTRACE(4, "H323TCP\tFlushing " << writeQueue.size() << " batched PDUs");
+
+  PBoolean ok = WriteCoalescedTPKTs(&writeQueue[0], writeQueue.size());
+  writeQueue.clear();
+  return ok;
+}
+
+
+PBoolean H323TransportTCP::WriteCoalescedTPKTs(const PBYTEArray * pdus, PINDEX count)
+{
+  // We must get each TPKT onto the wire without a separate write for its
+  // header, as we have disabled the Nagle TCP delay algorithm to improve
+  // network performance and would otherwise send a tiny segment per header.
+  // The TPKTs are copied into one buffer and written with one call, through
+  // the channel so a Close() can abort it and TLS can encrypt it.
+
+  PINDEX total = 0;
+  PINDEX i;
+  for (i = 0; i < count; i++)
+    total += pdus[i].GetSize() + 4;
+
+  PBYTEArray tpkts(total);
+  BYTE * ptr = tpkts.GetPointer();
+  for (i = 0; i < count; i++) {
+    PINDEX packetLength = pdus[i].GetSize() + 4;
+    ptr[0] = 3;
+    ptr[1] = 0;
+    ptr[2] = (BYTE)(packetLength >> 8);
+    ptr[3] = (BYTE)packetLength;
+    memcpy(ptr+4, (const BYTE *)pdus[i], pdus[i].GetSize());
+    ptr += packetLength;
+  }
+
+  return Write((const BYTE *)tpkts, total);
 }
 
 PBoolean H323TransportTCP::FinaliseSecurity(PSocket * socket)
@@ -1908,8 +2019,14 @@ PBoolean H323TransportTCP::Connect()
 
   socket->SetReadTimeout(endpoint.GetSignallingChannelConnectTimeout());
 
+  if (rangePort != 0) {
+    endpoint.ReleaseTCPPort(rangePort);
+    rangePort = 0;
+  }
+
   localPort = endpoint.GetNextTCPPort();
   WORD firstPort = localPort;
+  std::vector<WORD> busyPorts;
   for (;;) {
     PTRACE(4, "H323TCP\tConnecting to "
            << remoteAddress << ':' << remotePort
@@ -1917,12 +2034,15 @@ PBoolean H323TransportTCP::Connect()
     if (socket->Connect(localAddress, localPort, remoteAddress))
       break;
 
+    busyPorts.push_back(localPort);
+
     int errnum = socket->GetErrorNumber();
     if (localPort == 0 || (errnum != EADDRINUSE && errnum != EADDRNOTAVAIL)) {
       PTRACE(1, "H323TCP\tCould not connect to "
                 << remoteAddress << ':' << remotePort
                 << " (local port=" << localPort << ") - "
                 << socket->GetErrorText() << '(' << errnum << ')');
+      ReleaseBusyTCPPorts(endpoint, busyPorts);
       channelPointerMutex.EndRead();
       return SetErrorValues(socket->GetErrorCode(), errnum);
     }
@@ -1931,11 +2051,15 @@ PBoolean H323TransportTCP::Connect()
     if (localPort == firstPort) {
       PTRACE(1, "H323TCP\tCould not bind to any port in range " <<
                 endpoint.GetTCPPortBase() << " to " << endpoint.GetTCPPortMax());
+      ReleaseBusyTCPPorts(endpoint, busyPorts);
       channelPointerMutex.EndRead();
       return SetErrorValues(socket->GetErrorCode(), errnum);
     }
   }
 
+  ReleaseBusyTCPPorts(endpoint, busyPorts);
+  rangePort = localPort;
+
   socket->SetReadTimeout(PMaxTimeInterval);
 
   if (FinaliseSecurity(socket) && !SecureConnect())